@@ -0,0 +1,345 @@
+/* -------------------------------------------------------------------------- *
+ *                  OpenSim:  MuscleMetabolicsAutotuner.cpp                   *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsAutotuner.h"
+#include "MuscleMetabolicsCompiledKernel.h"
+#include "MuscleMetabolicsKernelGenerator.h"
+#include "UchidaUmberger2010MuscleMetabolicsProbe.h"
+#include "UchidaBhargava2004MuscleMetabolicsProbe.h"
+#include <OpenSim/Simulation/Model/Muscle.h>
+#include <SimTKcommon/internal/Random.h>
+#include <SimTKcommon/internal/Timing.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace OpenSim;
+
+namespace {
+typedef MuscleMetabolicsAutotuner::Mode Mode;
+typedef MuscleMetabolicsAutotuner::Result Result;
+
+// Synthetic samples of each muscle, and the minimum duration (ns) of a timed
+// repetition of a trial; the time of a mode is the minimum over NumTrials.
+const int NumSamples = 64;
+const double MinTrialDuration = 1e6;
+const int NumTrials = 3;
+
+// The trials cached in memory, by host, parameter hash and whether a
+// compiled kernel is loaded.
+map<string, Result>& getMemoryCache()
+{
+    static map<string, Result> cache;
+    return cache;
+}
+
+// Draw synthetic inputs of a muscle across its range: excitation and
+// activation in [0.02, 1], normalized fiber length in [0.5, 1.5], and fiber
+// velocity within the maximum contraction velocity.
+void sampleCommonInputs(const Muscle& muscle, SimTK::Random::Uniform& random,
+    double& excitation, double& activation, double& activeFiberForce,
+    double& fiberVelocity, double& activeForceLengthMultiplier,
+    double& normalizedFiberLength)
+{
+    excitation = 0.02 + 0.98*random.getValue();
+    activation = 0.02 + 0.98*random.getValue();
+    normalizedFiberLength = 0.5 + random.getValue();
+    activeForceLengthMultiplier =
+        exp(-SimTK::square(normalizedFiberLength - 1)/0.2);
+    activeFiberForce = activation*activeForceLengthMultiplier
+                       * muscle.getMaxIsometricForce();
+    fiberVelocity = (2*random.getValue() - 1)
+        * muscle.getMaxContractionVelocity()*muscle.getOptimalFiberLength();
+}
+
+void sampleMuscleInputs(const Muscle& muscle, SimTK::Random::Uniform& random,
+    UchidaUmberger2010MuscleMetabolicsKernel::MuscleInputs<double>& in)
+{
+    sampleCommonInputs(muscle, random, in.excitation, in.activation,
+        in.active_fiber_force, in.fiber_velocity,
+        in.active_force_length_multiplier, in.normalized_fiber_length);
+}
+
+void sampleMuscleInputs(const Muscle& muscle, SimTK::Random::Uniform& random,
+    UchidaBhargava2004MuscleMetabolicsKernel::MuscleInputs<double>& in)
+{
+    double normalizedFiberLength;
+    sampleCommonInputs(muscle, random, in.excitation, in.activation,
+        in.active_fiber_force, in.fiber_velocity,
+        in.active_force_length_multiplier, normalizedFiberLength);
+    in.passive_fiber_force = 0.1*random.getValue()
+                             * muscle.getMaxIsometricForce();
+    in.fiber_length_dependence = in.active_force_length_multiplier;
+    in.activation_heat_decay = 1;
+}
+
+// Evaluate the metabolic power of each sample (sample-major, with the muscles
+// in order) in a mode. The settings select the exact or fast-math kernel.
+template <class Kernel>
+void evaluateMode(Mode mode, const typename Kernel::Settings& settings,
+    const vector<typename Kernel::MuscleConstants>& constants,
+    const vector<typename Kernel::template MuscleInputs<double> >& inputs,
+    const MuscleMetabolicsCompiledKernel<Kernel>* compiledKernel,
+    vector<double>& power)
+{
+    const int nM = (int)constants.size();
+    for (size_t k=0; k<inputs.size(); ++k) {
+        const int i = int(k % nM);
+        typename Kernel::template MuscleRates<double> rates;
+        if (mode == MuscleMetabolicsAutotuner::CompiledKernel)
+            compiledKernel->calcMuscleRates(i, inputs[k], rates);
+        else
+            Kernel::calcMuscleRates(settings, constants[i], inputs[k], rates);
+        power[k] = rates.Edot;
+    }
+}
+
+// The time (ns) of the evaluation of a muscle in a mode: each trial repeats
+// the evaluation of all samples for at least MinTrialDuration.
+template <class Kernel>
+double timeMode(Mode mode, const typename Kernel::Settings& settings,
+    const vector<typename Kernel::MuscleConstants>& constants,
+    const vector<typename Kernel::template MuscleInputs<double> >& inputs,
+    const MuscleMetabolicsCompiledKernel<Kernel>* compiledKernel,
+    vector<double>& power)
+{
+    double best = SimTK::Infinity;
+    for (int trial=0; trial<NumTrials; ++trial) {
+        int numRepetitions = 0;
+        const long long start = SimTK::realTimeInNs();
+        long long elapsed = 0;
+        do {
+            evaluateMode(mode, settings, constants, inputs, compiledKernel,
+                         power);
+            ++numRepetitions;
+            elapsed = SimTK::realTimeInNs() - start;
+        } while (elapsed < MinTrialDuration);
+        best = std::min(best,
+            double(elapsed) / (double(numRepetitions)*inputs.size()));
+    }
+    return best;
+}
+
+// Read the trials cached for a key, in memory or in the cache file (the last
+// line of the key).
+bool findCachedResult(const string& key, const string& cacheFile,
+                      Result& result)
+{
+    map<string, Result>::const_iterator it = getMemoryCache().find(key);
+    if (it != getMemoryCache().end()) {
+        result = it->second;
+        return true;
+    }
+    if (cacheFile.empty())
+        return false;
+
+    ifstream in(cacheFile.c_str());
+    bool found = false;
+    string line;
+    while (getline(in, line)) {
+        istringstream fields(line);
+        string host, hash, compiled;
+        if (!(fields >> host >> hash >> compiled)
+            || host + " " + hash + " " + compiled != key)
+            continue;
+        Result record;
+        bool valid = true;
+        for (int m=0; m<MuscleMetabolicsAutotuner::NumModes; ++m) {
+            MuscleMetabolicsAutotuner::Trial& trial = record.trials[m];
+            valid = valid && (fields >> trial.time >> trial.error);
+            if (trial.time < 0)
+                trial.time = SimTK::Infinity;
+        }
+        if (valid) {
+            result = record;
+            found = true;
+        }
+    }
+    if (found)
+        getMemoryCache()[key] = result;
+    return found;
+}
+
+// Cache the trials of a key in memory, and append them to the cache file.
+// Unavailable modes are written with a time of -1.
+void cacheResult(const string& key, const string& cacheFile,
+                 const Result& result)
+{
+    getMemoryCache()[key] = result;
+    if (cacheFile.empty())
+        return;
+
+    ofstream out(cacheFile.c_str(), ios::app);
+    out.precision(6);
+    out << key;
+    for (int m=0; m<MuscleMetabolicsAutotuner::NumModes; ++m) {
+        const MuscleMetabolicsAutotuner::Trial& trial = result.trials[m];
+        out << " " << (SimTK::isFinite(trial.time) ? trial.time : -1.0)
+            << " " << trial.error;
+    }
+    out << endl;
+    if (!out)
+        cout << "WARNING: MuscleMetabolicsAutotuner: Unable to write to "
+            << cacheFile << "." << endl;
+}
+
+template <class Probe>
+Result tuneProbe(const Probe& probe, const string& cacheFile)
+{
+    typedef typename Probe::Kernel Kernel;
+    const int nM = probe.getNumMetabolicMuscles();
+
+    const string hash = MuscleMetabolicsKernelGenerator::calcParameterHash(probe);
+    const typename Probe::CompiledKernel* compiledKernel = 0;
+    if (!MuscleMetabolicsCompiledKernelRegistry::find(hash, compiledKernel)
+        || compiledKernel->getNumMuscles() != nM)
+        compiledKernel = 0;
+    const string key = MuscleMetabolicsAutotuner::getHostName() + " " + hash
+                       + (compiledKernel ? " 1" : " 0");
+
+    Result result;
+    if (findCachedResult(key, cacheFile, result)) {
+        result.cached = true;
+        return result;
+    }
+
+    typename Kernel::Settings settings = probe.getKernelSettings();
+    settings.fast_math = false;
+    typename Kernel::Settings fastMathSettings = settings;
+    fastMathSettings.fast_math = true;
+    vector<typename Kernel::MuscleConstants> constants;
+    for (int i=0; i<nM; ++i)
+        constants.push_back(probe.getKernelMuscleConstants(i));
+
+    SimTK::Random::Uniform random;
+    random.setSeed(0);
+    vector<typename Kernel::template MuscleInputs<double> > inputs(
+        NumSamples*nM);
+    for (size_t k=0; k<inputs.size(); ++k)
+        sampleMuscleInputs(probe.getMetabolicMuscle(int(k % nM)), random,
+                           inputs[k]);
+
+    vector<double> exact(inputs.size()), power(inputs.size());
+    for (int m=0; m<MuscleMetabolicsAutotuner::NumModes; ++m) {
+        const Mode mode = Mode(m);
+        MuscleMetabolicsAutotuner::Trial& trial = result.trials[m];
+        trial.time = SimTK::Infinity;
+        trial.error = 0;
+        if (nM == 0
+            || (mode == MuscleMetabolicsAutotuner::CompiledKernel
+                && !compiledKernel))
+            continue;
+
+        trial.time = timeMode(mode,
+            mode == MuscleMetabolicsAutotuner::FastMath ? fastMathSettings
+                                                         : settings,
+            constants, inputs, compiledKernel, power);
+        if (mode == MuscleMetabolicsAutotuner::Exact)
+            exact = power;
+        for (size_t k=0; k<inputs.size(); ++k) {
+            const double scale = std::max(fabs(exact[k]),
+                                          constants[k % nM].muscle_mass);
+            const double error = fabs(power[k] - exact[k]) / scale;
+            if (error > trial.error || SimTK::isNaN(error))
+                trial.error = error;
+        }
+    }
+    result.cached = false;
+    cacheResult(key, cacheFile, result);
+    return result;
+}
+}
+
+//=============================================================================
+// AUTOTUNING
+//=============================================================================
+MuscleMetabolicsAutotuner::Result MuscleMetabolicsAutotuner::tune(
+    const UchidaUmberger2010MuscleMetabolicsProbe& probe,
+    const std::string& cacheFile)
+{
+    return tuneProbe(probe, cacheFile);
+}
+
+MuscleMetabolicsAutotuner::Result MuscleMetabolicsAutotuner::tune(
+    const UchidaBhargava2004MuscleMetabolicsProbe& probe,
+    const std::string& cacheFile)
+{
+    return tuneProbe(probe, cacheFile);
+}
+
+MuscleMetabolicsAutotuner::Mode MuscleMetabolicsAutotuner::selectMode(
+    const Result& result, double tolerance)
+{
+    Mode best = Exact;
+    for (int m=1; m<NumModes; ++m) {
+        const Trial& trial = result.trials[m];
+        if (SimTK::isFinite(trial.time) && trial.error <= tolerance
+            && trial.time < result.trials[best].time)
+            best = Mode(m);
+    }
+    return best;
+}
+
+std::string MuscleMetabolicsAutotuner::getModeName(Mode mode)
+{
+    switch (mode) {
+    case Exact:             return "exact";
+    case CompiledKernel:    return "use_compiled_kernel";
+    case FastMath:          return "fast_math";
+    default:                return "unknown";
+    }
+}
+
+std::string MuscleMetabolicsAutotuner::getHostName()
+{
+#ifdef _WIN32
+    const char* name = getenv("COMPUTERNAME");
+    string host = name ? name : "";
+#else
+    char buffer[256] = "";
+    gethostname(buffer, sizeof(buffer) - 1);
+    string host = buffer;
+#endif
+    for (string::size_type k=0; k<host.size(); ++k)
+        if (isspace((unsigned char)host[k]))
+            host[k] = '_';
+    return host.empty() ? "unknown" : host;
+}
+
+void MuscleMetabolicsAutotuner::clearCache()
+{
+    getMemoryCache().clear();
+}
@@ -0,0 +1,113 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_AUTOTUNER_H_
+#define OPENSIM_MUSCLE_METABOLICS_AUTOTUNER_H_
+/* -------------------------------------------------------------------------- *
+ *                   OpenSim:  MuscleMetabolicsAutotuner.h                    *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include <string>
+
+namespace OpenSim {
+
+class UchidaUmberger2010MuscleMetabolicsProbe;
+class UchidaBhargava2004MuscleMetabolicsProbe;
+
+//=============================================================================
+//             EXECUTION-MODE AUTOTUNER OF A METABOLICS PROBE
+//=============================================================================
+/**
+ * Chooses how a metabolics probe evaluates its muscles on this host, for the
+ * probes whose 'autotune' property is true. Each execution mode evaluates
+ * the kernel of the probe with its settings and muscle constants:
+ *
+ *  - Exact: Kernel::calcMuscleRates() in double precision;
+ *  - CompiledKernel: the MuscleMetabolicsCompiledKernel registered for the
+ *    probe, if one is loaded (see 'use_compiled_kernel');
+ *  - FastMath: the kernel with the approximations of
+ *    MuscleMetabolicsFastMath (see 'fast_math').
+ *
+ * tune() times each available mode on synthetic inputs of the probe's
+ * muscles (excitations, activations, fiber lengths and velocities drawn
+ * across the range of each muscle, with a fixed seed), and measures the
+ * maximum deviation of the metabolic power of each muscle from the exact
+ * mode, relative to the larger of its exact power and its mass times the
+ * minimum heat rate (1 W/kg). selectMode() then chooses the fastest mode
+ * whose deviation is within a tolerance.
+ *
+ * The trials depend only on the settings and muscle constants of the probe
+ * (its parameter hash, see MuscleMetabolicsKernelGenerator) and on the host,
+ * so they are cached by parameter hash and host name: in memory for the
+ * process, and in a text file, if one is given, for later runs, which then
+ * start in the chosen mode without timing the modes again.
+ *
+ * The options that depend on the inputs along a trajectory (e.g.,
+ * 'incremental_evaluation' and 'use_surrogate') are not trialed.
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsAutotuner {
+public:
+    /** The execution modes, in order of preference for equal times. */
+    enum Mode {
+        Exact = 0,
+        CompiledKernel,
+        FastMath,
+        NumModes
+    };
+
+    /** The trial of a mode: the time (ns) of the evaluation of a muscle
+        (Infinity if the mode is not available), and the maximum relative
+        deviation of the metabolic power of a muscle from the exact mode. */
+    struct Trial {
+        double time;
+        double error;
+    };
+
+    /** The trials of all modes for a probe on this host, and whether they
+        were read from the cache. */
+    struct Result {
+        Trial trials[NumModes];
+        bool cached;
+    };
+
+    /** Time the modes for a connected probe, whose settings must be those of
+        the exact mode (as while it is autotuned), or read them from the
+        cache. The trials are cached in cacheFile (appended), unless it is
+        empty. */
+    static Result tune(const UchidaUmberger2010MuscleMetabolicsProbe& probe,
+                       const std::string& cacheFile);
+    static Result tune(const UchidaBhargava2004MuscleMetabolicsProbe& probe,
+                       const std::string& cacheFile);
+
+    /** The fastest mode whose deviation is within the tolerance. */
+    static Mode selectMode(const Result& result, double tolerance);
+
+    /** The name of a mode (e.g., "fast_math"). */
+    static std::string getModeName(Mode mode);
+
+    /** The name of this host, as used in the cache. */
+    static std::string getHostName();
+
+    /** Forget the trials cached in memory (the cache files are unchanged). */
+    static void clearCache();
+};
+
+} // namespace OpenSim
+
+#endif // OPENSIM_MUSCLE_METABOLICS_AUTOTUNER_H_
@@ -0,0 +1,436 @@
+/* -------------------------------------------------------------------------- *
+ *                 OpenSim:  MuscleMetabolicsCalibration.cpp                  *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsCalibration.h"
+#include "UchidaUmberger2010MuscleMetabolicsProbe.h"
+#include "UchidaBhargava2004MuscleMetabolicsProbe.h"
+#include "MuscleMetabolicsScreeningProbe.h"
+#include <OpenSim/Simulation/Model/Model.h>
+#include <OpenSim/Simulation/Model/ProbeSet.h>
+#include <simmath/Optimizer.h>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+using namespace OpenSim;
+
+namespace {
+typedef MuscleMetabolicsEvaluationService::Overrides Overrides;
+
+// The index of a parameter among the sensitivity parameters, or -1.
+int findParameter(const Array<std::string>& names, const std::string& name)
+{
+    for (int k=0; k<names.getSize(); ++k)
+        if (names[k] == name)
+            return k;
+    return -1;
+}
+
+// Set a parameter, named as a sensitivity parameter, in a probe.
+template <class ParameterSet, class Probe>
+void setParameter(Probe& probe, ParameterSet& muscleParameters,
+                  const std::string& name, double value)
+{
+    const std::string::size_type dot = name.find('.');
+    if (dot == std::string::npos) {
+        probe.updPropertyByName(name).template updValue<double>() = value;
+        return;
+    }
+    const int muscle = muscleParameters.getIndex(name.substr(0, dot));
+    if (muscle < 0) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsCalibration: '" << probe.getName()
+            << "' has no muscle '" << name.substr(0, dot) << "'." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    muscleParameters[muscle].updPropertyByName(name.substr(dot+1))
+        .template updValue<double>() = value;
+    if (muscleParameters[muscle].getMuscle())
+        muscleParameters[muscle].setMuscleMass();
+}
+
+//_____________________________________________________________________________
+/**
+ * The calibration cost as an OptimizerSystem, for SimTK::Optimizer.
+ */
+class CalibrationSystem : public SimTK::OptimizerSystem {
+public:
+    CalibrationSystem(MuscleMetabolicsCalibration& calibration)
+    :   SimTK::OptimizerSystem(calibration.getNumParameters()),
+        _calibration(calibration) {}
+
+    int objectiveFunc(const SimTK::Vector& p, bool newParameters,
+                      SimTK::Real& f) const OVERRIDE_11
+    {
+        f = _calibration.calcCost(p);
+        return 0;
+    }
+
+    int gradientFunc(const SimTK::Vector& p, bool newParameters,
+                     SimTK::Vector& g) const OVERRIDE_11
+    {
+        _calibration.calcCost(p, &g);
+        return 0;
+    }
+
+private:
+    MuscleMetabolicsCalibration& _calibration;
+};
+}
+
+
+//=============================================================================
+// CONSTRUCTOR
+//=============================================================================
+MuscleMetabolicsCalibration::MuscleMetabolicsCalibration(
+    MuscleMetabolicsEvaluationService& service, const std::string& probeName)
+:   _service(service), _probeName(probeName), _bestCost(SimTK::Infinity)
+{
+}
+
+
+//=============================================================================
+// PARAMETERS AND TRIALS
+//=============================================================================
+void MuscleMetabolicsCalibration::addParameter(const std::string& name,
+    double lowerBound, double upperBound)
+{
+    Array<std::string> members;
+    members.append(name);
+    addParameterGroup(name, members, lowerBound, upperBound);
+}
+
+void MuscleMetabolicsCalibration::addParameterGroup(const std::string& name,
+    const Array<std::string>& members, double lowerBound, double upperBound)
+{
+    if (members.getSize() == 0 || !(lowerBound <= upperBound)) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsCalibration: parameter '" << name
+            << "' requires at least one member and lower bound <= upper "
+            "bound." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    Parameter parameter;
+    parameter.name = name;
+    for (int i=0; i<members.getSize(); ++i)
+        parameter.members.push_back(members[i]);
+    parameter.lowerBound = lowerBound;
+    parameter.upperBound = upperBound;
+    parameter.initialValue = SimTK::NaN;
+    parameter.value = SimTK::NaN;
+    _parameters.push_back(parameter);
+}
+
+void MuscleMetabolicsCalibration::addTrial(const std::string& modelName,
+    const Storage& states, double measuredRate, double weight,
+    const Storage* controls)
+{
+    Trial trial;
+    trial.modelName = modelName;
+    trial.states = states;
+    trial.hasControls = controls != 0;
+    if (controls)
+        trial.controls = *controls;
+    trial.measuredRate = measuredRate;
+    trial.weight = weight;
+    trial.rate = SimTK::NaN;
+    _trials.push_back(trial);
+}
+
+void MuscleMetabolicsCalibration::addReferenceTrial(
+    const std::string& modelName, const Storage& states,
+    const std::string& referenceProbeName, double weight,
+    const Storage* controls)
+{
+    const MuscleMetabolicsSensitivity reference =
+        _service.evaluateSensitivity(modelName, referenceProbeName, states,
+                                     controls);
+    const double duration = reference.getEndTime() - reference.getStartTime();
+    if (!(duration > 0)) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsCalibration: the reference trial of '"
+            << referenceProbeName << "' (model '" << modelName << "') spans "
+            "no time." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    addTrial(modelName, states, reference.getEnergy() / duration, weight,
+             controls);
+}
+
+void MuscleMetabolicsCalibration::initializeValues()
+{
+    if (_trials.empty()) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsCalibration: no trials." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    bool initialized = true;
+    for (int k=0; k<getNumParameters(); ++k)
+        initialized = initialized && !SimTK::isNaN(_parameters[k].initialValue);
+    if (initialized)
+        return;
+
+    const Model& model = _service.loadModel(_trials[0].modelName);
+    const int index = model.getProbeSet().getIndex(_probeName);
+    const Probe* probe = index < 0 ? 0 : &model.getProbeSet()[index];
+    Array<std::string> names;
+    SimTK::Vector values;
+    if (const UchidaUmberger2010MuscleMetabolicsProbe* p =
+            dynamic_cast<const UchidaUmberger2010MuscleMetabolicsProbe*>(probe)) {
+        names = p->getSensitivityParameterNames();
+        values = p->getSensitivityParameterValues();
+    }
+    else if (const UchidaBhargava2004MuscleMetabolicsProbe* p =
+            dynamic_cast<const UchidaBhargava2004MuscleMetabolicsProbe*>(probe)) {
+        names = p->getSensitivityParameterNames();
+        values = p->getSensitivityParameterValues();
+    }
+    else if (const MuscleMetabolicsScreeningProbe* p =
+            dynamic_cast<const MuscleMetabolicsScreeningProbe*>(probe)) {
+        names = p->getSensitivityParameterNames();
+        values = p->getSensitivityParameterValues();
+    }
+    else {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsCalibration: '" << _probeName
+            << "' is not a metabolics probe of model '"
+            << _trials[0].modelName << "'." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    for (int k=0; k<getNumParameters(); ++k) {
+        Parameter& parameter = _parameters[k];
+        double sum = 0;
+        for (unsigned int i=0; i<parameter.members.size(); ++i) {
+            const int j = findParameter(names, parameter.members[i]);
+            if (j < 0) {
+                stringstream errorMessage;
+                errorMessage << "MuscleMetabolicsCalibration: '"
+                    << parameter.members[i] << "' is not a parameter of "
+                    "probe '" << _probeName << "' (see "
+                    "getSensitivityParameterNames())." << endl;
+                throw (Exception(errorMessage.str()));
+            }
+            sum += values[j];
+        }
+        parameter.initialValue = sum / parameter.members.size();
+        if (SimTK::isNaN(parameter.initialValue)) {
+            // e.g., a provided_muscle_mass that is not used.
+            stringstream errorMessage;
+            errorMessage << "MuscleMetabolicsCalibration: parameter '"
+                << parameter.name << "' has no value in probe '"
+                << _probeName << "'." << endl;
+            throw (Exception(errorMessage.str()));
+        }
+        parameter.value = parameter.initialValue;
+    }
+}
+
+
+//=============================================================================
+// CALIBRATION
+//=============================================================================
+double MuscleMetabolicsCalibration::calcCost(const SimTK::Vector& values,
+                                             SimTK::Vector* gradient)
+{
+    initializeValues();
+    const int numParameters = getNumParameters();
+    if (values.size() != numParameters) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsCalibration: " << values.size()
+            << " values given for " << numParameters << " parameters."
+            << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    for (int k=0; k<numParameters; ++k)
+        _parameters[k].value = values[k];
+    const Overrides overrides = getOverrides();
+
+    double cost = 0;
+    if (gradient) {
+        gradient->resize(numParameters);
+        *gradient = 0;
+    }
+    for (int t=0; t<getNumTrials(); ++t) {
+        Trial& trial = _trials[t];
+        const MuscleMetabolicsSensitivity sensitivity =
+            _service.evaluateSensitivity(trial.modelName, _probeName,
+                trial.states, trial.hasControls ? &trial.controls : 0,
+                overrides);
+        const double duration =
+            sensitivity.getEndTime() - sensitivity.getStartTime();
+        if (!(duration > 0)) {
+            stringstream errorMessage;
+            errorMessage << "MuscleMetabolicsCalibration: trial " << t
+                << " (model '" << trial.modelName << "') spans no time."
+                << endl;
+            throw (Exception(errorMessage.str()));
+        }
+        trial.rate = sensitivity.getEnergy() / duration;
+        const double residual = trial.rate - trial.measuredRate;
+        cost += 0.5 * trial.weight * residual * residual;
+        if (!gradient)
+            continue;
+
+        // d(rate)/d(parameter) is the sum over its members of
+        // d(energy)/d(member) / duration.
+        Array<std::string> names;
+        for (int j=0; j<sensitivity.getNumParameters(); ++j)
+            names.append(sensitivity.getName(j));
+        for (int k=0; k<numParameters; ++k) {
+            const Parameter& parameter = _parameters[k];
+            for (unsigned int i=0; i<parameter.members.size(); ++i) {
+                const int j = findParameter(names, parameter.members[i]);
+                if (j < 0) {
+                    stringstream errorMessage;
+                    errorMessage << "MuscleMetabolicsCalibration: '"
+                        << parameter.members[i] << "' is not a parameter of "
+                        "probe '" << _probeName << "' of model '"
+                        << trial.modelName << "'." << endl;
+                    throw (Exception(errorMessage.str()));
+                }
+                (*gradient)[k] += trial.weight * residual
+                                * sensitivity.getDerivative(j) / duration;
+            }
+        }
+    }
+
+    if (cost < _bestCost) {
+        _bestCost = cost;
+        _bestValues = values;
+    }
+    return cost;
+}
+
+double MuscleMetabolicsCalibration::calibrate(int maxIterations,
+                                              double tolerance)
+{
+    initializeValues();
+    const int numParameters = getNumParameters();
+    if (numParameters == 0) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsCalibration: no parameters." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    SimTK::Vector values(numParameters), lower(numParameters),
+                  upper(numParameters);
+    for (int k=0; k<numParameters; ++k) {
+        lower[k] = _parameters[k].lowerBound;
+        upper[k] = _parameters[k].upperBound;
+        values[k] = std::min(std::max(_parameters[k].value, lower[k]),
+                             upper[k]);
+    }
+
+    CalibrationSystem system(*this);
+    system.setParameterLimits(lower, upper);
+    SimTK::Optimizer optimizer(system, SimTK::LBFGSB);
+    optimizer.setConvergenceTolerance(tolerance);
+    optimizer.setMaxIterations(maxIterations);
+    optimizer.useNumericalGradient(false);
+
+    // The optimizer may stop at the limit of its iterations, or in a line
+    // search, with an exception; the best values evaluated are kept.
+    _bestCost = SimTK::Infinity;
+    _bestValues = values;
+    try {
+        optimizer.optimize(values);
+    }
+    catch (const SimTK::Exception::Base& ex) {
+        cout << ex.getMessage() << endl;
+        cout << "WARNING: MuscleMetabolicsCalibration: the optimizer did not "
+            "converge; the best values evaluated are kept." << endl;
+    }
+    return calcCost(_bestCost < SimTK::Infinity ? SimTK::Vector(_bestValues)
+                                                : values);
+}
+
+Overrides MuscleMetabolicsCalibration::getOverrides() const
+{
+    Overrides overrides;
+    for (int k=0; k<getNumParameters(); ++k) {
+        const Parameter& parameter = _parameters[k];
+        stringstream value;
+        value << setprecision(17) << parameter.value;
+        for (unsigned int i=0; i<parameter.members.size(); ++i)
+            overrides.push_back(make_pair(parameter.members[i], value.str()));
+    }
+    return overrides;
+}
+
+void MuscleMetabolicsCalibration::applyTo(Model& model) const
+{
+    const int index = model.getProbeSet().getIndex(_probeName);
+    Probe* probe = index < 0 ? 0 : &model.updProbeSet()[index];
+    UchidaUmberger2010MuscleMetabolicsProbe* umberger =
+        dynamic_cast<UchidaUmberger2010MuscleMetabolicsProbe*>(probe);
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargava =
+        dynamic_cast<UchidaBhargava2004MuscleMetabolicsProbe*>(probe);
+    MuscleMetabolicsScreeningProbe* screening =
+        dynamic_cast<MuscleMetabolicsScreeningProbe*>(probe);
+    if (!umberger && !bhargava && !screening) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsCalibration: '" << _probeName
+            << "' is not a metabolics probe of model '" << model.getName()
+            << "'." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    for (int k=0; k<getNumParameters(); ++k) {
+        const Parameter& parameter = _parameters[k];
+        for (unsigned int i=0; i<parameter.members.size(); ++i) {
+            if (umberger)
+                setParameter(*umberger,
+                    umberger->upd_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet(),
+                    parameter.members[i], parameter.value);
+            else if (bhargava)
+                setParameter(*bhargava,
+                    bhargava->upd_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet(),
+                    parameter.members[i], parameter.value);
+            else
+                setParameter(*screening,
+                    screening->upd_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet(),
+                    parameter.members[i], parameter.value);
+        }
+    }
+}
+
+void MuscleMetabolicsCalibration::print(std::ostream& out) const
+{
+    out << "parameter\tinitial_value\tvalue\tlower_bound\tupper_bound\n";
+    for (int k=0; k<getNumParameters(); ++k) {
+        const Parameter& parameter = _parameters[k];
+        out << parameter.name << "\t" << parameter.initialValue << "\t"
+            << parameter.value << "\t" << parameter.lowerBound << "\t"
+            << parameter.upperBound << "\n";
+    }
+    out << "trial\tmodel\tmeasured_rate\trate\tweight\n";
+    for (int t=0; t<getNumTrials(); ++t) {
+        const Trial& trial = _trials[t];
+        out << t << "\t" << trial.modelName << "\t" << trial.measuredRate
+            << "\t" << trial.rate << "\t" << trial.weight << "\n";
+    }
+}
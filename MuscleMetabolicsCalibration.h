@@ -0,0 +1,189 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_CALIBRATION_H_
+#define OPENSIM_MUSCLE_METABOLICS_CALIBRATION_H_
+/* -------------------------------------------------------------------------- *
+ *                  OpenSim:  MuscleMetabolicsCalibration.h                   *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include "MuscleMetabolicsEvaluationService.h"
+#include <OpenSim/Common/Array.h>
+#include <OpenSim/Common/Storage.h>
+#include <SimTKcommon.h>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace OpenSim {
+
+class Model;
+
+//=============================================================================
+//       CALIBRATION OF METABOLIC PARAMETERS TO MEASURED METABOLIC RATES
+//=============================================================================
+/**
+ * Fits parameters of a metabolics probe (e.g., 'muscle_effort_scaling_factor',
+ * 'aerobic_factor', or the 'ratio_slow_twitch_fibers' of a group of muscles)
+ * to the average metabolic rates measured in many trials (e.g., by indirect
+ * calorimetry), by bounded least squares.
+ *
+ * A trial is a stored trajectory of states (and optionally of controls) of a
+ * model kept by a MuscleMetabolicsEvaluationService, and its measured average
+ * metabolic rate (W). The probe of the given name is evaluated along the
+ * trajectory with the values of the parameters as overrides (see
+ * MuscleMetabolicsEvaluationService::evaluateSensitivity()); the average
+ * rate of the trial is the TOTAL energy of the probe over the trajectory
+ * divided by its duration. Its gradient with respect to the parameters is
+ * exact, propagated through the probe's kernel along with the energy (see
+ * calcParameterSensitivity() in the probes), so an iteration of the fit
+ * evaluates each trial once, on models that stay loaded. The trajectories
+ * are not simulated again: a parameter changes the metabolic rate of the
+ * stored states, not the states.
+ *
+ * The cost, (1/2) sum over the trials of weight*(rate - measured rate)^2, is
+ * minimized within the bounds of the parameters by SimTK::Optimizer with
+ * its LBFGSB algorithm, a limited-memory quasi-Newton method for simple
+ * bounds (MuscleMetabolicsStaticOptimization, whose problem also has the
+ * acceleration constraints of StaticOptimization, uses InteriorPoint). A
+ * parameter is either a parameter of the probe, named as in
+ * getSensitivityParameterNames() of the probes (e.g., "aerobic_factor" or
+ * "soleus_r.ratio_slow_twitch_fibers"), or a named group of such parameters
+ * that share a value. The initial values are those of the probe of the
+ * model of the first trial (the mean of a group). The calibrated values are
+ * set in a model by applyTo() (e.g., to print the calibrated model), or
+ * passed to the jobs of the service by getOverrides().
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsCalibration {
+public:
+    /** Calibrate the probes of the given name of the models of a service. */
+    MuscleMetabolicsCalibration(MuscleMetabolicsEvaluationService& service,
+                                const std::string& probeName);
+
+    //--------------------------------------------------------------------------
+    // Parameters
+    //--------------------------------------------------------------------------
+    /** Calibrate a parameter of the probe within [lowerBound, upperBound]. */
+    void addParameter(const std::string& name,
+                      double lowerBound, double upperBound);
+    /** Calibrate parameters of the probe that share a value, under a name
+        (e.g., the 'ratio_slow_twitch_fibers' of a group of muscles), within
+        [lowerBound, upperBound]. */
+    void addParameterGroup(const std::string& name,
+                           const Array<std::string>& members,
+                           double lowerBound, double upperBound);
+    int getNumParameters() const { return (int)_parameters.size(); }
+    const std::string& getParameterName(int k) const
+    {   return _parameters[k].name; }
+    /** The initial value of parameter k (NaN until the trials are first
+        evaluated). */
+    double getInitialParameterValue(int k) const
+    {   return _parameters[k].initialValue; }
+    /** The value of parameter k at the last evaluation of the trials (the
+        fitted value, after calibrate()). */
+    double getParameterValue(int k) const { return _parameters[k].value; }
+
+    //--------------------------------------------------------------------------
+    // Trials
+    //--------------------------------------------------------------------------
+    /** Add a trial: the states (and controls, if not null) of a model of the
+        service, which are copied, and the measured average metabolic rate
+        (W) with its weight in the cost. */
+    void addTrial(const std::string& modelName, const Storage& states,
+                  double measuredRate, double weight=1,
+                  const Storage* controls=0);
+    /** Add a trial whose measured rate is the average metabolic rate of
+        another probe of the model (e.g., an
+        UchidaUmberger2010MuscleMetabolicsProbe, to calibrate a
+        MuscleMetabolicsScreeningProbe against it), evaluated by the service
+        along the states (and controls, if not null). */
+    void addReferenceTrial(const std::string& modelName, const Storage& states,
+                           const std::string& referenceProbeName,
+                           double weight=1, const Storage* controls=0);
+    int getNumTrials() const { return (int)_trials.size(); }
+    double getMeasuredRate(int t) const { return _trials[t].measuredRate; }
+    /** The average metabolic rate of trial t at the last evaluation of the
+        trials (NaN until then). */
+    double getTrialRate(int t) const { return _trials[t].rate; }
+
+    //--------------------------------------------------------------------------
+    // Calibration
+    //--------------------------------------------------------------------------
+    /** Fit the parameters, starting from their current values, and evaluate
+        the trials at the fitted values. Returns the cost at the fitted
+        values. */
+    double calibrate(int maxIterations=100, double tolerance=1e-6);
+
+    /** Evaluate the trials with the given values of the parameters, and
+        return the cost and, if not null, its gradient. */
+    double calcCost(const SimTK::Vector& values, SimTK::Vector* gradient=0);
+
+    /** The values of the parameters as overrides of the parameters of the
+        probe (a pair for each member of a group). */
+    MuscleMetabolicsEvaluationService::Overrides getOverrides() const;
+
+    /** Set the values of the parameters in the probe of a model. */
+    void applyTo(Model& model) const;
+
+    /** Print a table of the parameters (name, initial value, value and
+        bounds), followed by a table of the trials (model, measured rate,
+        rate and weight). */
+    void print(std::ostream& out) const;
+
+private:
+    struct Parameter {
+        std::string name;
+        std::vector<std::string> members;
+        double lowerBound, upperBound;
+        double initialValue, value;
+    };
+    struct Trial {
+        std::string modelName;
+        Storage states, controls;
+        bool hasControls;
+        double measuredRate, weight;
+        double rate;
+    };
+
+    // Read the initial values from the probe of the model of the first
+    // trial, unless they have been read.
+    void initializeValues();
+
+    // Not copyable.
+    MuscleMetabolicsCalibration(const MuscleMetabolicsCalibration&);
+    MuscleMetabolicsCalibration& operator=(const MuscleMetabolicsCalibration&);
+
+    //=============================================================================
+    // DATA
+    //=============================================================================
+    MuscleMetabolicsEvaluationService& _service;
+    std::string _probeName;
+    std::vector<Parameter> _parameters;
+    std::vector<Trial> _trials;
+    // The lowest cost evaluated by calibrate(), and its values.
+    double _bestCost;
+    SimTK::Vector _bestValues;
+
+//=============================================================================
+};  // END of class MuscleMetabolicsCalibration
+//=============================================================================
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_CALIBRATION_H_
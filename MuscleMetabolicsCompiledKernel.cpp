@@ -0,0 +1,115 @@
+/* -------------------------------------------------------------------------- *
+ *                OpenSim:  MuscleMetabolicsCompiledKernel.cpp                *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsCompiledKernel.h"
+#include <map>
+
+using namespace std;
+using namespace OpenSim;
+
+namespace {
+
+// The registered kernels, by parameter hash. The maps are constructed on
+// first use, since kernels are registered during the static initialization
+// of the plugins that contain them.
+template <class CompiledKernel>
+map<string, const CompiledKernel*>& getRegisteredKernels()
+{
+    static map<string, const CompiledKernel*> kernels;
+    return kernels;
+}
+
+template <class CompiledKernel>
+void addKernel(const CompiledKernel& kernel)
+{
+    getRegisteredKernels<CompiledKernel>()[kernel.getParameterHash()] =
+        &kernel;
+}
+
+template <class CompiledKernel>
+void removeKernel(const CompiledKernel& kernel)
+{
+    map<string, const CompiledKernel*>& kernels =
+        getRegisteredKernels<CompiledKernel>();
+    typename map<string, const CompiledKernel*>::iterator it =
+        kernels.find(kernel.getParameterHash());
+    if (it != kernels.end() && it->second == &kernel)
+        kernels.erase(it);
+}
+
+template <class CompiledKernel>
+bool findKernel(const string& hash, const CompiledKernel*& kernel)
+{
+    const map<string, const CompiledKernel*>& kernels =
+        getRegisteredKernels<CompiledKernel>();
+    typename map<string, const CompiledKernel*>::const_iterator it =
+        kernels.find(hash);
+    kernel = it != kernels.end() ? it->second : 0;
+    return kernel != 0;
+}
+
+} // namespace
+
+
+//=============================================================================
+// REGISTRY
+//=============================================================================
+void MuscleMetabolicsCompiledKernelRegistry::add(
+    const Umberger2010Kernel& kernel)
+{
+    addKernel(kernel);
+}
+
+void MuscleMetabolicsCompiledKernelRegistry::add(
+    const Bhargava2004Kernel& kernel)
+{
+    addKernel(kernel);
+}
+
+void MuscleMetabolicsCompiledKernelRegistry::remove(
+    const Umberger2010Kernel& kernel)
+{
+    removeKernel(kernel);
+}
+
+void MuscleMetabolicsCompiledKernelRegistry::remove(
+    const Bhargava2004Kernel& kernel)
+{
+    removeKernel(kernel);
+}
+
+bool MuscleMetabolicsCompiledKernelRegistry::find(const string& hash,
+    const Umberger2010Kernel*& kernel)
+{
+    return findKernel(hash, kernel);
+}
+
+bool MuscleMetabolicsCompiledKernelRegistry::find(const string& hash,
+    const Bhargava2004Kernel*& kernel)
+{
+    return findKernel(hash, kernel);
+}
@@ -0,0 +1,141 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_COMPILED_KERNEL_H_
+#define OPENSIM_MUSCLE_METABOLICS_COMPILED_KERNEL_H_
+/* -------------------------------------------------------------------------- *
+ *                 OpenSim:  MuscleMetabolicsCompiledKernel.h                 *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include "UchidaUmberger2010MuscleMetabolicsKernel.h"
+#include "UchidaBhargava2004MuscleMetabolicsKernel.h"
+#include <string>
+
+namespace OpenSim {
+
+//=============================================================================
+//             AHEAD-OF-TIME COMPILED KERNEL OF A METABOLICS PROBE
+//=============================================================================
+/**
+ * The kernel of a metabolics probe specialized to the settings and muscle
+ * constants of one connected probe. Its source is generated by
+ * MuscleMetabolicsKernelGenerator, with the settings and the constants of
+ * each muscle written as literals so that the compiler can fold the disabled
+ * terms and the constant subexpressions of the equations, and is built as a
+ * plugin (see add_metabolics_kernel_plugin() in CMakeLists.txt). The
+ * generated source registers its kernel in the
+ * MuscleMetabolicsCompiledKernelRegistry when the plugin is loaded.
+ *
+ * A probe with 'use_compiled_kernel' set to true uses the registered kernel
+ * whose parameter hash matches its own settings and muscle constants (see
+ * MuscleMetabolicsKernelGenerator::calcParameterHash()); the rates are those
+ * of Kernel::calcMuscleRates().
+ *
+ * Kernel is UchidaUmberger2010MuscleMetabolicsKernel or
+ * UchidaBhargava2004MuscleMetabolicsKernel.
+ */
+template <class Kernel>
+class MuscleMetabolicsCompiledKernel {
+public:
+    typedef typename Kernel::template MuscleInputs<double> MuscleInputs;
+    typedef typename Kernel::template MuscleRates<double> MuscleRates;
+
+    virtual ~MuscleMetabolicsCompiledKernel() {}
+
+    /** The hash of the settings and muscle constants compiled into the
+        kernel. */
+    virtual std::string getParameterHash() const = 0;
+
+    /** The number of muscles of the probe the kernel was generated from. */
+    virtual int getNumMuscles() const = 0;
+
+    /** Evaluate the rates of the ith muscle of the probe. */
+    virtual void calcMuscleRates(int i, const MuscleInputs& in,
+                                 MuscleRates& rates) const = 0;
+
+    /** Evaluate the rates of all getNumMuscles() muscles of the probe, in
+        the order of its MetabolicMuscleParameterSet. */
+    virtual void calcMuscleRates(const MuscleInputs* in,
+                                 MuscleRates* rates) const = 0;
+};
+
+
+//=============================================================================
+//                    REGISTRY OF THE COMPILED KERNELS
+//=============================================================================
+/**
+ * The compiled kernels of the loaded plugins, by parameter hash. Kernels are
+ * added by a MuscleMetabolicsCompiledKernelRegistration when their plugin is
+ * loaded and removed when it is unloaded; the registry does not own them.
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsCompiledKernelRegistry {
+public:
+    typedef MuscleMetabolicsCompiledKernel<
+        UchidaUmberger2010MuscleMetabolicsKernel> Umberger2010Kernel;
+    typedef MuscleMetabolicsCompiledKernel<
+        UchidaBhargava2004MuscleMetabolicsKernel> Bhargava2004Kernel;
+
+    /** Register a kernel, replacing any kernel with the same hash. */
+    static void add(const Umberger2010Kernel& kernel);
+    static void add(const Bhargava2004Kernel& kernel);
+
+    /** Unregister a kernel, if it is registered. */
+    static void remove(const Umberger2010Kernel& kernel);
+    static void remove(const Bhargava2004Kernel& kernel);
+
+    /** Find the kernel registered with the given parameter hash. Returns
+        false, and sets kernel to null, if there is none. */
+    static bool find(const std::string& hash,
+                     const Umberger2010Kernel*& kernel);
+    static bool find(const std::string& hash,
+                     const Bhargava2004Kernel*& kernel);
+};
+
+
+//=============================================================================
+//                  REGISTRATION OF A COMPILED KERNEL
+//=============================================================================
+/**
+ * Registers a compiled kernel for the lifetime of this object. The generated
+ * sources define one at namespace scope, so that the kernel is registered
+ * when its plugin is loaded, as the probes are by
+ * RegisterTypes_osimMuscleMetabolicsProbes().
+ */
+template <class Kernel>
+class MuscleMetabolicsCompiledKernelRegistration {
+public:
+    explicit MuscleMetabolicsCompiledKernelRegistration(
+        const MuscleMetabolicsCompiledKernel<Kernel>& kernel)
+    :   _kernel(kernel)
+    {
+        MuscleMetabolicsCompiledKernelRegistry::add(_kernel);
+    }
+
+    ~MuscleMetabolicsCompiledKernelRegistration()
+    {
+        MuscleMetabolicsCompiledKernelRegistry::remove(_kernel);
+    }
+
+private:
+    const MuscleMetabolicsCompiledKernel<Kernel>& _kernel;
+};
+
+} // namespace OpenSim
+
+#endif // OPENSIM_MUSCLE_METABOLICS_COMPILED_KERNEL_H_
@@ -0,0 +1,473 @@
+/* -------------------------------------------------------------------------- *
+ *               OpenSim:  MuscleMetabolicsDeferredReporter.cpp               *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsDeferredReporter.h"
+#include "MuscleMetabolicsStatistics.h"
+#include "MuscleMetabolicsPeaks.h"
+#include "MuscleMetabolicsSensitivity.h"
+#include "MuscleMetabolicsIndexedResults.h"
+#include <OpenSim/Analyses/ProbeReporter.h>
+#include <OpenSim/Simulation/Model/Model.h>
+#include <OpenSim/Simulation/Model/ProbeSet.h>
+#include <SimTKcommon/internal/ParallelWorkQueue.h>
+#include <fstream>
+
+using namespace std;
+using namespace SimTK;
+using namespace OpenSim;
+
+
+//=============================================================================
+// CONSTRUCTOR(S)
+//=============================================================================
+MuscleMetabolicsDeferredReporter::MuscleMetabolicsDeferredReporter(Model* model)
+:   Analysis(model)
+{
+    setNull();
+    constructProperties();
+}
+
+// The worker thread and the blocks belong to a run of the simulation, and
+// are not copied.
+MuscleMetabolicsDeferredReporter::MuscleMetabolicsDeferredReporter(
+    const MuscleMetabolicsDeferredReporter& other)
+:   Analysis(other), _probeStore(other._probeStore),
+    _lastRecordedTime(other._lastRecordedTime),
+    _sampledStores(other._sampledStores), _worker(0),
+    _numBufferedRecords(0)
+{
+}
+
+MuscleMetabolicsDeferredReporter::~MuscleMetabolicsDeferredReporter()
+{
+    stopDeferredBlocks();
+}
+
+MuscleMetabolicsDeferredReporter& MuscleMetabolicsDeferredReporter::operator=(
+    const MuscleMetabolicsDeferredReporter& other)
+{
+    if (&other != this) {
+        stopDeferredBlocks();
+        Analysis::operator=(other);
+        _probeStore = other._probeStore;
+        _lastRecordedTime = other._lastRecordedTime;
+        _sampledStores = other._sampledStores;
+    }
+    return *this;
+}
+
+void MuscleMetabolicsDeferredReporter::setNull()
+{
+    setName("MuscleMetabolicsDeferredReporter");
+    _probeStore.setName("MuscleMetabolicsDeferredProbes");
+    _probeStore.setDescription("Outputs of the deferred metabolics probes, "
+        "computed from the muscle inputs recorded during the simulation.");
+    _lastRecordedTime = SimTK::NaN;
+    _worker = 0;
+    _numBufferedRecords = 0;
+}
+
+void MuscleMetabolicsDeferredReporter::constructProperties()
+{
+    constructProperty_asynchronous_evaluation(false);
+    constructProperty_asynchronous_block_size(1);
+    constructProperty_indexed_results(false);
+}
+
+
+//=============================================================================
+// DEFERRED BLOCKS
+//=============================================================================
+class MuscleMetabolicsDeferredReporter::ComputeBlockTask
+    : public SimTK::ParallelWorkQueue::Task {
+public:
+    explicit ComputeBlockTask(
+        const std::vector<MuscleMetabolicsReportedProbe::DeferredBlock*>& blocks)
+    :   _blocks(blocks) {}
+
+    void execute() OVERRIDE_11
+    {
+        for (unsigned int j=0; j<_blocks.size(); ++j)
+            _blocks[j]->computeBlock();
+    }
+
+private:
+    const std::vector<MuscleMetabolicsReportedProbe::DeferredBlock*>& _blocks;
+};
+
+namespace {
+// The probe as a reported metabolics probe, or null if it is not one or is
+// disabled.
+MuscleMetabolicsReportedProbe* getReportedProbe(Probe& probe)
+{
+    if (probe.isDisabled())
+        return 0;
+    return dynamic_cast<MuscleMetabolicsReportedProbe*>(&probe);
+}
+
+const MuscleMetabolicsReportedProbe* getReportedProbe(const Probe& probe)
+{
+    if (probe.isDisabled())
+        return 0;
+    return dynamic_cast<const MuscleMetabolicsReportedProbe*>(&probe);
+}
+
+// Print a table (statistics, peaks or sensitivity) to a file.
+template <class Table>
+void printTable(const Table& table, const string& fileName,
+                const string& analysisName)
+{
+    ofstream out(fileName.c_str());
+    table.print(out);
+    if (!out)
+        cout << "WARNING: " << analysisName << ": Unable to write "
+             << fileName << "." << endl;
+}
+}
+
+//_____________________________________________________________________________
+/**
+ * Give each sampled probe a storage of the reporter to stream its samples to.
+ */
+void MuscleMetabolicsDeferredReporter::startSampling()
+{
+    ProbeSet& probes = _model->updProbeSet();
+    std::vector<MuscleMetabolicsReportedProbe*> sampled;
+    for (int i=0; i<probes.getSize(); ++i) {
+        MuscleMetabolicsReportedProbe* p = getReportedProbe(probes[i]);
+        if (p && p->isSampled())
+            sampled.push_back(p);
+    }
+    _sampledStores.clear();
+    _sampledStores.resize(sampled.size());
+    for (unsigned int j=0; j<sampled.size(); ++j)
+        sampled[j]->setSampledResults(&_sampledStores[j]);
+}
+
+void MuscleMetabolicsDeferredReporter::stopSampling()
+{
+    ProbeSet& probes = _model->updProbeSet();
+    for (int i=0; i<probes.getSize(); ++i) {
+        MuscleMetabolicsReportedProbe* p = getReportedProbe(probes[i]);
+        if (p && p->isSampled())
+            p->setSampledResults(0);
+    }
+}
+
+const Storage& MuscleMetabolicsDeferredReporter::getSampledStorage(
+    const std::string& probeName) const
+{
+    for (unsigned int j=0; j<_sampledStores.size(); ++j)
+        if (_sampledStores[j].getName() == probeName + "_sampled")
+            return _sampledStores[j];
+    stringstream errorMessage;
+    errorMessage << getConcreteClassName() << ": '" << getName()
+        << "' has no samples of probe '" << probeName << "'." << endl;
+    throw (Exception(errorMessage.str()));
+}
+
+//_____________________________________________________________________________
+/**
+ * Create the block of each deferred probe, and start a worker thread with
+ * <asynchronous_evaluation>.
+ */
+void MuscleMetabolicsDeferredReporter::startDeferredBlocks()
+{
+    stopDeferredBlocks();
+    if (get_asynchronous_evaluation() && get_asynchronous_block_size() < 1) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": '" << getName()
+            << "' has <asynchronous_block_size> "
+            << get_asynchronous_block_size() << "; it must be at least 1."
+            << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    ProbeSet& probes = _model->updProbeSet();
+    for (int i=0; i<probes.getSize(); ++i) {
+        MuscleMetabolicsReportedProbe* p = getReportedProbe(probes[i]);
+        if (p && p->isDeferred())
+            _blocks.push_back(p->createDeferredBlock());
+    }
+    if (get_asynchronous_evaluation())
+        _worker = new SimTK::ParallelWorkQueue(1, 1);
+    _numBufferedRecords = 0;
+}
+
+//_____________________________________________________________________________
+/**
+ * Wait for the worker to compute the previous block, whose buffers are then
+ * reused for the records gathered next, and hand the worker the records
+ * gathered since.
+ */
+void MuscleMetabolicsDeferredReporter::handOffRecords()
+{
+    _worker->flush();
+    for (unsigned int j=0; j<_blocks.size(); ++j)
+        _blocks[j]->swapRecords();
+    _worker->addTask(new ComputeBlockTask(_blocks));
+    _numBufferedRecords = 0;
+}
+
+//_____________________________________________________________________________
+/**
+ * Wait for the worker to finish, stop it, and delete the blocks.
+ */
+void MuscleMetabolicsDeferredReporter::stopDeferredBlocks()
+{
+    if (_worker) {
+        _worker->flush();
+        delete _worker;
+        _worker = 0;
+    }
+    for (unsigned int j=0; j<_blocks.size(); ++j)
+        delete _blocks[j];
+    _blocks.clear();
+    _numBufferedRecords = 0;
+}
+
+
+//=============================================================================
+// ANALYSIS
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Discard the inputs, statistics, peaks and sensitivity recorded in the
+ * probes.
+ */
+void MuscleMetabolicsDeferredReporter::clearRecords()
+{
+    ProbeSet& probes = _model->updProbeSet();
+    for (int i=0; i<probes.getSize(); ++i)
+        if (MuscleMetabolicsReportedProbe* p = getReportedProbe(probes[i]))
+            p->clearReports();
+    _lastRecordedTime = SimTK::NaN;
+}
+
+//_____________________________________________________________________________
+/**
+ * Record the given state in the probes (see recordReports() in
+ * MuscleMetabolicsReportedProbe).
+ */
+void MuscleMetabolicsDeferredReporter::record(const SimTK::State& s)
+{
+    if (s.getTime() == _lastRecordedTime)
+        return;
+    _model->getMultibodySystem().realize(s, SimTK::Stage::Dynamics);
+
+    ProbeSet& probes = _model->updProbeSet();
+    for (int i=0; i<probes.getSize(); ++i)
+        if (MuscleMetabolicsReportedProbe* p = getReportedProbe(probes[i]))
+            p->recordReports(s);
+    _lastRecordedTime = s.getTime();
+
+    if (_worker && ++_numBufferedRecords >= get_asynchronous_block_size())
+        handOffRecords();
+}
+
+//_____________________________________________________________________________
+/**
+ * Warn about the deferred probes that a ProbeReporter of the model also
+ * reports: their values during the simulation are zeros.
+ */
+void MuscleMetabolicsDeferredReporter::warnProbeReporters() const
+{
+    const AnalysisSet& analyses = _model->getAnalysisSet();
+    std::vector<std::string> reporters;
+    for (int j=0; j<analyses.getSize(); ++j)
+        if (analyses[j].getOn()
+            && dynamic_cast<const ProbeReporter*>(&analyses[j]))
+            reporters.push_back(analyses[j].getName());
+    if (reporters.empty())
+        return;
+
+    const ProbeSet& probes = _model->getProbeSet();
+    for (int i=0; i<probes.getSize(); ++i) {
+        const MuscleMetabolicsReportedProbe* p = getReportedProbe(probes[i]);
+        if (!p || !p->isDeferred())
+            continue;
+        cout << "WARNING: " << getName() << ": '" << probes[i].getName()
+             << "' has <deferred_evaluation>, so the ProbeReporter '"
+             << reporters[0] << "' reports zeros for it; its outputs are "
+             << "those of this reporter." << endl;
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Compute the outputs of the deferred probes from the blocks of recorded
+ * inputs, and gather them in the probe storage.
+ */
+void MuscleMetabolicsDeferredReporter::computeResults()
+{
+    std::vector<Storage> results;
+    for (unsigned int j=0; j<_blocks.size(); ++j)
+        results.push_back(_blocks[j]->computeResults());
+
+    // All deferred probes were recorded at the same states.
+    Array<string> labels;
+    labels.append("time");
+    int numRecords = results.empty() ? 0 : results[0].getSize();
+    for (unsigned int j=0; j<results.size(); ++j) {
+        const Array<string>& probeLabels = results[j].getColumnLabels();
+        for (int c=1; c<probeLabels.getSize(); ++c)
+            labels.append(probeLabels[c]);
+        numRecords = std::min(numRecords, results[j].getSize());
+    }
+    _probeStore.reset(0);
+    _probeStore.setColumnLabels(labels);
+
+    for (int k=0; k<numRecords; ++k) {
+        Array<double> row;
+        for (unsigned int j=0; j<results.size(); ++j)
+            row.append(results[j].getStateVector(k)->getData());
+        _probeStore.append(results[0].getStateVector(k)->getTime(), row);
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Begin recording at the start of the simulation.
+ */
+int MuscleMetabolicsDeferredReporter::begin(SimTK::State& s)
+{
+    if (!proceed()) return 0;
+
+    _probeStore.reset(s.getTime());
+    clearRecords();
+    startSampling();
+    startDeferredBlocks();
+    warnProbeReporters();
+    record(s);
+    return 0;
+}
+
+//_____________________________________________________________________________
+/**
+ * Record the inputs at an accepted step of the simulation.
+ */
+int MuscleMetabolicsDeferredReporter::step(const SimTK::State& s,
+                                           int stepNumber)
+{
+    if (!proceed(stepNumber)) return 0;
+
+    record(s);
+    return 0;
+}
+
+//_____________________________________________________________________________
+/**
+ * Record the inputs at the end of the simulation, and compute the outputs of
+ * the deferred probes: the records not yet handed to the worker form the
+ * last block (all of the records, without <asynchronous_evaluation>).
+ */
+int MuscleMetabolicsDeferredReporter::end(SimTK::State& s)
+{
+    if (!proceed()) return 0;
+
+    record(s);
+    if (_worker) {
+        if (_numBufferedRecords > 0)
+            handOffRecords();
+        _worker->flush();
+    }
+    else
+        for (unsigned int j=0; j<_blocks.size(); ++j) {
+            _blocks[j]->swapRecords();
+            _blocks[j]->computeBlock();
+        }
+    computeResults();
+    stopDeferredBlocks();
+    stopSampling();
+    return 0;
+}
+
+//_____________________________________________________________________________
+/**
+ * Print the outputs of the deferred probes.
+ */
+int MuscleMetabolicsDeferredReporter::printResults(const std::string& baseName,
+    const std::string& dir, double dT, const std::string& extension)
+{
+    Storage::printResult(&_probeStore, baseName + "_" + getName() + "_probes",
+                         dir, dT, extension);
+    printIndexedResult(_probeStore, baseName + "_" + getName() + "_probes",
+                       dir);
+
+    // Each probe's samples, statistics, peaks and sensitivity are printed to
+    // a file each.
+    for (unsigned int j=0; j<_sampledStores.size(); ++j) {
+        if (_sampledStores[j].getSize() == 0)
+            continue;
+        const string name = baseName + "_" + getName() + "_"
+                            + _sampledStores[j].getName();
+        Storage::printResult(&_sampledStores[j], name, dir, dT, extension);
+        printIndexedResult(_sampledStores[j], name, dir);
+    }
+
+    const ProbeSet& probes = _model->getProbeSet();
+    for (int i=0; i<probes.getSize(); ++i) {
+        const MuscleMetabolicsReportedProbe* p = getReportedProbe(probes[i]);
+        if (!p)
+            continue;
+        const string name = baseName + "_" + getName() + "_"
+                            + probes[i].getName();
+        const string prefix = (dir.empty() ? "" : dir + "/") + name;
+
+        if (p->hasSummaryStatistics()
+            && p->getStatistics().getNumSamples() > 0)
+            printTable(p->getStatistics(), prefix + "_summary.txt",
+                       getName());
+        if (p->hasPeakTracking() && p->getPeaks().getNumSamples() > 0)
+            printTable(p->getPeaks(), prefix + "_peaks.txt", getName());
+        if (p->hasParameterSensitivity()
+            && p->getSensitivity().getNumSamples() > 0)
+            printTable(p->getSensitivity(), prefix + "_sensitivity.txt",
+                       getName());
+    }
+    return 0;
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: With <indexed_results>, print a Storage to an indexed results
+ * file, at every row (the pyramid replaces the dT resampling of the .sto).
+ */
+void MuscleMetabolicsDeferredReporter::printIndexedResult(
+    const Storage& storage, const std::string& name,
+    const std::string& dir) const
+{
+    if (!get_indexed_results() || storage.getSize() == 0)
+        return;
+    const string fileName = (dir.empty() ? "" : dir + "/") + name + ".mmi";
+    try {
+        MuscleMetabolicsIndexedWriter::write(storage, fileName);
+    }
+    catch (const std::exception& e) {
+        cout << "WARNING: " << getName() << ": Unable to write " << fileName
+             << ": " << e.what() << endl;
+    }
+}
@@ -0,0 +1,209 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_DEFERRED_REPORTER_H_
+#define OPENSIM_MUSCLE_METABOLICS_DEFERRED_REPORTER_H_
+/* -------------------------------------------------------------------------- *
+ *                OpenSim:  MuscleMetabolicsDeferredReporter.h                *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include <OpenSim/Common/Storage.h>
+#include "MuscleMetabolicsReportedProbe.h"
+#include <OpenSim/Simulation/Model/Analysis.h>
+#include <vector>
+
+namespace SimTK { class ParallelWorkQueue; }
+
+namespace OpenSim {
+
+//=============================================================================
+//                  MUSCLE METABOLICS DEFERRED REPORTER
+//=============================================================================
+/**
+ * An Analysis that reports the metabolics probes of the model whose
+ * 'deferred_evaluation' property is true. At the beginning, at each accepted
+ * step (subject to the step interval of the analysis) and at the end of a
+ * simulation, the reporter records the inputs of each muscle of these
+ * probes; the probes are not evaluated during the simulation, including the
+ * intermediate evaluations of the integrator. At the end of the simulation,
+ * the probe outputs are computed in bulk from the recorded inputs (see
+ * computeDeferredResults() in the probes).
+ *
+ * Adding this reporter to the AnalysisSet of a CMC setup file produces the
+ * metabolics of the CMC solution without evaluating the probes inside CMC,
+ * and without running the AnalyzeTool afterwards. The results are printed to
+ * the same file as those of a ProbeReporter
+ * (<base name>_<analysis name>_probes.sto). Probes that are not deferred are
+ * not reported; use a ProbeReporter for them. A ProbeReporter reports zeros
+ * for the deferred probes, and the reporter warns about them at the
+ * beginning of the simulation.
+ *
+ * The reporter handles the probes through the MuscleMetabolicsReportedProbe
+ * interface: at each recorded state it calls recordReports() of each enabled
+ * metabolics probe.
+ *
+ * The samples of the metabolics probes with a positive 'sampling_rate' are
+ * streamed by the probes to the reporter during the simulation (see
+ * setSampledResults() in the probes), and printed to
+ * <base name>_<analysis name>_<probe name>_sampled.sto.
+ *
+ * The reporter also accumulates the statistics of the metabolics probes
+ * whose 'summary_statistics' property is true (deferred or not) at the same
+ * states, and prints them to
+ * <base name>_<analysis name>_<probe name>_summary.txt, in place of a time
+ * series.
+ *
+ * Likewise, it updates the peaks of the metabolics probes whose
+ * 'peak_tracking' property is true, and the times at which they occurred,
+ * at the same states, and prints them to
+ * <base name>_<analysis name>_<probe name>_peaks.txt. The peaks are kept by
+ * the probes, and add no state to the system.
+ *
+ * Likewise, it accumulates the derivatives of the metabolic energy of the
+ * metabolics probes whose 'parameter_sensitivity' property is true with
+ * respect to their parameters, and prints them to
+ * <base name>_<analysis name>_<probe name>_sensitivity.txt.
+ *
+ * If the 'indexed_results' property is true, the probe outputs and samples
+ * are also printed to indexed results files, with the same names and the
+ * extension .mmi, whose time ranges can be read at any resolution without
+ * reading the whole file (see MuscleMetabolicsIndexedReader).
+ *
+ * If the 'asynchronous_evaluation' property is true, the recorded inputs are
+ * computed during the simulation instead of at its end, on a worker thread:
+ * every 'asynchronous_block_size' records, the records of each deferred
+ * probe are exchanged with a second buffer (see swapDeferredInputs() in the
+ * probes) and handed to the worker, which computes their outputs while the
+ * simulation proceeds and the next records are gathered into the first
+ * buffer. The simulation thread only gathers the inputs, and waits for the
+ * worker only if the previous block has not been computed by the next
+ * hand-off. The results are identical to those computed at the end, but
+ * the probes hold no records after the simulation.
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsDeferredReporter
+    : public Analysis {
+OpenSim_DECLARE_CONCRETE_OBJECT(MuscleMetabolicsDeferredReporter, Analysis);
+public:
+//==============================================================================
+// PROPERTIES
+//==============================================================================
+    /** @name Property declarations
+    These are the serializable properties associated with this class. **/
+    /**@{**/
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(asynchronous_evaluation, bool,
+        "Specify whether the recorded inputs will be computed during the "
+        "simulation, on a worker thread (true/false).");
+
+    /** Default value = 1. **/
+    OpenSim_DECLARE_PROPERTY(asynchronous_block_size, int,
+        "Number of records handed to the worker thread at a time, when "
+        "asynchronous_evaluation is true.");
+
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(indexed_results, bool,
+        "Specify whether the results will also be printed to indexed, "
+        "multi-resolution files (.mmi) for fast range queries (true/false).");
+    /**@}**/
+
+    //--------------------------------------------------------------------------
+    // Constructor(s)
+    //--------------------------------------------------------------------------
+    MuscleMetabolicsDeferredReporter(Model* model=0);
+    MuscleMetabolicsDeferredReporter(
+        const MuscleMetabolicsDeferredReporter& other);
+    ~MuscleMetabolicsDeferredReporter();
+    MuscleMetabolicsDeferredReporter& operator=(
+        const MuscleMetabolicsDeferredReporter& other);
+
+    //--------------------------------------------------------------------------
+    // Get and set
+    //--------------------------------------------------------------------------
+    /** Get the outputs of the deferred probes, available at the end of the
+        simulation. */
+    const Storage& getProbeStorage() const { return _probeStore; }
+
+    /** Get the samples of the probe with the given name and a positive
+        'sampling_rate', streamed by the probe during the simulation (see
+        setSampledResults() in the probes). */
+    const Storage& getSampledStorage(const std::string& probeName) const;
+
+    //--------------------------------------------------------------------------
+    // Analysis interface
+    //--------------------------------------------------------------------------
+    int begin(SimTK::State& s) OVERRIDE_11;
+    int step(const SimTK::State& s, int stepNumber) OVERRIDE_11;
+    int end(SimTK::State& s) OVERRIDE_11;
+    int printResults(const std::string& baseName, const std::string& dir="",
+                     double dT=-1.0, const std::string& extension=".sto")
+                     OVERRIDE_11;
+
+private:
+    void setNull();
+    void constructProperties();
+    void clearRecords();
+    void record(const SimTK::State& s);
+    void computeResults();
+    void printIndexedResult(const Storage& storage, const std::string& name,
+                            const std::string& dir) const;
+
+    // Warn about the deferred probes that a ProbeReporter also reports.
+    void warnProbeReporters() const;
+
+    // Stream the samples of each sampled probe to a storage of the
+    // reporter, or stop streaming them.
+    void startSampling();
+    void stopSampling();
+
+    // Create the block of each deferred probe, and start the worker thread
+    // with <asynchronous_evaluation>.
+    void startDeferredBlocks();
+    // Wait for the worker to compute the previous block, and hand it the
+    // records gathered since.
+    void handOffRecords();
+    // Stop the worker thread, and delete the blocks.
+    void stopDeferredBlocks();
+
+    // The task that computes a block of records on the worker thread.
+    class ComputeBlockTask;
+
+    //=============================================================================
+    // DATA
+    //=============================================================================
+    Storage _probeStore;
+    double _lastRecordedTime;
+
+    // The samples of each sampled probe, in the order of the ProbeSet. The
+    // probes hold pointers to them while streaming, so the vector is not
+    // resized then.
+    std::vector<Storage> _sampledStores;
+
+    // The block of each deferred probe and, with <asynchronous_evaluation>,
+    // the worker thread and the number of records since the last hand-off.
+    std::vector<MuscleMetabolicsReportedProbe::DeferredBlock*> _blocks;
+    SimTK::ParallelWorkQueue* _worker;
+    int _numBufferedRecords;
+
+//=============================================================================
+};  // END of class MuscleMetabolicsDeferredReporter
+//=============================================================================
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_DEFERRED_REPORTER_H_
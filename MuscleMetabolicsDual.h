@@ -0,0 +1,160 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_DUAL_H_
+#define OPENSIM_MUSCLE_METABOLICS_DUAL_H_
+/* -------------------------------------------------------------------------- *
+ *                    OpenSim:  MuscleMetabolicsDual.h                        *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+#include "MuscleMetabolicsFastMath.h"
+#include <cmath>
+#include <limits>
+
+namespace OpenSim {
+
+//=============================================================================
+//                DUAL NUMBERS FOR THE METABOLICS KERNELS
+//=============================================================================
+/**
+ * A forward-mode dual number, value + derivative*eps with eps^2 = 0, used to
+ * evaluate the analytic derivative of the metabolics kernels (which are
+ * templated on their scalar type) with respect to a single input. Seed the
+ * input with a derivative of 1 and every other input with 0; the derivative
+ * of each result is then its partial derivative with respect to that input.
+ *
+ * The kernels branch on comparisons of their inputs (e.g., concentric versus
+ * eccentric contraction, and the clamps on the total power and heat rate);
+ * comparisons use the value only, so the derivative is that of the branch
+ * taken, i.e., a one-sided derivative at the kinks. The derivative of
+ * pow(x, y) at x = 0 is its limit from x > 0: infinite for y < 1 (e.g., the
+ * x^0.6 terms of the kernels), so callers that need a finite gradient must
+ * keep x > 0 (MuscleMetabolicsStaticOptimization bounds the activations of
+ * the metabolic muscles by its 'minimum_activation'). For x < 0, the value
+ * and the derivative are NaN unless y is a constant integer.
+ *
+ * The fast_math approximations are evaluated with the exact functions for
+ * dual numbers (see the specializations below).
+ */
+struct MuscleMetabolicsDual {
+    double value;
+    double derivative;
+
+    MuscleMetabolicsDual(double v=0, double d=0) : value(v), derivative(d) {}
+
+    MuscleMetabolicsDual& operator+=(const MuscleMetabolicsDual& b)
+    {   value += b.value; derivative += b.derivative; return *this; }
+    MuscleMetabolicsDual& operator-=(const MuscleMetabolicsDual& b)
+    {   value -= b.value; derivative -= b.derivative; return *this; }
+    MuscleMetabolicsDual& operator*=(const MuscleMetabolicsDual& b)
+    {   derivative = derivative*b.value + value*b.derivative;
+        value *= b.value; return *this; }
+    MuscleMetabolicsDual& operator/=(const MuscleMetabolicsDual& b)
+    {   derivative = (derivative*b.value - value*b.derivative)
+                     / (b.value*b.value);
+        value /= b.value; return *this; }
+
+    // Friends defined in the class, so that they are found only by
+    // argument-dependent lookup from the kernels (which call sin, cos and pow
+    // unqualified) and do not hide std::sin, std::cos and std::pow from other
+    // code in namespace OpenSim.
+    friend MuscleMetabolicsDual sin(const MuscleMetabolicsDual& a)
+    {   return MuscleMetabolicsDual(std::sin(a.value),
+                                    std::cos(a.value)*a.derivative); }
+
+    friend MuscleMetabolicsDual cos(const MuscleMetabolicsDual& a)
+    {   return MuscleMetabolicsDual(std::cos(a.value),
+                                    -std::sin(a.value)*a.derivative); }
+
+    friend MuscleMetabolicsDual pow(const MuscleMetabolicsDual& a,
+                                    const MuscleMetabolicsDual& b)
+    {
+        const double value = std::pow(a.value, b.value);
+        if (a.value == 0) {
+            // The limit of d/dx x^y from x > 0: infinite for 0 < y < 1, 1 for
+            // y = 1, and 0 for y > 1 (or y = 0).
+            if (a.derivative == 0 || b.value == 0 || b.value > 1)
+                return MuscleMetabolicsDual(value, 0);
+            if (b.value == 1)
+                return MuscleMetabolicsDual(value, a.derivative);
+            const double infinity = std::numeric_limits<double>::infinity();
+            return MuscleMetabolicsDual(value,
+                (a.derivative > 0) ? infinity : -infinity);
+        }
+        double derivative =
+            b.value*std::pow(a.value, b.value - 1)*a.derivative;
+        if (b.derivative != 0)
+            derivative += value*std::log(a.value)*b.derivative;
+        return MuscleMetabolicsDual(value, derivative);
+    }
+};
+
+inline MuscleMetabolicsDual operator-(const MuscleMetabolicsDual& a)
+{   return MuscleMetabolicsDual(-a.value, -a.derivative); }
+
+inline MuscleMetabolicsDual operator+(MuscleMetabolicsDual a,
+                                      const MuscleMetabolicsDual& b)
+{   return a += b; }
+inline MuscleMetabolicsDual operator-(MuscleMetabolicsDual a,
+                                      const MuscleMetabolicsDual& b)
+{   return a -= b; }
+inline MuscleMetabolicsDual operator*(MuscleMetabolicsDual a,
+                                      const MuscleMetabolicsDual& b)
+{   return a *= b; }
+inline MuscleMetabolicsDual operator/(MuscleMetabolicsDual a,
+                                      const MuscleMetabolicsDual& b)
+{   return a /= b; }
+
+inline bool operator==(const MuscleMetabolicsDual& a,
+                       const MuscleMetabolicsDual& b)
+{   return a.value == b.value; }
+inline bool operator!=(const MuscleMetabolicsDual& a,
+                       const MuscleMetabolicsDual& b)
+{   return a.value != b.value; }
+inline bool operator<(const MuscleMetabolicsDual& a,
+                      const MuscleMetabolicsDual& b)
+{   return a.value < b.value; }
+inline bool operator<=(const MuscleMetabolicsDual& a,
+                       const MuscleMetabolicsDual& b)
+{   return a.value <= b.value; }
+inline bool operator>(const MuscleMetabolicsDual& a,
+                      const MuscleMetabolicsDual& b)
+{   return a.value > b.value; }
+inline bool operator>=(const MuscleMetabolicsDual& a,
+                       const MuscleMetabolicsDual& b)
+{   return a.value >= b.value; }
+
+namespace MuscleMetabolicsFastMath {
+    template <> inline MuscleMetabolicsDual
+    sinHalfPi<MuscleMetabolicsDual>(MuscleMetabolicsDual u)
+    {   return sin(MuscleMetabolicsDual(1.5707963267948966) * u); }
+
+    template <> inline MuscleMetabolicsDual
+    oneMinusCosHalfPi<MuscleMetabolicsDual>(MuscleMetabolicsDual u)
+    {   return MuscleMetabolicsDual(1)
+               - cos(MuscleMetabolicsDual(1.5707963267948966) * u); }
+
+    template <> inline MuscleMetabolicsDual
+    pow06<MuscleMetabolicsDual>(MuscleMetabolicsDual A)
+    {   return pow(A, MuscleMetabolicsDual(0.6)); }
+} // namespace MuscleMetabolicsFastMath
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_DUAL_H_
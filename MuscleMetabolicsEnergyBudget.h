@@ -0,0 +1,75 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_ENERGY_BUDGET_H_
+#define OPENSIM_MUSCLE_METABOLICS_ENERGY_BUDGET_H_
+/* -------------------------------------------------------------------------- *
+ *                  OpenSim:  MuscleMetabolicsEnergyBudget.h                  *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <SimTKcommon/internal/EventHandler.h>
+
+namespace OpenSim {
+
+//=============================================================================
+//              ENERGY BUDGET OF A METABOLICS PROBE
+//=============================================================================
+/**
+ * An event handler that terminates a simulation when the metabolic energy
+ * integrated by a metabolics probe (the TOTAL of a probe with the
+ * 'integrate' operation, with the gain applied) rises through the probe's
+ * 'energy_budget', and records the time at which it did (see
+ * recordEnergyBudgetExceeded() in the probes). The probes add it to the
+ * System in addToSystem(); the budget is read at each evaluation, so it may
+ * be changed between simulations without recreating the System. The event
+ * is inactive while the budget is 0.
+ *
+ * Probe is UchidaUmberger2010MuscleMetabolicsProbe or
+ * UchidaBhargava2004MuscleMetabolicsProbe.
+ */
+template <class Probe>
+class MuscleMetabolicsEnergyBudget : public SimTK::TriggeredEventHandler {
+public:
+    explicit MuscleMetabolicsEnergyBudget(const Probe& probe)
+    :   SimTK::TriggeredEventHandler(SimTK::Stage::Dynamics), _probe(probe)
+    {
+        getTriggerInfo().setTriggerOnFallingSignTransition(false);
+    }
+
+    SimTK::Real getValue(const SimTK::State& s) const OVERRIDE_11
+    {
+        const double budget = _probe.get_energy_budget();
+        if (budget <= 0)
+            return -1;
+        return _probe.getProbeOutputs(s)[0] - budget;
+    }
+
+    void handleEvent(SimTK::State& s, SimTK::Real /*accuracy*/,
+                     bool& shouldTerminate) const OVERRIDE_11
+    {
+        _probe.recordEnergyBudgetExceeded(s.getTime());
+        shouldTerminate = true;
+    }
+
+private:
+    const Probe& _probe;
+};
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_ENERGY_BUDGET_H_
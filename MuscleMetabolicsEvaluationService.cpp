@@ -0,0 +1,552 @@
+/* -------------------------------------------------------------------------- *
+ *              OpenSim:  MuscleMetabolicsEvaluationService.cpp               *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsEvaluationService.h"
+#include "UchidaUmberger2010MuscleMetabolicsProbe.h"
+#include "UchidaBhargava2004MuscleMetabolicsProbe.h"
+#include "MuscleMetabolicsScreeningProbe.h"
+#include <OpenSim/Simulation/Model/Actuator.h>
+#include <OpenSim/Simulation/Model/Model.h>
+#include <OpenSim/Simulation/Model/ProbeSet.h>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+using namespace OpenSim;
+
+namespace {
+// The MetabolicMuscleParameterSet of each probe.
+UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet&
+    updMuscleParameters(UchidaUmberger2010MuscleMetabolicsProbe& probe)
+{
+    return probe.upd_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet();
+}
+
+UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet&
+    updMuscleParameters(UchidaBhargava2004MuscleMetabolicsProbe& probe)
+{
+    return probe.upd_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet();
+}
+
+UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet&
+    updMuscleParameters(MuscleMetabolicsScreeningProbe& probe)
+{
+    return probe.upd_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet();
+}
+
+// The value of a double, int or bool property as text, exactly.
+std::string getPropertyValue(const AbstractProperty& property)
+{
+    stringstream value;
+    const std::string type = property.getTypeName();
+    if (type == "double")
+        value << setprecision(17) << Property<double>::getAs(property).getValue();
+    else if (type == "int")
+        value << Property<int>::getAs(property).getValue();
+    else if (type == "bool")
+        value << (Property<bool>::getAs(property).getValue() ? "true" : "false");
+    else {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsEvaluationService: property '"
+            << property.getName() << "' is a " << type << "; only double, "
+            "int and bool properties can be overridden." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    return value.str();
+}
+
+void setPropertyValue(AbstractProperty& property, const std::string& value)
+{
+    const std::string type = property.getTypeName();
+    istringstream in(value);
+    bool valid = false;
+    if (type == "double") {
+        double x;
+        valid = (in >> x) && in.eof();
+        if (valid) Property<double>::updAs(property).setValue(x);
+    }
+    else if (type == "int") {
+        int x;
+        valid = (in >> x) && in.eof();
+        if (valid) Property<int>::updAs(property).setValue(x);
+    }
+    else if (type == "bool") {
+        valid = value == "true" || value == "false"
+                || value == "1" || value == "0";
+        if (valid) Property<bool>::updAs(property).setValue(
+            value == "true" || value == "1");
+    }
+    if (!valid) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsEvaluationService: '" << value
+            << "' is not a valid value of property '" << property.getName()
+            << "' (" << type << ")." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Overrides of the parameters of a probe, restored on destruction. Only the
+ * parameters of the kernel (see getSensitivityParameterNames() in the
+ * probes) may be overridden; the other properties are read when the probe is
+ * connected, and overriding them would have no effect or leave the probe
+ * inconsistent. The mass of a muscle is recomputed after its parameters are
+ * overridden or restored.
+ */
+template <class Probe>
+class ScopedOverrides {
+public:
+    ScopedOverrides(Probe& probe,
+                    const MuscleMetabolicsEvaluationService::Overrides& overrides)
+    :   _probe(probe), _names(probe.getSensitivityParameterNames())
+    {
+        try {
+            for (unsigned int k=0; k<overrides.size(); ++k)
+                apply(overrides[k].first, overrides[k].second);
+        } catch (...) {
+            restore();
+            throw;
+        }
+    }
+    ~ScopedOverrides() { restore(); }
+
+private:
+    struct Saved {
+        int muscle;     // -1 for a property of the probe.
+        AbstractProperty* property;
+        std::string value;
+    };
+
+    void apply(const std::string& name, const std::string& value)
+    {
+        if (_names.findIndex(name) < 0) {
+            stringstream errorMessage;
+            errorMessage << "MuscleMetabolicsEvaluationService: '" << name
+                << "' is not a parameter of '" << _probe.getName()
+                << "' that a job may override (see "
+                << "getSensitivityParameterNames())." << endl;
+            throw (Exception(errorMessage.str()));
+        }
+
+        Saved saved;
+        saved.muscle = -1;
+        const std::string::size_type dot = name.find('.');
+        if (dot == std::string::npos)
+            saved.property = &_probe.updPropertyByName(name);
+        else {
+            saved.muscle = updMuscleParameters(_probe).getIndex(name.substr(0, dot));
+            if (saved.muscle < 0) {
+                stringstream errorMessage;
+                errorMessage << "MuscleMetabolicsEvaluationService: '"
+                    << _probe.getName() << "' has no muscle '"
+                    << name.substr(0, dot) << "'." << endl;
+                throw (Exception(errorMessage.str()));
+            }
+            saved.property = &updMuscleParameters(_probe)[saved.muscle]
+                .updPropertyByName(name.substr(dot+1));
+        }
+        saved.value = getPropertyValue(*saved.property);
+        setPropertyValue(*saved.property, value);
+        _saved.push_back(saved);
+        if (saved.muscle >= 0)
+            updMuscleParameters(_probe)[saved.muscle].setMuscleMass();
+    }
+
+    void restore()
+    {
+        while (!_saved.empty()) {
+            const Saved& saved = _saved.back();
+            setPropertyValue(*saved.property, saved.value);
+            if (saved.muscle >= 0)
+                updMuscleParameters(_probe)[saved.muscle].setMuscleMass();
+            _saved.pop_back();
+        }
+    }
+
+    Probe& _probe;
+    const Array<std::string> _names;
+    std::vector<Saved> _saved;
+};
+
+// The output labels of the real-time evaluator of a probe.
+template <class Probe>
+Array<std::string> getOutputLabels(Probe& probe)
+{
+    Array<std::string> labels;
+    labels.append("time");
+    labels.append(probe.getName() + "_TOTAL");
+    labels.append(probe.getName() + "_BASAL");
+    for (int i=0; i<probe.getNumMetabolicMuscles(); ++i)
+        labels.append(probe.getName() + "_"
+                      + updMuscleParameters(probe)[i].getName());
+    return labels;
+}
+
+// The number of doubles in the muscle inputs of a probe's kernel.
+template <class Probe>
+int getNumInputsPerMuscle(const Probe&)
+{
+    return (int)(sizeof(typename Probe::Kernel::template MuscleInputs<double>)
+                 / sizeof(double));
+}
+
+//_____________________________________________________________________________
+/**
+ * Sets a State to the rows of a trajectory of states, and optionally of
+ * controls.
+ */
+class TrajectoryStates {
+public:
+    TrajectoryStates(Model& model, const SimTK::State& s,
+                     const Storage& states, const Storage* controls)
+    :   _model(model), _states(states), _controls(controls),
+        _stateValues(model.getStateValues(s))
+    {
+        // The state variable of each column of the states, and the actuator
+        // of each column of the controls (-1 if none).
+        const Array<std::string> stateNames = model.getStateVariableNames();
+        const Array<std::string>& stateLabels = states.getColumnLabels();
+        int numIgnored = 0;
+        for (int c=1; c<stateLabels.getSize(); ++c) {
+            _stateIndices.push_back(stateNames.findIndex(stateLabels[c]));
+            numIgnored += _stateIndices.back() < 0;
+        }
+        if (numIgnored > 0)
+            cout << "WARNING: MuscleMetabolicsEvaluationService: " << numIgnored
+                 << " column(s) of the states are not state variables of the "
+                 "model, and are ignored." << endl;
+        if (controls) {
+            const Array<std::string>& controlLabels = controls->getColumnLabels();
+            for (int c=1; c<controlLabels.getSize(); ++c)
+                _actuatorIndices.push_back(
+                    model.getActuators().getIndex(controlLabels[c]));
+        }
+    }
+
+    int getSize() const { return _states.getSize(); }
+
+    // Set s to a row of the trajectory, realized to Stage::Dynamics.
+    void setState(int row, SimTK::State& s)
+    {
+        const StateVector& stateRow = *_states.getStateVector(row);
+        const Array<double>& data = stateRow.getData();
+        for (int c=0; c<(int)_stateIndices.size() && c<data.getSize(); ++c)
+            if (_stateIndices[c] >= 0)
+                _stateValues[_stateIndices[c]] = data[c];
+        s.updTime() = stateRow.getTime();
+        _model.setStateValues(s, &_stateValues[0]);
+
+        if (_controls) {
+            _model.getMultibodySystem().realize(s, SimTK::Stage::Velocity);
+            SimTK::Vector modelControls = _model.getControls(s);
+            Array<double> controlValues(0.0, (int)_actuatorIndices.size());
+            _controls->getDataAtTime(s.getTime(), controlValues.getSize(),
+                                     controlValues);
+            for (unsigned int c=0; c<_actuatorIndices.size(); ++c)
+                if (_actuatorIndices[c] >= 0)
+                    _model.getActuators()[_actuatorIndices[c]].setControls(
+                        SimTK::Vector(1, controlValues[c]), modelControls);
+            _model.setControls(s, modelControls);
+        }
+        _model.getMultibodySystem().realize(s, SimTK::Stage::Dynamics);
+    }
+
+private:
+    Model& _model;
+    const Storage& _states;
+    const Storage* _controls;
+    std::vector<int> _stateIndices;
+    std::vector<int> _actuatorIndices;
+    SimTK::Vector _stateValues;
+};
+
+//_____________________________________________________________________________
+/**
+ * Evaluate a probe along a trajectory, on a copy of the working state.
+ */
+template <class Probe>
+Storage evaluateProbeTrajectory(Model& model, Probe& probe,
+    const Storage& states, const Storage* controls,
+    const MuscleMetabolicsEvaluationService::Overrides& overrides)
+{
+    ScopedOverrides<Probe> scoped(probe, overrides);
+    SimTK::State s = model.getWorkingState();
+    model.getMultibodySystem().realize(s, SimTK::Stage::Instance);
+    const typename Probe::RealTimeEvaluator evaluator =
+        probe.createRealTimeEvaluator(s);
+    TrajectoryStates trajectory(model, s, states, controls);
+
+    Storage results;
+    results.setName(probe.getName());
+    results.setColumnLabels(getOutputLabels(probe));
+    std::vector<typename Probe::RealTimeEvaluator::MuscleInputs>
+        inputs(probe.getNumMetabolicMuscles());
+    std::vector<double> outputs(evaluator.getNumOutputs());
+    for (int row=0; row<trajectory.getSize(); ++row) {
+        trajectory.setState(row, s);
+        for (int i=0; i<probe.getNumMetabolicMuscles(); ++i)
+            probe.gatherMuscleInputs(s, i, inputs[i]);
+        if (!inputs.empty())
+            evaluator.calcMetabolicRates(&inputs[0], &outputs[0]);
+        else
+            evaluator.calcMetabolicRates(0, &outputs[0]);
+        results.append(s.getTime(), (int)outputs.size(), &outputs[0]);
+    }
+    return results;
+}
+
+//_____________________________________________________________________________
+/**
+ * Accumulate the sensitivity of a probe along a trajectory, on a copy of the
+ * working state.
+ */
+template <class Probe>
+MuscleMetabolicsSensitivity evaluateProbeSensitivity(Model& model,
+    Probe& probe, const Storage& states, const Storage* controls,
+    const MuscleMetabolicsEvaluationService::Overrides& overrides)
+{
+    ScopedOverrides<Probe> scoped(probe, overrides);
+    SimTK::State s = model.getWorkingState();
+    model.getMultibodySystem().realize(s, SimTK::Stage::Instance);
+    TrajectoryStates trajectory(model, s, states, controls);
+
+    MuscleMetabolicsSensitivity sensitivity(
+        probe.getSensitivityParameterNames(),
+        probe.getSensitivityParameterValues());
+    SimTK::Vector derivatives;
+    for (int row=0; row<trajectory.getSize(); ++row) {
+        trajectory.setState(row, s);
+        const double power = probe.calcParameterSensitivity(s, derivatives);
+        sensitivity.add(s.getTime(), power, derivatives);
+    }
+    return sensitivity;
+}
+
+//_____________________________________________________________________________
+/**
+ * Evaluate a probe from a trace, in place.
+ */
+template <class Probe>
+int evaluateProbeTrace(Model& model, Probe& probe, int numSamples,
+    const double* inputs, double* outputs,
+    const MuscleMetabolicsEvaluationService::Overrides& overrides)
+{
+    typedef typename Probe::RealTimeEvaluator::MuscleInputs MuscleInputs;
+    ScopedOverrides<Probe> scoped(probe, overrides);
+    SimTK::State s = model.getWorkingState();
+    model.getMultibodySystem().realize(s, SimTK::Stage::Instance);
+    const typename Probe::RealTimeEvaluator evaluator =
+        probe.createRealTimeEvaluator(s);
+
+    // The fields of MuscleInputs are doubles, so a sample of the trace is an
+    // array of MuscleInputs.
+    // The offsets are computed in size_t, as a long trace of a large model
+    // exceeds the range of int.
+    const size_t numInputs =
+        size_t(evaluator.getNumMuscles())*getNumInputsPerMuscle(probe);
+    const size_t numOutputs = evaluator.getNumOutputs();
+    int numInvalid = 0;
+    for (int k=0; k<numSamples; ++k)
+        numInvalid += evaluator.calcMetabolicRates(
+            reinterpret_cast<const MuscleInputs*>(inputs + size_t(k)*numInputs),
+            outputs + size_t(k)*numOutputs);
+    return numInvalid;
+}
+}
+
+
+//=============================================================================
+// CONSTRUCTOR(S) AND DESTRUCTOR
+//=============================================================================
+MuscleMetabolicsEvaluationService::MuscleMetabolicsEvaluationService()
+{
+}
+
+MuscleMetabolicsEvaluationService::~MuscleMetabolicsEvaluationService()
+{
+    for (std::map<std::string, Model*>::iterator it = _models.begin();
+         it != _models.end(); ++it)
+        delete it->second;
+}
+
+
+//=============================================================================
+// MODELS
+//=============================================================================
+Model& MuscleMetabolicsEvaluationService::loadModel(const std::string& fileName)
+{
+    if (!hasModel(fileName))
+        addModel(fileName, new Model(fileName));
+    return updModel(fileName);
+}
+
+void MuscleMetabolicsEvaluationService::addModel(const std::string& name,
+                                                 Model* model)
+{
+    try {
+        model->initSystem();
+    } catch (...) {
+        delete model;
+        throw;
+    }
+    unloadModel(name);
+    _models[name] = model;
+}
+
+void MuscleMetabolicsEvaluationService::unloadModel(const std::string& name)
+{
+    std::map<std::string, Model*>::iterator it = _models.find(name);
+    if (it != _models.end()) {
+        delete it->second;
+        _models.erase(it);
+    }
+}
+
+bool MuscleMetabolicsEvaluationService::hasModel(const std::string& name) const
+{
+    return _models.find(name) != _models.end();
+}
+
+Model& MuscleMetabolicsEvaluationService::updModel(const std::string& name)
+{
+    std::map<std::string, Model*>::iterator it = _models.find(name);
+    if (it == _models.end()) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsEvaluationService: model '" << name
+            << "' has not been loaded." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    return *it->second;
+}
+
+Probe& MuscleMetabolicsEvaluationService::updMetabolicsProbe(Model& model,
+    const std::string& probeName)
+{
+    ProbeSet& probes = model.updProbeSet();
+    const int index = probes.getIndex(probeName);
+    if (index < 0
+        || (!dynamic_cast<UchidaUmberger2010MuscleMetabolicsProbe*>(&probes[index])
+            && !dynamic_cast<UchidaBhargava2004MuscleMetabolicsProbe*>(&probes[index])
+            && !dynamic_cast<MuscleMetabolicsScreeningProbe*>(&probes[index]))) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsEvaluationService: '" << probeName
+            << "' is not a metabolics probe of model '" << model.getName()
+            << "'." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    return probes[index];
+}
+
+
+//=============================================================================
+// JOBS
+//=============================================================================
+Storage MuscleMetabolicsEvaluationService::evaluateTrajectory(
+    const std::string& modelName, const std::string& probeName,
+    const Storage& states, const Storage* controls, const Overrides& overrides)
+{
+    Model& model = updModel(modelName);
+    Probe& probe = updMetabolicsProbe(model, probeName);
+    if (UchidaUmberger2010MuscleMetabolicsProbe* p =
+            dynamic_cast<UchidaUmberger2010MuscleMetabolicsProbe*>(&probe))
+        return evaluateProbeTrajectory(model, *p, states, controls, overrides);
+    if (MuscleMetabolicsScreeningProbe* p =
+            dynamic_cast<MuscleMetabolicsScreeningProbe*>(&probe))
+        return evaluateProbeTrajectory(model, *p, states, controls, overrides);
+    return evaluateProbeTrajectory(model,
+        dynamic_cast<UchidaBhargava2004MuscleMetabolicsProbe&>(probe),
+        states, controls, overrides);
+}
+
+MuscleMetabolicsSensitivity MuscleMetabolicsEvaluationService::
+    evaluateSensitivity(const std::string& modelName,
+                        const std::string& probeName, const Storage& states,
+                        const Storage* controls, const Overrides& overrides)
+{
+    Model& model = updModel(modelName);
+    Probe& probe = updMetabolicsProbe(model, probeName);
+    if (UchidaUmberger2010MuscleMetabolicsProbe* p =
+            dynamic_cast<UchidaUmberger2010MuscleMetabolicsProbe*>(&probe))
+        return evaluateProbeSensitivity(model, *p, states, controls,
+                                        overrides);
+    if (MuscleMetabolicsScreeningProbe* p =
+            dynamic_cast<MuscleMetabolicsScreeningProbe*>(&probe))
+        return evaluateProbeSensitivity(model, *p, states, controls,
+                                        overrides);
+    return evaluateProbeSensitivity(model,
+        dynamic_cast<UchidaBhargava2004MuscleMetabolicsProbe&>(probe),
+        states, controls, overrides);
+}
+
+int MuscleMetabolicsEvaluationService::getNumTraceInputs(
+    const std::string& modelName, const std::string& probeName)
+{
+    Probe& probe = updMetabolicsProbe(updModel(modelName), probeName);
+    if (UchidaUmberger2010MuscleMetabolicsProbe* p =
+            dynamic_cast<UchidaUmberger2010MuscleMetabolicsProbe*>(&probe))
+        return p->getNumMetabolicMuscles()*getNumInputsPerMuscle(*p);
+    if (MuscleMetabolicsScreeningProbe* p =
+            dynamic_cast<MuscleMetabolicsScreeningProbe*>(&probe))
+        return p->getNumMetabolicMuscles()*getNumInputsPerMuscle(*p);
+    const UchidaBhargava2004MuscleMetabolicsProbe& p =
+        dynamic_cast<UchidaBhargava2004MuscleMetabolicsProbe&>(probe);
+    return p.getNumMetabolicMuscles()*getNumInputsPerMuscle(p);
+}
+
+int MuscleMetabolicsEvaluationService::getNumTraceOutputs(
+    const std::string& modelName, const std::string& probeName)
+{
+    Probe& probe = updMetabolicsProbe(updModel(modelName), probeName);
+    if (UchidaUmberger2010MuscleMetabolicsProbe* p =
+            dynamic_cast<UchidaUmberger2010MuscleMetabolicsProbe*>(&probe))
+        return p->getNumMetabolicMuscles() + 2;
+    if (MuscleMetabolicsScreeningProbe* p =
+            dynamic_cast<MuscleMetabolicsScreeningProbe*>(&probe))
+        return p->getNumMetabolicMuscles() + 2;
+    return dynamic_cast<UchidaBhargava2004MuscleMetabolicsProbe&>(probe)
+        .getNumMetabolicMuscles() + 2;
+}
+
+int MuscleMetabolicsEvaluationService::evaluateTrace(
+    const std::string& modelName, const std::string& probeName,
+    int numSamples, const double* inputs, double* outputs,
+    const Overrides& overrides)
+{
+    Model& model = updModel(modelName);
+    Probe& probe = updMetabolicsProbe(model, probeName);
+    if (UchidaUmberger2010MuscleMetabolicsProbe* p =
+            dynamic_cast<UchidaUmberger2010MuscleMetabolicsProbe*>(&probe))
+        return evaluateProbeTrace(model, *p, numSamples, inputs, outputs,
+                                  overrides);
+    if (MuscleMetabolicsScreeningProbe* p =
+            dynamic_cast<MuscleMetabolicsScreeningProbe*>(&probe))
+        return evaluateProbeTrace(model, *p, numSamples, inputs, outputs,
+                                  overrides);
+    return evaluateProbeTrace(model,
+        dynamic_cast<UchidaBhargava2004MuscleMetabolicsProbe&>(probe),
+        numSamples, inputs, outputs, overrides);
+}
@@ -0,0 +1,167 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_EVALUATION_SERVICE_H_
+#define OPENSIM_MUSCLE_METABOLICS_EVALUATION_SERVICE_H_
+/* -------------------------------------------------------------------------- *
+ *               OpenSim:  MuscleMetabolicsEvaluationService.h                *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include "MuscleMetabolicsSensitivity.h"
+#include <OpenSim/Common/Storage.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace OpenSim {
+
+class Model;
+class Probe;
+
+//=============================================================================
+//             EVALUATION SERVICE WITH WARM MODELS
+//=============================================================================
+/**
+ * Evaluates the metabolics probes of models that are loaded, initialized and
+ * connected once, for many jobs: a tool or notebook pays the deserialization
+ * of a model, initSystem() and the connection of its probes on the first job
+ * only. The metabolicsService executable serves the jobs of an instance of
+ * this class to other processes over a Unix domain socket (see README.txt).
+ *
+ * A job evaluates a metabolics probe of a model (an
+ * UchidaUmberger2010MuscleMetabolicsProbe, an
+ * UchidaBhargava2004MuscleMetabolicsProbe or a
+ * MuscleMetabolicsScreeningProbe, found by name) from either
+ *
+ *  - a trajectory: a Storage of states, whose columns are named after state
+ *    variables of the model (e.g., a CMC states file), and optionally a
+ *    Storage of controls, whose columns are named after actuators (the
+ *    controls of the other actuators are computed by the model's
+ *    controllers); or
+ *  - a trace: the muscle inputs of the probe's kernel, with no State, for
+ *    each sample (see evaluateTrace()).
+ *
+ * The probe is evaluated through its real-time evaluator (see
+ * createRealTimeEvaluator() in the probes): the outputs are TOTAL, BASAL and
+ * the metabolic power of each muscle, regardless of the probe's operation and
+ * 'report_total_metabolics_only' property.
+ *
+ * The sensitivity of the energy of a probe to its parameters along a
+ * trajectory is evaluated by evaluateSensitivity() (e.g., by a
+ * MuscleMetabolicsCalibration).
+ *
+ * A job may override parameters of the probe: a name is either a property
+ * of the probe (e.g., "aerobic_factor") or "<muscle>.<property>" for a
+ * property of one of its MetabolicMuscleParameters (e.g.,
+ * "soleus_r.ratio_slow_twitch_fibers"), and a value is the text of a
+ * double. The overrides apply to the job only. Only the parameters of the
+ * kernel settings, muscle constants and basal rate listed by
+ * getSensitivityParameterNames() in the probes may be overridden; other
+ * names, including the properties read when the probe is connected (e.g.,
+ * 'reconstruct_excitation'), are rejected.
+ *
+ * A service is not safe to use from several threads at once.
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsEvaluationService {
+public:
+    /** Parameter overrides of a job: (name, value) pairs. */
+    typedef std::vector<std::pair<std::string, std::string> > Overrides;
+
+    MuscleMetabolicsEvaluationService();
+    /** Delete the models. */
+    ~MuscleMetabolicsEvaluationService();
+
+    //--------------------------------------------------------------------------
+    // Models
+    //--------------------------------------------------------------------------
+    /** Load the model file, initialize its system and keep it for the jobs
+        that name the file, unless it has already been loaded. */
+    Model& loadModel(const std::string& fileName);
+    /** Keep a model, which the service takes ownership of, for the jobs that
+        give this name; its system is initialized. A model of the same name is
+        replaced. */
+    void addModel(const std::string& name, Model* model);
+    /** Delete a model. */
+    void unloadModel(const std::string& name);
+    bool hasModel(const std::string& name) const;
+    int getNumModels() const { return (int)_models.size(); }
+
+    //--------------------------------------------------------------------------
+    // Jobs
+    //--------------------------------------------------------------------------
+    /** Evaluate a probe along a trajectory of states (and controls, if not
+        null). Returns a Storage with a row for each state, and the columns
+        <probe>_TOTAL, <probe>_BASAL and <probe>_<muscle>. */
+    Storage evaluateTrajectory(const std::string& modelName,
+                               const std::string& probeName,
+                               const Storage& states,
+                               const Storage* controls=0,
+                               const Overrides& overrides=Overrides());
+
+    /** Accumulate the metabolic energy of a probe along a trajectory of
+        states (and controls, if not null), and its derivatives with respect
+        to the parameters of the probe (see calcParameterSensitivity() in
+        the probes). */
+    MuscleMetabolicsSensitivity evaluateSensitivity(
+        const std::string& modelName, const std::string& probeName,
+        const Storage& states, const Storage* controls=0,
+        const Overrides& overrides=Overrides());
+
+    /** The number of doubles in the inputs of a sample of a trace: the
+        fields of the probe kernel's MuscleInputs (in order), for each muscle
+        of the probe (in order). */
+    int getNumTraceInputs(const std::string& modelName,
+                          const std::string& probeName);
+    /** The number of doubles in the outputs of a sample of a trace: TOTAL,
+        BASAL and the metabolic power of each muscle. */
+    int getNumTraceOutputs(const std::string& modelName,
+                           const std::string& probeName);
+
+    /** Evaluate a probe from a trace of numSamples samples, read directly
+        from inputs (numSamples*getNumTraceInputs() doubles) and written
+        directly to outputs (numSamples*getNumTraceOutputs() doubles), which
+        may be in memory shared with another process. Returns the number of
+        muscle rates that were not finite (reported as NaN). */
+    int evaluateTrace(const std::string& modelName,
+                      const std::string& probeName, int numSamples,
+                      const double* inputs, double* outputs,
+                      const Overrides& overrides=Overrides());
+
+private:
+    Model& updModel(const std::string& name);
+    Probe& updMetabolicsProbe(Model& model, const std::string& probeName);
+
+    // Not copyable.
+    MuscleMetabolicsEvaluationService(const MuscleMetabolicsEvaluationService&);
+    MuscleMetabolicsEvaluationService& operator=(
+        const MuscleMetabolicsEvaluationService&);
+
+    //=============================================================================
+    // DATA
+    //=============================================================================
+    std::map<std::string, Model*> _models;
+
+//=============================================================================
+};  // END of class MuscleMetabolicsEvaluationService
+//=============================================================================
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_EVALUATION_SERVICE_H_
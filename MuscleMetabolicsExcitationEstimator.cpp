@@ -0,0 +1,129 @@
+/* -------------------------------------------------------------------------- *
+ *           OpenSim:  MuscleMetabolicsExcitationEstimator.cpp                *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsExcitationEstimator.h"
+#include <OpenSim/Simulation/Model/Muscle.h>
+#include <OpenSim/Actuators/Thelen2003Muscle.h>
+#include <OpenSim/Actuators/Millard2012EquilibriumMuscle.h>
+#include <algorithm>
+
+using namespace std;
+using namespace SimTK;
+using namespace OpenSim;
+
+
+//=============================================================================
+// SETUP
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Fit a quintic GCV smoothing spline to each column of the states.
+ */
+void MuscleMetabolicsExcitationEstimator::setActivationStates(
+    const Storage& states)
+{
+    _splines = GCVSplineSet(5, &states);
+    clearMuscles();
+}
+
+void MuscleMetabolicsExcitationEstimator::clearMuscles()
+{
+    _splineIndices.clear();
+    _activationTimeConstants.clear();
+    _deactivationTimeConstants.clear();
+}
+
+//_____________________________________________________________________________
+/**
+ * Find the activation spline and the time constants of a muscle.
+ */
+void MuscleMetabolicsExcitationEstimator::addMuscle(const Muscle& muscle)
+{
+    const std::string column = muscle.getName() + ".activation";
+    const int index = _splines.getIndex(column);
+    if (index < 0) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsExcitationEstimator: No column '"
+            << column << "' in the activation states, which are needed to "
+            "reconstruct the excitation of muscle " << muscle.getName() << "."
+            << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    double tauAct = 0.010, tauDeact = 0.040;
+    if (const Thelen2003Muscle* m =
+            dynamic_cast<const Thelen2003Muscle*>(&muscle)) {
+        tauAct = m->getActivationTimeConstant();
+        tauDeact = m->getDeactivationTimeConstant();
+    }
+    else if (const Millard2012EquilibriumMuscle* m =
+            dynamic_cast<const Millard2012EquilibriumMuscle*>(&muscle)) {
+        tauAct = m->getActivationTimeConstant();
+        tauDeact = m->getDeactivationTimeConstant();
+    }
+    else
+        cout << "WARNING: MuscleMetabolicsExcitationEstimator: The activation "
+            "time constants of " << muscle.getConcreteClassName() << " '"
+            << muscle.getName() << "' are unknown; using " << tauAct
+            << " s and " << tauDeact << " s." << endl;
+
+    _splineIndices.push_back(index);
+    _activationTimeConstants.push_back(tauAct);
+    _deactivationTimeConstants.push_back(tauDeact);
+}
+
+
+//=============================================================================
+// EVALUATION
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Reconstruct the excitation of muscle k from its smoothed activation.
+ */
+double MuscleMetabolicsExcitationEstimator::calcExcitation(int k,
+                                                           double t) const
+{
+    const Function& activation = _splines[_splineIndices[k]];
+    const Vector time(1, t);
+    return calcExcitation(activation.calcValue(time),
+        activation.calcDerivative(std::vector<int>(1, 0), time),
+        _activationTimeConstants[k], _deactivationTimeConstants[k]);
+}
+
+//_____________________________________________________________________________
+/**
+ * Invert first-order activation dynamics for the excitation.
+ */
+double MuscleMetabolicsExcitationEstimator::calcExcitation(double activation,
+    double activationRate, double activationTimeConstant,
+    double deactivationTimeConstant)
+{
+    const double f = 0.5 + 1.5*activation;
+    const double tau = (activationRate > 0) ? activationTimeConstant*f
+                                            : deactivationTimeConstant/f;
+    const double excitation = activation + activationRate*tau;
+    return std::min(1.0, std::max(0.0, excitation));
+}
@@ -0,0 +1,114 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_EXCITATION_ESTIMATOR_H_
+#define OPENSIM_MUSCLE_METABOLICS_EXCITATION_ESTIMATOR_H_
+/* -------------------------------------------------------------------------- *
+ *            OpenSim:  MuscleMetabolicsExcitationEstimator.h                 *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include <OpenSim/Common/GCVSplineSet.h>
+#include <OpenSim/Common/Storage.h>
+#include <vector>
+
+namespace OpenSim {
+
+class Muscle;
+
+//=============================================================================
+//              EXCITATION ESTIMATOR OF THE METABOLICS PROBES
+//=============================================================================
+/**
+ * Reconstructs the excitation of muscles from their activation trajectories,
+ * used by the metabolics probes when their 'reconstruct_excitation' property
+ * is enabled, so that the probes can be evaluated from a states file without
+ * the controls that produced it.
+ *
+ * The activation of each muscle (the column "<muscle name>.activation" of the
+ * states) is smoothed by a quintic GCV spline (as StaticOptimization smooths
+ * the coordinates), and the first-order activation dynamics of Thelen (2003),
+ *
+ *   da/dt = (u - a) / tau(u,a),
+ *   tau(u,a) = t_act*(0.5 + 1.5a)     if u > a,
+ *              t_deact/(0.5 + 1.5a)   otherwise,
+ *
+ * which are used by Thelen2003Muscle and Millard2012EquilibriumMuscle, are
+ * inverted for the excitation u from the smoothed activation and its
+ * derivative. As u > a exactly when da/dt > 0, the inversion is explicit:
+ *
+ *   u = a + da/dt * tau,  with tau evaluated for the sign of da/dt,
+ *
+ * clamped to [0, 1]. The time constants are those of the muscle; muscles of
+ * other types use t_act = 0.010 s and t_deact = 0.040 s, with a warning.
+ *
+ * Excitations that change faster than the activation dynamics can follow
+ * (e.g., the piecewise-constant controls of CMC) are recovered only as
+ * smoothed by the spline.
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsExcitationEstimator {
+public:
+    //--------------------------------------------------------------------------
+    // Setup
+    //--------------------------------------------------------------------------
+    /** Fit the smoothing splines to the columns of the states. */
+    void setActivationStates(const Storage& states);
+
+    /** Whether activation states have been set. */
+    bool hasActivationStates() const { return _splines.getSize() > 0; }
+
+    /** Remove the muscles. */
+    void clearMuscles();
+
+    /** Append a muscle, whose excitation is then calcExcitation() at the
+        same index. Throws an Exception if the states have no activation
+        column for the muscle. */
+    void addMuscle(const Muscle& muscle);
+
+    /** Get the number of muscles. */
+    int getNumMuscles() const { return (int)_splineIndices.size(); }
+
+    //--------------------------------------------------------------------------
+    // Evaluation
+    //--------------------------------------------------------------------------
+    /** Reconstruct the excitation of the kth muscle at time t. */
+    double calcExcitation(int k, double t) const;
+
+    /** Invert the activation dynamics for the excitation, given the
+        activation, its time derivative, and the time constants. */
+    static double calcExcitation(double activation, double activationRate,
+        double activationTimeConstant, double deactivationTimeConstant);
+
+private:
+    //=============================================================================
+    // DATA
+    //=============================================================================
+    GCVSplineSet _splines;
+
+    // For each muscle: the index of its spline and its time constants.
+    std::vector<int> _splineIndices;
+    std::vector<double> _activationTimeConstants;
+    std::vector<double> _deactivationTimeConstants;
+
+//=============================================================================
+};  // END of class MuscleMetabolicsExcitationEstimator
+//=============================================================================
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_EXCITATION_ESTIMATOR_H_
@@ -0,0 +1,136 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_FAST_MATH_H_
+#define OPENSIM_MUSCLE_METABOLICS_FAST_MATH_H_
+/* -------------------------------------------------------------------------- *
+ *                  OpenSim:  MuscleMetabolicsFastMath.h                      *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <cmath>
+
+namespace OpenSim {
+
+//=============================================================================
+//             FAST APPROXIMATIONS USED BY THE METABOLICS PROBES
+//=============================================================================
+/**
+ * Polynomial approximations of the transcendental functions evaluated by the
+ * metabolics probes when their 'fast_math' property is enabled. The functions
+ * are templates so that they can also be used by the single-precision kernels
+ * (the errors below are for double). Each function
+ * is specialized to the domain on which the probes evaluate it (excitation and
+ * activation in [0,1], possibly slightly above after scaling by
+ * 'muscle_effort_scaling_factor') and falls back to the <cmath> function
+ * outside that domain.
+ *
+ * The coefficients were obtained by a weighted minimax (Lawson) fit of the
+ * relative error. Measured maximum errors over the domain:
+ *
+ * - sinHalfPi(u) = sin(Pi/2*u), u in [0,1]: relative error < 6e-9.
+ * - oneMinusCosHalfPi(u) = 1-cos(Pi/2*u), u in [0,1]: relative error
+ *   < 1.2e-8. Evaluated as 2*sin^2(Pi/4*u), which also avoids the
+ *   cancellation error of 1-cos(x) for small u.
+ * - pow06(A) = A^0.6, A >= 0: relative error < 9e-7.
+ *
+ * Propagated through the probes, the maximum absolute error in the metabolic
+ * power of a muscle is:
+ *
+ * - UchidaUmberger2010MuscleMetabolicsProbe: < 3e-4 W/kg (dominated by A^0.6
+ *   in the activation and maintenance heat rate, which is at most
+ *   1.5*153*A^0.6 W/kg with the default aerobic_factor).
+ * - UchidaBhargava2004MuscleMetabolicsProbe: < 5e-6 W/kg (the activation and
+ *   maintenance constants sum to at most 40+74 W/kg for slow-twitch and
+ *   133+111 W/kg for fast-twitch fibers).
+ *
+ * These bounds are validated against the exact functions across the domain
+ * in testMuscleMetabolicsProbes.
+ */
+namespace MuscleMetabolicsFastMath {
+
+    /** Documented maximum absolute error (W/kg) of the fast_math mode of
+        UchidaUmberger2010MuscleMetabolicsProbe, per muscle. */
+    static const double UmbergerMaxAbsErrorPerKg = 3e-4;
+
+    /** Documented maximum absolute error (W/kg) of the fast_math mode of
+        UchidaBhargava2004MuscleMetabolicsProbe, per muscle. */
+    static const double BhargavaMaxAbsErrorPerKg = 5e-6;
+
+    /** sin(Pi/2*u). Odd polynomial of degree 9 on [0,1]. */
+    template <class T>
+    inline T sinHalfPi(T u)
+    {
+        if (!(u >= T(0) && u <= T(1)))
+            return std::sin(T(1.5707963267948966) * u);
+        const T t = u*u;
+        return u * ( T( 1.5707963184483198)
+                   + t*(T(-0.64596371060764241)
+                   + t*(T( 0.079689678974744458)
+                   + t*(T(-0.0046737666472352968)
+                   + t* T( 0.00015148514585283608)))));
+    }
+
+    /** 1-cos(Pi/2*u), evaluated as 2*sin^2(Pi/4*u). */
+    template <class T>
+    inline T oneMinusCosHalfPi(T u)
+    {
+        if (!(u >= T(0) && u <= T(1)))
+            return T(1) - std::cos(T(1.5707963267948966) * u);
+        const T s = sinHalfPi(T(0.5)*u);
+        return T(2)*s*s;
+    }
+
+    /** A^0.6. The argument is split into m*2^e with m in [0.5,1); m^0.6 is
+        a degree-5 polynomial and 2^(0.6*e) is an exact power of two times
+        a tabulated 2^(k/5). */
+    template <class T>
+    inline T pow06(T A)
+    {
+        if (!(A > T(0)) || !(A < T(1.0e30)))
+            return (A == T(0)) ? T(0) : T(std::pow(A, T(0.6)));
+
+        static const double twoToFifths[5] = { 1.0, 1.148698354997035,
+            1.3195079107728942, 1.515716566510398, 1.7411011265922482 };
+
+        int e;
+        const T m = std::frexp(A, &e);
+        const T pm = T( 0.13553408264916805)
+                   + m*(T( 1.4439806336315902)
+                   + m*(T(-1.1580423943663585)
+                   + m*(T( 0.93674724071739731)
+                   + m*(T(-0.45306671318590733)
+                   + m* T( 0.094848032739895386)))));
+
+        // 0.6*e = 3*e/5 = q + k/5 with k in [0,4].
+        const int e3 = 3*e;
+        const int q = (e3 >= 0) ? e3/5 : -((4 - e3)/5);
+        return std::ldexp(pm * T(twoToFifths[e3 - 5*q]), q);
+    }
+
+    /** A^2. */
+    template <class T>
+    inline T pow2(T A)
+    {
+        return A*A;
+    }
+
+} // namespace MuscleMetabolicsFastMath
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_FAST_MATH_H_
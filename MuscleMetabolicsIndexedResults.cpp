@@ -0,0 +1,508 @@
+/* -------------------------------------------------------------------------- *
+ *                OpenSim:  MuscleMetabolicsIndexedResults.cpp                *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsIndexedResults.h"
+#include <OpenSim/Common/Exception.h>
+#include <OpenSim/Common/Storage.h>
+#include <OpenSim/Common/StateVector.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+using namespace OpenSim;
+
+const int MuscleMetabolicsIndexedWriter::DefaultReductionFactor = 16;
+
+namespace {
+// The file starts with HeaderMagic and a byte order mark, and ends with
+// FooterMagic, so that incomplete files and files of the other byte order
+// are detected.
+const char HeaderMagic[8] = { 'M','M','I','D','X','0','0','1' };
+const char FooterMagic[8] = { 'M','M','I','D','X','E','N','D' };
+const int ByteOrderMark = 0x01020304;
+
+template <class T>
+void writeBinary(std::ostream& out, const T& value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <class T>
+T readBinary(std::istream& in)
+{
+    T value = T();
+    in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return value;
+}
+
+// The start and end times of a record are its first two values; those of a
+// sample are its time.
+int startTimeIndex(int /*level*/) { return 0; }
+int endTimeIndex(int level) { return level == 0 ? 0 : 1; }
+}
+
+
+//=============================================================================
+// WRITER
+//=============================================================================
+MuscleMetabolicsIndexedWriter::MuscleMetabolicsIndexedWriter(
+    const std::string& fileName, const Array<std::string>& labels,
+    int reductionFactor) :
+    _fileName(fileName),
+    _numChannels(labels.getSize()),
+    _reductionFactor(reductionFactor),
+    _numSamples(0),
+    _samplesOffset(0),
+    _lastTime(SimTK::NaN)
+{
+    if (reductionFactor < 2) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsIndexedWriter: the reduction factor "
+            "must be at least 2 (" << reductionFactor << " was given)."
+            << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    _out.open(fileName.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!_out) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsIndexedWriter: unable to create "
+            << fileName << "." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    _out.write(HeaderMagic, sizeof(HeaderMagic));
+    writeBinary(_out, ByteOrderMark);
+    writeBinary(_out, _numChannels);
+    writeBinary(_out, _reductionFactor);
+    for (int c=0; c<_numChannels; ++c) {
+        writeBinary(_out, (int)labels[c].size());
+        _out.write(labels[c].data(), labels[c].size());
+    }
+    _samplesOffset = (long long)_out.tellp();
+}
+
+MuscleMetabolicsIndexedWriter::~MuscleMetabolicsIndexedWriter()
+{
+    try {
+        close();
+    }
+    catch (const std::exception& e) {
+        cout << "WARNING: " << e.what() << endl;
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Append a sample, and add it to the first coarser level.
+ */
+void MuscleMetabolicsIndexedWriter::append(double t, const SimTK::Vector& values)
+{
+    checkOpen();
+    if (values.size() != _numChannels || (_numSamples > 0 && t < _lastTime)) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsIndexedWriter: a sample of "
+            << values.size() << " channel(s) at t = " << t << " cannot be "
+            "appended to " << _fileName << " (" << _numChannels
+            << " channel(s), ending at t = " << _lastTime << ")." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    writeBinary(_out, t);
+    for (int c=0; c<_numChannels; ++c)
+        writeBinary(_out, values[c]);
+    _lastTime = t;
+    ++_numSamples;
+
+    const double* v = _numChannels > 0 ? &values[0] : 0;
+    addToLevel(0, 1, t, t, v, v, v);
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Add a record of the level below to the group of _levels[k].
+ */
+void MuscleMetabolicsIndexedWriter::addToLevel(int k, double numSamples,
+    double startTime, double endTime, const double* min, const double* max,
+    const double* sum)
+{
+    if (k == (int)_levels.size()) {
+        _levels.push_back(Level());
+        _levels.back().numRecords = 0;
+        resetGroup(_levels.back().group);
+    }
+    Group& group = _levels[k].group;
+    if (group.numChildren == 0)
+        group.startTime = startTime;
+    group.endTime = endTime;
+    group.numSamples += numSamples;
+    for (int c=0; c<_numChannels; ++c) {
+        group.min[c] = std::min(group.min[c], min[c]);
+        group.max[c] = std::max(group.max[c], max[c]);
+        group.sum[c] += sum[c];
+    }
+    if (++group.numChildren == _reductionFactor)
+        closeGroup(k, true);
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Write the group of _levels[k] as a record: start time, end time,
+ * number of samples, and the minima, maxima and means of the channels.
+ */
+void MuscleMetabolicsIndexedWriter::closeGroup(int k, bool propagate)
+{
+    Level& level = _levels[k];
+    Group group = level.group;
+    std::vector<double>& records = level.records;
+    records.push_back(group.startTime);
+    records.push_back(group.endTime);
+    records.push_back(group.numSamples);
+    records.insert(records.end(), group.min.begin(), group.min.end());
+    records.insert(records.end(), group.max.begin(), group.max.end());
+    for (int c=0; c<_numChannels; ++c)
+        records.push_back(group.sum[c] / group.numSamples);
+    ++level.numRecords;
+    resetGroup(level.group);
+
+    if (propagate) {
+        const bool empty = _numChannels == 0;
+        addToLevel(k+1, group.numSamples, group.startTime, group.endTime,
+                   empty ? 0 : &group.min[0], empty ? 0 : &group.max[0],
+                   empty ? 0 : &group.sum[0]);
+    }
+}
+
+void MuscleMetabolicsIndexedWriter::resetGroup(Group& group) const
+{
+    group.numChildren = 0;
+    group.numSamples = 0;
+    group.startTime = group.endTime = SimTK::NaN;
+    group.min.assign(_numChannels, SimTK::Infinity);
+    group.max.assign(_numChannels, -SimTK::Infinity);
+    group.sum.assign(_numChannels, 0.0);
+}
+
+//_____________________________________________________________________________
+/**
+ * Close the partial groups of the coarser levels, from the finest to the
+ * top, and write the levels and their table.
+ */
+void MuscleMetabolicsIndexedWriter::close()
+{
+    if (!_out.is_open())
+        return;
+
+    // A level receives records only when the level below closes a group, so
+    // the last level has no records yet: its group is the top record.
+    for (int k=0; k<(int)_levels.size(); ++k)
+        if (_levels[k].group.numChildren > 0)
+            closeGroup(k, k+1 < (int)_levels.size());
+    // Levels above a level of a single record repeat it.
+    for (int k=0; k<(int)_levels.size(); ++k)
+        if (_levels[k].numRecords == 1) {
+            _levels.resize(k+1);
+            break;
+        }
+
+    std::vector<long long> offsets(1, _samplesOffset);
+    std::vector<long long> numRecords(1, _numSamples);
+    for (int k=0; k<(int)_levels.size(); ++k) {
+        offsets.push_back((long long)_out.tellp());
+        numRecords.push_back(_levels[k].numRecords);
+        const std::vector<double>& records = _levels[k].records;
+        if (!records.empty())
+            _out.write(reinterpret_cast<const char*>(&records[0]),
+                       records.size()*sizeof(double));
+    }
+    for (unsigned int k=0; k<offsets.size(); ++k) {
+        writeBinary(_out, offsets[k]);
+        writeBinary(_out, numRecords[k]);
+    }
+    writeBinary(_out, (int)offsets.size());
+    _out.write(FooterMagic, sizeof(FooterMagic));
+    _out.close();
+    _levels.clear();
+
+    if (_out.fail()) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsIndexedWriter: unable to write "
+            << _fileName << "." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+}
+
+void MuscleMetabolicsIndexedWriter::checkOpen() const
+{
+    if (!_out.is_open()) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsIndexedWriter: " << _fileName
+            << " has been closed." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Write the rows of a Storage to an indexed results file.
+ */
+void MuscleMetabolicsIndexedWriter::write(const Storage& storage,
+    const std::string& fileName, int reductionFactor)
+{
+    const Array<std::string>& columnLabels = storage.getColumnLabels();
+    Array<std::string> labels;
+    for (int c=1; c<columnLabels.getSize(); ++c)
+        labels.append(columnLabels[c]);
+
+    MuscleMetabolicsIndexedWriter writer(fileName, labels, reductionFactor);
+    SimTK::Vector values(labels.getSize());
+    for (int i=0; i<storage.getSize(); ++i) {
+        const StateVector* row = storage.getStateVector(i);
+        const Array<double>& data = row->getData();
+        for (int c=0; c<labels.getSize(); ++c)
+            values[c] = c < data.getSize() ? data[c] : SimTK::NaN;
+        writer.append(row->getTime(), values);
+    }
+    writer.close();
+}
+
+
+//=============================================================================
+// READER
+//=============================================================================
+MuscleMetabolicsIndexedReader::MuscleMetabolicsIndexedReader(
+    const std::string& fileName) :
+    _fileName(fileName),
+    _reductionFactor(0)
+{
+    _in.open(fileName.c_str(), ios::in | ios::binary);
+    char magic[8];
+    _in.read(magic, sizeof(magic));
+    const bool hasHeader = _in && memcmp(magic, HeaderMagic, 8) == 0;
+    const bool hasByteOrder = hasHeader && readBinary<int>(_in) == ByteOrderMark;
+    int numChannels = 0;
+    if (hasByteOrder) {
+        numChannels = readBinary<int>(_in);
+        _reductionFactor = readBinary<int>(_in);
+        for (int c=0; _in && c<numChannels; ++c) {
+            const int size = readBinary<int>(_in);
+            std::string label(std::max(size, 0), ' ');
+            if (size > 0)
+                _in.read(&label[0], size);
+            _labels.push_back(label);
+        }
+    }
+
+    // The table of the levels precedes the level count and FooterMagic.
+    int numLevels = 0;
+    if (hasByteOrder && _in) {
+        _in.seekg(-(streamoff)(sizeof(int) + sizeof(FooterMagic)), ios::end);
+        numLevels = readBinary<int>(_in);
+        _in.read(magic, sizeof(magic));
+        if (!_in || memcmp(magic, FooterMagic, 8) != 0)
+            numLevels = 0;
+    }
+    if (numLevels > 0) {
+        _in.seekg(-(streamoff)(sizeof(int) + sizeof(FooterMagic)
+                  + numLevels*2*sizeof(long long)), ios::end);
+        for (int k=0; _in && k<numLevels; ++k) {
+            LevelInfo info;
+            info.offset = readBinary<long long>(_in);
+            info.numRecords = readBinary<long long>(_in);
+            _levels.push_back(info);
+        }
+    }
+
+    if (!_in || numLevels == 0) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsIndexedReader: " << fileName
+            << " is not a complete indexed results file";
+        if (hasHeader && !hasByteOrder)
+            errorMessage << " of this machine's byte order";
+        errorMessage << "." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+}
+
+long long MuscleMetabolicsIndexedReader::getNumRecords(int level) const
+{
+    checkLevel(level);
+    return _levels[level].numRecords;
+}
+
+double MuscleMetabolicsIndexedReader::getStartTime() const
+{
+    return getNumRecords(0) > 0 ? readValue(0, 0, 0) : SimTK::NaN;
+}
+
+double MuscleMetabolicsIndexedReader::getEndTime() const
+{
+    const long long n = getNumRecords(0);
+    return n > 0 ? readValue(0, n-1, 0) : SimTK::NaN;
+}
+
+//_____________________________________________________________________________
+/**
+ * Find the finest level with at most maxPoints records in the range.
+ */
+int MuscleMetabolicsIndexedReader::findLevel(double startTime, double endTime,
+                                             int maxPoints) const
+{
+    for (int k=0; k<getNumLevels(); ++k) {
+        const long long first = findFirstEndingAtOrAfter(k, startTime);
+        const long long last = findFirstStartingAfter(k, endTime);
+        if (last - first <= maxPoints)
+            return k;
+    }
+    return getNumLevels() - 1;
+}
+
+//_____________________________________________________________________________
+/**
+ * Read the records of a level that overlap the range in a single read.
+ */
+int MuscleMetabolicsIndexedReader::read(int level, double startTime,
+    double endTime, Storage& result) const
+{
+    checkLevel(level);
+    const int numChannels = getNumChannels();
+    Array<std::string> columnLabels;
+    columnLabels.append("time");
+    if (level == 0)
+        for (int c=0; c<numChannels; ++c)
+            columnLabels.append(_labels[c]);
+    else {
+        const char* suffixes[3] = { "_min", "_max", "_mean" };
+        for (int s=0; s<3; ++s)
+            for (int c=0; c<numChannels; ++c)
+                columnLabels.append(_labels[c] + suffixes[s]);
+    }
+    result.purge();
+    result.setColumnLabels(columnLabels);
+
+    const long long first = findFirstEndingAtOrAfter(level, startTime);
+    const long long last = std::max(first,
+                                    findFirstStartingAfter(level, endTime));
+    const int recordSize = getRecordSize(level);
+    std::vector<double> records((size_t)(last - first)*recordSize);
+    if (!records.empty()) {
+        _in.clear();
+        _in.seekg((streamoff)(_levels[level].offset
+                              + first*recordSize*sizeof(double)));
+        _in.read(reinterpret_cast<char*>(&records[0]),
+                 records.size()*sizeof(double));
+        if (!_in) {
+            stringstream errorMessage;
+            errorMessage << "MuscleMetabolicsIndexedReader: unable to read "
+                "level " << level << " of " << _fileName << "." << endl;
+            throw (Exception(errorMessage.str()));
+        }
+    }
+
+    // The values of a coarser record follow its start and end times and its
+    // number of samples.
+    const int valuesIndex = level == 0 ? 1 : 3;
+    for (long long r=0; r<last-first; ++r) {
+        const double* record = &records[(size_t)r*recordSize];
+        result.append(record[0], recordSize - valuesIndex,
+                      record + valuesIndex, false);
+    }
+    return (int)(last - first);
+}
+
+int MuscleMetabolicsIndexedReader::readRange(double startTime, double endTime,
+    int maxPoints, Storage& result) const
+{
+    const int level = findLevel(startTime, endTime, maxPoints);
+    read(level, startTime, endTime, result);
+    return level;
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Binary searches on the times of the records of a level, which
+ * read a single value per step.
+ */
+long long MuscleMetabolicsIndexedReader::findFirstEndingAtOrAfter(int level,
+                                                                  double t) const
+{
+    long long lo = 0, hi = getNumRecords(level);
+    while (lo < hi) {
+        const long long mid = lo + (hi - lo)/2;
+        if (readValue(level, mid, endTimeIndex(level)) < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+long long MuscleMetabolicsIndexedReader::findFirstStartingAfter(int level,
+                                                                double t) const
+{
+    long long lo = 0, hi = getNumRecords(level);
+    while (lo < hi) {
+        const long long mid = lo + (hi - lo)/2;
+        if (readValue(level, mid, startTimeIndex(level)) <= t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int MuscleMetabolicsIndexedReader::getRecordSize(int level) const
+{
+    return level == 0 ? 1 + getNumChannels() : 3 + 3*getNumChannels();
+}
+
+double MuscleMetabolicsIndexedReader::readValue(int level, long long r,
+                                                int i) const
+{
+    _in.clear();
+    _in.seekg((streamoff)(_levels[level].offset
+                          + (r*getRecordSize(level) + i)*sizeof(double)));
+    const double value = readBinary<double>(_in);
+    if (!_in) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsIndexedReader: unable to read "
+            "level " << level << " of " << _fileName << "." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    return value;
+}
+
+void MuscleMetabolicsIndexedReader::checkLevel(int level) const
+{
+    if (level < 0 || level >= getNumLevels()) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsIndexedReader: " << _fileName
+            << " has no level " << level << " (it has " << getNumLevels()
+            << ")." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+}
@@ -0,0 +1,201 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_INDEXED_RESULTS_H_
+#define OPENSIM_MUSCLE_METABOLICS_INDEXED_RESULTS_H_
+/* -------------------------------------------------------------------------- *
+ *                 OpenSim:  MuscleMetabolicsIndexedResults.h                 *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include <OpenSim/Common/Array.h>
+#include <SimTKcommon.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace OpenSim {
+
+class Storage;
+
+//=============================================================================
+//             INDEXED, MULTI-RESOLUTION METABOLICS RESULTS
+//=============================================================================
+/**
+ * Indexed results files (.mmi) hold the time series of a metabolics probe
+ * (or of any Storage) together with a level-of-detail pyramid, so that any
+ * time range of a long trial can be read at any resolution without reading
+ * the rest of the file.
+ *
+ * Level 0 holds the samples: a time and a value per channel. Each record of
+ * level k > 0 summarizes up to 'reduction_factor' consecutive records of
+ * level k-1 by their start and end times, their number of samples, and the
+ * minimum, maximum and mean (over the samples) of each channel; the top
+ * level has a single record. The records of a level have a fixed size and
+ * are sorted by time, so the records of a time range are found by binary
+ * search and read contiguously: a query reads O(log N) values to locate the
+ * range, and then only the records it returns.
+ *
+ * The file is binary, in the byte order of the machine that wrote it (a
+ * reader on a machine of the other byte order reports an error). It starts
+ * with a header (the channel labels and the reduction factor), followed by
+ * the samples, the coarser levels, and a table of the levels at its end.
+ */
+
+//_____________________________________________________________________________
+/**
+ * Writes an indexed results file, one sample at a time. The samples are
+ * written to the file as they are appended; the coarser levels, which are
+ * built at the same time, are kept in memory (about 3/reduction_factor of
+ * the size of the samples) and written by close().
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsIndexedWriter {
+public:
+    /** Default reduction factor between consecutive levels. */
+    static const int DefaultReductionFactor;
+
+    /** Create the file, for the channels with the given labels (excluding
+        time). Throws an Exception if the file cannot be created. */
+    MuscleMetabolicsIndexedWriter(const std::string& fileName,
+                                  const Array<std::string>& labels,
+                                  int reductionFactor=DefaultReductionFactor);
+    /** Close the file, if close() has not been called. */
+    ~MuscleMetabolicsIndexedWriter();
+
+    /** Append the values of the channels at time t, which must not precede
+        the last sample. */
+    void append(double t, const SimTK::Vector& values);
+
+    /** Write the coarser levels and the table of the levels, and close the
+        file. */
+    void close();
+
+    int getNumChannels() const { return _numChannels; }
+    int getNumSamples() const { return _numSamples; }
+
+    /** Write the rows of a Storage (whose first column is time) to an
+        indexed results file. */
+    static void write(const Storage& storage, const std::string& fileName,
+                      int reductionFactor=DefaultReductionFactor);
+
+private:
+    // Summary of the records of a level not yet grouped into a record of
+    // the next level.
+    struct Group {
+        int numChildren;
+        double numSamples, startTime, endTime;
+        std::vector<double> min, max, sum;
+    };
+    struct Level {
+        std::vector<double> records;
+        long long numRecords;
+        Group group;
+    };
+
+    // Add a record of level k-1 (or a sample, for k = 1) to the group of
+    // level k, which is closed when it has 'reduction factor' children.
+    void addToLevel(int k, double numSamples, double startTime,
+                    double endTime, const double* min, const double* max,
+                    const double* sum);
+    // Write the group of level k as a record of level k, and add it to the
+    // group of level k+1 unless level k is the top level.
+    void closeGroup(int k, bool propagate);
+    void resetGroup(Group& group) const;
+    void checkOpen() const;
+
+    // Not copyable.
+    MuscleMetabolicsIndexedWriter(const MuscleMetabolicsIndexedWriter&);
+    MuscleMetabolicsIndexedWriter& operator=(
+        const MuscleMetabolicsIndexedWriter&);
+
+    std::string _fileName;
+    std::ofstream _out;
+    int _numChannels;
+    int _reductionFactor;
+    long long _numSamples;
+    long long _samplesOffset;
+    double _lastTime;
+    // Levels 1, 2, ... (level 0 is written directly to the file).
+    std::vector<Level> _levels;
+};
+
+//_____________________________________________________________________________
+/**
+ * Reads time ranges of an indexed results file, at the finest level that
+ * fits a number of points. A reader keeps the file open; it is not safe to
+ * use one reader from several threads at once.
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsIndexedReader {
+public:
+    /** Open the file, and read its header and table of levels. Throws an
+        Exception if the file is not a complete indexed results file. */
+    explicit MuscleMetabolicsIndexedReader(const std::string& fileName);
+
+    int getNumChannels() const { return (int)_labels.size(); }
+    const std::string& getLabel(int c) const { return _labels[c]; }
+    int getReductionFactor() const { return _reductionFactor; }
+    /** The number of levels, including the samples (level 0). */
+    int getNumLevels() const { return (int)_levels.size(); }
+    long long getNumRecords(int level) const;
+    /** The time of the first and of the last sample (NaN if there are no
+        samples). */
+    double getStartTime() const;
+    double getEndTime() const;
+
+    /** The finest level with at most maxPoints records overlapping
+        [startTime, endTime] (the top level, if none). */
+    int findLevel(double startTime, double endTime, int maxPoints) const;
+
+    /** Read the records of the given level that overlap [startTime,
+        endTime]. Level 0 is read as the samples, with the labels of the
+        channels as column labels. The records of a coarser level are read as
+        rows at their start time, with columns <label>_min, <label>_max and
+        <label>_mean for each channel. Returns the number of rows read. */
+    int read(int level, double startTime, double endTime,
+             Storage& result) const;
+
+    /** Read [startTime, endTime] at the finest level with at most maxPoints
+        records in the range (see findLevel()). Returns the level read. */
+    int readRange(double startTime, double endTime, int maxPoints,
+                  Storage& result) const;
+
+private:
+    struct LevelInfo {
+        long long offset;
+        long long numRecords;
+    };
+
+    int getRecordSize(int level) const;
+    // Read the ith value of record r of a level.
+    double readValue(int level, long long r, int i) const;
+    // The first record of a level whose end time is >= t (numRecords if
+    // none), and the first record whose start time is > t.
+    long long findFirstEndingAtOrAfter(int level, double t) const;
+    long long findFirstStartingAfter(int level, double t) const;
+    void checkLevel(int level) const;
+
+    std::string _fileName;
+    mutable std::ifstream _in;
+    std::vector<std::string> _labels;
+    int _reductionFactor;
+    std::vector<LevelInfo> _levels;
+};
+
+} // namespace OpenSim
+
+#endif // OPENSIM_MUSCLE_METABOLICS_INDEXED_RESULTS_H_
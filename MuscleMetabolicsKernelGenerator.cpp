@@ -0,0 +1,298 @@
+/* -------------------------------------------------------------------------- *
+ *                OpenSim:  MuscleMetabolicsKernelGenerator.cpp                *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsKernelGenerator.h"
+#include "UchidaUmberger2010MuscleMetabolicsProbe.h"
+#include "UchidaBhargava2004MuscleMetabolicsProbe.h"
+#include <OpenSim/Simulation/Model/Muscle.h>
+#include <cctype>
+#include <cstdio>
+#include <sstream>
+
+using namespace std;
+using namespace OpenSim;
+
+namespace {
+
+// Write a value as a C++ literal that is read back exactly.
+string literal(bool value)
+{
+    return value ? "true" : "false";
+}
+
+string literal(double value)
+{
+    if (!SimTK::isFinite(value)) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsKernelGenerator: " << value
+            << " cannot be written as a kernel constant." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    char buffer[32];
+    sprintf(buffer, "%.17g", value);
+    return buffer;
+}
+
+// Write the kernel settings and the muscle constants as assignments to the
+// members of 'settings' and 'mc'. The parameter hash is computed from the
+// same text, so that a kernel matches exactly the probes that would generate
+// it.
+void writeSettings(const UchidaUmberger2010MuscleMetabolicsKernel::Settings& s,
+                   const string& indent, ostream& out)
+{
+    out << indent << "settings.activation_maintenance_rate_on = "
+        << literal(s.activation_maintenance_rate_on) << ";\n"
+        << indent << "settings.shortening_rate_on = "
+        << literal(s.shortening_rate_on) << ";\n"
+        << indent << "settings.mechanical_work_rate_on = "
+        << literal(s.mechanical_work_rate_on) << ";\n"
+        << indent << "settings.enforce_minimum_heat_rate_per_muscle = "
+        << literal(s.enforce_minimum_heat_rate_per_muscle) << ";\n"
+        << indent << "settings.use_Bhargava_recruitment_model = "
+        << literal(s.use_Bhargava_recruitment_model) << ";\n"
+        << indent << "settings.include_negative_mechanical_work = "
+        << literal(s.include_negative_mechanical_work) << ";\n"
+        << indent << "settings.forbid_negative_total_power = "
+        << literal(s.forbid_negative_total_power) << ";\n"
+        << indent << "settings.fast_math = "
+        << literal(s.fast_math) << ";\n"
+        << indent << "settings.aerobic_factor = "
+        << literal(s.aerobic_factor) << ";\n"
+        << indent << "settings.muscle_effort_scaling_factor = "
+        << literal(s.muscle_effort_scaling_factor) << ";\n";
+}
+
+void writeSettings(const UchidaBhargava2004MuscleMetabolicsKernel::Settings& s,
+                   const string& indent, ostream& out)
+{
+    out << indent << "settings.activation_rate_on = "
+        << literal(s.activation_rate_on) << ";\n"
+        << indent << "settings.maintenance_rate_on = "
+        << literal(s.maintenance_rate_on) << ";\n"
+        << indent << "settings.shortening_rate_on = "
+        << literal(s.shortening_rate_on) << ";\n"
+        << indent << "settings.mechanical_work_rate_on = "
+        << literal(s.mechanical_work_rate_on) << ";\n"
+        << indent << "settings.enforce_minimum_heat_rate_per_muscle = "
+        << literal(s.enforce_minimum_heat_rate_per_muscle) << ";\n"
+        << indent << "settings.use_force_dependent_shortening_prop_constant = "
+        << literal(s.use_force_dependent_shortening_prop_constant) << ";\n"
+        << indent << "settings.include_negative_mechanical_work = "
+        << literal(s.include_negative_mechanical_work) << ";\n"
+        << indent << "settings.forbid_negative_total_power = "
+        << literal(s.forbid_negative_total_power) << ";\n"
+        << indent << "settings.fast_math = "
+        << literal(s.fast_math) << ";\n"
+        << indent << "settings.muscle_effort_scaling_factor = "
+        << literal(s.muscle_effort_scaling_factor) << ";\n";
+}
+
+void writeMuscleConstants(
+    const UchidaUmberger2010MuscleMetabolicsKernel::MuscleConstants& mc,
+    const string& indent, ostream& out)
+{
+    out << indent << "mc.muscle_mass = "
+        << literal(mc.muscle_mass) << ";\n"
+        << indent << "mc.ratio_slow_twitch_fibers = "
+        << literal(mc.ratio_slow_twitch_fibers) << ";\n"
+        << indent << "mc.max_contraction_velocity = "
+        << literal(mc.max_contraction_velocity) << ";\n"
+        << indent << "mc.optimal_fiber_length = "
+        << literal(mc.optimal_fiber_length) << ";\n";
+}
+
+void writeMuscleConstants(
+    const UchidaBhargava2004MuscleMetabolicsKernel::MuscleConstants& mc,
+    const string& indent, ostream& out)
+{
+    out << indent << "mc.muscle_mass = "
+        << literal(mc.muscle_mass) << ";\n"
+        << indent << "mc.ratio_slow_twitch_fibers = "
+        << literal(mc.ratio_slow_twitch_fibers) << ";\n"
+        << indent << "mc.activation_constant_slow_twitch = "
+        << literal(mc.activation_constant_slow_twitch) << ";\n"
+        << indent << "mc.activation_constant_fast_twitch = "
+        << literal(mc.activation_constant_fast_twitch) << ";\n"
+        << indent << "mc.maintenance_constant_slow_twitch = "
+        << literal(mc.maintenance_constant_slow_twitch) << ";\n"
+        << indent << "mc.maintenance_constant_fast_twitch = "
+        << literal(mc.maintenance_constant_fast_twitch) << ";\n"
+        << indent << "mc.max_isometric_force = "
+        << literal(mc.max_isometric_force) << ";\n";
+}
+
+// The name of the kernel class of a probe, e.g.,
+// UchidaUmberger2010MuscleMetabolicsKernel.
+template <class Probe>
+string getKernelClassName(const Probe& probe)
+{
+    const string probeClassName = probe.getConcreteClassName();
+    return probeClassName.substr(0, probeClassName.size() - 5) + "Kernel";
+}
+
+template <class Probe>
+string calcProbeParameterHash(const Probe& probe)
+{
+    stringstream text;
+    text << getKernelClassName(probe) << "\n";
+    writeSettings(probe.getKernelSettings(), "", text);
+    for (int i = 0; i < probe.getNumMetabolicMuscles(); ++i) {
+        text << "muscle " << i << "\n";
+        writeMuscleConstants(probe.getKernelMuscleConstants(i), "", text);
+    }
+
+    // 64-bit FNV-1a.
+    const string s = text.str();
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t k = 0; k < s.size(); ++k) {
+        hash ^= (unsigned char)s[k];
+        hash *= 1099511628211ULL;
+    }
+    char buffer[17];
+    sprintf(buffer, "%016llx", hash);
+    return buffer;
+}
+
+template <class Probe>
+void generateKernel(const Probe& probe, const string& className, ostream& out)
+{
+    bool validName = !className.empty() && !isdigit(className[0]);
+    for (size_t k = 0; k < className.size(); ++k)
+        validName = validName && (isalnum(className[k]) || className[k] == '_');
+    if (!validName) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsKernelGenerator: '" << className
+            << "' is not a valid class name for the kernel of '"
+            << probe.getName() << "'." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    const string kernelClassName = "OpenSim::" + getKernelClassName(probe);
+    const int nM = probe.getNumMetabolicMuscles();
+
+    out << "// Compiled kernel of the metabolics probe '" << probe.getName()
+        << "'\n"
+        << "// (" << probe.getConcreteClassName() << "), generated by\n"
+        << "// OpenSim::MuscleMetabolicsKernelGenerator. Do not edit: "
+           "regenerate this\n"
+        << "// file when the probe or its muscles change.\n"
+        << "#include \"MuscleMetabolicsCompiledKernel.h\"\n"
+        << "#include <OpenSim/Common/Exception.h>\n"
+        << "\n"
+        << "class " << className << "\n"
+        << "    : public OpenSim::MuscleMetabolicsCompiledKernel<\n"
+        << "          " << kernelClassName << "> {\n"
+        << "public:\n"
+        << "    typedef " << kernelClassName << " Kernel;\n"
+        << "\n"
+        << "    std::string getParameterHash() const\n"
+        << "    {\n"
+        << "        return \"" << calcProbeParameterHash(probe) << "\";\n"
+        << "    }\n"
+        << "\n"
+        << "    int getNumMuscles() const { return " << nM << "; }\n"
+        << "\n"
+        << "    void calcMuscleRates(int i, const MuscleInputs& in,\n"
+        << "                         MuscleRates& rates) const\n"
+        << "    {\n"
+        << "        switch (i) {\n";
+    for (int i = 0; i < nM; ++i)
+        out << "        case " << i << ": calcMuscleRates" << i
+            << "(in, rates); break;\n";
+    out << "        default: throw OpenSim::Exception(\"" << className
+        << ": muscle index out of range.\");\n"
+        << "        }\n"
+        << "    }\n"
+        << "\n"
+        << "    void calcMuscleRates(const MuscleInputs* in,\n"
+        << "                         MuscleRates* rates) const\n"
+        << "    {\n";
+    for (int i = 0; i < nM; ++i)
+        out << "        calcMuscleRates" << i << "(in[" << i << "], rates["
+            << i << "]);\n";
+    out << "    }\n"
+        << "\n"
+        << "private:\n"
+        << "    static Kernel::Settings getSettings()\n"
+        << "    {\n"
+        << "        Kernel::Settings settings;\n";
+    writeSettings(probe.getKernelSettings(), "        ", out);
+    out << "        return settings;\n"
+        << "    }\n";
+    for (int i = 0; i < nM; ++i) {
+        out << "\n"
+            << "    // " << probe.getMetabolicMuscle(i).getName() << "\n"
+            << "    static void calcMuscleRates" << i
+            << "(const MuscleInputs& in, MuscleRates& rates)\n"
+            << "    {\n"
+            << "        Kernel::MuscleConstants mc;\n";
+        writeMuscleConstants(probe.getKernelMuscleConstants(i), "        ", out);
+        out << "        Kernel::calcMuscleRates(getSettings(), mc, in, rates);\n"
+            << "    }\n";
+    }
+    out << "};\n"
+        << "\n"
+        << "namespace {\n"
+        << className << " " << className << "Instance;\n"
+        << "const OpenSim::MuscleMetabolicsCompiledKernelRegistration<\n"
+        << "    " << kernelClassName << ">\n"
+        << "    " << className << "Registration(" << className
+        << "Instance);\n"
+        << "} // namespace\n";
+}
+
+} // namespace
+
+
+//=============================================================================
+// GENERATION
+//=============================================================================
+void MuscleMetabolicsKernelGenerator::generate(
+    const UchidaUmberger2010MuscleMetabolicsProbe& probe,
+    const string& className, ostream& out)
+{
+    generateKernel(probe, className, out);
+}
+
+void MuscleMetabolicsKernelGenerator::generate(
+    const UchidaBhargava2004MuscleMetabolicsProbe& probe,
+    const string& className, ostream& out)
+{
+    generateKernel(probe, className, out);
+}
+
+string MuscleMetabolicsKernelGenerator::calcParameterHash(
+    const UchidaUmberger2010MuscleMetabolicsProbe& probe)
+{
+    return calcProbeParameterHash(probe);
+}
+
+string MuscleMetabolicsKernelGenerator::calcParameterHash(
+    const UchidaBhargava2004MuscleMetabolicsProbe& probe)
+{
+    return calcProbeParameterHash(probe);
+}
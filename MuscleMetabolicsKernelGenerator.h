@@ -0,0 +1,82 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_KERNEL_GENERATOR_H_
+#define OPENSIM_MUSCLE_METABOLICS_KERNEL_GENERATOR_H_
+/* -------------------------------------------------------------------------- *
+ *                OpenSim:  MuscleMetabolicsKernelGenerator.h                 *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include <iosfwd>
+#include <string>
+
+namespace OpenSim {
+
+class UchidaUmberger2010MuscleMetabolicsProbe;
+class UchidaBhargava2004MuscleMetabolicsProbe;
+
+//=============================================================================
+//            GENERATOR OF MODEL-SPECIFIC METABOLICS KERNELS
+//=============================================================================
+/**
+ * Generates the C++ source of a MuscleMetabolicsCompiledKernel for a
+ * connected metabolics probe: the probe's kernel settings and the constants
+ * of each of its muscles (see getKernelSettings() and
+ * getKernelMuscleConstants() in the probes) are written as literals, and the
+ * evaluation of all muscles is unrolled. The source registers the kernel when
+ * it is loaded; build it as a plugin with add_metabolics_kernel_plugin() in
+ * CMakeLists.txt, and load the plugin with the probes' plugin.
+ *
+ * The kernel is used by the probes whose 'use_compiled_kernel' property is
+ * true and whose parameter hash (see calcParameterHash()) matches the hash
+ * of the probe it was generated from, i.e., by probes with the same kernel
+ * settings and the same muscle constants, in the same order. A kernel is
+ * therefore specific to a model (the muscle masses depend on the muscles'
+ * properties) and must be regenerated when the probe or the muscles change;
+ * the probes fall back to the parameter set when no kernel matches.
+ *
+ * Example:
+ * @code
+ * model.initSystem();
+ * std::ofstream out("GaitMetabolicsKernel.cpp");
+ * MuscleMetabolicsKernelGenerator::generate(probe, "GaitMetabolicsKernel", out);
+ * @endcode
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsKernelGenerator {
+public:
+    /** Write the source of the compiled kernel of a connected probe to out.
+        className is the name of the generated class, which must be a valid
+        C++ identifier and unique within the plugin. */
+    static void generate(const UchidaUmberger2010MuscleMetabolicsProbe& probe,
+                         const std::string& className, std::ostream& out);
+    static void generate(const UchidaBhargava2004MuscleMetabolicsProbe& probe,
+                         const std::string& className, std::ostream& out);
+
+    /** The hash (64-bit FNV-1a, in hexadecimal) of the kernel settings and
+        the muscle constants of a connected probe, as written to the generated
+        source. */
+    static std::string calcParameterHash(
+        const UchidaUmberger2010MuscleMetabolicsProbe& probe);
+    static std::string calcParameterHash(
+        const UchidaBhargava2004MuscleMetabolicsProbe& probe);
+};
+
+} // namespace OpenSim
+
+#endif // OPENSIM_MUSCLE_METABOLICS_KERNEL_GENERATOR_H_
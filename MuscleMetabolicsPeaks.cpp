@@ -0,0 +1,105 @@
+/* -------------------------------------------------------------------------- *
+ *                    OpenSim:  MuscleMetabolicsPeaks.cpp                     *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsPeaks.h"
+#include <OpenSim/Common/Exception.h>
+#include <ostream>
+#include <sstream>
+
+using namespace std;
+using namespace SimTK;
+using namespace OpenSim;
+
+
+//=============================================================================
+// CONSTRUCTOR(S)
+//=============================================================================
+MuscleMetabolicsPeaks::MuscleMetabolicsPeaks()
+{
+    clear();
+}
+
+MuscleMetabolicsPeaks::MuscleMetabolicsPeaks(const Array<std::string>& labels)
+{
+    for (int c=0; c<labels.getSize(); ++c)
+        _labels.push_back(labels[c]);
+    clear();
+}
+
+void MuscleMetabolicsPeaks::clear()
+{
+    const int numChannels = getNumChannels();
+    _numSamples = 0;
+    _max.assign(numChannels, -Infinity);
+    _maxTime.assign(numChannels, NaN);
+    _min.assign(numChannels, Infinity);
+    _minTime.assign(numChannels, NaN);
+}
+
+
+//=============================================================================
+// TRACKING
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Update the peaks with the values of the channels at time t.
+ */
+void MuscleMetabolicsPeaks::update(double t, const Vector& values)
+{
+    if (values.size() != getNumChannels()) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsPeaks: a sample of "
+            << values.size() << " channel(s) at t = " << t << " cannot be "
+            "added to the peaks of " << getNumChannels() << " channel(s)."
+            << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    for (int c=0; c<getNumChannels(); ++c) {
+        if (values[c] > _max[c]) {
+            _max[c] = values[c];
+            _maxTime[c] = t;
+        }
+        if (values[c] < _min[c]) {
+            _min[c] = values[c];
+            _minTime[c] = t;
+        }
+    }
+    ++_numSamples;
+}
+
+//_____________________________________________________________________________
+/**
+ * Print a table with a row for each channel.
+ */
+void MuscleMetabolicsPeaks::print(std::ostream& out) const
+{
+    out << "channel\tnum_samples\tmax\tmax_time\tmin\tmin_time\n";
+    for (int c=0; c<getNumChannels(); ++c)
+        out << _labels[c] << "\t" << _numSamples << "\t" << getMax(c)
+            << "\t" << getMaxTime(c) << "\t" << getMin(c) << "\t"
+            << getMinTime(c) << "\n";
+}
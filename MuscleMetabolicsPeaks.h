@@ -0,0 +1,86 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_PEAKS_H_
+#define OPENSIM_MUSCLE_METABOLICS_PEAKS_H_
+/* -------------------------------------------------------------------------- *
+ *                     OpenSim:  MuscleMetabolicsPeaks.h                      *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include <OpenSim/Common/Array.h>
+#include <SimTKcommon.h>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace OpenSim {
+
+//=============================================================================
+//                PEAKS OF METABOLIC POWER AND THEIR TIMES
+//=============================================================================
+/**
+ * The maximum and minimum of each channel of a metabolics probe (e.g., TOTAL,
+ * BASAL and the metabolic power of each muscle) over a trial, and the times
+ * at which they first occurred, updated one state at a time. The values are
+ * kept in flat arrays of one entry per channel, owned by the probe: unlike
+ * the 'maximum' and 'maxabs' operations of a probe, which add a Measure (and
+ * its state) to the system for each column, the tracker adds nothing to the
+ * system and leaves the probe's own output unchanged.
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsPeaks {
+public:
+    /** Peaks of no channels. */
+    MuscleMetabolicsPeaks();
+
+    /** Empty peaks of the channels with the given labels. */
+    explicit MuscleMetabolicsPeaks(const Array<std::string>& labels);
+
+    /** Update the peaks with the values of the channels at time t. A value
+        equal to the current peak does not move its time. */
+    void update(double t, const SimTK::Vector& values);
+
+    /** Discard the samples. */
+    void clear();
+
+    int getNumChannels() const { return (int)_labels.size(); }
+    const std::string& getLabel(int c) const { return _labels[c]; }
+    int getNumSamples() const { return _numSamples; }
+
+    /** The maximum of channel c (-Infinity before the first sample). */
+    double getMax(int c) const { return _max[c]; }
+    /** The time of the maximum of channel c (NaN before the first sample). */
+    double getMaxTime(int c) const { return _maxTime[c]; }
+    /** The minimum of channel c (Infinity before the first sample). */
+    double getMin(int c) const { return _min[c]; }
+    /** The time of the minimum of channel c (NaN before the first sample). */
+    double getMinTime(int c) const { return _minTime[c]; }
+
+    /** Print a table with a row for each channel: label, number of samples,
+        maximum, time of the maximum, minimum and time of the minimum. */
+    void print(std::ostream& out) const;
+
+private:
+    std::vector<std::string> _labels;
+    int _numSamples;
+    std::vector<double> _max, _maxTime, _min, _minTime;
+};
+
+} // namespace OpenSim
+
+#endif // OPENSIM_MUSCLE_METABOLICS_PEAKS_H_
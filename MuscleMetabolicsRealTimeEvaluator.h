@@ -0,0 +1,129 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_REAL_TIME_EVALUATOR_H_
+#define OPENSIM_MUSCLE_METABOLICS_REAL_TIME_EVALUATOR_H_
+/* -------------------------------------------------------------------------- *
+ *              OpenSim:  MuscleMetabolicsRealTimeEvaluator.h                 *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <SimTKcommon/Scalar.h>
+#include <vector>
+
+namespace OpenSim {
+
+//=============================================================================
+//               REAL-TIME EVALUATOR OF THE METABOLICS KERNELS
+//=============================================================================
+/**
+ * The real-time profile of the metabolics probes, for embedded and
+ * online-feedback use. An evaluator is a snapshot of the settings, muscle
+ * constants and basal rate of a probe (see createRealTimeEvaluator() in the
+ * probes), and evaluates the probe's per-muscle kernel from muscle inputs
+ * supplied by the caller (e.g., from sensors or a state estimator) rather
+ * than from a State.
+ *
+ * Setup (construction, addMuscle(), copying) may allocate. The evaluation
+ * path, calcMetabolicRates(), performs no heap allocation, no I/O and no
+ * locking, and does not throw. Its execution time is bounded: it makes one
+ * pass over the muscles, and the kernels contain no loops and evaluate a
+ * fixed number of sin, cos and pow calls per muscle. With 'fast_math'
+ * enabled on the probe, these calls are polynomials for excitations and
+ * activations in [0,1] (see MuscleMetabolicsFastMath.h), which removes the
+ * data-dependent execution time of the library functions.
+ *
+ * Errors that the probes report by printing a warning are instead reported
+ * through the return value of calcMetabolicRates(): a muscle whose metabolic
+ * rate is not finite is reported as NaN in its own output, excluded from the
+ * TOTAL, and counted.
+ *
+ * Kernel is UchidaUmberger2010MuscleMetabolicsKernel or
+ * UchidaBhargava2004MuscleMetabolicsKernel.
+ */
+template <class Kernel>
+class MuscleMetabolicsRealTimeEvaluator {
+public:
+    typedef typename Kernel::Settings Settings;
+    typedef typename Kernel::MuscleConstants MuscleConstants;
+    typedef typename Kernel::template MuscleInputs<double> MuscleInputs;
+    typedef typename Kernel::template MuscleRates<double> MuscleRates;
+
+    //--------------------------------------------------------------------------
+    // Setup
+    //--------------------------------------------------------------------------
+    MuscleMetabolicsRealTimeEvaluator(const Settings& settings,
+                                      double basalRate)
+    :   _settings(settings), _basalRate(basalRate) {}
+
+    /** Append a muscle; its inputs are at the same index in the inputs
+        passed to calcMetabolicRates(). */
+    void addMuscle(const MuscleConstants& mc) { _muscles.push_back(mc); }
+
+    /** Get the number of muscles. */
+    int getNumMuscles() const { return (int)_muscles.size(); }
+
+    /** Get the number of outputs of calcMetabolicRates(): TOTAL, BASAL and
+        one for each muscle, as reported by the probes. */
+    int getNumOutputs() const { return getNumMuscles() + 2; }
+
+    const Settings& getSettings() const { return _settings; }
+    double getBasalRate() const { return _basalRate; }
+
+    //--------------------------------------------------------------------------
+    // Evaluation
+    //--------------------------------------------------------------------------
+    /** Evaluate the metabolic rates (W) from the inputs of each muscle
+        (getNumMuscles() entries), and write TOTAL, BASAL and the rate of each
+        muscle to outputs (getNumOutputs() entries). Returns the number of
+        muscles whose rate was not finite. */
+    int calcMetabolicRates(const MuscleInputs* inputs, double* outputs) const
+    {
+        const int numMuscles = getNumMuscles();
+        int numInvalid = 0;
+        double total = _basalRate;
+        for (int i=0; i<numMuscles; ++i) {
+            MuscleRates rates;
+            Kernel::calcMuscleRates(_settings, _muscles[i], inputs[i], rates);
+            if (SimTK::isFinite(rates.Edot))
+                total += rates.Edot;
+            else {
+                rates.Edot = SimTK::NaN;
+                ++numInvalid;
+            }
+            outputs[i+2] = rates.Edot;
+        }
+        outputs[0] = total;
+        outputs[1] = _basalRate;
+        return numInvalid;
+    }
+
+private:
+    //=============================================================================
+    // DATA
+    //=============================================================================
+    Settings _settings;
+    double _basalRate;
+    std::vector<MuscleConstants> _muscles;
+
+//=============================================================================
+};  // END of class MuscleMetabolicsRealTimeEvaluator
+//=============================================================================
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_REAL_TIME_EVALUATOR_H_
@@ -0,0 +1,64 @@
+/* -------------------------------------------------------------------------- *
+ *                OpenSim:  MuscleMetabolicsReportedProbe.cpp                 *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsReportedProbe.h"
+
+using namespace OpenSim;
+
+
+//=============================================================================
+// RECORDING
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Record the given state, as enabled by the options of the probe.
+ */
+void MuscleMetabolicsReportedProbe::recordReports(const SimTK::State& s)
+{
+    if (isDeferred())
+        recordDeferredInputs(s);
+    else if (hasSummaryStatistics() || hasPeakTracking())
+        reportInputs(s.getTime(), computeProbeInputs(s));
+    if (hasParameterSensitivity())
+        accumulateSensitivity(s);
+}
+
+void MuscleMetabolicsReportedProbe::reportInputs(double time,
+                                                 const SimTK::Vector& inputs)
+{
+    if (hasSummaryStatistics())
+        accumulateStatistics(time, inputs);
+    if (hasPeakTracking())
+        updatePeaks(time, inputs);
+}
+
+void MuscleMetabolicsReportedProbe::clearReports()
+{
+    clearDeferredInputs();
+    clearStatistics();
+    clearPeaks();
+    clearSensitivity();
+}
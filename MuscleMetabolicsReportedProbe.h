@@ -0,0 +1,178 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_REPORTED_PROBE_H_
+#define OPENSIM_MUSCLE_METABOLICS_REPORTED_PROBE_H_
+/* -------------------------------------------------------------------------- *
+ *                 OpenSim:  MuscleMetabolicsReportedProbe.h                  *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include <OpenSim/Common/Storage.h>
+#include <SimTKcommon.h>
+#include <vector>
+
+namespace OpenSim {
+
+class MuscleMetabolicsStatistics;
+class MuscleMetabolicsPeaks;
+class MuscleMetabolicsSensitivity;
+
+//=============================================================================
+//           REPORTER-FACING INTERFACE OF A METABOLICS PROBE
+//=============================================================================
+/**
+ * The hooks through which a MuscleMetabolicsDeferredReporter records and
+ * reports a metabolics probe (UchidaUmberger2010MuscleMetabolicsProbe or
+ * UchidaBhargava2004MuscleMetabolicsProbe), so that the reporter finds the
+ * probes of a model with a single cast and treats them alike.
+ *
+ * The options are the properties of the probe of the same name
+ * ('deferred_evaluation', 'summary_statistics', 'peak_tracking' and
+ * 'parameter_sensitivity'). recordReports() and clearReports() apply them
+ * at each recorded state and at the beginning of a simulation; the other
+ * methods are implemented by the probes (see their headers).
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsReportedProbe {
+public:
+    virtual ~MuscleMetabolicsReportedProbe() {}
+
+    //--------------------------------------------------------------------------
+    // Options
+    //--------------------------------------------------------------------------
+    virtual bool isDeferred() const = 0;
+    virtual bool hasSummaryStatistics() const = 0;
+    virtual bool hasPeakTracking() const = 0;
+    virtual bool hasParameterSensitivity() const = 0;
+
+    //--------------------------------------------------------------------------
+    // Recording
+    //--------------------------------------------------------------------------
+    /** Record the given state, which must be realized to Stage::Dynamics,
+        as enabled by the options: the inputs of a deferred probe, the
+        sensitivity, and the statistics and peaks of a probe that is not
+        deferred, from a single call to computeProbeInputs(). The statistics
+        and peaks of a deferred probe are those of its computed outputs (see
+        reportInputs()). */
+    void recordReports(const SimTK::State& s);
+
+    /** Add the probe inputs at the given time to the statistics and the
+        peaks, as enabled by the options. Called by recordReports(), and by
+        the DeferredBlock of a deferred probe as it computes its records. */
+    void reportInputs(double time, const SimTK::Vector& inputs);
+
+    /** Discard the recorded inputs, statistics, peaks and sensitivity. */
+    void clearReports();
+
+    //--------------------------------------------------------------------------
+    // Deferred evaluation
+    //--------------------------------------------------------------------------
+    /** The records of a deferred probe, exchanged with the probe's records
+        and computed as a block, e.g., on a worker thread while the next
+        records are gathered (see MuscleMetabolicsDeferredReporter). */
+    class DeferredBlock {
+    public:
+        virtual ~DeferredBlock() {}
+
+        /** Exchange the records of the probe with the block, and clear the
+            records of the probe (the previous block). The block must not be
+            being computed. */
+        virtual void swapRecords() = 0;
+
+        /** Compute the probe inputs of the records of the block, and report
+            them to the statistics and peaks of the probe. */
+        virtual void computeBlock() = 0;
+
+        /** Compute the probe outputs from the probe inputs of all blocks
+            computed so far. */
+        virtual Storage computeResults() const = 0;
+    };
+
+    /** Create a block for the records of this probe, to be deleted by the
+        caller. */
+    virtual DeferredBlock* createDeferredBlock() = 0;
+
+    virtual SimTK::Vector computeProbeInputs(const SimTK::State& s) const = 0;
+
+    virtual void recordDeferredInputs(const SimTK::State& s) = 0;
+    virtual void clearDeferredInputs() = 0;
+
+    //--------------------------------------------------------------------------
+    // Reports
+    //--------------------------------------------------------------------------
+    virtual bool isSampled() const = 0;
+    virtual void setSampledResults(Storage* results) = 0;
+
+    virtual void accumulateStatistics(double time,
+                                      const SimTK::Vector& inputs) = 0;
+    virtual const MuscleMetabolicsStatistics& getStatistics() const = 0;
+    virtual void clearStatistics() = 0;
+
+    virtual void updatePeaks(double time, const SimTK::Vector& inputs) = 0;
+    virtual const MuscleMetabolicsPeaks& getPeaks() const = 0;
+    virtual void clearPeaks() = 0;
+
+    virtual void accumulateSensitivity(const SimTK::State& s) = 0;
+    virtual const MuscleMetabolicsSensitivity& getSensitivity() const = 0;
+    virtual void clearSensitivity() = 0;
+};
+
+//=============================================================================
+//                  DEFERRED BLOCK OF A METABOLICS PROBE
+//=============================================================================
+/**
+ * The DeferredBlock of a probe with DeferredRecords, swapDeferredInputs(),
+ * calcDeferredOutputs() and computeDeferredResults(times, outputs), as the
+ * metabolics probes have. The probes return it from createDeferredBlock().
+ */
+template <class Probe>
+class MuscleMetabolicsDeferredBlock
+    : public MuscleMetabolicsReportedProbe::DeferredBlock {
+public:
+    explicit MuscleMetabolicsDeferredBlock(Probe& probe) : _probe(probe) {}
+
+    void swapRecords() OVERRIDE_11
+    {
+        _probe.swapDeferredInputs(_block);
+        _probe.clearDeferredInputs();
+    }
+
+    void computeBlock() OVERRIDE_11
+    {
+        const size_t first = _outputs.size();
+        _probe.calcDeferredOutputs(_block, _outputs);
+        for (size_t k=first; k<_outputs.size(); ++k)
+            _probe.reportInputs(_block.times[k-first], _outputs[k]);
+        _times.insert(_times.end(), _block.times.begin(), _block.times.end());
+    }
+
+    Storage computeResults() const OVERRIDE_11
+    {
+        return _probe.computeDeferredResults(_times, _outputs);
+    }
+
+private:
+    Probe& _probe;
+    typename Probe::DeferredRecords _block;
+    std::vector<double> _times;
+    std::vector<SimTK::Vector> _outputs;
+};
+
+} // namespace OpenSim
+
+#endif // OPENSIM_MUSCLE_METABOLICS_REPORTED_PROBE_H_
@@ -0,0 +1,61 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_SAMPLER_H_
+#define OPENSIM_MUSCLE_METABOLICS_SAMPLER_H_
+/* -------------------------------------------------------------------------- *
+ *                    OpenSim:  MuscleMetabolicsSampler.h                     *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+#include <SimTKcommon/internal/EventReporter.h>
+
+namespace OpenSim {
+
+//=============================================================================
+//                   PERIODIC SAMPLER OF A METABOLICS PROBE
+//=============================================================================
+/**
+ * An event reporter that records a sample of a metabolics probe at a fixed
+ * interval of simulation time (see 'sampling_rate' and recordSample() in the
+ * probes). The probes add it to the System in addToSystem(). Because the
+ * samples are event-triggered, the integrator reports the state at each
+ * sample time (interpolated, without shortening its steps), so the samples
+ * do not depend on the integrator's step pattern.
+ *
+ * Probe is UchidaUmberger2010MuscleMetabolicsProbe or
+ * UchidaBhargava2004MuscleMetabolicsProbe.
+ */
+template <class Probe>
+class MuscleMetabolicsSampler : public SimTK::PeriodicEventReporter {
+public:
+    MuscleMetabolicsSampler(const Probe& probe, double interval)
+    :   SimTK::PeriodicEventReporter(interval), _probe(probe) {}
+
+    void handleEvent(const SimTK::State& s) const OVERRIDE_11
+    {
+        _probe.recordSample(s);
+    }
+
+private:
+    const Probe& _probe;
+};
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_SAMPLER_H_
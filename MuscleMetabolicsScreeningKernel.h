@@ -0,0 +1,150 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_SCREENING_KERNEL_H_
+#define OPENSIM_MUSCLE_METABOLICS_SCREENING_KERNEL_H_
+/* -------------------------------------------------------------------------- *
+ *                OpenSim:  MuscleMetabolicsScreeningKernel.h                 *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+namespace OpenSim {
+
+//=============================================================================
+//          PER-MUSCLE KERNEL OF MuscleMetabolicsScreeningProbe
+//=============================================================================
+/**
+ * The per-muscle computation of MuscleMetabolicsScreeningProbe: an
+ * activation cost, proportional to the squared activation, and the positive
+ * mechanical work rate of the contractile element divided by an efficiency.
+ * It has the same structure as the kernels of the Umberger and Bhargava
+ * probes, so that it can be evaluated by a MuscleMetabolicsRealTimeEvaluator
+ * and differentiated with MuscleMetabolicsDual, but it needs only the
+ * activation, fiber velocity and active fiber force of a muscle, and contains
+ * no transcendental functions.
+ *
+ * The kernel performs no I/O and no heap allocation; NaN checking and
+ * warnings remain the responsibility of the caller.
+ */
+class MuscleMetabolicsScreeningKernel {
+public:
+    /** Probe-wide settings, taken from the properties of the probe. The
+        coefficients are of type P: double, or MuscleMetabolicsDual to
+        differentiate the rates with respect to one of them (see
+        convert()). */
+    template <class P>
+    struct BasicSettings {
+        bool activation_rate_on;
+        bool mechanical_work_rate_on;
+        P activation_coefficient;           // (W/kg)
+        P positive_work_efficiency;
+    };
+    typedef BasicSettings<double> Settings;
+
+    /** Constant parameters of a single muscle, of type P (see
+        BasicSettings). */
+    template <class P>
+    struct BasicMuscleConstants {
+        P muscle_mass;                      // (kg)
+    };
+    typedef BasicMuscleConstants<double> MuscleConstants;
+
+    /** State-dependent inputs of a single muscle. */
+    template <class T>
+    struct MuscleInputs {
+        T activation;
+        T fiber_velocity;                   // (m/s)
+        T active_fiber_force;               // (N)
+    };
+
+    /** Activation rate and positive mechanical work rate (W/kg), and total
+        metabolic rate (W) of a single muscle. */
+    template <class T>
+    struct MuscleRates {
+        T Adot;
+        T Wdot;
+        T Edot;
+    };
+
+    /** Convert muscle inputs to another scalar type. */
+    template <class T, class U>
+    static void convert(const MuscleInputs<U>& from, MuscleInputs<T>& to)
+    {
+        to.activation = T(from.activation);
+        to.fiber_velocity = T(from.fiber_velocity);
+        to.active_fiber_force = T(from.active_fiber_force);
+    }
+
+    /** Convert muscle rates to another scalar type. */
+    template <class T, class U>
+    static void convert(const MuscleRates<U>& from, MuscleRates<T>& to)
+    {
+        to.Adot = T(from.Adot);
+        to.Wdot = T(from.Wdot);
+        to.Edot = T(from.Edot);
+    }
+
+    /** Convert settings to another coefficient type. */
+    template <class P, class Q>
+    static void convert(const BasicSettings<Q>& from, BasicSettings<P>& to)
+    {
+        to.activation_rate_on = from.activation_rate_on;
+        to.mechanical_work_rate_on = from.mechanical_work_rate_on;
+        to.activation_coefficient = P(from.activation_coefficient);
+        to.positive_work_efficiency = P(from.positive_work_efficiency);
+    }
+
+    /** Convert muscle constants to another coefficient type. */
+    template <class P, class Q>
+    static void convert(const BasicMuscleConstants<Q>& from,
+                        BasicMuscleConstants<P>& to)
+    {
+        to.muscle_mass = P(from.muscle_mass);
+    }
+
+    /** Evaluate the metabolic rate of a single muscle. */
+    template <class T, class P>
+    static void calcMuscleRates(const BasicSettings<P>& settings,
+                                const BasicMuscleConstants<P>& mc,
+                                const MuscleInputs<T>& in,
+                                MuscleRates<T>& out)
+    {
+        const T mass = T(mc.muscle_mass);
+
+        // ACTIVATION RATE (W/kg)
+        T Adot = T(0);
+        if (settings.activation_rate_on)
+            Adot = T(settings.activation_coefficient)
+                   * in.activation * in.activation;
+
+        // POSITIVE MECHANICAL WORK RATE of the contractile element (W/kg)
+        // --> note that we define Vm<0 as shortening and Vm>0 as lengthening
+        T Wdot = T(0);
+        if (settings.mechanical_work_rate_on
+            && in.active_fiber_force > T(0) && in.fiber_velocity < T(0))
+            Wdot = -in.active_fiber_force * in.fiber_velocity / mass;
+
+        // TOTAL METABOLIC ENERGY RATE (W)
+        out.Adot = Adot;
+        out.Wdot = Wdot;
+        out.Edot = mass * (Adot + Wdot / T(settings.positive_work_efficiency));
+    }
+};
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_SCREENING_KERNEL_H_
@@ -0,0 +1,674 @@
+/* -------------------------------------------------------------------------- *
+ *                OpenSim:  MuscleMetabolicsScreeningProbe.cpp                *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsScreeningProbe.h"
+#include "MuscleMetabolicsDual.h"
+#include <OpenSim/Simulation/Model/Muscle.h>
+
+using namespace std;
+using namespace SimTK;
+using namespace OpenSim;
+
+
+//=============================================================================
+// CONSTRUCTOR(S) AND SETUP
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Default constructor.
+ */
+MuscleMetabolicsScreeningProbe::MuscleMetabolicsScreeningProbe() : Probe()
+{
+    setNull();
+    constructProperties();
+}
+
+//_____________________________________________________________________________
+/**
+ * Convenience constructor
+ */
+MuscleMetabolicsScreeningProbe::MuscleMetabolicsScreeningProbe(
+    const bool activation_rate_on,
+    const bool work_rate_on,
+    const bool basal_rate_on) : Probe()
+{
+    setNull();
+    constructProperties();
+
+    set_activation_rate_on(activation_rate_on);
+    set_mechanical_work_rate_on(work_rate_on);
+    set_basal_rate_on(basal_rate_on);
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Set the data members of this MuscleMetabolicsScreeningProbe to their null
+ * values.
+ */
+void MuscleMetabolicsScreeningProbe::setNull()
+{
+    _muscleMap.clear();
+}
+
+//_____________________________________________________________________________
+/**
+ * Construct and initilize object properties.
+ */
+void MuscleMetabolicsScreeningProbe::constructProperties()
+{
+    constructProperty_activation_rate_on(true);
+    constructProperty_mechanical_work_rate_on(true);
+    constructProperty_basal_rate_on(true);
+    constructProperty_activation_coefficient(100.0);
+    constructProperty_positive_work_efficiency(0.25);
+    constructProperty_basal_coefficient(1.2);   // As in UchidaUmberger2010MuscleMetabolicsProbe.
+    constructProperty_basal_exponent(1.0);
+    constructProperty_report_total_metabolics_only(true);
+    constructProperty_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet
+       (UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet());
+}
+
+
+
+
+//=============================================================================
+// MODEL COMPONENT METHODS
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Perform some set up functions that happen after the
+ * object has been deserialized or copied.
+ *
+ * @param aModel OpenSim model containing this MuscleMetabolicsScreeningProbe.
+ */
+void MuscleMetabolicsScreeningProbe::connectToModel(Model& aModel)
+{
+    Super::connectToModel(aModel);
+    if (isDisabled()) return;   // Nothing to connect
+
+    _muscleMap.clear();
+    const int nM =
+        get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet().getSize();
+    for (int i=0; i<nM; ++i) {
+        connectIndividualMetabolicMuscle(aModel,
+            upd_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]);
+    }
+
+    if (!(get_positive_work_efficiency() > 0)) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": '" << getName()
+            << "' has <positive_work_efficiency> "
+            << get_positive_work_efficiency() << ", which must be positive."
+            << endl;
+        throw (Exception(errorMessage.str()));
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Connect an individual metabolic muscle to the model, and set its mass, as
+ * in UchidaUmberger2010MuscleMetabolicsProbe.
+ */
+void MuscleMetabolicsScreeningProbe::connectIndividualMetabolicMuscle(
+    Model& aModel,
+    UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter& mm)
+{
+    stringstream errorMessage;
+
+    int k = aModel.getMuscles().getIndex(mm.getName());
+    if( k < 0 )	{
+        cout << "WARNING: MuscleMetabolicsScreeningProbe: "
+            "Muscle '" << mm.getName() << "' not found in model. Ignoring..." << endl;
+        setDisabled(true);
+        return;
+    }
+    else {
+        mm.setMuscle(&aModel.updMuscles()[k]);  // Set internal muscle pointer
+        _muscleMap[mm.getName()] = &mm;         // Add parameters to the _muscleMap
+    }
+
+    // -----------------------------------------------------------------------
+    // Check the properties from which the muscle mass is set.
+    // -----------------------------------------------------------------------
+    if (mm.get_use_provided_muscle_mass()) {
+        if (!(mm.get_provided_muscle_mass() > 0)) {
+            errorMessage << "ERROR: Invalid <provided_muscle_mass> specified for "
+                << mm.getName()
+                << ". <provided_muscle_mass> must be a positive number (kg)." << endl;
+            std::cout << "WARNING: " << errorMessage.str() << "Probe will be disabled." << std::endl;
+            setDisabled(true);
+        }
+    }
+    else {
+        if (mm.get_specific_tension() <= 0) {
+            errorMessage << "ERROR: Negative <specific_tension> specified for "
+                << mm.getName()
+                << ". <specific_tension> must be a positive number (N/m^2)." << endl;
+            std::cout << "WARNING: " << errorMessage.str() << "Probe will be disabled." << std::endl;
+            setDisabled(true);
+        }
+        if (mm.get_density() <= 0) {
+            errorMessage << "ERROR: Negative <density> specified for "
+                << mm.getName()
+                << ". <density> must be a positive number (kg/m^3)." << endl;
+            std::cout << "WARNING: " << errorMessage.str() << "Probe will be disabled." << std::endl;
+            setDisabled(true);
+        }
+    }
+
+    // -----------------------------------------------------------------------
+    // Set the mass used for this muscle.
+    // -----------------------------------------------------------------------
+    mm.setMuscleMass();
+}
+
+
+
+
+//=============================================================================
+// COMPUTATION
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Compute muscle metabolic power.
+ * Units = W.
+ * Note: for muscle velocities, Vm, we define Vm<0 as shortening and Vm>0 as lengthening.
+ */
+SimTK::Vector MuscleMetabolicsScreeningProbe::computeProbeInputs(const State& s) const
+{
+    Vector EdotOutput(getNumProbeInputs());
+    EdotOutput = 0;
+
+    // BASAL METABOLIC RATE (W) (based on whole body mass, not muscle mass)
+    const double Bdot = calcBasalRate(s);
+    if (isNaN(Bdot))
+        cout << "WARNING::" << getName() << ": Bdot = NaN!" << endl;
+    EdotOutput(0) += Bdot;       // TOTAL metabolic power storage
+    if (!get_report_total_metabolics_only())
+        EdotOutput(1) = Bdot;    // BASAL metabolic power storage
+
+    const Kernel::Settings settings = getKernelSettings();
+    for (int i=0; i<getNumMetabolicMuscles(); ++i) {
+        Kernel::MuscleInputs<double> in;
+        gatherMuscleInputs(s, i, in);
+        Kernel::MuscleRates<double> rates;
+        Kernel::calcMuscleRates(settings, getKernelMuscleConstants(i), in,
+                                rates);
+        if (isNaN(rates.Edot))
+            cout << "WARNING::" << getName() << ": Edot ("
+                 << getMetabolicMuscle(i).getName() << ") = NaN!" << endl;
+
+        EdotOutput(0) += rates.Edot;     // Add to TOTAL metabolic power storage
+        if (!get_report_total_metabolics_only())
+            EdotOutput(i+2) = rates.Edot;
+    }
+    return EdotOutput;
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: The basal metabolic rate (W) at the given state.
+ */
+double MuscleMetabolicsScreeningProbe::calcBasalRate(const State& s) const
+{
+    if (!get_basal_rate_on())
+        return 0;
+    return get_basal_coefficient()
+        * pow(_model->getMatterSubsystem().calcSystemMass(s), get_basal_exponent());
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the probe-wide settings used by the per-muscle kernel.
+ */
+MuscleMetabolicsScreeningKernel::Settings
+    MuscleMetabolicsScreeningProbe::getKernelSettings() const
+{
+    Kernel::Settings settings;
+    settings.activation_rate_on = get_activation_rate_on();
+    settings.mechanical_work_rate_on = get_mechanical_work_rate_on();
+    settings.activation_coefficient = get_activation_coefficient();
+    settings.positive_work_efficiency = get_positive_work_efficiency();
+    return settings;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the constant parameters of muscle i used by the per-muscle kernel.
+ */
+MuscleMetabolicsScreeningKernel::MuscleConstants
+    MuscleMetabolicsScreeningProbe::getKernelMuscleConstants(int i) const
+{
+    Kernel::MuscleConstants mc;
+    mc.muscle_mass =
+        get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+        .getMuscleMass();
+    return mc;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get muscle i of the MetabolicMuscleParameterSet.
+ */
+const Muscle& MuscleMetabolicsScreeningProbe::getMetabolicMuscle(int i) const
+{
+    return *get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+        .getMuscle();
+}
+
+//_____________________________________________________________________________
+/**
+ * Gather the state-dependent inputs of muscle i used by the per-muscle kernel.
+ * The active fiber force is computed from the multipliers of the muscle
+ * rather than obtained from getActiveFiberForce(), which requires the state
+ * to be realized to Stage::Dynamics.
+ */
+void MuscleMetabolicsScreeningProbe::gatherMuscleInputs(
+    const State& s, int i, Kernel::MuscleInputs<double>& in) const
+{
+    const Muscle& m = getMetabolicMuscle(i);
+
+    in.activation = m.getActivation(s);
+    in.fiber_velocity = m.getFiberVelocity(s);
+    in.active_fiber_force = in.activation
+        * m.getActiveForceLengthMultiplier(s)
+        * m.getForceVelocityMultiplier(s)
+        * m.getMaxIsometricForce();
+}
+
+//_____________________________________________________________________________
+/**
+ * Create a real-time evaluator from the current properties of the probe.
+ */
+MuscleMetabolicsScreeningProbe::RealTimeEvaluator
+    MuscleMetabolicsScreeningProbe::createRealTimeEvaluator(const State& s) const
+{
+    RealTimeEvaluator evaluator(getKernelSettings(), calcBasalRate(s));
+    for (int i=0; i<getNumMetabolicMuscles(); ++i)
+        evaluator.addMuscle(getKernelMuscleConstants(i));
+    return evaluator;
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Returns the number of probe inputs in the vector returned by computeProbeInputs().
+ * If report_total_metabolics_only = true, then only the TOTAL metabolics will be
+ * calculated. If report_total_metabolics_only = false, then the calculation will
+ * consist of a TOTAL value, a BASAL value, and each individual muscle
+ * contribution.
+ */
+int MuscleMetabolicsScreeningProbe::getNumProbeInputs() const
+{
+    if (get_report_total_metabolics_only())
+        return 1;
+    else
+        return 2 + getNumMetabolicMuscles();
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Provide labels for the probe values being reported, as
+ * getNumProbeInputs().
+ */
+Array<string> MuscleMetabolicsScreeningProbe::getProbeOutputLabels() const
+{
+    Array<string> labels;
+    labels.append(getName()+"_TOTAL");
+
+    if (get_report_total_metabolics_only())
+        return labels;
+
+    labels.append(getName()+"_BASAL");
+
+    for (int i=0; i<getNumMetabolicMuscles(); ++i)
+        labels.append(getName()+"_"+get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i].getName());
+
+    return labels;
+}
+
+
+
+
+//=============================================================================
+// PARAMETER SENSITIVITY
+//=============================================================================
+Array<string> MuscleMetabolicsScreeningProbe::getSensitivityParameterNames() const
+{
+    static const char* globalNames[NumGlobalSensitivityParameters] = {
+        "activation_coefficient", "positive_work_efficiency",
+        "basal_coefficient", "basal_exponent" };
+    static const char* muscleNames[NumMuscleSensitivityParameters] = {
+        "specific_tension", "density", "provided_muscle_mass" };
+
+    Array<string> names;
+    for (int k=0; k<NumGlobalSensitivityParameters; ++k)
+        names.append(globalNames[k]);
+    const UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet& mms =
+        get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet();
+    for (int i=0; i<mms.getSize(); ++i)
+        for (int k=0; k<NumMuscleSensitivityParameters; ++k)
+            names.append(mms[i].getName() + "." + muscleNames[k]);
+    return names;
+}
+
+Vector MuscleMetabolicsScreeningProbe::getSensitivityParameterValues() const
+{
+    const UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet& mms =
+        get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet();
+    Vector values(NumGlobalSensitivityParameters
+                  + NumMuscleSensitivityParameters*mms.getSize());
+    values[0] = get_activation_coefficient();
+    values[1] = get_positive_work_efficiency();
+    values[2] = get_basal_coefficient();
+    values[3] = get_basal_exponent();
+    for (int i=0; i<mms.getSize(); ++i) {
+        const int j = NumGlobalSensitivityParameters
+                      + NumMuscleSensitivityParameters*i;
+        values[j] = mms[i].get_specific_tension();
+        values[j+1] = mms[i].get_density();
+        values[j+2] = mms[i].get_provided_muscle_mass();
+    }
+    return values;
+}
+
+//_____________________________________________________________________________
+/**
+ * Evaluate the total metabolic power and its partial derivatives. The
+ * derivatives of the basal rate are analytic; those of each muscle are
+ * propagated through the kernel with MuscleMetabolicsDual, seeding the
+ * activation coefficient, the efficiency and the muscle mass one at a time.
+ */
+double MuscleMetabolicsScreeningProbe::calcParameterSensitivity(
+    const State& s, Vector& derivatives) const
+{
+    typedef MuscleMetabolicsDual Dual;
+    const int nM = getNumMetabolicMuscles();
+    derivatives.resize(NumGlobalSensitivityParameters
+                       + NumMuscleSensitivityParameters*nM);
+    derivatives = 0;
+
+    double total = 0;
+    if (get_basal_rate_on()) {
+        const double mass = _model->getMatterSubsystem().calcSystemMass(s);
+        const double massTerm = pow(mass, get_basal_exponent());
+        total = get_basal_coefficient()*massTerm;
+        derivatives[2] = massTerm;
+        derivatives[3] = total*log(mass);
+    }
+
+    Kernel::BasicSettings<Dual> settings;
+    Kernel::convert(getKernelSettings(), settings);
+    for (int i=0; i<nM; ++i) {
+        const UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter& mm =
+            get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i];
+        Kernel::MuscleInputs<double> inDouble;
+        gatherMuscleInputs(s, i, inDouble);
+        Kernel::MuscleInputs<Dual> in;
+        Kernel::convert(inDouble, in);
+        Kernel::BasicMuscleConstants<Dual> mc;
+        Kernel::convert(getKernelMuscleConstants(i), mc);
+
+        Dual* seeds[] = { &settings.activation_coefficient,
+            &settings.positive_work_efficiency, &mc.muscle_mass };
+        const int numSeeds = sizeof(seeds)/sizeof(seeds[0]);
+        double dEdot[numSeeds];
+        for (int k=0; k<numSeeds; ++k) {
+            seeds[k]->derivative = 1;
+            Kernel::MuscleRates<Dual> rates;
+            Kernel::calcMuscleRates(settings, mc, in, rates);
+            seeds[k]->derivative = 0;
+            dEdot[k] = rates.Edot.derivative;
+            if (k == 0)
+                total += rates.Edot.value;
+        }
+
+        derivatives[0] += dEdot[0];
+        derivatives[1] += dEdot[1];
+        const int j = NumGlobalSensitivityParameters
+                      + NumMuscleSensitivityParameters*i;
+        // The muscle mass is either provided, or
+        // (max isometric force/specific tension)*density*optimal fiber length.
+        if (mm.get_use_provided_muscle_mass())
+            derivatives[j+2] = dEdot[2];
+        else {
+            const double mass = mc.muscle_mass.value;
+            derivatives[j] = -dEdot[2]*mass/mm.get_specific_tension();
+            derivatives[j+1] = dEdot[2]*mass/mm.get_density();
+        }
+    }
+    return total;
+}
+
+
+
+
+//=============================================================================
+// MUSCLE METABOLICS INTERFACE
+//=============================================================================
+//_____________________________________________________________________________
+/**
+* Get the number of muscles being analysed in the metabolic analysis.
+*/
+const int MuscleMetabolicsScreeningProbe::getNumMetabolicMuscles() const
+{
+    return get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet().getSize();
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Add a muscle, whose mass is calculated, so that it can be included in the
+ * metabolic analysis. Its ratio of slow twitch fibers is not used.
+ */
+void MuscleMetabolicsScreeningProbe::addMuscle(const string& muscleName)
+{
+    UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter* mm =
+        new UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter(
+            muscleName, 0.5);
+
+    connectIndividualMetabolicMuscle(*_model, *mm);
+
+    upd_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()
+        .adoptAndAppend(mm);    // add to MetabolicMuscleParameterSet in the model
+}
+
+//_____________________________________________________________________________
+/**
+ * Add a muscle and its mass so that it can be included in the metabolic
+ * analysis.
+ */
+void MuscleMetabolicsScreeningProbe::addMuscle(const string& muscleName,
+    double muscle_mass)
+{
+    UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter* mm =
+        new UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter(
+            muscleName, 0.5, muscle_mass);
+
+    connectIndividualMetabolicMuscle(*_model, *mm);
+
+    upd_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()
+        .adoptAndAppend(mm);    // add to MetabolicMuscleParameterSet in the model
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Remove a muscle from the MetabolicMuscleParameterSet.
+ */
+void MuscleMetabolicsScreeningProbe::removeMuscle(const string& muscleName)
+{
+    _muscleMap.erase(muscleName);
+
+    const int k = get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet().getIndex(muscleName);
+    if (k<0) {
+        cout << "WARNING: MetabolicMuscleParameter: Invalid muscle '"
+            << muscleName << "' specified. No metabolic muscles removed." << endl;
+        return;
+    }
+    upd_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet().remove(k);
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Set an existing muscle in the MetabolicMuscleParameterSet
+ * to use an provided muscle mass.
+ */
+void MuscleMetabolicsScreeningProbe::useProvidedMass(const string& muscleName,
+    double providedMass)
+{
+    UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter* mm =
+        updMetabolicParameters(muscleName);
+
+    mm->set_use_provided_muscle_mass(true);
+    mm->set_provided_muscle_mass(providedMass);
+    mm->setMuscleMass();      // actual mass used.
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Set an existing muscle in the MetabolicMuscleParameterSet
+ * to calculate its own mass.
+ */
+void MuscleMetabolicsScreeningProbe::useCalculatedMass(const string& muscleName)
+{
+    UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter* mm =
+        updMetabolicParameters(muscleName);
+
+    mm->set_use_provided_muscle_mass(false);
+    mm->setMuscleMass();       // actual mass used.
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Get whether the muscle mass is being explicitly provided.
+ */
+bool MuscleMetabolicsScreeningProbe::isUsingProvidedMass(
+    const std::string& muscleName)
+{
+    return getMetabolicParameters(muscleName)->get_use_provided_muscle_mass();
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Get the muscle mass used in the metabolic analysis.
+ */
+const double MuscleMetabolicsScreeningProbe::getMuscleMass(
+    const std::string& muscleName) const
+{
+    return getMetabolicParameters(muscleName)->getMuscleMass();
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Get the density for an existing muscle (kg/m^3).
+ */
+const double MuscleMetabolicsScreeningProbe::getDensity(
+    const std::string& muscleName) const
+{
+    return getMetabolicParameters(muscleName)->get_density();
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Set the density for an existing muscle (kg/m^3).
+ */
+void MuscleMetabolicsScreeningProbe::setDensity(const std::string& muscleName,
+    const double& density)
+{
+    updMetabolicParameters(muscleName)->set_density(density);
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Get the specific tension for an existing muscle (Pascals (N/m^2)).
+ */
+const double MuscleMetabolicsScreeningProbe::getSpecificTension(
+    const std::string& muscleName) const
+{
+    return getMetabolicParameters(muscleName)->get_specific_tension();
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Set the specific tension for an existing muscle (Pascals (N/m^2)).
+ */
+void MuscleMetabolicsScreeningProbe::setSpecificTension(
+    const std::string& muscleName, const double& specificTension)
+{
+    updMetabolicParameters(muscleName)->set_specific_tension(specificTension);
+}
+
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Get const MetabolicMuscleParameter from the MuscleMap using a
+ * string accessor.
+ */
+const UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter*
+    MuscleMetabolicsScreeningProbe::getMetabolicParameters(
+    const std::string& muscleName) const
+{
+    MuscleMap::const_iterator m_i = _muscleMap.find(muscleName);
+    if (m_i == _muscleMap.end()) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": Invalid muscle "
+            << muscleName << " in the MetabolicMuscleParameter map." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    return m_i->second;
+}
+
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Get writable MetabolicMuscleParameter from the MuscleMap using a
+ * string accessor.
+ */
+UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter*
+    MuscleMetabolicsScreeningProbe::updMetabolicParameters(
+    const std::string& muscleName)
+{
+    MuscleMap::const_iterator m_i = _muscleMap.find(muscleName);
+    if (m_i == _muscleMap.end()) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": Invalid muscle "
+            << muscleName << " in the MetabolicMuscleParameter map." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    return m_i->second;
+}
@@ -0,0 +1,313 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_SCREENING_PROBE_H_
+#define OPENSIM_MUSCLE_METABOLICS_SCREENING_PROBE_H_
+/* -------------------------------------------------------------------------- *
+ *                 OpenSim:  MuscleMetabolicsScreeningProbe.h                 *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include "MuscleMetabolicsScreeningKernel.h"
+#include "MuscleMetabolicsRealTimeEvaluator.h"
+#include "UchidaUmberger2010MuscleMetabolicsProbe.h"
+#include <OpenSim/Simulation/Model/Probe.h>
+#include <OpenSim/Simulation/Model/Model.h>
+
+namespace OpenSim {
+
+//=============================================================================
+//                    LOW-COST SCREENING METABOLICS PROBE
+//=============================================================================
+/**
+ * %MuscleMetabolicsScreeningProbe is a Probe ModelComponent for ranking many
+ * candidate simulations by a cheap proxy of their metabolic cost before the
+ * best candidates are evaluated with UchidaUmberger2010MuscleMetabolicsProbe
+ * or UchidaBhargava2004MuscleMetabolicsProbe.
+ *
+ * The metabolic rate of each muscle (W) is an activation cost and the
+ * positive mechanical work rate of its contractile element, divided by an
+ * efficiency:
+ *
+ * <B>Edot = m * c_A * a^2 + max(0, -F_CE * v_CE) / eta</B>,
+ *
+ * where m is the mass of the muscle, a its activation, F_CE its active fiber
+ * force and v_CE its fiber velocity (v_CE < 0 when shortening),
+ * c_A is 'activation_coefficient' (W/kg) and eta is
+ * 'positive_work_efficiency'. The basal rate of the whole body,
+ * <B>Bdot = basal_coefficient * (m_body^basal_exponent)</B>, is added to the
+ * TOTAL as in the other probes.
+ *
+ * The probe needs neither the excitations nor the forces of the muscles: the
+ * active fiber force is the activation times the active-force-length and
+ * force-velocity multipliers and the maximum isometric force, so the probe
+ * may be evaluated at a State realized to Stage::Velocity. The equations are
+ * in MuscleMetabolicsScreeningKernel, which is evaluated by the same
+ * real-time evaluator and evaluation service as the kernels of the other
+ * probes.
+ *
+ * The muscles and their masses are given by the same
+ * MetabolicMuscleParameterSet as UchidaUmberger2010MuscleMetabolicsProbe
+ * (<ratio_slow_twitch_fibers> is ignored). The coefficients are calibrated
+ * against a reference probe by a MuscleMetabolicsCalibration, with trials
+ * whose measured rates are those of the reference probe (see
+ * MuscleMetabolicsCalibration::addReferenceTrial()): e.g., the trials of the
+ * gait example, calibrated against its
+ * UchidaUmberger2010MuscleMetabolicsProbe, so that the rankings of the
+ * screening probe agree with those of the reference probe.
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsScreeningProbe : public Probe {
+OpenSim_DECLARE_CONCRETE_OBJECT(MuscleMetabolicsScreeningProbe, Probe);
+public:
+//==============================================================================
+// PROPERTIES
+//==============================================================================
+    /** @name Property declarations
+    These are the serializable properties associated with this class. **/
+    /**@{**/
+    /** Enabled by default. **/
+    OpenSim_DECLARE_PROPERTY(activation_rate_on,
+        bool,
+        "Specify whether the activation rate is to be calculated (true/false).");
+
+    /** Enabled by default. **/
+    OpenSim_DECLARE_PROPERTY(mechanical_work_rate_on,
+        bool,
+        "Specify whether the positive mechanical work rate is to be calculated "
+        "(true/false).");
+
+    /** Enabled by default. **/
+    OpenSim_DECLARE_PROPERTY(basal_rate_on,
+        bool,
+        "Specify whether basal heat rate is to be calculated (true/false).");
+
+    /** Default value = 100. **/
+    OpenSim_DECLARE_PROPERTY(activation_coefficient,
+        double,
+        "Metabolic rate of a fully activated muscle, per unit mass, in "
+        "addition to its work rate (W/kg).");
+
+    /** Default value = 0.25. **/
+    OpenSim_DECLARE_PROPERTY(positive_work_efficiency,
+        double,
+        "Ratio of the positive mechanical work rate of the muscles to the "
+        "metabolic rate it costs.");
+
+    /** Default value = 1.2. **/
+    OpenSim_DECLARE_PROPERTY(basal_coefficient,
+        double,
+        "Basal metabolic coefficient.");
+
+    /** Default value = 1.0. **/
+    OpenSim_DECLARE_PROPERTY(basal_exponent,
+        double,
+        "Basal metabolic exponent.");
+
+    /** Default value = true **/
+    OpenSim_DECLARE_PROPERTY(report_total_metabolics_only,
+        bool,
+        "If set to false, the individual muscle metabolics, basal rate, and "
+        "total summation will be reported. If set to true, only the total "
+        "summation will be reported.");
+
+    OpenSim_DECLARE_UNNAMED_PROPERTY(
+        UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet,
+        "A set containing, for each muscle, the parameters "
+        "required to calculate muscle mass.");
+
+    /**@}**/
+
+//=============================================================================
+// PUBLIC METHODS
+//=============================================================================
+    /** The per-muscle kernel used by this probe. */
+    typedef MuscleMetabolicsScreeningKernel Kernel;
+
+    /** MuscleMap typedef */
+    typedef std::map
+       <std::string,
+        UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter*>
+        MuscleMap;
+
+    //--------------------------------------------------------------------------
+    // Constructor(s) and Setup
+    //--------------------------------------------------------------------------
+    /** Default constructor */
+    MuscleMetabolicsScreeningProbe();
+
+    /** Convenience constructor */
+    MuscleMetabolicsScreeningProbe(
+        const bool activation_rate_on,
+        const bool work_rate_on,
+        const bool basal_rate_on);
+
+
+    //-----------------------------------------------------------------------------
+    // Computation
+    //-----------------------------------------------------------------------------
+    /** Compute muscle metabolic power. The state must be realized to
+        Stage::Velocity. */
+    virtual SimTK::Vector computeProbeInputs(const SimTK::State& state) const OVERRIDE_11;
+
+    /** Returns the number of probe inputs in the vector returned by computeProbeInputs(). */
+    int getNumProbeInputs() const OVERRIDE_11;
+
+    /** Returns the column labels of the probe values for reporting.
+        Currently uses the Probe name as the column label, so be sure
+        to name your probe appropiately!  */
+    virtual OpenSim::Array<std::string> getProbeOutputLabels() const OVERRIDE_11;
+
+    /** Get the probe-wide settings used by the per-muscle kernel. */
+    Kernel::Settings getKernelSettings() const;
+
+    /** Get the constant parameters of the ith muscle in the
+        MetabolicMuscleParameterSet used by the per-muscle kernel. */
+    Kernel::MuscleConstants getKernelMuscleConstants(int i) const;
+
+    /** Get the ith muscle in the MetabolicMuscleParameterSet. The probe must
+        be connected to a model. */
+    const Muscle& getMetabolicMuscle(int i) const;
+
+    /** Gather the state-dependent inputs of the ith muscle in the
+        MetabolicMuscleParameterSet. The state must be realized to
+        Stage::Velocity. */
+    void gatherMuscleInputs(const SimTK::State& s, int i,
+                            Kernel::MuscleInputs<double>& in) const;
+
+    /** The real-time profile of this probe. */
+    typedef MuscleMetabolicsRealTimeEvaluator<Kernel> RealTimeEvaluator;
+
+    /** Create a real-time evaluator from the current properties of the
+        probe, with a muscle for each muscle in the MetabolicMuscleParameterSet
+        (in the same order) and the basal rate of the model at the given
+        state, which must be realized to Stage::Instance. */
+    RealTimeEvaluator createRealTimeEvaluator(const SimTK::State& s) const;
+
+
+    //-----------------------------------------------------------------------------
+    /** @name     Parameter sensitivity
+    The derivatives of the metabolic power with respect to the parameters,
+    e.g., to calibrate the coefficients with a MuscleMetabolicsCalibration. */
+    /**@{**/
+    /** The names of the parameters: the global coefficients, followed by the
+        parameters of each muscle of the MetabolicMuscleParameterSet. */
+    Array<std::string> getSensitivityParameterNames() const;
+
+    /** The values of the parameters, in the order of their names. */
+    SimTK::Vector getSensitivityParameterValues() const;
+
+    /** Evaluate the TOTAL metabolic power at the given state, which must be
+        realized to Stage::Velocity, and its partial derivatives with respect
+        to the parameters (resized to their number). */
+    double calcParameterSensitivity(const SimTK::State& s,
+                                    SimTK::Vector& derivatives) const;
+    /**@}**/
+
+
+    //-----------------------------------------------------------------------------
+    /** @name     MetabolicMuscleParameterSet
+    The muscles are added and their masses set as in
+    UchidaUmberger2010MuscleMetabolicsProbe. */
+    /**@{**/
+    /** Get the number of muscles being analysed in the metabolic analysis. */
+    const int getNumMetabolicMuscles() const;
+
+    /** Add a muscle, whose mass is calculated from its properties, so that
+        it can be included in the metabolic analysis. */
+    void addMuscle(const std::string& muscleName);
+
+    /** Add a muscle and its mass so that it can be included in the metabolic
+        analysis. */
+    void addMuscle(const std::string& muscleName, double muscle_mass);
+
+    /** Remove a muscle from the metabolic analysis. */
+    void removeMuscle(const std::string& muscleName);
+
+    /** Set an existing muscle to use a provided muscle mass. */
+    void useProvidedMass(const std::string& muscleName, double providedMass);
+
+    /** Set an existing muscle to calculate its own mass. */
+    void useCalculatedMass(const std::string& muscleName);
+
+    /** Get whether the muscle mass is being explicitly provided. */
+    bool isUsingProvidedMass(const std::string& muscleName);
+
+    /** Get the muscle mass used in the metabolic analysis. */
+    const double getMuscleMass(const std::string& muscleName) const;
+
+    /** Get the density for an existing muscle (kg/m^3). */
+    const double getDensity(const std::string& muscleName) const;
+
+    /** Set the density for an existing muscle (kg/m^3). */
+    void setDensity(const std::string& muscleName, const double& density);
+
+    /** Get the specific tension for an existing muscle (Pascals (N/m^2)). */
+    const double getSpecificTension(const std::string& muscleName) const;
+
+    /** Set the specific tension for an existing muscle (Pascals (N/m^2)). */
+    void setSpecificTension(const std::string& muscleName, const double& specificTension);
+    /**@}**/
+
+
+
+//==============================================================================
+// PRIVATE
+//==============================================================================
+private:
+    //--------------------------------------------------------------------------
+    // Data
+    //--------------------------------------------------------------------------
+    MuscleMap _muscleMap;
+
+    // The number of global and per-muscle sensitivity parameters.
+    enum { NumGlobalSensitivityParameters = 4,
+           NumMuscleSensitivityParameters = 3 };
+
+    //--------------------------------------------------------------------------
+    // ModelComponent Interface
+    //--------------------------------------------------------------------------
+    void connectToModel(Model& aModel) OVERRIDE_11;
+    void connectIndividualMetabolicMuscle
+       (Model& aModel,
+        UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter& mm);
+
+    void setNull();
+    void constructProperties();
+
+    // The basal metabolic rate (W) at the given state, which must be realized
+    // to Stage::Instance.
+    double calcBasalRate(const SimTK::State& s) const;
+
+    //--------------------------------------------------------------------------
+    // MetabolicMuscleParameter Private Interface
+    //--------------------------------------------------------------------------
+    // Get const MetabolicMuscleParameter from the MuscleMap using a string accessor.
+    const UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter*
+        getMetabolicParameters(const std::string& muscleName) const;
+
+    // Get writable MetabolicMuscleParameter from the MuscleMap using a string accessor.
+    UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter*
+        updMetabolicParameters(const std::string& muscleName);
+
+//=============================================================================
+};  // END of class MuscleMetabolicsScreeningProbe
+//=============================================================================
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_SCREENING_PROBE_H_
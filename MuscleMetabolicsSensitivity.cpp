@@ -0,0 +1,131 @@
+/* -------------------------------------------------------------------------- *
+ *                 OpenSim:  MuscleMetabolicsSensitivity.cpp                  *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsSensitivity.h"
+#include <OpenSim/Common/Exception.h>
+#include <ostream>
+#include <sstream>
+
+using namespace std;
+using namespace SimTK;
+using namespace OpenSim;
+
+
+//=============================================================================
+// CONSTRUCTOR(S)
+//=============================================================================
+MuscleMetabolicsSensitivity::MuscleMetabolicsSensitivity()
+{
+    clear();
+}
+
+MuscleMetabolicsSensitivity::MuscleMetabolicsSensitivity(
+    const Array<std::string>& names, const Vector& values)
+{
+    if (values.size() != names.getSize()) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsSensitivity: " << names.getSize()
+            << " parameter name(s) were given with " << values.size()
+            << " value(s)." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    for (int k=0; k<names.getSize(); ++k) {
+        _names.push_back(names[k]);
+        _values.push_back(values[k]);
+    }
+    clear();
+}
+
+void MuscleMetabolicsSensitivity::clear()
+{
+    _numSamples = 0;
+    _firstTime = _lastTime = NaN;
+    _lastPower = NaN;
+    _lastDerivatives.resize(0);
+    _energy = 0;
+    _derivatives.assign(getNumParameters(), 0.0);
+}
+
+
+//=============================================================================
+// ACCUMULATION
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Add a sample, integrating the interval from the last sample by the
+ * trapezoidal rule.
+ */
+void MuscleMetabolicsSensitivity::add(double t, double power,
+                                      const Vector& derivatives)
+{
+    if (derivatives.size() != getNumParameters()
+        || (_numSamples > 0 && t < _lastTime)) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsSensitivity: a sample of "
+            << derivatives.size() << " derivative(s) at t = " << t
+            << " cannot be added to the sensitivity to "
+            << getNumParameters() << " parameter(s) ending at t = "
+            << _lastTime << "." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    if (_numSamples > 0 && t == _lastTime)
+        return;
+
+    if (_numSamples == 0)
+        _firstTime = t;
+    else {
+        const double halfStep = 0.5*(t - _lastTime);
+        _energy += halfStep*(power + _lastPower);
+        for (int k=0; k<getNumParameters(); ++k)
+            _derivatives[k] += halfStep*(derivatives[k] + _lastDerivatives[k]);
+    }
+    _lastTime = t;
+    _lastPower = power;
+    _lastDerivatives = derivatives;
+    ++_numSamples;
+}
+
+
+//=============================================================================
+// RESULTS
+//=============================================================================
+double MuscleMetabolicsSensitivity::getNormalizedSensitivity(int k) const
+{
+    if (_energy == 0)
+        return NaN;
+    return _values[k]/_energy*_derivatives[k];
+}
+
+void MuscleMetabolicsSensitivity::print(std::ostream& out) const
+{
+    out << "num_samples\t" << _numSamples << "\tduration\t"
+        << (_numSamples > 0 ? _lastTime - _firstTime : 0.0)
+        << "\tenergy\t" << _energy << "\n";
+    out << "parameter\tvalue\tdenergy_dparameter\tnormalized_sensitivity\n";
+    for (int k=0; k<getNumParameters(); ++k)
+        out << _names[k] << "\t" << _values[k] << "\t" << _derivatives[k]
+            << "\t" << getNormalizedSensitivity(k) << "\n";
+}
@@ -0,0 +1,103 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_SENSITIVITY_H_
+#define OPENSIM_MUSCLE_METABOLICS_SENSITIVITY_H_
+/* -------------------------------------------------------------------------- *
+ *                  OpenSim:  MuscleMetabolicsSensitivity.h                   *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include <OpenSim/Common/Array.h>
+#include <SimTKcommon.h>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace OpenSim {
+
+//=============================================================================
+//        SENSITIVITY OF METABOLIC ENERGY TO THE PROBE PARAMETERS
+//=============================================================================
+/**
+ * The metabolic energy of a metabolics probe over a trial, and its partial
+ * derivatives with respect to the parameters of the probe (e.g.,
+ * "aerobic_factor" or "soleus_r.ratio_slow_twitch_fibers"), accumulated one
+ * state at a time from the total metabolic power and its partial
+ * derivatives at that state (see calcParameterSensitivities() in the
+ * probes). The energy and its derivatives are integrated over time by the
+ * trapezoidal rule, as in the probes' deferred evaluation.
+ *
+ * The derivatives are those of the energy along the given trajectory: the
+ * states are not affected by the parameters, as in an AnalyzeTool run with
+ * perturbed parameters.
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsSensitivity {
+public:
+    /** Sensitivity to no parameters. */
+    MuscleMetabolicsSensitivity();
+
+    /** Empty sensitivity to the parameters with the given names and
+        values. */
+    MuscleMetabolicsSensitivity(const Array<std::string>& names,
+                                const SimTK::Vector& values);
+
+    /** Add the total metabolic power (W) at time t, which must not precede
+        the last sample, and its partial derivatives with respect to the
+        parameters. A sample at the time of the last sample is ignored. */
+    void add(double t, double power, const SimTK::Vector& derivatives);
+
+    /** Discard the samples. */
+    void clear();
+
+    int getNumParameters() const { return (int)_names.size(); }
+    const std::string& getName(int k) const { return _names[k]; }
+    double getValue(int k) const { return _values[k]; }
+    int getNumSamples() const { return _numSamples; }
+    double getStartTime() const { return _firstTime; }
+    double getEndTime() const { return _lastTime; }
+
+    /** The metabolic energy (J) over the samples. */
+    double getEnergy() const { return _energy; }
+    /** The partial derivative of the energy with respect to parameter k
+        (J per unit of the parameter). */
+    double getDerivative(int k) const { return _derivatives[k]; }
+    /** The normalized sensitivity to parameter k, (value/energy)*derivative:
+        the relative change of the energy per relative change of the
+        parameter (NaN if the energy is 0). */
+    double getNormalizedSensitivity(int k) const;
+
+    /** Print a table with a row for each parameter: name, value, derivative
+        of the energy and normalized sensitivity, preceded by a line with the
+        number of samples, duration and energy. */
+    void print(std::ostream& out) const;
+
+private:
+    std::vector<std::string> _names;
+    std::vector<double> _values;
+    int _numSamples;
+    double _firstTime, _lastTime;
+    double _lastPower;
+    SimTK::Vector _lastDerivatives;
+    double _energy;
+    std::vector<double> _derivatives;
+};
+
+} // namespace OpenSim
+
+#endif // OPENSIM_MUSCLE_METABOLICS_SENSITIVITY_H_
@@ -0,0 +1,194 @@
+/* -------------------------------------------------------------------------- *
+ *             OpenSim:  MuscleMetabolicsStaticOptimization.cpp               *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsStaticOptimization.h"
+#include "UchidaUmberger2010MuscleMetabolicsProbe.h"
+#include "UchidaBhargava2004MuscleMetabolicsProbe.h"
+#include <OpenSim/Simulation/Model/ProbeSet.h>
+#include <simmath/Optimizer.h>
+#include <algorithm>
+
+using namespace std;
+using namespace SimTK;
+using namespace OpenSim;
+
+
+//=============================================================================
+// CONSTRUCTOR(S)
+//=============================================================================
+MuscleMetabolicsStaticOptimization::MuscleMetabolicsStaticOptimization(
+    Model* model)
+:   StaticOptimization(model)
+{
+    setName("MuscleMetabolicsStaticOptimization");
+    constructProperties();
+}
+
+void MuscleMetabolicsStaticOptimization::constructProperties()
+{
+    constructProperty_metabolics_probe("");
+    constructProperty_metabolic_cost_weight(1.0);
+    constructProperty_minimum_activation(0.01);
+}
+
+
+//=============================================================================
+// ANALYSIS
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Record the optimal actuator controls and forces at the given state. This
+ * follows StaticOptimization::record(), with the metabolic cost of the probe
+ * named by 'metabolics_probe' as the objective.
+ */
+int MuscleMetabolicsStaticOptimization::record(const SimTK::State& s)
+{
+    if (!_modelWorkingCopy) return -1;
+
+    const ProbeSet& probes = _modelWorkingCopy->getProbeSet();
+    const int index = probes.getIndex(get_metabolics_probe());
+    if (index < 0) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": Probe '"
+            << get_metabolics_probe() << "' was not found in the model." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    if (const UchidaUmberger2010MuscleMetabolicsProbe* p =
+            dynamic_cast<const UchidaUmberger2010MuscleMetabolicsProbe*>(&probes[index]))
+        solve(s, *p);
+    else if (const UchidaBhargava2004MuscleMetabolicsProbe* p =
+            dynamic_cast<const UchidaBhargava2004MuscleMetabolicsProbe*>(&probes[index]))
+        solve(s, *p);
+    else {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": Probe '"
+            << get_metabolics_probe() << "' is a "
+            << probes[index].getConcreteClassName() << ", not a "
+            << "UchidaUmberger2010MuscleMetabolicsProbe or "
+            << "UchidaBhargava2004MuscleMetabolicsProbe." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    return 0;
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Solve the static optimization problem at s with the metabolic
+ * cost of the given probe, and append the results to the storages.
+ */
+template <class Probe>
+void MuscleMetabolicsStaticOptimization::solve(const SimTK::State& s,
+                                               const Probe& probe)
+{
+    // Set the working copy of the model to the time, Qs and Us of s.
+    SimTK::State& sWorkingCopy = _modelWorkingCopy->updWorkingState();
+    sWorkingCopy.setTime(s.getTime());
+    _modelWorkingCopy->initStateWithoutRecreatingSystem(sWorkingCopy);
+    sWorkingCopy.setQ(s.getQ());
+    sWorkingCopy.setU(s.getU());
+    _modelWorkingCopy->getMultibodySystem().realize(sWorkingCopy,
+                                                    SimTK::Stage::Velocity);
+
+    const Set<Actuator>& actuators = _modelWorkingCopy->getActuators();
+    const int na = actuators.getSize();
+    const int nacc = _accelerationIndices.getSize();
+
+    _numericalDerivativeStepSize = 0.0001;
+    _optimizerAlgorithm = "ipopt";
+    _printLevel = 0;
+
+    // Optimization target
+    _modelWorkingCopy->setAllControllersEnabled(false);
+    MuscleMetabolicsStaticOptimizationTarget<Probe> target(sWorkingCopy,
+        _modelWorkingCopy, na, nacc, _useMusclePhysiology, probe,
+        get_metabolic_cost_weight());
+    target.setStatesStore(_statesStore);
+    target.setStatesSplineSet(_statesSplineSet);
+    target.setActivationExponent(_activationExponent);
+    target.setDX(_numericalDerivativeStepSize);
+
+    // Optimizer
+    SimTK::Optimizer optimizer(target, SimTK::InteriorPoint);
+    optimizer.setDiagnosticsLevel(_printLevel);
+    optimizer.setConvergenceTolerance(_convergenceCriterion);
+    optimizer.setMaxIterations(_maximumIterations);
+    optimizer.useNumericalGradient(false);
+    optimizer.useNumericalJacobian(false);
+    optimizer.setLimitedMemoryHistory(500);
+    optimizer.setAdvancedBoolOption("warm_start", true);
+    optimizer.setAdvancedRealOption("obj_scaling_factor", 1);
+    optimizer.setAdvancedRealOption("nlp_scaling_max_gradient", 1);
+
+    // Parameter bounds. The activations of the metabolic muscles are kept
+    // away from 0, where the slope of the metabolic rate is unbounded.
+    if (!(get_minimum_activation() > 0)) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": <minimum_activation> is "
+            << get_minimum_activation() << ", which must be positive." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    SimTK::Vector lowerBounds(na), upperBounds(na);
+    for (int j=0; j<na; ++j) {
+        lowerBounds[j] = actuators[j].getMinControl();
+        upperBounds[j] = actuators[j].getMaxControl();
+        if (target.isMetabolicActuator(j))
+            lowerBounds[j] = std::max(lowerBounds[j],
+                                      get_minimum_activation());
+    }
+    target.setParameterLimits(lowerBounds, upperBounds);
+
+    // Initial guess: the solution of the previous frame, or the lower bounds
+    // at the first frame, within the bounds.
+    const bool firstFrame = (_activationStorage->getSize() == 0
+                             || _parameters.size() != na);
+    if (_parameters.size() != na)
+        _parameters.resize(na);
+    for (int j=0; j<na; ++j) {
+        const double guess = firstFrame ? lowerBounds[j] : _parameters[j];
+        _parameters[j] = std::min(std::max(guess, lowerBounds[j]),
+                                  upperBounds[j]);
+    }
+
+    // Static optimization
+    target.prepareToOptimize(sWorkingCopy, &_parameters[0]);
+    target.prepareMetabolicCost(sWorkingCopy);
+    try {
+        target.setCurrentState(&sWorkingCopy);
+        optimizer.optimize(_parameters);
+    }
+    catch (const SimTK::Exception::Base& ex) {
+        cout << ex.getMessage() << endl;
+        cout << "WARNING: " << getConcreteClassName()
+            << ": The optimizer could not find a solution at time = "
+            << s.getTime() << "." << endl;
+    }
+
+    SimTK::Vector forces(na);
+    target.getActuation(sWorkingCopy, _parameters, forces);
+    _activationStorage->append(sWorkingCopy.getTime(), na, &_parameters[0]);
+    _forceStorage->append(sWorkingCopy.getTime(), na, &forces[0]);
+}
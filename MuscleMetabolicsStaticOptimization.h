@@ -0,0 +1,293 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_STATIC_OPTIMIZATION_H_
+#define OPENSIM_MUSCLE_METABOLICS_STATIC_OPTIMIZATION_H_
+/* -------------------------------------------------------------------------- *
+ *              OpenSim:  MuscleMetabolicsStaticOptimization.h                *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include "MuscleMetabolicsDual.h"
+#include <OpenSim/Analyses/StaticOptimization.h>
+#include <OpenSim/Analyses/StaticOptimizationTarget.h>
+#include <OpenSim/Simulation/Model/Model.h>
+#include <OpenSim/Simulation/Model/Muscle.h>
+#include <cmath>
+#include <vector>
+
+namespace OpenSim {
+
+//=============================================================================
+//           METABOLIC-COST STATIC OPTIMIZATION TARGET
+//=============================================================================
+/**
+ * A StaticOptimizationTarget whose objective is the summed metabolic rate of
+ * the muscles of a metabolics probe, evaluated with the per-muscle kernel of
+ * the probe (and hence with its MetabolicMuscleParameterSet and settings):
+ *
+ *   J(x) = sum_{j not in probe} |x_j|^p
+ *          + metabolic_cost_weight * sum_{i in probe} Edot_i(x_j(i)),
+ *
+ * where x are the actuator controls (activations of the muscles), p is the
+ * activation exponent, and actuators that are not muscles of the probe
+ * (e.g., reserve actuators) keep the activation objective of
+ * StaticOptimization. The basal rate does not depend on x and is omitted.
+ *
+ * Each muscle is evaluated under the quasi-static assumption excitation =
+ * activation = x_j, with the active fiber force x_j*F1, where
+ * F1 = max_isometric_force * active-force-length multiplier *
+ * force-velocity multiplier is the active fiber force at full activation
+ * with a rigid tendon (as assumed by StaticOptimization). The fiber length,
+ * velocity and the other inputs of the kernel do not depend on x; they are
+ * gathered once per time frame by prepareMetabolicCost().
+ *
+ * The gradient is analytic: the kernel is evaluated with dual numbers (see
+ * MuscleMetabolicsDual), with the fast_math approximations replaced by the
+ * exact functions. The slope of the x^0.6 terms of the rates is unbounded at
+ * x = 0, where the derivative is infinite; the activations of the metabolic
+ * muscles must be bounded away from 0 (see 'minimum_activation' of
+ * MuscleMetabolicsStaticOptimization). Probe is UchidaUmberger2010MuscleMetabolicsProbe or
+ * UchidaBhargava2004MuscleMetabolicsProbe.
+ */
+template <class Probe>
+class MuscleMetabolicsStaticOptimizationTarget
+    : public StaticOptimizationTarget {
+public:
+    typedef typename Probe::Kernel Kernel;
+    typedef typename Kernel::Settings Settings;
+    typedef typename Kernel::MuscleConstants MuscleConstants;
+    typedef typename Kernel::template MuscleInputs<double> MuscleInputs;
+
+    //--------------------------------------------------------------------------
+    // Constructor(s)
+    //--------------------------------------------------------------------------
+    /** The arguments before 'probe' are those of StaticOptimizationTarget.
+        The probe must be connected to the model. */
+    MuscleMetabolicsStaticOptimizationTarget(const SimTK::State& s,
+        Model* model, int na, int nacc, bool useMusclePhysiology,
+        const Probe& probe, double metabolicCostWeight)
+    :   StaticOptimizationTarget(s, model, na, nacc, useMusclePhysiology),
+        _probe(probe), _weight(metabolicCostWeight),
+        _settings(probe.getKernelSettings()),
+        _isMetabolicMuscle(na, false)
+    {
+        _settings.fast_math = false;
+
+        const Set<Actuator>& actuators = model->getActuators();
+        const int numMuscles = probe.getNumMetabolicMuscles();
+        for (int i=0; i<numMuscles; ++i) {
+            const int j = actuators.getIndex(
+                probe.getMetabolicMuscle(i).getName());
+            if (j < 0 || j >= na || _isMetabolicMuscle[j])
+                continue;
+            _isMetabolicMuscle[j] = true;
+            _probeMuscles.push_back(i);
+            _actuatorIndices.push_back(j);
+            _constants.push_back(probe.getKernelMuscleConstants(i));
+        }
+        _inputs.resize(_probeMuscles.size());
+        _maxActiveFiberForces.resize(_probeMuscles.size(), 0.0);
+    }
+
+    //--------------------------------------------------------------------------
+    // Metabolic cost
+    //--------------------------------------------------------------------------
+    /** Gather the inputs of the kernel that do not depend on the activations
+        from a state realized to Stage::Velocity, with the tendons of the
+        muscles treated as rigid. The state is not modified. */
+    void prepareMetabolicCost(const SimTK::State& s)
+    {
+        SimTK::State sRigid = s;
+        for (unsigned int k=0; k<_probeMuscles.size(); ++k)
+            _probe.getMetabolicMuscle(_probeMuscles[k])
+                .setIgnoreTendonCompliance(sRigid, true);
+        _probe.getModel().getMultibodySystem().realize(sRigid,
+            SimTK::Stage::Dynamics);
+
+        for (unsigned int k=0; k<_probeMuscles.size(); ++k) {
+            const Muscle& m = _probe.getMetabolicMuscle(_probeMuscles[k]);
+            _probe.gatherMuscleInputs(sRigid, _probeMuscles[k], _inputs[k]);
+            _maxActiveFiberForces[k] = m.getMaxIsometricForce()
+                * m.getActiveForceLengthMultiplier(sRigid)
+                * m.getForceVelocityMultiplier(sRigid);
+        }
+    }
+
+    /** Get the number of actuators whose cost is their metabolic rate. */
+    int getNumMetabolicActuators() const
+    {   return (int)_actuatorIndices.size(); }
+
+    /** Whether the cost of the jth actuator is its metabolic rate. */
+    bool isMetabolicActuator(int j) const
+    {   return _isMetabolicMuscle[j]; }
+
+    /** Evaluate the metabolic rate (W) of the kth metabolic actuator at the
+        activation a, and its derivative with respect to a in dEdot. */
+    double calcMetabolicRate(int k, double a, double& dEdot) const
+    {
+        typename Kernel::template MuscleInputs<MuscleMetabolicsDual> in;
+        Kernel::convert(_inputs[k], in);
+        in.excitation = MuscleMetabolicsDual(a, 1);
+        in.activation = MuscleMetabolicsDual(a, 1);
+        in.active_fiber_force = MuscleMetabolicsDual(
+            a*_maxActiveFiberForces[k], _maxActiveFiberForces[k]);
+
+        typename Kernel::template MuscleRates<MuscleMetabolicsDual> rates;
+        Kernel::calcMuscleRates(_settings, _constants[k], in, rates);
+        dEdot = rates.Edot.derivative;
+        return rates.Edot.value;
+    }
+
+    //--------------------------------------------------------------------------
+    // Optimization target
+    //--------------------------------------------------------------------------
+    int objectiveFunc(const SimTK::Vector& x, bool /*new_coefficients*/,
+                      SimTK::Real& rP) const OVERRIDE_11
+    {
+        rP = 0;
+        for (int j=0; j<getNumParameters(); ++j)
+            if (!_isMetabolicMuscle[j])
+                rP += std::pow(std::fabs(x[j]), _activationExponent);
+        for (int k=0; k<getNumMetabolicActuators(); ++k) {
+            double dEdot;
+            rP += _weight * calcMetabolicRate(k, x[_actuatorIndices[k]], dEdot);
+        }
+        return 0;
+    }
+
+    int gradientFunc(const SimTK::Vector& x, bool /*new_coefficients*/,
+                     SimTK::Vector& gradient) const OVERRIDE_11
+    {
+        for (int j=0; j<getNumParameters(); ++j) {
+            gradient[j] = 0;
+            if (!_isMetabolicMuscle[j] && x[j] != 0)
+                gradient[j] = _activationExponent
+                    * std::pow(std::fabs(x[j]), _activationExponent-1.0)
+                    * (x[j] < 0 ? -1.0 : 1.0);
+        }
+        for (int k=0; k<getNumMetabolicActuators(); ++k) {
+            double dEdot;
+            calcMetabolicRate(k, x[_actuatorIndices[k]], dEdot);
+            gradient[_actuatorIndices[k]] = _weight * dEdot;
+        }
+        return 0;
+    }
+
+private:
+    //=============================================================================
+    // DATA
+    //=============================================================================
+    const Probe& _probe;
+    double _weight;
+    Settings _settings;
+
+    // Whether each actuator is a muscle of the probe.
+    std::vector<bool> _isMetabolicMuscle;
+
+    // For each metabolic actuator k: its index in the probe and among the
+    // actuators, its constants, and the inputs and F1 gathered by
+    // prepareMetabolicCost().
+    std::vector<int> _probeMuscles;
+    std::vector<int> _actuatorIndices;
+    std::vector<MuscleConstants> _constants;
+    std::vector<MuscleInputs> _inputs;
+    std::vector<double> _maxActiveFiberForces;
+
+//=============================================================================
+};  // END of class MuscleMetabolicsStaticOptimizationTarget
+//=============================================================================
+
+
+
+//=============================================================================
+//               METABOLIC-COST STATIC OPTIMIZATION
+//=============================================================================
+/**
+ * StaticOptimization that minimizes the metabolic rate of the muscles of a
+ * metabolics probe of the model (UchidaUmberger2010MuscleMetabolicsProbe or
+ * UchidaBhargava2004MuscleMetabolicsProbe), named by the 'metabolics_probe'
+ * property, instead of the summed activations raised to the activation
+ * exponent. The metabolic rates are evaluated with the parameters and
+ * settings of the probe, and the gradient of the objective is analytic (see
+ * MuscleMetabolicsStaticOptimizationTarget). Actuators that are not muscles
+ * of the probe keep the objective of StaticOptimization.
+ *
+ * The metabolic rate is not differentiable at zero activation (its slope is
+ * unbounded there), so the activations of the muscles of the probe are
+ * bounded below by 'minimum_activation' (or by their minimum control, if it
+ * is larger). Each time frame starts from the solution of the previous
+ * frame, and the first from the lower bounds.
+ *
+ * The other properties, the results and the output files are those of
+ * StaticOptimization; use it in place of a StaticOptimization in the
+ * AnalysisSet of an AnalyzeTool setup file.
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsStaticOptimization
+    : public StaticOptimization {
+OpenSim_DECLARE_CONCRETE_OBJECT(MuscleMetabolicsStaticOptimization,
+                                StaticOptimization);
+public:
+//==============================================================================
+// PROPERTIES
+//==============================================================================
+    /** @name Property declarations
+    These are the serializable properties associated with this class. **/
+    /**@{**/
+    OpenSim_DECLARE_PROPERTY(metabolics_probe, std::string,
+        "Name of the UchidaUmberger2010MuscleMetabolicsProbe or "
+        "UchidaBhargava2004MuscleMetabolicsProbe of the model whose muscles' "
+        "metabolic rate is minimized.");
+
+    OpenSim_DECLARE_PROPERTY(metabolic_cost_weight, double,
+        "Weight of the summed metabolic rate (1/W) in the objective, relative "
+        "to the activation objective of the actuators that are not muscles of "
+        "the probe.");
+
+    OpenSim_DECLARE_PROPERTY(minimum_activation, double,
+        "Lower bound of the activations of the muscles of the probe, which "
+        "must be positive: the metabolic rate is not differentiable at zero "
+        "activation.");
+    /**@}**/
+
+    //--------------------------------------------------------------------------
+    // Constructor(s)
+    //--------------------------------------------------------------------------
+    MuscleMetabolicsStaticOptimization(Model* model=0);
+
+protected:
+    //--------------------------------------------------------------------------
+    // StaticOptimization interface
+    //--------------------------------------------------------------------------
+    int record(const SimTK::State& s) OVERRIDE_11;
+
+private:
+    void constructProperties();
+
+    // Solve the static optimization problem at s with the metabolic cost of
+    // the given probe, which is connected to the working copy of the model.
+    template <class Probe>
+    void solve(const SimTK::State& s, const Probe& probe);
+
+//=============================================================================
+};  // END of class MuscleMetabolicsStaticOptimization
+//=============================================================================
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_STATIC_OPTIMIZATION_H_
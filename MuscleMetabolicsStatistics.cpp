@@ -0,0 +1,288 @@
+/* -------------------------------------------------------------------------- *
+ *                  OpenSim:  MuscleMetabolicsStatistics.cpp                  *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsStatistics.h"
+#include <OpenSim/Common/Exception.h>
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+#include <sstream>
+
+using namespace std;
+using namespace SimTK;
+using namespace OpenSim;
+
+const double MuscleMetabolicsStatistics::RelativeAccuracy = 0.01;
+const double MuscleMetabolicsStatistics::MinMagnitude = 1e-3;
+const double MuscleMetabolicsStatistics::MaxMagnitude = 1e5;
+
+namespace {
+// Ratio of the bounds of a bin: a bin (x/r, x] is represented, within the
+// relative accuracy a, by 2x/(1+r), with r = (1+a)/(1-a).
+const double binRatio = (1 + MuscleMetabolicsStatistics::RelativeAccuracy)
+                        / (1 - MuscleMetabolicsStatistics::RelativeAccuracy);
+const int numMagnitudeBins = (int)std::ceil(
+    std::log(MuscleMetabolicsStatistics::MaxMagnitude
+             / MuscleMetabolicsStatistics::MinMagnitude) / std::log(binRatio));
+}
+
+
+//=============================================================================
+// CONSTRUCTOR(S)
+//=============================================================================
+MuscleMetabolicsStatistics::MuscleMetabolicsStatistics()
+{
+    clear();
+}
+
+MuscleMetabolicsStatistics::MuscleMetabolicsStatistics(
+    const Array<std::string>& labels)
+{
+    for (int c=0; c<labels.getSize(); ++c)
+        _labels.push_back(labels[c]);
+    clear();
+}
+
+void MuscleMetabolicsStatistics::clear()
+{
+    const int numChannels = getNumChannels();
+    _numSamples = 0;
+    _firstTime = _lastTime = NaN;
+    _firstValues.resize(0);
+    _lastValues.resize(0);
+    _min.assign(numChannels, Infinity);
+    _max.assign(numChannels, -Infinity);
+    _integral.assign(numChannels, 0.0);
+    _integralOfSquares.assign(numChannels, 0.0);
+    _weights.assign(numChannels*getNumBins(), 0.0);
+}
+
+
+//=============================================================================
+// ACCUMULATION
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Add the values of the channels at time t.
+ */
+void MuscleMetabolicsStatistics::add(double t, const Vector& values)
+{
+    if (values.size() != getNumChannels()
+        || (_numSamples > 0 && t < _lastTime)) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsStatistics: a sample of "
+            << values.size() << " channel(s) at t = " << t << " cannot be "
+            "added to the statistics of " << getNumChannels() << " channel(s) "
+            "ending at t = " << _lastTime << "." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    if (_numSamples > 0 && t == _lastTime)
+        return;
+
+    for (int c=0; c<getNumChannels(); ++c) {
+        _min[c] = std::min(_min[c], values[c]);
+        _max[c] = std::max(_max[c], values[c]);
+    }
+    if (_numSamples == 0) {
+        _firstTime = t;
+        _firstValues = values;
+    }
+    else
+        addInterval(_lastTime, _lastValues, t, values);
+    _lastTime = t;
+    _lastValues = values;
+    ++_numSamples;
+}
+
+//_____________________________________________________________________________
+/**
+ * Combine these statistics with those of another time chunk.
+ */
+void MuscleMetabolicsStatistics::merge(const MuscleMetabolicsStatistics& other)
+{
+    if (other._numSamples == 0)
+        return;
+    if (_numSamples == 0
+        && (_labels.empty() || other.getNumChannels() == getNumChannels())) {
+        *this = other;
+        return;
+    }
+    const bool otherIsLater = other._firstTime >= _lastTime;
+    if (other.getNumChannels() != getNumChannels()
+        || (!otherIsLater && other._lastTime > _firstTime)) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsStatistics: statistics of "
+            << other.getNumChannels() << " channel(s) over ["
+            << other._firstTime << ", " << other._lastTime << "] cannot be "
+            "merged with statistics of " << getNumChannels() << " channel(s) "
+            "over [" << _firstTime << ", " << _lastTime << "]." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    for (int c=0; c<getNumChannels(); ++c) {
+        _min[c] = std::min(_min[c], other._min[c]);
+        _max[c] = std::max(_max[c], other._max[c]);
+        _integral[c] += other._integral[c];
+        _integralOfSquares[c] += other._integralOfSquares[c];
+    }
+    for (unsigned int k=0; k<_weights.size(); ++k)
+        _weights[k] += other._weights[k];
+
+    // Bridge the gap between the chunks.
+    if (otherIsLater) {
+        addInterval(_lastTime, _lastValues, other._firstTime, other._firstValues);
+        _lastTime = other._lastTime;
+        _lastValues = other._lastValues;
+    }
+    else {
+        addInterval(other._lastTime, other._lastValues, _firstTime, _firstValues);
+        _firstTime = other._firstTime;
+        _firstValues = other._firstValues;
+    }
+    _numSamples += other._numSamples;
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Integrate the interval between two samples.
+ */
+void MuscleMetabolicsStatistics::addInterval(double t0, const Vector& values0,
+    double t1, const Vector& values1)
+{
+    const double dt = t1 - t0;
+    const int numBins = getNumBins();
+    for (int c=0; c<getNumChannels(); ++c) {
+        _integral[c] += 0.5*dt*(values0[c] + values1[c]);
+        _integralOfSquares[c] +=
+            0.5*dt*(values0[c]*values0[c] + values1[c]*values1[c]);
+        _weights[c*numBins + getBin(values0[c])] += 0.5*dt;
+        _weights[c*numBins + getBin(values1[c])] += 0.5*dt;
+    }
+}
+
+
+//=============================================================================
+// STATISTICS
+//=============================================================================
+double MuscleMetabolicsStatistics::getDuration() const
+{
+    return _numSamples > 0 ? _lastTime - _firstTime : 0;
+}
+
+double MuscleMetabolicsStatistics::getMean(int c) const
+{
+    if (getDuration() > 0)
+        return _integral[c] / getDuration();
+    return _numSamples > 0 ? _firstValues[c] : NaN;
+}
+
+double MuscleMetabolicsStatistics::getRMS(int c) const
+{
+    if (getDuration() > 0)
+        return std::sqrt(_integralOfSquares[c] / getDuration());
+    return _numSamples > 0 ? std::fabs(_firstValues[c]) : NaN;
+}
+
+//_____________________________________________________________________________
+/**
+ * The approximate time-weighted pth percentile of channel c.
+ */
+double MuscleMetabolicsStatistics::getPercentile(int c, double p) const
+{
+    if (_numSamples == 0)
+        return NaN;
+    if (getDuration() == 0)
+        return _firstValues[c];
+
+    const int numBins = getNumBins();
+    const double* weights = &_weights[c*numBins];
+    const double target = std::min(std::max(p, 0.0), 100.0)/100
+                          * getDuration();
+    double cumulative = 0;
+    int bin = 0;
+    for (; bin < numBins-1; ++bin) {
+        cumulative += weights[bin];
+        if (cumulative >= target && weights[bin] > 0)
+            break;
+    }
+    return std::min(std::max(getBinValue(bin), _min[c]), _max[c]);
+}
+
+//_____________________________________________________________________________
+/**
+ * Print a table with a row for each channel.
+ */
+void MuscleMetabolicsStatistics::print(std::ostream& out) const
+{
+    const double percentiles[5] = { 5, 25, 50, 75, 95 };
+    out << "channel\tnum_samples\tduration\tmean\tmin\tmax\tRMS\tintegral";
+    for (int k=0; k<5; ++k)
+        out << "\tp" << percentiles[k];
+    out << "\n";
+    for (int c=0; c<getNumChannels(); ++c) {
+        out << _labels[c] << "\t" << _numSamples << "\t" << getDuration()
+            << "\t" << getMean(c) << "\t" << getMin(c) << "\t" << getMax(c)
+            << "\t" << getRMS(c) << "\t" << getIntegral(c);
+        for (int k=0; k<5; ++k)
+            out << "\t" << getPercentile(c, percentiles[k]);
+        out << "\n";
+    }
+}
+
+
+//=============================================================================
+// HISTOGRAM
+//=============================================================================
+// The bins are ordered by value: the negative bins from the largest
+// magnitude down, the zero bin (magnitudes below MinMagnitude), and the
+// positive bins. Bin k > 0 of a sign holds the magnitudes in
+// (MinMagnitude*r^(k-1), MinMagnitude*r^k].
+int MuscleMetabolicsStatistics::getNumBins()
+{
+    return 2*numMagnitudeBins + 1;
+}
+
+int MuscleMetabolicsStatistics::getBin(double value)
+{
+    const int zeroBin = getNumBins()/2;
+    const double magnitude = std::fabs(value);
+    if (!(magnitude >= MinMagnitude))     // Also NaN.
+        return zeroBin;
+    const int k = std::min(zeroBin, std::max(1,
+        (int)std::ceil(std::log(magnitude/MinMagnitude) / std::log(binRatio))));
+    return value > 0 ? zeroBin + k : zeroBin - k;
+}
+
+double MuscleMetabolicsStatistics::getBinValue(int bin)
+{
+    const int zeroBin = getNumBins()/2;
+    const int k = bin - zeroBin;
+    if (k == 0)
+        return 0;
+    const double magnitude = MinMagnitude * std::pow(binRatio, std::abs(k))
+                             * 2/(1 + binRatio);
+    return k > 0 ? magnitude : -magnitude;
+}
@@ -0,0 +1,131 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_STATISTICS_H_
+#define OPENSIM_MUSCLE_METABOLICS_STATISTICS_H_
+/* -------------------------------------------------------------------------- *
+ *                   OpenSim:  MuscleMetabolicsStatistics.h                   *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include <OpenSim/Common/Array.h>
+#include <SimTKcommon.h>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace OpenSim {
+
+//=============================================================================
+//              STREAMING STATISTICS OF METABOLIC POWER
+//=============================================================================
+/**
+ * Summary statistics of the channels of a metabolics probe (e.g., TOTAL,
+ * BASAL and the metabolic power of each muscle) over a trial, accumulated
+ * one state at a time in constant memory per channel: the minimum, maximum,
+ * time-weighted mean and RMS, the integral over time (trapezoidal rule, as in
+ * the probes' deferred evaluation), and approximate percentiles.
+ *
+ * The samples are weighted by the time they represent (half of each adjacent
+ * interval), so the statistics do not depend on the step pattern of the
+ * integrator. The percentiles are read from a histogram with logarithmically
+ * spaced bins of magnitude (one for each sign), whose representative values
+ * are within RelativeAccuracy of every value in the bin, for magnitudes from
+ * MinMagnitude to MaxMagnitude W; smaller magnitudes are counted as zero and
+ * larger ones in the outermost bins.
+ *
+ * Statistics accumulated over consecutive time chunks of a trial (e.g., by
+ * several threads) are combined with merge(), one chunk at a time, each
+ * lying entirely before or after the chunks merged so far; the result is
+ * that of a single accumulation over the trial, up to rounding, provided
+ * the chunks do not share samples.
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsStatistics {
+public:
+    /** Relative accuracy of the percentiles. */
+    static const double RelativeAccuracy;
+    /** Range of the magnitudes (W) resolved by the percentiles. */
+    static const double MinMagnitude;
+    static const double MaxMagnitude;
+
+    /** Statistics of no channels. */
+    MuscleMetabolicsStatistics();
+
+    /** Empty statistics of the channels with the given labels. */
+    explicit MuscleMetabolicsStatistics(const Array<std::string>& labels);
+
+    /** Add the values of the channels at time t, which must not precede the
+        last sample. A sample at the time of the last sample is ignored. */
+    void add(double t, const SimTK::Vector& values);
+
+    /** Combine these statistics with those of another time chunk of the same
+        channels, which must lie entirely before or after this chunk. The gap
+        between the chunks is integrated by the trapezoidal rule. */
+    void merge(const MuscleMetabolicsStatistics& other);
+
+    /** Discard the samples. */
+    void clear();
+
+    int getNumChannels() const { return (int)_labels.size(); }
+    const std::string& getLabel(int c) const { return _labels[c]; }
+    int getNumSamples() const { return _numSamples; }
+    double getStartTime() const { return _firstTime; }
+    double getEndTime() const { return _lastTime; }
+    /** The time spanned by the samples. */
+    double getDuration() const;
+
+    double getMin(int c) const { return _min[c]; }
+    double getMax(int c) const { return _max[c]; }
+    /** The integral of channel c over time (e.g., J for a power in W). */
+    double getIntegral(int c) const { return _integral[c]; }
+    /** The time-weighted mean (the value of the sample, if there is one). */
+    double getMean(int c) const;
+    /** The time-weighted root mean square. */
+    double getRMS(int c) const;
+    /** The approximate time-weighted pth percentile (0 <= p <= 100),
+        clamped to [getMin(), getMax()]. */
+    double getPercentile(int c, double p) const;
+
+    /** Print a table with a row for each channel: label, number of samples,
+        duration, mean, minimum, maximum, RMS, integral, and the 5th, 25th,
+        50th, 75th and 95th percentiles. */
+    void print(std::ostream& out) const;
+
+private:
+    // The histogram bin of a value, and its representative value.
+    static int getBin(double value);
+    static double getBinValue(int bin);
+    static int getNumBins();
+
+    // Integrate the interval between two samples of the channels by the
+    // trapezoidal rule, and weight the samples by half of the interval.
+    void addInterval(double t0, const SimTK::Vector& values0,
+                     double t1, const SimTK::Vector& values1);
+
+    std::vector<std::string> _labels;
+    int _numSamples;
+    double _firstTime, _lastTime;
+    SimTK::Vector _firstValues, _lastValues;
+    std::vector<double> _min, _max, _integral, _integralOfSquares;
+    // Histogram weights (s), getNumBins() per channel (channel-major).
+    std::vector<double> _weights;
+};
+
+} // namespace OpenSim
+
+#endif // OPENSIM_MUSCLE_METABOLICS_STATISTICS_H_
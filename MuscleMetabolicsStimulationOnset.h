@@ -0,0 +1,76 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_STIMULATION_ONSET_H_
+#define OPENSIM_MUSCLE_METABOLICS_STIMULATION_ONSET_H_
+/* -------------------------------------------------------------------------- *
+ *                OpenSim:  MuscleMetabolicsStimulationOnset.h                *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include <SimTKcommon/internal/EventHandler.h>
+#include <string>
+
+namespace OpenSim {
+
+//=============================================================================
+//              STIMULATION ONSET OF A MUSCLE OF A METABOLICS PROBE
+//=============================================================================
+/**
+ * An event handler that restarts the stimulation time of a muscle of a
+ * metabolics probe with 'activation_heat_decay' when the excitation of the
+ * muscle rises through the probe's 'activation_heat_decay_onset_excitation'.
+ * The stimulation time (the integral of u/tau since the onset) is a
+ * continuous state variable of the probe, named stateVariableName, which the
+ * handler sets to 0 at the onset. The probe adds one handler per muscle to
+ * the System in addToSystem().
+ *
+ * Probe is UchidaBhargava2004MuscleMetabolicsProbe.
+ */
+template <class Probe>
+class MuscleMetabolicsStimulationOnset : public SimTK::TriggeredEventHandler {
+public:
+    MuscleMetabolicsStimulationOnset(const Probe& probe, int muscleIndex,
+                                     const std::string& stateVariableName)
+    :   SimTK::TriggeredEventHandler(SimTK::Stage::Dynamics), _probe(probe),
+        _muscleIndex(muscleIndex), _stateVariableName(stateVariableName)
+    {
+        getTriggerInfo().setTriggerOnFallingSignTransition(false);
+    }
+
+    SimTK::Real getValue(const SimTK::State& s) const OVERRIDE_11
+    {
+        return _probe.getMuscleExcitation(s, _muscleIndex)
+               - _probe.get_activation_heat_decay_onset_excitation();
+    }
+
+    void handleEvent(SimTK::State& s, SimTK::Real /*accuracy*/,
+                     bool& shouldTerminate) const OVERRIDE_11
+    {
+        _probe.setStateVariable(s, _stateVariableName, 0);
+        shouldTerminate = false;
+    }
+
+private:
+    const Probe& _probe;
+    int _muscleIndex;
+    std::string _stateVariableName;
+};
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_STIMULATION_ONSET_H_
@@ -0,0 +1,332 @@
+/* -------------------------------------------------------------------------- *
+ *                OpenSim:  MuscleMetabolicsSurrogate.cpp                     *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+
+//=============================================================================
+// INCLUDES and STATICS
+//=============================================================================
+#include "MuscleMetabolicsSurrogate.h"
+#include <algorithm>
+
+using namespace std;
+using namespace SimTK;
+using namespace OpenSim;
+
+
+//=============================================================================
+// CONSTRUCTOR(S)
+//=============================================================================
+MuscleMetabolicsSurrogate::MuscleMetabolicsSurrogate()
+{
+    setNull();
+    constructProperties();
+}
+
+MuscleMetabolicsSurrogate::MuscleMetabolicsSurrogate(
+    const std::string& muscleName)
+{
+    setNull();
+    constructProperties();
+    setName(muscleName);
+}
+
+void MuscleMetabolicsSurrogate::setNull()
+{
+    for (int d=0; d<NumInputs; ++d) {
+        _nodes[d].clear();
+        _strides[d] = 0;
+    }
+    _values.clear();
+    _numNodes = 0;
+    _numHeatRates = 0;
+}
+
+void MuscleMetabolicsSurrogate::constructProperties()
+{
+    constructProperty_excitation_nodes();
+    constructProperty_activation_nodes();
+    constructProperty_normalized_fiber_length_nodes();
+    constructProperty_normalized_fiber_velocity_nodes();
+    constructProperty_active_fiber_force_nodes();
+    constructProperty_num_heat_rates(1);
+    constructProperty_heat_rate_values();
+}
+
+
+//=============================================================================
+// FITTING
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Create numNodes[d] uniformly spaced nodes spanning the observed
+ * range of input d. The kinks of the exact models at l_norm = 1 and
+ * v_norm = 0 are added as nodes if they lie inside the range.
+ */
+void MuscleMetabolicsSurrogate::createGrid(
+    const std::vector<InputVector>& observedInputs, const int numNodes[NumInputs])
+{
+    for (int d=0; d<NumInputs; ++d) {
+        if (observedInputs.empty() || numNodes[d] < 1) {
+            stringstream errorMessage;
+            errorMessage << "MuscleMetabolicsSurrogate: Cannot fit surrogate for "
+                << getName() << " from " << observedInputs.size()
+                << " observations with " << numNodes[d] << " nodes in "
+                << getNodeProperty(d).getName() << "." << endl;
+            throw (Exception(errorMessage.str()));
+        }
+    }
+
+    InputVector lower = observedInputs[0];
+    InputVector upper = observedInputs[0];
+    for (unsigned int k=1; k<observedInputs.size(); ++k) {
+        for (int d=0; d<NumInputs; ++d) {
+            lower[d] = std::min(lower[d], observedInputs[k][d]);
+            upper[d] = std::max(upper[d], observedInputs[k][d]);
+        }
+    }
+
+    const double kinks[NumInputs] = { NaN, NaN, 1.0, 0.0, NaN };
+    for (int d=0; d<NumInputs; ++d) {
+        Property<double>& nodes = updNodeProperty(d);
+        nodes.clear();
+
+        // The heat rates do not depend on this input.
+        if (numNodes[d] == 1) {
+            nodes.appendValue(0.5*(lower[d] + upper[d]));
+            continue;
+        }
+
+        // The input did not vary; keep a range check around the observation.
+        if (!(upper[d] > lower[d]))
+            upper[d] = lower[d] + SignificantReal*std::max(1.0, fabs(lower[d]));
+
+        for (int k=0; k<numNodes[d]; ++k) {
+            const double node = (k == numNodes[d]-1) ? upper[d]
+                : lower[d] + (upper[d]-lower[d])*k/(numNodes[d]-1);
+            if (k > 0 && kinks[d] > nodes[nodes.size()-1] && kinks[d] < node)
+                nodes.appendValue(kinks[d]);
+            nodes.appendValue(node);
+        }
+    }
+}
+
+
+//=============================================================================
+// EVALUATION
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Cache the nodes and compute the strides of the value table.
+ */
+void MuscleMetabolicsSurrogate::cacheNodes()
+{
+    _numNodes = 1;
+    for (int d=NumInputs-1; d>=0; --d) {
+        const Property<double>& nodes = getNodeProperty(d);
+        if (nodes.size() == 0) {
+            stringstream errorMessage;
+            errorMessage << "MuscleMetabolicsSurrogate: No nodes specified for "
+                << nodes.getName() << " of " << getName() << "." << endl;
+            throw (Exception(errorMessage.str()));
+        }
+        _nodes[d].resize(nodes.size());
+        for (int k=0; k<nodes.size(); ++k) {
+            _nodes[d][k] = nodes[k];
+            if (k > 0 && !(nodes[k] > nodes[k-1])) {
+                stringstream errorMessage;
+                errorMessage << "MuscleMetabolicsSurrogate: " << nodes.getName()
+                    << " of " << getName() << " must be increasing." << endl;
+                throw (Exception(errorMessage.str()));
+            }
+        }
+        _strides[d] = _numNodes;
+        _numNodes *= nodes.size();
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Check that the nodes and values are consistent, and cache them.
+ */
+void MuscleMetabolicsSurrogate::initialize()
+{
+    cacheNodes();
+    _numHeatRates = get_num_heat_rates();
+    const Property<double>& values = getProperty_heat_rate_values();
+    if (_numHeatRates < 1 || _numHeatRates > MaxHeatRates
+        || values.size() != _numNodes*_numHeatRates) {
+        stringstream errorMessage;
+        errorMessage << "MuscleMetabolicsSurrogate: " << getName() << " has "
+            << values.size() << " heat_rate_values, but its grid has "
+            << _numNodes << " nodes with " << _numHeatRates
+            << " heat rates each." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    _values.resize(values.size());
+    for (int k=0; k<values.size(); ++k)
+        _values[k] = values[k];
+}
+
+//_____________________________________________________________________________
+/**
+ * Whether x lies inside the grid.
+ */
+bool MuscleMetabolicsSurrogate::isInRange(const InputVector& x) const
+{
+    if (_values.empty())
+        return false;
+    for (int d=0; d<NumInputs; ++d) {
+        if (_nodes[d].size() > 1
+            && !(x[d] >= _nodes[d].front() && x[d] <= _nodes[d].back()))
+            return false;
+    }
+    return true;
+}
+
+//_____________________________________________________________________________
+/**
+ * Multilinear interpolation of the tabulated heat rates.
+ */
+void MuscleMetabolicsSurrogate::calcHeatRates(const InputVector& x,
+                                              double* heatRates) const
+{
+    // Locate the cell containing x in each input, and the weight of the upper
+    // node of the cell.
+    int offset = 0;
+    int upperStep[NumInputs];
+    double weight[NumInputs];
+    for (int d=0; d<NumInputs; ++d) {
+        const std::vector<double>& nodes = _nodes[d];
+        const int n = (int)nodes.size();
+        if (n == 1 || !(x[d] > nodes.front())) {
+            upperStep[d] = 0;
+            weight[d] = 0;
+            continue;
+        }
+        if (x[d] >= nodes.back()) {
+            offset += (n-1)*_strides[d];
+            upperStep[d] = 0;
+            weight[d] = 0;
+            continue;
+        }
+        const int k = (int)(upper_bound(nodes.begin(), nodes.end(), x[d])
+                            - nodes.begin()) - 1;
+        offset += k*_strides[d];
+        upperStep[d] = _strides[d];
+        weight[d] = (x[d] - nodes[k]) / (nodes[k+1] - nodes[k]);
+    }
+
+    // Sum over the 2^NumInputs corners of the cell.
+    for (int j=0; j<_numHeatRates; ++j)
+        heatRates[j] = 0;
+    for (int corner=0; corner<(1<<NumInputs); ++corner) {
+        int index = offset;
+        double w = 1;
+        for (int d=0; d<NumInputs; ++d) {
+            if (corner & (1<<d)) {
+                if (weight[d] == 0) { w = 0; break; }
+                index += upperStep[d];
+                w *= weight[d];
+            } else
+                w *= 1 - weight[d];
+        }
+        if (w != 0) {
+            const double* values = &_values[index*_numHeatRates];
+            for (int j=0; j<_numHeatRates; ++j)
+                heatRates[j] += w*values[j];
+        }
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Get the property holding the nodes of input d.
+ */
+const Property<double>& MuscleMetabolicsSurrogate::getNodeProperty(int d) const
+{
+    switch (d) {
+        case 0:  return getProperty_excitation_nodes();
+        case 1:  return getProperty_activation_nodes();
+        case 2:  return getProperty_normalized_fiber_length_nodes();
+        case 3:  return getProperty_normalized_fiber_velocity_nodes();
+        default: return getProperty_active_fiber_force_nodes();
+    }
+}
+
+Property<double>& MuscleMetabolicsSurrogate::updNodeProperty(int d)
+{
+    switch (d) {
+        case 0:  return updProperty_excitation_nodes();
+        case 1:  return updProperty_activation_nodes();
+        case 2:  return updProperty_normalized_fiber_length_nodes();
+        case 3:  return updProperty_normalized_fiber_velocity_nodes();
+        default: return updProperty_active_fiber_force_nodes();
+    }
+}
+
+
+//=============================================================================
+// FIBER LENGTH TABLE
+//=============================================================================
+void MuscleMetabolicsSurrogate::FiberLengthTable::addSample(
+    double normalizedFiberLength, const Vec3& value)
+{
+    _lengths.push_back(normalizedFiberLength);
+    _values.push_back(value);
+}
+
+void MuscleMetabolicsSurrogate::FiberLengthTable::sort()
+{
+    std::vector<std::pair<double,int> > order(_lengths.size());
+    for (unsigned int k=0; k<_lengths.size(); ++k)
+        order[k] = std::make_pair(_lengths[k], (int)k);
+    std::sort(order.begin(), order.end());
+
+    std::vector<double> lengths(order.size());
+    std::vector<Vec3> values(order.size());
+    for (unsigned int k=0; k<order.size(); ++k) {
+        lengths[k] = order[k].first;
+        values[k] = _values[order[k].second];
+    }
+    _lengths.swap(lengths);
+    _values.swap(values);
+}
+
+Vec3 MuscleMetabolicsSurrogate::FiberLengthTable::calcValue(
+    double normalizedFiberLength) const
+{
+    if (_lengths.empty())
+        return Vec3(NaN);
+    if (normalizedFiberLength <= _lengths.front())
+        return _values.front();
+    if (normalizedFiberLength >= _lengths.back())
+        return _values.back();
+
+    const int k = (int)(upper_bound(_lengths.begin(), _lengths.end(),
+                                    normalizedFiberLength)
+                        - _lengths.begin()) - 1;
+    const double span = _lengths[k+1] - _lengths[k];
+    if (!(span > 0))
+        return _values[k];
+    const double w = (normalizedFiberLength - _lengths[k]) / span;
+    return (1-w)*_values[k] + w*_values[k+1];
+}
@@ -0,0 +1,256 @@
+#ifndef OPENSIM_MUSCLE_METABOLICS_SURROGATE_H_
+#define OPENSIM_MUSCLE_METABOLICS_SURROGATE_H_
+/* -------------------------------------------------------------------------- *
+ *                 OpenSim:  MuscleMetabolicsSurrogate.h                      *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "osimMuscleMetabolicsProbesDLL.h"
+#include <OpenSim/Common/Object.h>
+#include <OpenSim/Common/Set.h>
+#include <SimTKcommon.h>
+#include <vector>
+
+namespace OpenSim {
+
+//=============================================================================
+//                     MUSCLE METABOLICS SURROGATE
+//=============================================================================
+/**
+ * A fitted approximation of the metabolic rate of a single muscle, used by
+ * the metabolics probes when their 'use_surrogate' property is enabled. The
+ * name of the surrogate is the name of the muscle.
+ *
+ * The heat rates of the muscle, before the clamps on the total power and heat
+ * rate, are tabulated on a rectangular grid of the five inputs
+ *
+ *   x = (u, a, l_norm, v_norm, F_act),
+ *
+ * where u is the excitation, a is the activation, l_norm is the normalized
+ * fiber length, v_norm is the fiber velocity in optimal fiber lengths per
+ * second, and F_act is the active fiber force (N). Between the nodes the
+ * surrogate is the tensor-product linear spline (i.e., multilinear
+ * interpolation) of the tabulated values, so an evaluation requires neither
+ * transcendental functions nor the length-dependent quantities of the muscle
+ * (force-length multiplier, passive force). The probes evaluate the
+ * mechanical work rate, the clamps and the total metabolic rate exactly from
+ * the interpolated heat rates; tabulating the total rate instead would smear
+ * the clamps, which are not smooth, across the cells of the grid.
+ *
+ * An input with a single node is one on which the heat rates do not depend
+ * (e.g., F_act for UchidaUmberger2010MuscleMetabolicsProbe); it is ignored
+ * in evaluation.
+ *
+ * A surrogate is generated by fit() from the exact kernel of a probe over the
+ * operating range of the muscle observed in a set of states (see
+ * fitSurrogates() in the probes); the quantities that depend only on the
+ * fiber length are interpolated from the same observations. The grid
+ * includes l_norm = 1 and v_norm = 0 when these lie in the observed range,
+ * as the exact models are not smooth there. Outside the range of the grid,
+ * the probes fall back to the exact kernel.
+ *
+ * A MuscleMetabolicsSurrogateSet is stored in a sidecar XML file, named by the
+ * 'surrogate_file' property of the probe.
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsSurrogate : public Object {
+OpenSim_DECLARE_CONCRETE_OBJECT(MuscleMetabolicsSurrogate, Object);
+public:
+//==============================================================================
+// PROPERTIES
+//==============================================================================
+    /** @name Property declarations
+    These are the serializable properties associated with this class. **/
+    /**@{**/
+    OpenSim_DECLARE_LIST_PROPERTY(excitation_nodes, double,
+        "Grid nodes in excitation (increasing).");
+
+    OpenSim_DECLARE_LIST_PROPERTY(activation_nodes, double,
+        "Grid nodes in activation (increasing).");
+
+    OpenSim_DECLARE_LIST_PROPERTY(normalized_fiber_length_nodes, double,
+        "Grid nodes in normalized fiber length (increasing).");
+
+    OpenSim_DECLARE_LIST_PROPERTY(normalized_fiber_velocity_nodes, double,
+        "Grid nodes in fiber velocity, in optimal fiber lengths per second "
+        "(increasing).");
+
+    OpenSim_DECLARE_LIST_PROPERTY(active_fiber_force_nodes, double,
+        "Grid nodes in active fiber force (N) (increasing).");
+
+    OpenSim_DECLARE_PROPERTY(num_heat_rates, int,
+        "Number of heat rates tabulated at each grid node.");
+
+    OpenSim_DECLARE_LIST_PROPERTY(heat_rate_values, double,
+        "Heat rates at the grid nodes, num_heat_rates consecutive values per "
+        "node. The active fiber force index varies fastest and the excitation "
+        "index slowest.");
+    /**@}**/
+
+    /** Number of inputs of the surrogate. */
+    enum { NumInputs = 5 };
+
+    /** Maximum number of heat rates tabulated at each node. */
+    enum { MaxHeatRates = 3 };
+
+    /** Inputs of the surrogate: (u, a, l_norm, v_norm, F_act). */
+    typedef SimTK::Vec<NumInputs> InputVector;
+
+    //--------------------------------------------------------------------------
+    // Fiber length table
+    //--------------------------------------------------------------------------
+    /** Observed values of up to three quantities that depend only on the
+        normalized fiber length (e.g., the active-force-length multiplier),
+        interpolated linearly when a surrogate is fitted. */
+    class FiberLengthTable {
+    public:
+        void addSample(double normalizedFiberLength, const SimTK::Vec3& value);
+        /** Sort the samples; call after the last addSample(). */
+        void sort();
+        /** Interpolate at the given normalized fiber length; the values at
+            the ends of the table are used outside it. */
+        SimTK::Vec3 calcValue(double normalizedFiberLength) const;
+    private:
+        std::vector<double> _lengths;
+        std::vector<SimTK::Vec3> _values;
+    };
+
+    //--------------------------------------------------------------------------
+    // Constructor(s)
+    //--------------------------------------------------------------------------
+    MuscleMetabolicsSurrogate();
+    explicit MuscleMetabolicsSurrogate(const std::string& muscleName);
+
+    //--------------------------------------------------------------------------
+    // Fitting
+    //--------------------------------------------------------------------------
+    /** Create the grid from the range of the observed inputs, with
+        numNodes[d] nodes in input d (plus l_norm = 1 and v_norm = 0 if they
+        lie inside the range), and tabulate the numHeatRates heat rates
+        calcHeatRates(x, heatRates) at each node. NodeFunction must provide
+        void operator()(const InputVector& x, double* heatRates) const. */
+    template <class NodeFunction>
+    void fit(const std::vector<InputVector>& observedInputs,
+             const int numNodes[NumInputs], int numHeatRates,
+             const NodeFunction& calcHeatRates)
+    {
+        createGrid(observedInputs, numNodes);
+        tabulate(numHeatRates, calcHeatRates);
+    }
+
+    /** Tabulate the heat rates at the nodes of the current grid. */
+    template <class NodeFunction>
+    void tabulate(int numHeatRates, const NodeFunction& calcHeatRates)
+    {
+        cacheNodes();
+        set_num_heat_rates(numHeatRates);
+        updProperty_heat_rate_values().clear();
+        int index[NumInputs] = { 0 };
+        for (int k=0; k<_numNodes; ++k) {
+            InputVector x;
+            for (int d=0; d<NumInputs; ++d)
+                x[d] = _nodes[d][index[d]];
+            double heatRates[MaxHeatRates];
+            calcHeatRates(x, heatRates);
+            for (int j=0; j<numHeatRates; ++j)
+                updProperty_heat_rate_values().appendValue(heatRates[j]);
+
+            // Advance the multi-index; the last input varies fastest.
+            for (int d=NumInputs-1; d>=0; --d) {
+                if (++index[d] < (int)_nodes[d].size()) break;
+                index[d] = 0;
+            }
+        }
+        initialize();
+    }
+
+    //--------------------------------------------------------------------------
+    // Evaluation
+    //--------------------------------------------------------------------------
+    /** Check that the nodes and values are consistent, and cache them for
+        evaluation. Must be called after the properties have been modified
+        (e.g., after deserialization); fit() and tabulate() call it. Throws
+        an Exception if the surrogate is invalid. */
+    void initialize();
+
+    /** Whether x lies inside the grid (ignoring inputs with a single node). */
+    bool isInRange(const InputVector& x) const;
+
+    /** Interpolate the num_heat_rates heat rates at x into heatRates. Inputs
+        outside the grid are clamped to it. */
+    void calcHeatRates(const InputVector& x, double* heatRates) const;
+
+    /** Get the number of nodes in input d. */
+    int getNumNodes(int d) const { return (int)_nodes[d].size(); }
+
+private:
+    void setNull();
+    void constructProperties();
+
+    void createGrid(const std::vector<InputVector>& observedInputs,
+                    const int numNodes[NumInputs]);
+    void cacheNodes();
+    const Property<double>& getNodeProperty(int d) const;
+    Property<double>& updNodeProperty(int d);
+
+    //=============================================================================
+    // DATA
+    //=============================================================================
+    // Cached copies of the properties, set by initialize().
+    std::vector<double> _nodes[NumInputs];
+    std::vector<double> _values;
+    int _strides[NumInputs];
+    int _numNodes;
+    int _numHeatRates;
+
+//=============================================================================
+};	// END of class MuscleMetabolicsSurrogate
+//=============================================================================
+
+
+
+//==============================================================================
+//                       MuscleMetabolicsSurrogateSet
+//==============================================================================
+/**
+ * The set of MuscleMetabolicsSurrogates of a probe, one for each muscle. This
+ * is the content of the sidecar file named by the 'surrogate_file' property
+ * of the probes.
+ */
+class OSIMMUSCLEMETABOLICSPROBES_API MuscleMetabolicsSurrogateSet
+    : public Set<MuscleMetabolicsSurrogate>
+{
+    OpenSim_DECLARE_CONCRETE_OBJECT(MuscleMetabolicsSurrogateSet,
+                                    Set<MuscleMetabolicsSurrogate>);
+
+public:
+    MuscleMetabolicsSurrogateSet()
+    {  }
+
+    MuscleMetabolicsSurrogateSet(const std::string& fileName)
+    :   Set<MuscleMetabolicsSurrogate>(fileName)
+    {  }
+
+//=============================================================================
+};	// END of class MuscleMetabolicsSurrogateSet
+//=============================================================================
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_MUSCLE_METABOLICS_SURROGATE_H_
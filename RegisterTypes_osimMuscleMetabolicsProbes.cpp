@@ -27,6 +27,10 @@
 
 #include "UchidaBhargava2004MuscleMetabolicsProbe.h"
 #include "UchidaUmberger2010MuscleMetabolicsProbe.h"
+#include "MuscleMetabolicsScreeningProbe.h"
+#include "MuscleMetabolicsSurrogate.h"
+#include "MuscleMetabolicsDeferredReporter.h"
+#include "MuscleMetabolicsStaticOptimization.h"
 
 using namespace OpenSim;
 using namespace std;
@@ -41,6 +45,11 @@ OSIMMUSCLEMETABOLICSPROBES_API void RegisterTypes_osimMuscleMetabolicsProbes()
     Object::RegisterType( UchidaUmberger2010MuscleMetabolicsProbe() );
     Object::RegisterType( UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet() );
     Object::RegisterType( UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter() );
+    Object::RegisterType( MuscleMetabolicsScreeningProbe() );
+    Object::RegisterType( MuscleMetabolicsSurrogate() );
+    Object::RegisterType( MuscleMetabolicsSurrogateSet() );
+    Object::RegisterType( MuscleMetabolicsDeferredReporter() );
+    Object::RegisterType( MuscleMetabolicsStaticOptimization() );
 }
 
 dllObjectInstantiator::dllObjectInstantiator() 
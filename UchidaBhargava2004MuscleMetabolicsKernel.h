@@ -0,0 +1,405 @@
+#ifndef OPENSIM_UCHIDABHARGAVA2004_METABOLICS_KERNEL_H_
+#define OPENSIM_UCHIDABHARGAVA2004_METABOLICS_KERNEL_H_
+/* -------------------------------------------------------------------------- *
+ *             OpenSim:  UchidaBhargava2004MuscleMetabolicsKernel.h           *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ * Author(s): Tim Dorn                                                        *
+ * Contributor(s): Thomas Uchida                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "MuscleMetabolicsFastMath.h"
+#include <SimTKcommon/Constants.h>
+#include <cmath>
+
+namespace OpenSim {
+
+//=============================================================================
+//        PER-MUSCLE KERNEL OF UchidaBhargava2004MuscleMetabolicsProbe
+//=============================================================================
+/**
+ * The per-muscle computation of UchidaBhargava2004MuscleMetabolicsProbe,
+ * separated from the probe so that it can be evaluated from inputs that were
+ * gathered from a State (see
+ * UchidaBhargava2004MuscleMetabolicsProbe::gatherMuscleInputs()) and in
+ * different scalar types. The equations are documented in
+ * UchidaBhargava2004MuscleMetabolicsProbe.
+ *
+ * The kernel performs no I/O and no heap allocation; NaN checking and
+ * warnings remain the responsibility of the caller.
+ */
+class UchidaBhargava2004MuscleMetabolicsKernel {
+public:
+    /** Probe-wide settings, taken from the properties of the probe. The
+        coefficients are of type P: double, or MuscleMetabolicsDual to
+        differentiate the rates with respect to one of them (see
+        convert()). */
+    template <class P>
+    struct BasicSettings {
+        bool activation_rate_on;
+        bool maintenance_rate_on;
+        bool shortening_rate_on;
+        bool mechanical_work_rate_on;
+        bool enforce_minimum_heat_rate_per_muscle;
+        bool use_force_dependent_shortening_prop_constant;
+        bool include_negative_mechanical_work;
+        bool forbid_negative_total_power;
+        bool fast_math;
+        P muscle_effort_scaling_factor;
+    };
+    typedef BasicSettings<double> Settings;
+
+    /** Constant parameters of a single muscle, of type P (see
+        BasicSettings). */
+    template <class P>
+    struct BasicMuscleConstants {
+        P muscle_mass;                              // (kg)
+        P ratio_slow_twitch_fibers;
+        P activation_constant_slow_twitch;          // (W/kg)
+        P activation_constant_fast_twitch;          // (W/kg)
+        P maintenance_constant_slow_twitch;         // (W/kg)
+        P maintenance_constant_fast_twitch;         // (W/kg)
+        P max_isometric_force;                      // (N)
+    };
+    typedef BasicMuscleConstants<double> MuscleConstants;
+
+    /** State-dependent inputs of a single muscle, as reported by the Muscle
+        (i.e., not yet scaled by muscle_effort_scaling_factor). The fiber
+        length dependence of the maintenance heat rate is the value of the
+        probe's normalized_fiber_length_dependence_on_maintenance_rate
+        function at the normalized fiber length. The activation heat decay
+        multiplies the activation heat rate: it is the value of
+        calcActivationHeatDecay() when the probe's 'activation_heat_decay'
+        property is true, and 1 otherwise. */
+    template <class T>
+    struct MuscleInputs {
+        T excitation;
+        T activation;
+        T active_fiber_force;               // (N)
+        T passive_fiber_force;              // (N)
+        T fiber_velocity;                   // (m/s)
+        T active_force_length_multiplier;
+        T fiber_length_dependence;
+        T activation_heat_decay;
+    };
+
+    /** The terms of the heat rates of a single muscle that depend only on
+        its excitation (see calcExcitationTerms()). */
+    template <class T>
+    struct ExcitationTerms {
+        T slow_twitch_excitation;
+        T fast_twitch_excitation;
+    };
+
+    /** Heat rates, mechanical work rate and total metabolic rate (W) of a
+        single muscle. */
+    template <class T>
+    struct MuscleRates {
+        T Adot;
+        T Mdot;
+        T Sdot;
+        T Wdot;
+        T Edot;
+    };
+
+    /** Convert muscle inputs to another scalar type. */
+    template <class T, class U>
+    static void convert(const MuscleInputs<U>& from, MuscleInputs<T>& to)
+    {
+        to.excitation = T(from.excitation);
+        to.activation = T(from.activation);
+        to.active_fiber_force = T(from.active_fiber_force);
+        to.passive_fiber_force = T(from.passive_fiber_force);
+        to.fiber_velocity = T(from.fiber_velocity);
+        to.active_force_length_multiplier = T(from.active_force_length_multiplier);
+        to.fiber_length_dependence = T(from.fiber_length_dependence);
+        to.activation_heat_decay = T(from.activation_heat_decay);
+    }
+
+    /** Convert muscle rates to another scalar type. */
+    template <class T, class U>
+    static void convert(const MuscleRates<U>& from, MuscleRates<T>& to)
+    {
+        to.Adot = T(from.Adot);
+        to.Mdot = T(from.Mdot);
+        to.Sdot = T(from.Sdot);
+        to.Wdot = T(from.Wdot);
+        to.Edot = T(from.Edot);
+    }
+
+    /** Convert settings to another coefficient type. */
+    template <class P, class Q>
+    static void convert(const BasicSettings<Q>& from, BasicSettings<P>& to)
+    {
+        to.activation_rate_on = from.activation_rate_on;
+        to.maintenance_rate_on = from.maintenance_rate_on;
+        to.shortening_rate_on = from.shortening_rate_on;
+        to.mechanical_work_rate_on = from.mechanical_work_rate_on;
+        to.enforce_minimum_heat_rate_per_muscle =
+            from.enforce_minimum_heat_rate_per_muscle;
+        to.use_force_dependent_shortening_prop_constant =
+            from.use_force_dependent_shortening_prop_constant;
+        to.include_negative_mechanical_work =
+            from.include_negative_mechanical_work;
+        to.forbid_negative_total_power = from.forbid_negative_total_power;
+        to.fast_math = from.fast_math;
+        to.muscle_effort_scaling_factor = P(from.muscle_effort_scaling_factor);
+    }
+
+    /** Convert muscle constants to another coefficient type. */
+    template <class P, class Q>
+    static void convert(const BasicMuscleConstants<Q>& from,
+                        BasicMuscleConstants<P>& to)
+    {
+        to.muscle_mass = P(from.muscle_mass);
+        to.ratio_slow_twitch_fibers = P(from.ratio_slow_twitch_fibers);
+        to.activation_constant_slow_twitch =
+            P(from.activation_constant_slow_twitch);
+        to.activation_constant_fast_twitch =
+            P(from.activation_constant_fast_twitch);
+        to.maintenance_constant_slow_twitch =
+            P(from.maintenance_constant_slow_twitch);
+        to.maintenance_constant_fast_twitch =
+            P(from.maintenance_constant_fast_twitch);
+        to.max_isometric_force = P(from.max_isometric_force);
+    }
+
+    /** The decay function of the activation heat rate of Bhargava et al.
+        (2004), 0.06 + exp(-t_stim*u/tau), where t_stim is the time since the
+        onset of stimulation, u the (scaled) excitation and tau the decay time
+        constant. Its argument is the normalized stimulation time: the
+        integral of u/tau since the onset, which is t_stim*u/tau for a
+        constant excitation. */
+    template <class T>
+    static T calcActivationHeatDecay(const T& normalizedStimulationTime)
+    {
+        using std::exp;
+        return T(0.06) + exp(-normalizedStimulationTime);
+    }
+
+    /** Whether two sets of inputs of a single muscle take the same branches
+        of the equations (shortening or lengthening), i.e., whether the rates
+        vary smoothly between them, apart from the clamps on the total power
+        and heat rate. The muscle constants are those of the signature of the
+        Umberger kernel; no branch of these equations depends on them. */
+    template <class T, class P>
+    static bool isSameBranch(const BasicMuscleConstants<P>& /*mc*/,
+                             const MuscleInputs<T>& a,
+                             const MuscleInputs<T>& b)
+    {
+        return (a.fiber_velocity <= T(0)) == (b.fiber_velocity <= T(0));
+    }
+
+    /** Evaluate the metabolic rate of a single muscle. */
+    template <class T, class P>
+    static void calcMuscleRates(const BasicSettings<P>& settings,
+                                const BasicMuscleConstants<P>& mc,
+                                const MuscleInputs<T>& in,
+                                MuscleRates<T>& out)
+    {
+        calcHeatRates(settings, mc, in, out);
+        calcWorkAndTotalRates(settings, mc, in, out);
+    }
+
+    /** Evaluate the activation (out.Adot), maintenance (out.Mdot) and
+        shortening (out.Sdot) heat rates of a single muscle, before the clamps
+        applied by calcWorkAndTotalRates(). These are the rates approximated
+        by a MuscleMetabolicsSurrogate. */
+    template <class T, class P>
+    static void calcHeatRates(const BasicSettings<P>& settings,
+                              const BasicMuscleConstants<P>& mc,
+                              const MuscleInputs<T>& in,
+                              MuscleRates<T>& out)
+    {
+        ExcitationTerms<T> terms;
+        calcExcitationTerms(settings, mc, in.excitation, terms);
+        calcHeatRates(settings, mc, in, terms, out);
+    }
+
+    /** Evaluate the terms of the heat rates that depend only on the
+        (unscaled) excitation: the excitations of the slow- and fast-twitch
+        fibers. These terms contain the transcendental functions of the
+        excitation, and may be computed once for an excitation that recurs
+        (see calcHeatRates()). */
+    template <class T, class P>
+    static void calcExcitationTerms(const BasicSettings<P>& settings,
+                                    const BasicMuscleConstants<P>& mc,
+                                    const T& unscaledExcitation,
+                                    ExcitationTerms<T>& terms)
+    {
+        using std::sin;
+        using std::cos;
+
+        const T ratio = T(mc.ratio_slow_twitch_fibers);
+        const T excitation =
+            T(settings.muscle_effort_scaling_factor) * unscaledExcitation;
+        terms.slow_twitch_excitation = ratio * (settings.fast_math
+            ? MuscleMetabolicsFastMath::sinHalfPi(excitation)
+            : sin(T(SimTK_PI)/T(2) * excitation));
+        terms.fast_twitch_excitation = (T(1) - ratio) * (settings.fast_math
+            ? MuscleMetabolicsFastMath::oneMinusCosHalfPi(excitation)
+            : (T(1) - cos(T(SimTK_PI)/T(2) * excitation)));
+    }
+
+    /** calcHeatRates() with the excitation terms computed by
+        calcExcitationTerms() for in.excitation. */
+    template <class T, class P>
+    static void calcHeatRates(const BasicSettings<P>& settings,
+                              const BasicMuscleConstants<P>& mc,
+                              const MuscleInputs<T>& in,
+                              const ExcitationTerms<T>& terms,
+                              MuscleRates<T>& out)
+    {
+        T Adot = T(0), Mdot = T(0), Sdot = T(0);
+
+        const T scale = T(settings.muscle_effort_scaling_factor);
+        const T mass = T(mc.muscle_mass);
+        const T activation = scale * in.activation;
+        const T fiber_force_active = scale * in.active_fiber_force;
+        const T fiber_force_total = fiber_force_active      // Scaled.
+                                    + in.passive_fiber_force;
+        const T fiber_velocity = in.fiber_velocity;
+        const T slow_twitch_excitation = terms.slow_twitch_excitation;
+        const T fast_twitch_excitation = terms.fast_twitch_excitation;
+
+        // Unnormalized total active force, F_iso, that 'would' be developed at
+        // the current activation and fiber length under isometric conditions.
+        const T F_iso = activation * in.active_force_length_multiplier
+                        * T(mc.max_isometric_force);
+
+        // ACTIVATION HEAT RATE (W)
+        if (settings.forbid_negative_total_power || settings.activation_rate_on)
+        {
+            // The decay function of Bhargava et al. (2004), or 1.0, as used
+            // by Anderson & Pandy (1999), without 'activation_heat_decay'.
+            const T decay_function_value = in.activation_heat_decay;
+            Adot = mass * decay_function_value *
+                ( (T(mc.activation_constant_slow_twitch) * slow_twitch_excitation)
+                + (T(mc.activation_constant_fast_twitch) * fast_twitch_excitation) );
+        }
+
+        // MAINTENANCE HEAT RATE (W)
+        if (settings.forbid_negative_total_power || settings.maintenance_rate_on)
+        {
+            Mdot = mass * in.fiber_length_dependence *
+                ( (T(mc.maintenance_constant_slow_twitch) * slow_twitch_excitation)
+                + (T(mc.maintenance_constant_fast_twitch) * fast_twitch_excitation) );
+        }
+
+        // SHORTENING HEAT RATE (W)
+        // --> note that we define Vm<0 as shortening and Vm>0 as lengthening
+        if (settings.forbid_negative_total_power || settings.shortening_rate_on)
+        {
+            T alpha;
+            if (settings.use_force_dependent_shortening_prop_constant)
+            {
+                if (fiber_velocity <= T(0))     // concentric contraction, Vm<0
+                    alpha = (T(0.16) * F_iso) + (T(0.18) * fiber_force_total);
+                else                            // eccentric contraction, Vm>0
+                    alpha = T(0.157) * fiber_force_total;
+            }
+            else
+            {
+                if (fiber_velocity <= T(0))     // concentric contraction, Vm<0
+                    alpha = T(0.25) * fiber_force_total;
+                else                            // eccentric contraction, Vm>0
+                    alpha = T(0);
+            }
+            Sdot = -alpha * fiber_velocity;
+        }
+
+        out.Adot = Adot;
+        out.Mdot = Mdot;
+        out.Sdot = Sdot;
+    }
+
+    /** Given the heat rates computed by calcHeatRates() (or approximated by
+        a surrogate) in out.Adot, out.Mdot and out.Sdot, evaluate the
+        mechanical work rate, apply the clamps on the total power and heat
+        rate, and evaluate the total metabolic rate of a single muscle. Only
+        the active fiber force and fiber velocity are used from the inputs. */
+    template <class T, class P>
+    static void calcWorkAndTotalRates(const BasicSettings<P>& settings,
+                                      const BasicMuscleConstants<P>& mc,
+                                      const MuscleInputs<T>& in,
+                                      MuscleRates<T>& out)
+    {
+        const T Adot = out.Adot, Mdot = out.Mdot;
+        T Sdot = out.Sdot, Wdot = T(0);
+
+        const T scale = T(settings.muscle_effort_scaling_factor);
+        const T mass = T(mc.muscle_mass);
+        const T fiber_force_active = scale * in.active_fiber_force;
+        const T fiber_velocity = in.fiber_velocity;
+
+        // MECHANICAL WORK RATE for the contractile element (W)
+        if (settings.forbid_negative_total_power ||
+            settings.mechanical_work_rate_on)
+        {
+            if (settings.include_negative_mechanical_work
+                || fiber_velocity <= T(0))
+                Wdot = -fiber_force_active*fiber_velocity;
+            else
+                Wdot = T(0);
+        }
+
+        // If necessary, increase the shortening heat rate so that the total
+        // power is non-negative.
+        if (settings.forbid_negative_total_power) {
+            const T Edot_W_beforeClamp = Adot + Mdot + Sdot + Wdot;
+            if (Edot_W_beforeClamp < T(0))
+                Sdot -= Edot_W_beforeClamp;
+        }
+
+        // The total heat rate (i.e., Adot + Mdot + Sdot) for a given muscle
+        // cannot fall below 1.0 W/kg (adapted from Umberger(2003), page 104).
+        T totalHeatRate = Adot + Mdot + Sdot;
+        if (settings.enforce_minimum_heat_rate_per_muscle
+            && totalHeatRate < T(1) * mass
+            && settings.activation_rate_on
+            && settings.maintenance_rate_on
+            && settings.shortening_rate_on)
+            totalHeatRate = T(1) * mass;
+
+        // TOTAL METABOLIC ENERGY RATE (W)
+        T Edot = T(0);
+        if (settings.activation_rate_on && settings.maintenance_rate_on
+            && settings.shortening_rate_on)
+        {
+            Edot += totalHeatRate;      // May have been clamped to 1.0 W/kg.
+        } else {
+            if (settings.activation_rate_on)
+                Edot += Adot;
+            if (settings.maintenance_rate_on)
+                Edot += Mdot;
+            if (settings.shortening_rate_on)
+                Edot += Sdot;
+        }
+        if (settings.mechanical_work_rate_on)
+            Edot += Wdot;
+
+        out.Sdot = Sdot;
+        out.Wdot = Wdot;
+        out.Edot = Edot;
+    }
+};
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_UCHIDABHARGAVA2004_METABOLICS_KERNEL_H_
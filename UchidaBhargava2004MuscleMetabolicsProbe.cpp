@@ -27,7 +27,14 @@
 // INCLUDES and STATICS
 //=============================================================================
 #include "UchidaBhargava2004MuscleMetabolicsProbe.h"
+#include "MuscleMetabolicsFastMath.h"
+#include "MuscleMetabolicsDual.h"
+#include "MuscleMetabolicsSampler.h"
+#include "MuscleMetabolicsEnergyBudget.h"
+#include "MuscleMetabolicsStimulationOnset.h"
+#include "MuscleMetabolicsKernelGenerator.h"
 #include <OpenSim/Simulation/Model/Muscle.h>
+#include <algorithm>
 //#define DEBUG_METABOLICS
 
 using namespace std;
@@ -82,6 +89,19 @@ void UchidaBhargava2004MuscleMetabolicsProbe::setNull()
 		"A phenomenological model for estimating metabolic energy consumption "
 		"in muscle contraction. J Biomech 37, 81-8..");
     _muscleMap.clear();
+    resetSinglePrecisionErrorReport();
+    _surrogateIndices.clear();
+    _numSurrogateFallbacks = 0;
+    clearDeferredInputs();
+    clearSamples();
+    _energyBudgetExceededTime = SimTK::NaN;
+    resetMuscleEvaluationCounter();
+    resetIncrementalEvaluation();
+    _compiledKernel = 0;
+    _stimulationTimeIndices.clear();
+    _probeInputsIndex.invalidate();
+    _autotuneResult = MuscleMetabolicsAutotuner::Result();
+    _autotunedMode = MuscleMetabolicsAutotuner::Exact;
 }
 
 //_____________________________________________________________________________
@@ -110,6 +130,30 @@ void UchidaBhargava2004MuscleMetabolicsProbe::constructProperties()
     constructProperty_include_negative_mechanical_work(true);
     constructProperty_forbid_negative_total_power(true);
     constructProperty_report_total_metabolics_only(true);
+    constructProperty_fast_math(false);
+    constructProperty_single_precision_check_interval(0);
+    constructProperty_single_precision_tolerance(1e-4);
+    constructProperty_use_surrogate(false);
+    constructProperty_surrogate_file("");
+    constructProperty_deferred_evaluation(false);
+    constructProperty_reconstruct_excitation(false);
+    constructProperty_activation_states_file("");
+    constructProperty_count_muscle_evaluations(false);
+    constructProperty_sampling_rate(0);
+    constructProperty_incremental_evaluation(false);
+    constructProperty_incremental_tolerance(1e-4);
+    constructProperty_summary_statistics(false);
+    constructProperty_peak_tracking(false);
+    constructProperty_parameter_sensitivity(false);
+    constructProperty_energy_budget(0);
+    constructProperty_use_compiled_kernel(false);
+    constructProperty_activation_heat_decay(false);
+    constructProperty_activation_heat_decay_time_constant(0.045);
+    constructProperty_activation_heat_decay_onset_excitation(0.02);
+    constructProperty_vector_evaluation(false);
+    constructProperty_autotune(false);
+    constructProperty_autotune_tolerance(1e-3);
+    constructProperty_autotune_cache_file("");
     constructProperty_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet
        (UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet());
 }
@@ -140,6 +184,205 @@ void UchidaBhargava2004MuscleMetabolicsProbe::connectToModel(Model& aModel)
         connectIndividualMetabolicMuscle(aModel, 
             upd_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]);
     }
+    resetSinglePrecisionErrorReport();
+
+    // The execution mode is chosen before the connections that depend on
+    // the settings of the kernel.
+    connectAutotune();
+
+    // Load the surrogates from the sidecar file.
+    if (get_use_surrogate() && !get_surrogate_file().empty()) {
+        try {
+            _surrogates = MuscleMetabolicsSurrogateSet(get_surrogate_file());
+        } catch (const std::exception& x) {
+            cout << "WARNING: " << getName() << ": Unable to load surrogates "
+                "from " << get_surrogate_file() << " (" << x.what() << "). "
+                "The exact equations will be used." << endl;
+            _surrogates.setSize(0);
+        }
+    }
+    connectSurrogates();
+
+    // Load the activation states from which the excitations are
+    // reconstructed.
+    if (get_reconstruct_excitation() && !get_activation_states_file().empty())
+        _excitationEstimator.setActivationStates(
+            Storage(get_activation_states_file()));
+    connectExcitationEstimator();
+    connectIncrementalEvaluation();
+    connectCompiledKernel();
+
+    // The outputs of deferred evaluation are computed from the recorded
+    // states, so only operations on the probe values can be supported.
+    clearDeferredInputs();
+    if (get_deferred_evaluation()
+        && getOperation() != "value" && getOperation() != "integrate") {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": '" << getName()
+            << "' uses the '" << getOperation() << "' operation, which is not "
+            "supported with <deferred_evaluation>. Use 'value' or 'integrate'."
+            << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    clearStatistics();
+    clearSensitivity();
+    clearPeaks();
+    if (get_peak_tracking() && get_report_total_metabolics_only())
+        cout << "WARNING: " << getName() << ": <peak_tracking> tracks the "
+             << "TOTAL metabolic power only; set "
+             << "<report_total_metabolics_only> to false to track the peaks "
+             << "of each muscle." << endl;
+
+    // Samples are recorded in place of the evaluations during a simulation,
+    // which deferred evaluation skips altogether.
+    clearSamples();
+    if (get_sampling_rate() < 0
+        || (get_sampling_rate() > 0 && get_deferred_evaluation())) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": '" << getName()
+            << "' has <sampling_rate> " << get_sampling_rate() << ", which "
+            "must be 0, or positive without <deferred_evaluation>." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    // The budget applies to the energy integrated during the simulation,
+    // which deferred evaluation does not compute.
+    if (get_energy_budget() < 0 || (get_energy_budget() > 0
+        && (getOperation() != "integrate" || get_deferred_evaluation()))) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": '" << getName()
+            << "' has <energy_budget> " << get_energy_budget() << ", which "
+            "must be 0, or positive with the 'integrate' operation and "
+            "without <deferred_evaluation>." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    if (get_activation_heat_decay()
+        && !(get_activation_heat_decay_time_constant() > 0)) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": '" << getName()
+            << "' has <activation_heat_decay_time_constant> "
+            << get_activation_heat_decay_time_constant() << ", which must be "
+            "positive." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Add the sampler of the probe to the System if <sampling_rate> is positive,
+ * the energy budget if the operation is 'integrate', and the stimulation time
+ * of each muscle, with the event restarting it at the onset of stimulation,
+ * if <activation_heat_decay> is true.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::addToSystem(
+    SimTK::MultibodySystem& system) const
+{
+    Super::addToSystem(system);
+
+    _numSamples = 0;
+    if (get_sampling_rate() > 0 && !isDisabled())
+        system.addEventReporter(
+            new MuscleMetabolicsSampler<UchidaBhargava2004MuscleMetabolicsProbe>(
+                *this, 1.0/get_sampling_rate()));
+
+    _energyBudgetExceededTime = SimTK::NaN;
+    if (getOperation() == "integrate" && !get_deferred_evaluation()
+        && !isDisabled())
+        system.addEventHandler(
+            new MuscleMetabolicsEnergyBudget<UchidaBhargava2004MuscleMetabolicsProbe>(*this));
+
+    if (get_activation_heat_decay() && !isDisabled()) {
+        for (int i=0; i<getNumMetabolicMuscles(); ++i) {
+            addStateVariable(getStimulationTimeName(i));
+            system.addEventHandler(
+                new MuscleMetabolicsStimulationOnset<UchidaBhargava2004MuscleMetabolicsProbe>(
+                    *this, i, getStimulationTimeName(i)));
+        }
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Allocate the cache entry of <vector_evaluation>, which holds the probe
+ * inputs of a State for all of the columns of the probe, and find the
+ * stimulation times of <activation_heat_decay> in the State.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::realizeTopology(
+    SimTK::State& state) const
+{
+    Super::realizeTopology(state);
+
+    _probeInputsIndex.invalidate();
+    if (get_vector_evaluation() && !isDisabled())
+        _probeInputsIndex = getModel().getMultibodySystem()
+            .getDefaultSubsystem().allocateLazyCacheEntry(state,
+                Stage::Dynamics,
+                new Value<Vector>(Vector(getNumProbeInputs(), 0.0)));
+
+    _stimulationTimeIndices.clear();
+    if (get_activation_heat_decay() && !isDisabled())
+        for (int i=0; i<getNumMetabolicMuscles(); ++i)
+            _stimulationTimeIndices.push_back(
+                getStateIndex(getStimulationTimeName(i)));
+}
+
+//_____________________________________________________________________________
+/**
+ * The derivative of the stimulation time of each muscle with
+ * <activation_heat_decay>: u/tau (scaled by <muscle_effort_scaling_factor>)
+ * while the muscle is stimulated, and 0 otherwise.
+ */
+Vector UchidaBhargava2004MuscleMetabolicsProbe::
+    computeStateVariableDerivatives(const State& s) const
+{
+    Vector derivs = Super::computeStateVariableDerivatives(s);
+    const int n = derivs.size();
+    const int nS = (int)_stimulationTimeIndices.size();
+    if (nS == 0)
+        return derivs;
+
+    derivs.resizeKeep(n + nS);
+    const double scale = get_muscle_effort_scaling_factor()
+                         / get_activation_heat_decay_time_constant();
+    for (int i=0; i<nS; ++i) {
+        const double excitation = getMuscleExcitation(s, i);
+        derivs[n + i] =
+            (excitation > get_activation_heat_decay_onset_excitation())
+            ? scale*excitation : 0;
+    }
+    return derivs;
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: The name of the state variable holding the stimulation time of
+ * the ith muscle.
+ */
+std::string UchidaBhargava2004MuscleMetabolicsProbe::getStimulationTimeName(
+    int i) const
+{
+    return get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+        .getName() + "_stimulation_time";
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: The factor of the activation heat rate of the ith muscle with
+ * <activation_heat_decay>, from the stimulation time held in the State. The
+ * stimulation time is 0 while the excitation is at or below
+ * <activation_heat_decay_onset_excitation>.
+ */
+double UchidaBhargava2004MuscleMetabolicsProbe::calcActivationHeatDecay(
+    const State& s, int i, double excitation) const
+{
+    if (_stimulationTimeIndices.empty())
+        return 1;
+    if (!(excitation > get_activation_heat_decay_onset_excitation()))
+        return Kernel::calcActivationHeatDecay(0.0);
+    return Kernel::calcActivationHeatDecay(getModel().getMultibodySystem()
+        .getDefaultSubsystem().getZ(s)[ZIndex(_stimulationTimeIndices[i])]);
 }
 
 
@@ -249,10 +492,46 @@ void UchidaBhargava2004MuscleMetabolicsProbe::connectIndividualMetabolicMuscle(
  */
 SimTK::Vector UchidaBhargava2004MuscleMetabolicsProbe::
 computeProbeInputs(const State& s) const
+{
+    // In deferred evaluation, the outputs are computed by
+    // computeDeferredResults() from the inputs recorded by
+    // recordDeferredInputs().
+    if (get_deferred_evaluation())
+        return Vector(getNumProbeInputs(), 0.0);
+
+    // With multi-rate sampling, the inputs are held from the last sample if
+    // it is at or before the time of the state (see recordSample()); only
+    // the last sample is kept, so states before it are evaluated.
+    if (get_sampling_rate() > 0 && _numSamples > 0
+        && s.getTime() >= _lastSampleTime)
+        return _lastSampleInputs;
+
+    // With vector evaluation, the columns of the probe share one evaluation
+    // per State.
+    if (_probeInputsIndex.isValid() && s.getSystemStage() >= Stage::Dynamics) {
+        const DefaultSystemSubsystem& subsystem =
+            getModel().getMultibodySystem().getDefaultSubsystem();
+        Vector& inputs = Value<Vector>::updDowncast(
+            subsystem.updCacheEntry(s, _probeInputsIndex)).upd();
+        if (!subsystem.isCacheValueRealized(s, _probeInputsIndex)) {
+            inputs = calcMetabolicPower(s);
+            subsystem.markCacheValueRealized(s, _probeInputsIndex);
+        }
+        return inputs;
+    }
+
+    return calcMetabolicPower(s);
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Evaluate the metabolic power at the given state.
+ */
+SimTK::Vector UchidaBhargava2004MuscleMetabolicsProbe::
+calcMetabolicPower(const State& s) const
 {
     // Initialize metabolic energy rate values
-    double Adot, Mdot, Sdot, Bdot, Wdot;
-    Adot = Mdot = Sdot = Bdot = Wdot = 0;
+    double Bdot = 0;
     Vector EdotOutput(getNumProbeInputs());
     EdotOutput = 0;
 
@@ -273,6 +552,25 @@ computeProbeInputs(const State& s) const
         EdotOutput(1) = Bdot;    // BASAL metabolic power storage
 
 
+    // Every Nth evaluation is repeated in single precision to estimate the
+    // precision loss of the per-muscle calculations.
+    const Kernel::Settings settings = getKernelSettings();
+    bool singlePrecisionCheck = false;
+    if (get_single_precision_check_interval() > 0) {
+        singlePrecisionCheck = (_numSinglePrecisionEvaluations
+                                % get_single_precision_check_interval() == 0);
+        ++_numSinglePrecisionEvaluations;
+    }
+    double singlePrecisionTotal = Bdot, doublePrecisionTotal = Bdot;
+    const bool incremental = get_incremental_evaluation()
+        && !get_use_surrogate()
+        && (int)_incrementalInputs.size() == getNumMetabolicMuscles();
+    const int numMuscles = getNumMetabolicMuscles();
+    if (singlePrecisionCheck
+        && (int)_singlePrecisionMaxRelErrorMuscles.size() != numMuscles)
+        _singlePrecisionMaxRelErrorMuscles.resize(numMuscles, 0.0);
+
+
     // Loop through each muscle in the MetabolicMuscleParameterSet
     const int nM = 
         get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()
@@ -281,161 +579,101 @@ computeProbeInputs(const State& s) const
     {
         // Get the current muscle parameters from the MetabolicMuscleParameterSet
         // and the corresponding OpenSim::Muscle pointer from the muscleMap.
-        UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameter& mm =
+        const UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameter& mm =
             get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i];
         const Muscle* m = mm.getMuscle();
 
-        // Get important muscle values at the current time state
-        const double max_isometric_force = m->getMaxIsometricForce();
-        const double max_shortening_velocity = m->getMaxContractionVelocity();
-        const double activation = get_muscle_effort_scaling_factor()
-                                  * m->getActivation(s);
-        const double excitation = get_muscle_effort_scaling_factor()
-                                  * m->getControl(s);
-        const double fiber_force_passive = m->getPassiveFiberForce(s);
-        const double fiber_force_active = get_muscle_effort_scaling_factor()
-                                          * m->getActiveFiberForce(s);
-        const double fiber_force_total = fiber_force_active     // Scaled.
-                                         + fiber_force_passive;
-        const double fiber_length_normalized = m->getNormalizedFiberLength(s);
-        const double fiber_velocity = m->getFiberVelocity(s);
-        const double fiber_velocity_normalized = m->getNormalizedFiberVelocity(s);
-        const double slow_twitch_excitation = mm.get_ratio_slow_twitch_fibers() * sin(Pi/2 * excitation);
-        const double fast_twitch_excitation = (1 - mm.get_ratio_slow_twitch_fibers()) * (1 - cos(Pi/2 * excitation));
-        double alpha, fiber_length_dependence;
-
-        // Get the unnormalized total active force, F_iso that 'would' be developed at the current activation
-        // and fiber length under isometric conditions (i.e. Vm=0)
-        const double F_iso = activation * m->getActiveForceLengthMultiplier(s) * max_isometric_force;
+        if (get_count_muscle_evaluations())
+            ++_numMuscleEvaluations;
+
+        // Get the muscle constants and the muscle inputs at the current time
+        // state. If the muscle is within the range of its surrogate, the rates
+        // are evaluated from the surrogate and only its inputs are gathered.
+        const Kernel::MuscleConstants mc = getKernelMuscleConstants(i);
+        Kernel::MuscleInputs<double> in;
+        Kernel::MuscleRates<double> rates;
+        bool surrogate = false;
+        if (get_use_surrogate() && i < (int)_surrogateIndices.size()
+            && _surrogateIndices[i] >= 0) {
+            surrogate = calcSurrogateMuscleRates(s, i, settings, mc, in, rates);
+            if (!surrogate)
+                ++_numSurrogateFallbacks;
+        }
+        if (!surrogate)
+            gatherMuscleInputs(s, i, in);
 
         // Warnings
-        if (fiber_length_normalized < 0)
+        if (m->getNormalizedFiberLength(s) < 0)
             cout << "WARNING: " << getName() << "  (t = " << s.getTime() 
             << "), muscle '" << m->getName() 
             << "' has negative normalized fiber-length." << endl; 
 
 
-
-        // ACTIVATION HEAT RATE for muscle i (W)
-        // ------------------------------------------
-        if (get_forbid_negative_total_power() || get_activation_rate_on())
-        {
-            const double decay_function_value = 1.0;    // This value is set to 1.0, as used by Anderson & Pandy (1999), however, in
-                                                        // Bhargava et al., (2004) they assume a function here. We will ignore this
-                                                        // function and use 1.0 for now.
-            Adot = mm.getMuscleMass() * decay_function_value * 
-                ( (mm.get_activation_constant_slow_twitch() * slow_twitch_excitation) + (mm.get_activation_constant_fast_twitch() * fast_twitch_excitation) );
-        }
-
-
-
-        // MAINTENANCE HEAT RATE for muscle i (W)
-        // ------------------------------------------
-        if (get_forbid_negative_total_power() || get_maintenance_rate_on())
-        {
-            Vector tmp(1, fiber_length_normalized);
-            fiber_length_dependence = get_normalized_fiber_length_dependence_on_maintenance_rate().calcValue(tmp);
-            
-            Mdot = mm.getMuscleMass() * fiber_length_dependence * 
-                ( (mm.get_maintenance_constant_slow_twitch() * slow_twitch_excitation) + (mm.get_maintenance_constant_fast_twitch() * fast_twitch_excitation) );
-        }
-
-
-
-        // SHORTENING HEAT RATE for muscle i (W)
-        // --> note that we define Vm<0 as shortening and Vm>0 as lengthening
+        // Heat rates, mechanical work rate and total metabolic energy rate (W)
+        // for muscle i. See UchidaBhargava2004MuscleMetabolicsKernel.
         // -----------------------------------------------------------------------
-        if (get_forbid_negative_total_power() || get_shortening_rate_on())
-        {
-            if (get_use_force_dependent_shortening_prop_constant())
-            {
-                if (fiber_velocity <= 0)    // concentric contraction, Vm<0
-                    alpha = (0.16 * F_iso) + (0.18 * fiber_force_total);
-                else						// eccentric contraction, Vm>0
-                    alpha = 0.157 * fiber_force_total;
+        bool reused = false;
+        if (!surrogate) {
+            if (incremental && isWithinIncrementalTolerance(i, mc, in)) {
+                reused = true;
+                rates = _incrementalRates[i];
             }
+            else if (_compiledKernel)
+                _compiledKernel->calcMuscleRates(i, in, rates);
             else
-            {
-                if (fiber_velocity <= 0)    // concentric contraction, Vm<0
-                    alpha = 0.25 * fiber_force_total;
-                else						// eccentric contraction, Vm>0
-                    alpha = 0.0;
-            }
-            Sdot = -alpha * fiber_velocity;
+                Kernel::calcMuscleRates(settings, mc, in, rates);
         }
-        
 
+        // The rates of the muscle in single precision, compared to those in
+        // double precision (the surrogate is evaluated in double precision).
+        if (singlePrecisionCheck) {
+            double singlePrecisionEdot = rates.Edot;
+            double doublePrecisionEdot = rates.Edot;
+            if (!surrogate) {
+                Kernel::MuscleInputs<float> inFloat;
+                Kernel::MuscleRates<float> ratesFloat;
+                Kernel::MuscleRates<double> ratesDouble;
+                Kernel::convert(in, inFloat);
+                Kernel::calcMuscleRates(settings, mc, inFloat, ratesFloat);
+                Kernel::convert(ratesFloat, ratesDouble);
+                singlePrecisionEdot = ratesDouble.Edot;
+                Kernel::calcMuscleRates(settings, mc, in, ratesDouble);
+                doublePrecisionEdot = ratesDouble.Edot;
+                updateSinglePrecisionError(
+                    _singlePrecisionMaxRelErrorMuscles[i],
+                    singlePrecisionEdot, doublePrecisionEdot);
+            }
+            singlePrecisionTotal += singlePrecisionEdot;
+            doublePrecisionTotal += doublePrecisionEdot;
+        }
 
-        // MECHANICAL WORK RATE for the contractile element of muscle i (W).
-        // --> note that we define Vm<0 as shortening and Vm>0 as lengthening.
-        // -------------------------------------------------------------------
-        if (get_forbid_negative_total_power() || get_mechanical_work_rate_on())
-        {
-            if (get_include_negative_mechanical_work() || fiber_velocity <= 0)
-                Wdot = -fiber_force_active*fiber_velocity;
+        if (incremental) {
+            ++_numIncrementalEvaluations;
+            if (reused)
+                ++_numReusedMuscleEvaluations;
             else
-                Wdot = 0;
+                updateIncrementalCache(i, in, rates);
         }
 
 
         // NAN CHECKING
         // ------------------------------------------
-        if (isNaN(Adot))
+        if (isNaN(rates.Adot))
             cout << "WARNING::" << getName() << ": Adot (" << m->getName() << ") = NaN!" << endl;
-        if (isNaN(Mdot))
+        if (isNaN(rates.Mdot))
             cout << "WARNING::" << getName() << ": Mdot (" << m->getName() << ") = NaN!" << endl;
-        if (isNaN(Sdot))
+        if (isNaN(rates.Sdot))
             cout << "WARNING::" << getName() << ": Sdot (" << m->getName() << ") = NaN!" << endl;
-        if (isNaN(Wdot))
+        if (isNaN(rates.Wdot))
             cout << "WARNING::" << getName() << ": Wdot (" << m->getName() << ") = NaN!" << endl;
 
 
-        // If necessary, increase the shortening heat rate so that the total
-        // power is non-negative.
-        if (get_forbid_negative_total_power()) {
-            const double Edot_W_beforeClamp = Adot + Mdot + Sdot + Wdot;
-            if (Edot_W_beforeClamp < 0)
-                Sdot -= Edot_W_beforeClamp;
-        }
-
-
-        // This check is adapted from Umberger(2003), page 104: the total heat rate 
-        // (i.e., Adot + Mdot + Sdot) for a given muscle cannot fall below 1.0 W/kg.
-        // -----------------------------------------------------------------------
-        double totalHeatRate = Adot + Mdot + Sdot;      // (W)
-
-        if(get_enforce_minimum_heat_rate_per_muscle() && totalHeatRate < 1.0 * mm.getMuscleMass()
-            && get_activation_rate_on() 
-            && get_maintenance_rate_on() 
-            && get_shortening_rate_on()) {
-                //cout << "WARNING: " << getName() 
-                //    << "  (t = " << s.getTime() 
-                //    << "), the muscle '" << mm.getName() 
-                //    << "' has a net metabolic energy rate of less than 1.0 W/kg." << endl; 
-                totalHeatRate = 1.0 * mm.getMuscleMass();			// not allowed to fall below 1.0 W.kg-1
-        }
-
-
         // TOTAL METABOLIC ENERGY RATE for muscle i (W)
         // ------------------------------------------
-        double Edot = 0;
+        const double Edot = rates.Edot;
 
-        if (get_activation_rate_on() && get_maintenance_rate_on()
-            && get_shortening_rate_on())
-        {
-            Edot += totalHeatRate;      // May have been clamped to 1.0 W/kg.
-        } else {
-            if (get_activation_rate_on())
-                Edot += Adot;
-            if (get_maintenance_rate_on())
-                Edot += Mdot;
-            if (get_shortening_rate_on())
-                Edot += Sdot;
-        }
-        if (get_mechanical_work_rate_on())
-            Edot += Wdot;
-
-        EdotOutput(0) += Edot;       // Add to TOTAL metabolic power storage
+        if (!incremental)
+            EdotOutput(0) += Edot;   // Add to TOTAL metabolic power storage
         if (!get_report_total_metabolics_only()) {
             // Metabolic power storage for muscle i
             EdotOutput(i+2) = Edot;  
@@ -444,40 +682,203 @@ computeProbeInputs(const State& s) const
 
 
 #ifdef DEBUG_METABOLICS
-        cout << "muscle_mass = " << mm.getMuscleMass() << endl;
-        cout << "ratio_slow_twitch_fibers = " << mm.get_ratio_slow_twitch_fibers() << endl;
-        cout << "activation_constant_slow_twitch = " << mm.get_activation_constant_slow_twitch() << endl;
-        cout << "activation_constant_fast_twitch = " << mm.get_activation_constant_fast_twitch() << endl;
-        cout << "maintenance_constant_slow_twitch = " << mm.get_maintenance_constant_slow_twitch() << endl;
-        cout << "maintenance_constant_fast_twitch = " << mm.get_maintenance_constant_fast_twitch() << endl;
+        cout << "muscle_mass = " << mc.muscle_mass << endl;
+        cout << "ratio_slow_twitch_fibers = " << mc.ratio_slow_twitch_fibers << endl;
+        cout << "activation_constant_slow_twitch = " << mc.activation_constant_slow_twitch << endl;
+        cout << "activation_constant_fast_twitch = " << mc.activation_constant_fast_twitch << endl;
+        cout << "maintenance_constant_slow_twitch = " << mc.maintenance_constant_slow_twitch << endl;
+        cout << "maintenance_constant_fast_twitch = " << mc.maintenance_constant_fast_twitch << endl;
         cout << "bodymass = " << _model->getMatterSubsystem().calcSystemMass(s) << endl;
-        cout << "max_isometric_force = " << max_isometric_force << endl;
-        cout << "activation = " << activation << endl;
-        cout << "excitation = " << excitation << endl;
-        cout << "fiber_force_total = " << fiber_force_total << endl;
-        cout << "fiber_force_active = " << fiber_force_active << endl;
-        cout << "fiber_length_normalized = " << fiber_length_normalized << endl;
-        cout << "fiber_length_dependence = " << fiber_length_dependence << endl;
-        cout << "fiber_velocity = " << fiber_velocity << endl;
-        cout << "fiber_velocity_normalized = " << fiber_velocity_normalized << endl;
-        cout << "slow_twitch_excitation = " << slow_twitch_excitation << endl;
-        cout << "fast_twitch_excitation = " << fast_twitch_excitation << endl;
-        cout << "max shortening velocity = " << max_shortening_velocity << endl;
-        cout << "alpha = " << alpha << endl;
-        cout << "Adot = " << Adot << endl;
-        cout << "Mdot = " << Mdot << endl;
-        cout << "Sdot = " << Sdot << endl;
+        cout << "max_isometric_force = " << mc.max_isometric_force << endl;
+        cout << "activation = " << in.activation << endl;
+        cout << "excitation = " << in.excitation << endl;
+        cout << "fiber_force_passive = " << in.passive_fiber_force << endl;
+        cout << "fiber_force_active = " << in.active_fiber_force << endl;
+        cout << "fiber_length_dependence = " << in.fiber_length_dependence << endl;
+        cout << "activation_heat_decay = " << in.activation_heat_decay << endl;
+        cout << "fiber_velocity = " << in.fiber_velocity << endl;
+        cout << "Adot = " << rates.Adot << endl;
+        cout << "Mdot = " << rates.Mdot << endl;
+        cout << "Sdot = " << rates.Sdot << endl;
         cout << "Bdot = " << Bdot << endl;
-        cout << "Wdot = " << Wdot << endl;
+        cout << "Wdot = " << rates.Wdot << endl;
         cout << "Edot = " << Edot << endl;
 		std::cin.get();
 #endif
     }
 
+    // In incremental evaluation, the sum of the metabolic rates of the muscles
+    // is updated by updateIncrementalCache().
+    if (incremental)
+        EdotOutput(0) += _incrementalTotal;
+
+    if (singlePrecisionCheck) {
+        ++_numSinglePrecisionChecks;
+        updateSinglePrecisionError(_singlePrecisionMaxRelErrorTotal,
+                                   singlePrecisionTotal, doublePrecisionTotal);
+        checkSinglePrecisionTolerance(s);
+    }
+
     return EdotOutput;
 }
 
 
+//_____________________________________________________________________________
+/**
+ * Get the probe-wide settings used by the per-muscle kernel.
+ */
+UchidaBhargava2004MuscleMetabolicsKernel::Settings
+    UchidaBhargava2004MuscleMetabolicsProbe::getKernelSettings() const
+{
+    Kernel::Settings settings;
+    settings.activation_rate_on = get_activation_rate_on();
+    settings.maintenance_rate_on = get_maintenance_rate_on();
+    settings.shortening_rate_on = get_shortening_rate_on();
+    settings.mechanical_work_rate_on = get_mechanical_work_rate_on();
+    settings.enforce_minimum_heat_rate_per_muscle =
+        get_enforce_minimum_heat_rate_per_muscle();
+    settings.use_force_dependent_shortening_prop_constant =
+        get_use_force_dependent_shortening_prop_constant();
+    settings.include_negative_mechanical_work =
+        get_include_negative_mechanical_work();
+    settings.forbid_negative_total_power = get_forbid_negative_total_power();
+    settings.fast_math = usesFastMath();
+    settings.muscle_effort_scaling_factor = get_muscle_effort_scaling_factor();
+    return settings;
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Get the constant parameters of muscle i used by the per-muscle kernel.
+ */
+UchidaBhargava2004MuscleMetabolicsKernel::MuscleConstants
+    UchidaBhargava2004MuscleMetabolicsProbe::getKernelMuscleConstants(int i) const
+{
+    const UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameter& mm =
+        get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i];
+
+    Kernel::MuscleConstants mc;
+    mc.muscle_mass = mm.getMuscleMass();
+    mc.ratio_slow_twitch_fibers = mm.get_ratio_slow_twitch_fibers();
+    mc.activation_constant_slow_twitch = mm.get_activation_constant_slow_twitch();
+    mc.activation_constant_fast_twitch = mm.get_activation_constant_fast_twitch();
+    mc.maintenance_constant_slow_twitch = mm.get_maintenance_constant_slow_twitch();
+    mc.maintenance_constant_fast_twitch = mm.get_maintenance_constant_fast_twitch();
+    mc.max_isometric_force = mm.getMuscle()->getMaxIsometricForce();
+    return mc;
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Get muscle i of the MetabolicMuscleParameterSet.
+ */
+const Muscle& UchidaBhargava2004MuscleMetabolicsProbe::getMetabolicMuscle(int i) const
+{
+    return *get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+        .getMuscle();
+}
+
+//_____________________________________________________________________________
+/**
+ * Gather the state-dependent inputs of muscle i used by the per-muscle kernel.
+ * The state must be realized to Stage::Dynamics.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::gatherMuscleInputs(
+    const State& s, int i, Kernel::MuscleInputs<double>& in) const
+{
+    const Muscle* m =
+        get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+        .getMuscle();
+
+    in.excitation = getMuscleExcitation(s, i);
+    in.activation = m->getActivation(s);
+    in.active_fiber_force = m->getActiveFiberForce(s);
+    in.passive_fiber_force = m->getPassiveFiberForce(s);
+    in.fiber_velocity = m->getFiberVelocity(s);
+    in.active_force_length_multiplier = m->getActiveForceLengthMultiplier(s);
+
+    // The fiber length dependence is needed only for the maintenance heat rate.
+    in.fiber_length_dependence = 0;
+    if (get_forbid_negative_total_power() || get_maintenance_rate_on()) {
+        Vector tmp(1, m->getNormalizedFiberLength(s));
+        in.fiber_length_dependence =
+            get_normalized_fiber_length_dependence_on_maintenance_rate().calcValue(tmp);
+    }
+
+    in.activation_heat_decay = calcActivationHeatDecay(s, i, in.excitation);
+}
+
+//_____________________________________________________________________________
+/**
+ * Create a real-time evaluator from the current properties of the probe.
+ */
+UchidaBhargava2004MuscleMetabolicsProbe::RealTimeEvaluator
+    UchidaBhargava2004MuscleMetabolicsProbe::createRealTimeEvaluator(const State& s) const
+{
+    double Bdot = 0;
+    if (get_basal_rate_on())
+        Bdot = get_basal_coefficient()
+            * pow(_model->getMatterSubsystem().calcSystemMass(s), get_basal_exponent());
+
+    RealTimeEvaluator evaluator(getKernelSettings(), Bdot);
+    for (int i=0; i<getNumMetabolicMuscles(); ++i)
+        evaluator.addMuscle(getKernelMuscleConstants(i));
+    return evaluator;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the compiled kernel used when <use_compiled_kernel> is true.
+ */
+const UchidaBhargava2004MuscleMetabolicsProbe::CompiledKernel*
+    UchidaBhargava2004MuscleMetabolicsProbe::getCompiledKernel() const
+{
+    return _compiledKernel;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the trials of the execution modes with <autotune>.
+ */
+const MuscleMetabolicsAutotuner::Result&
+    UchidaBhargava2004MuscleMetabolicsProbe::getAutotuneResult() const
+{
+    return _autotuneResult;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the execution mode chosen with <autotune>.
+ */
+MuscleMetabolicsAutotuner::Mode
+    UchidaBhargava2004MuscleMetabolicsProbe::getAutotunedMode() const
+{
+    return _autotunedMode;
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Whether the muscles are evaluated with the approximations of
+ * <fast_math> or by the compiled kernel: in the mode chosen with <autotune>,
+ * or as set by the properties otherwise.
+ */
+bool UchidaBhargava2004MuscleMetabolicsProbe::usesFastMath() const
+{
+    if (get_autotune())
+        return _autotunedMode == MuscleMetabolicsAutotuner::FastMath;
+    return get_fast_math();
+}
+
+bool UchidaBhargava2004MuscleMetabolicsProbe::usesCompiledKernel() const
+{
+    if (get_autotune())
+        return _autotunedMode == MuscleMetabolicsAutotuner::CompiledKernel;
+    return get_use_compiled_kernel();
+}
+
+
 //_____________________________________________________________________________
 /** 
  * Returns the number of probe inputs in the vector returned by computeProbeInputs().
@@ -494,29 +895,596 @@ int UchidaBhargava2004MuscleMetabolicsProbe::getNumProbeInputs() const
         return 2 + getNumMetabolicMuscles();
 }
 
-
+
+//_____________________________________________________________________________
+/** 
+ * Provide labels for the probe values being reported.
+ * If report_total_metabolics_only = true, then only the TOTAL metabolics will be
+ * calculated. If report_total_metabolics_only = false, then the calculation will
+ * consist of a TOTAL value, a BASAL value, and each individual muscle
+ * contribution.
+ */
+Array<string> UchidaBhargava2004MuscleMetabolicsProbe::getProbeOutputLabels() const
+{
+    Array<string> labels;
+    labels.append(getName()+"_TOTAL");
+
+    if (get_report_total_metabolics_only())
+        return labels;
+
+    labels.append(getName()+"_BASAL");
+
+    for (int i=0; i<getNumMetabolicMuscles(); ++i)
+        labels.append(getName()+"_"+get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i].getName());
+
+    return labels;
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Whether computeProbeInputs() may be called concurrently on distinct States.
+ * The options below write to the probe (or, for reconstruct_excitation, to
+ * the workspace of the activation splines) during the evaluation.
+ */
+bool UchidaBhargava2004MuscleMetabolicsProbe::supportsConcurrentEvaluation() const
+{
+    return get_single_precision_check_interval() == 0
+        && !get_use_surrogate()
+        && !get_count_muscle_evaluations()
+        && !get_incremental_evaluation()
+        && !get_reconstruct_excitation()
+        && get_sampling_rate() == 0;
+}
+
+
+
+
+//=============================================================================
+// SINGLE-PRECISION ERROR REPORT
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Record the relative deviation of a value computed in single
+ * precision from its double-precision reference.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::updateSinglePrecisionError(
+    double& maxRelError, double value, double reference)
+{
+    double relError = fabs(value - reference);
+    if (fabs(reference) > SimTK::SignificantReal)
+        relError /= fabs(reference);
+    if (relError > maxRelError || isNaN(relError))
+        maxRelError = relError;
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Print a warning (once) if the maximum relative deviation exceeds
+ * the <single_precision_tolerance>.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::checkSinglePrecisionTolerance(
+    const State& s) const
+{
+    if (_singlePrecisionWarningIssued)
+        return;
+
+    double maxRelError = _singlePrecisionMaxRelErrorTotal;
+    for (unsigned int i=0; i<_singlePrecisionMaxRelErrorMuscles.size(); ++i)
+        maxRelError = max(maxRelError, _singlePrecisionMaxRelErrorMuscles[i]);
+
+    if (maxRelError > get_single_precision_tolerance() || isNaN(maxRelError)) {
+        cout << "WARNING: " << getName() << "  (t = " << s.getTime()
+            << "), single-precision metabolic power deviates from double "
+            "precision by " << maxRelError << " (relative), which exceeds "
+            "<single_precision_tolerance> = " << get_single_precision_tolerance()
+            << "." << endl;
+        _singlePrecisionWarningIssued = true;
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the number of evaluations that were checked in double precision.
+ */
+int UchidaBhargava2004MuscleMetabolicsProbe::getNumSinglePrecisionChecks() const
+{
+    return _numSinglePrecisionChecks;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the maximum relative deviation of the TOTAL metabolic power.
+ */
+double UchidaBhargava2004MuscleMetabolicsProbe::
+    getSinglePrecisionMaxRelativeError() const
+{
+    return _singlePrecisionMaxRelErrorTotal;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the maximum relative deviation of the metabolic power of a muscle.
+ */
+double UchidaBhargava2004MuscleMetabolicsProbe::
+    getSinglePrecisionMaxRelativeError(const std::string& muscleName) const
+{
+    const int k = get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()
+                  .getIndex(muscleName);
+    if (k < 0) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": Invalid muscle "
+            << muscleName << " in the MetabolicMuscleParameterSet." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    return (k < (int)_singlePrecisionMaxRelErrorMuscles.size())
+           ? _singlePrecisionMaxRelErrorMuscles[k] : 0.0;
+}
+
+//_____________________________________________________________________________
+/**
+ * Print the single-precision error report.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::
+    printSinglePrecisionErrorReport(std::ostream& out) const
+{
+    const double tol = get_single_precision_tolerance();
+    double maxRelError = _singlePrecisionMaxRelErrorTotal;
+
+    out << getName() << ": single-precision error report ("
+        << _numSinglePrecisionChecks << " evaluations checked)" << endl;
+    out << "    " << getName() << "_TOTAL: " << _singlePrecisionMaxRelErrorTotal
+        << endl;
+    for (int i=0; i<getNumMetabolicMuscles(); ++i) {
+        const double err = (i < (int)_singlePrecisionMaxRelErrorMuscles.size())
+                           ? _singlePrecisionMaxRelErrorMuscles[i] : 0.0;
+        maxRelError = max(maxRelError, err);
+        out << "    " << getName() << "_"
+            << get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i].getName()
+            << ": " << err << endl;
+    }
+    out << "    maximum relative deviation " << maxRelError
+        << ((maxRelError <= tol) ? " is within" : " EXCEEDS")
+        << " <single_precision_tolerance> = " << tol << endl;
+}
+
+//_____________________________________________________________________________
+/**
+ * Reset the single-precision error report.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::resetSinglePrecisionErrorReport()
+{
+    _numSinglePrecisionEvaluations = 0;
+    _numSinglePrecisionChecks = 0;
+    _singlePrecisionMaxRelErrorTotal = 0;
+    _singlePrecisionMaxRelErrorMuscles.clear();
+    _singlePrecisionWarningIssued = false;
+}
+
+
+
+
+//=============================================================================
+// SURROGATES
+//=============================================================================
+namespace {
+    // Heat rates of a muscle at a node of its surrogate, from the exact
+    // kernel. The active-force-length multiplier, the passive fiber force and
+    // the fiber length dependence of the maintenance heat rate are
+    // interpolated from the values observed at the node's fiber length.
+    class BhargavaSurrogateNodeFunction {
+    public:
+        BhargavaSurrogateNodeFunction(
+            const UchidaBhargava2004MuscleMetabolicsKernel::Settings& settings,
+            const UchidaBhargava2004MuscleMetabolicsKernel::MuscleConstants& mc,
+            double optimalFiberLength,
+            const MuscleMetabolicsSurrogate::FiberLengthTable& table)
+        :   _settings(settings), _mc(mc),
+            _optimalFiberLength(optimalFiberLength), _table(table) {}
+
+        void operator()(const MuscleMetabolicsSurrogate::InputVector& x,
+                        double* heatRates) const
+        {
+            UchidaBhargava2004MuscleMetabolicsKernel::MuscleInputs<double> in;
+            const Vec3 lengthDependent = _table.calcValue(x[2]);
+            in.excitation = x[0];
+            in.activation = x[1];
+            in.fiber_velocity = x[3] * _optimalFiberLength;
+            in.active_fiber_force = x[4];
+            in.active_force_length_multiplier = lengthDependent[0];
+            in.passive_fiber_force = lengthDependent[1];
+            in.fiber_length_dependence = lengthDependent[2];
+            in.activation_heat_decay = 1;   // Applied to the interpolated rate.
+
+            UchidaBhargava2004MuscleMetabolicsKernel::MuscleRates<double> rates;
+            UchidaBhargava2004MuscleMetabolicsKernel::calcHeatRates(
+                _settings, _mc, in, rates);
+            heatRates[0] = rates.Adot;
+            heatRates[1] = rates.Mdot;
+            heatRates[2] = rates.Sdot;
+        }
+
+    private:
+        UchidaBhargava2004MuscleMetabolicsKernel::Settings _settings;
+        UchidaBhargava2004MuscleMetabolicsKernel::MuscleConstants _mc;
+        double _optimalFiberLength;
+        const MuscleMetabolicsSurrogate::FiberLengthTable& _table;
+    };
+}
+
+//_____________________________________________________________________________
+/**
+ * Fit a surrogate for each muscle to the exact equations over the operating
+ * range observed in the given states.
+ */
+MuscleMetabolicsSurrogateSet UchidaBhargava2004MuscleMetabolicsProbe::
+    fitSurrogates(const std::vector<SimTK::State>& states,
+                  int numNodesPerInput) const
+{
+    // The surrogates approximate the exact equations.
+    Kernel::Settings settings = getKernelSettings();
+    settings.fast_math = false;
+
+    MuscleMetabolicsSurrogateSet surrogates;
+    for (int i=0; i<getNumMetabolicMuscles(); ++i) {
+        const Kernel::MuscleConstants mc = getKernelMuscleConstants(i);
+        std::vector<MuscleMetabolicsSurrogate::InputVector>
+            observedInputs(states.size());
+        MuscleMetabolicsSurrogate::FiberLengthTable table;
+        for (unsigned int k=0; k<states.size(); ++k) {
+            Kernel::MuscleInputs<double> in;
+            gatherMuscleInputs(states[k], i, in);
+            gatherSurrogateInputs(states[k], i, observedInputs[k]);
+            table.addSample(observedInputs[k][2],
+                            Vec3(in.active_force_length_multiplier,
+                                 in.passive_fiber_force,
+                                 in.fiber_length_dependence));
+        }
+        table.sort();
+
+        MuscleMetabolicsSurrogate* surrogate = new MuscleMetabolicsSurrogate(
+            get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+            .getName());
+        const double optimalFiberLength =
+            get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+            .getMuscle()->getOptimalFiberLength();
+        const int numNodes[MuscleMetabolicsSurrogate::NumInputs] = {
+            numNodesPerInput, numNodesPerInput, numNodesPerInput,
+            numNodesPerInput, numNodesPerInput };
+        surrogate->fit(observedInputs, numNodes, 3,
+            BhargavaSurrogateNodeFunction(settings, mc, optimalFiberLength, table));
+        surrogates.adoptAndAppend(surrogate);
+    }
+    return surrogates;
+}
+
+//_____________________________________________________________________________
+/**
+ * Set the surrogates used when <use_surrogate> is true.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::setSurrogates(
+    const MuscleMetabolicsSurrogateSet& surrogates)
+{
+    _surrogates = surrogates;
+    connectSurrogates();
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the surrogates used when <use_surrogate> is true.
+ */
+const MuscleMetabolicsSurrogateSet&
+    UchidaBhargava2004MuscleMetabolicsProbe::getSurrogates() const
+{
+    return _surrogates;
+}
+
+//_____________________________________________________________________________
+/**
+ * Compare the surrogates to the exact equations at the given states.
+ */
+SimTK::Vector UchidaBhargava2004MuscleMetabolicsProbe::validateSurrogates(
+    const std::vector<SimTK::State>& states, std::ostream& out) const
+{
+    const Kernel::Settings settings = getKernelSettings();
+    const int nM = getNumMetabolicMuscles();
+    Vector maxError(nM, 0.0);
+
+    out << getName() << ": surrogate validation report (" << states.size()
+        << " states)" << endl;
+    for (int i=0; i<nM; ++i) {
+        const std::string& muscleName =
+            get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+            .getName();
+        const int k = (i < (int)_surrogateIndices.size())
+                      ? _surrogateIndices[i] : -1;
+        if (k < 0) {
+            out << "    " << muscleName << ": no surrogate" << endl;
+            continue;
+        }
+
+        const Kernel::MuscleConstants mc = getKernelMuscleConstants(i);
+        double sumSquaredError = 0, sumSquaredExact = 0;
+        int numInRange = 0;
+        for (unsigned int j=0; j<states.size(); ++j) {
+            Kernel::MuscleInputs<double> in;
+            Kernel::MuscleRates<double> ratesSurrogate, rates;
+            if (!calcSurrogateMuscleRates(states[j], i, settings, mc, in,
+                                          ratesSurrogate))
+                continue;
+            gatherMuscleInputs(states[j], i, in);
+            Kernel::calcMuscleRates(settings, mc, in, rates);
+
+            const double error = fabs(ratesSurrogate.Edot - rates.Edot);
+            maxError[i] = max(maxError[i], error);
+            sumSquaredError += error*error;
+            sumSquaredExact += rates.Edot*rates.Edot;
+            ++numInRange;
+        }
+
+        const double rmsError = numInRange ? sqrt(sumSquaredError/numInRange) : 0;
+        const double rmsExact = numInRange ? sqrt(sumSquaredExact/numInRange) : 0;
+        out << "    " << muscleName << ": max error " << maxError[i]
+            << " W, RMS error " << rmsError << " W (RMS exact " << rmsExact
+            << " W), " << (states.size() - numInRange) << " of "
+            << states.size() << " states out of range" << endl;
+    }
+    return maxError;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the number of muscle evaluations that fell back to the exact equations.
+ */
+int UchidaBhargava2004MuscleMetabolicsProbe::getNumSurrogateFallbacks() const
+{
+    return _numSurrogateFallbacks;
+}
+
+//_____________________________________________________________________________
+/**
+ * Gather the inputs of the surrogate of muscle i.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::gatherSurrogateInputs(
+    const State& s, int i, MuscleMetabolicsSurrogate::InputVector& x) const
+{
+    const Muscle* m =
+        get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+        .getMuscle();
+
+    x[0] = getMuscleExcitation(s, i);
+    x[1] = m->getActivation(s);
+    x[2] = m->getNormalizedFiberLength(s);
+    x[3] = m->getFiberVelocity(s) / m->getOptimalFiberLength();
+    x[4] = m->getActiveFiberForce(s);
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Map each muscle in the MetabolicMuscleParameterSet to the
+ * surrogate of the same name.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::connectSurrogates()
+{
+    _numSurrogateFallbacks = 0;
+    _surrogateIndices.assign(getNumMetabolicMuscles(), -1);
+    if (_surrogates.getSize() == 0)
+        return;
+
+    for (int i=0; i<getNumMetabolicMuscles(); ++i) {
+        const std::string& muscleName =
+            get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+            .getName();
+        const int k = _surrogates.getIndex(muscleName);
+        if (k < 0) {
+            if (get_use_surrogate())
+                cout << "WARNING: " << getName() << ": No surrogate for muscle '"
+                    << muscleName << "'. The exact equations will be used."
+                    << endl;
+            continue;
+        }
+        _surrogates[k].initialize();
+        _surrogateIndices[i] = k;
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Evaluate the rates of muscle i from its surrogate. The heat rates
+ * are interpolated; the mechanical work rate, the clamps and the total rate
+ * are evaluated exactly by the kernel.
+ */
+bool UchidaBhargava2004MuscleMetabolicsProbe::calcSurrogateMuscleRates(
+    const State& s, int i, const Kernel::Settings& settings,
+    const Kernel::MuscleConstants& mc, Kernel::MuscleInputs<double>& in,
+    Kernel::MuscleRates<double>& rates) const
+{
+    if (i >= (int)_surrogateIndices.size() || _surrogateIndices[i] < 0)
+        return false;
+
+    const MuscleMetabolicsSurrogate& surrogate =
+        _surrogates[_surrogateIndices[i]];
+    MuscleMetabolicsSurrogate::InputVector x;
+    gatherSurrogateInputs(s, i, x);
+    if (!surrogate.isInRange(x))
+        return false;
+
+    // The surrogate is fitted without the activation heat decay.
+    in.activation_heat_decay =
+        calcActivationHeatDecay(s, i, getMuscleExcitation(s, i));
+
+    double heatRates[MuscleMetabolicsSurrogate::MaxHeatRates];
+    surrogate.calcHeatRates(x, heatRates);
+    rates.Adot = in.activation_heat_decay * heatRates[0];
+    rates.Mdot = heatRates[1];
+    rates.Sdot = heatRates[2];
+
+    const Muscle* m =
+        get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+        .getMuscle();
+    in.excitation = x[0];
+    in.activation = x[1];
+    in.fiber_velocity = x[3] * m->getOptimalFiberLength();
+    in.active_fiber_force = x[4];
+    in.passive_fiber_force = SimTK::NaN;                // Not gathered.
+    in.active_force_length_multiplier = SimTK::NaN;
+    in.fiber_length_dependence = SimTK::NaN;
+    Kernel::calcWorkAndTotalRates(settings, mc, in, rates);
+    return true;
+}
+
+
+
+
+//=============================================================================
+// DEFERRED EVALUATION
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Record the time, the basal rate and the inputs of each muscle at the given
+ * state.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::recordDeferredInputs(const State& s)
+{
+    double Bdot = 0;
+    if (get_basal_rate_on())
+        Bdot = get_basal_coefficient()
+            * pow(_model->getMatterSubsystem().calcSystemMass(s), get_basal_exponent());
+
+    _deferredRecords.times.push_back(s.getTime());
+    _deferredRecords.basalRates.push_back(Bdot);
+    for (int i=0; i<getNumMetabolicMuscles(); ++i) {
+        _deferredRecords.inputs.push_back(Kernel::MuscleInputs<double>());
+        gatherMuscleInputs(s, i, _deferredRecords.inputs.back());
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the number of recorded states.
+ */
+int UchidaBhargava2004MuscleMetabolicsProbe::getNumDeferredRecords() const
+{
+    return (int)_deferredRecords.times.size();
+}
+
+//_____________________________________________________________________________
+/**
+ * Discard the recorded inputs. The capacity of the records is kept, so that
+ * recording resumes without reallocation.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::clearDeferredInputs()
+{
+    _deferredRecords.times.clear();
+    _deferredRecords.basalRates.clear();
+    _deferredRecords.inputs.clear();
+}
+
+//_____________________________________________________________________________
+/**
+ * Exchange the recorded inputs with the given records.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::swapDeferredInputs(DeferredRecords& records)
+{
+    _deferredRecords.times.swap(records.times);
+    _deferredRecords.basalRates.swap(records.basalRates);
+    _deferredRecords.inputs.swap(records.inputs);
+}
+
+//_____________________________________________________________________________
+/**
+ * Compute the probe inputs (TOTAL, BASAL and per-muscle metabolic power, as
+ * returned by computeProbeInputs()) at each of the given records, and append
+ * them to 'outputs'.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::calcDeferredOutputs(const DeferredRecords& records,
+    std::vector<Vector>& outputs) const
+{
+    const Kernel::Settings settings = getKernelSettings();
+    const int numMuscles = getNumMetabolicMuscles();
+    std::vector<Kernel::MuscleConstants> mc(numMuscles);
+    for (int i=0; i<numMuscles; ++i)
+        mc[i] = getKernelMuscleConstants(i);
+
+    const int numOutputs = getNumProbeInputs();
+    std::vector<Kernel::MuscleRates<double> > rates(numMuscles);
+    for (unsigned int k=0; k<records.times.size(); ++k) {
+        Vector EdotOutput(numOutputs, 0.0);
+        const double Bdot = records.basalRates[k];
+        EdotOutput(0) += Bdot;
+        if (!get_report_total_metabolics_only())
+            EdotOutput(1) = Bdot;
+
+        // A compiled kernel evaluates all muscles of a record in one call.
+        if (_compiledKernel && numMuscles > 0)
+            _compiledKernel->calcMuscleRates(&records.inputs[k*numMuscles],
+                                             &rates[0]);
+        else
+            for (int i=0; i<numMuscles; ++i)
+                Kernel::calcMuscleRates(settings, mc[i],
+                    records.inputs[k*numMuscles+i], rates[i]);
+
+        for (int i=0; i<numMuscles; ++i) {
+            EdotOutput(0) += rates[i].Edot;
+            if (!get_report_total_metabolics_only())
+                EdotOutput(i+2) = rates[i].Edot;
+        }
+        outputs.push_back(EdotOutput);
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Create a block for the records of this probe.
+ */
+MuscleMetabolicsReportedProbe::DeferredBlock*
+    UchidaBhargava2004MuscleMetabolicsProbe::createDeferredBlock()
+{
+    return new MuscleMetabolicsDeferredBlock<UchidaBhargava2004MuscleMetabolicsProbe>(*this);
+}
+
+//_____________________________________________________________________________
+/**
+ * Compute the probe outputs at the recorded states.
+ */
+Storage UchidaBhargava2004MuscleMetabolicsProbe::computeDeferredResults() const
+{
+    std::vector<Vector> outputs;
+    outputs.reserve(getNumDeferredRecords());
+    calcDeferredOutputs(_deferredRecords, outputs);
+    return computeDeferredResults(_deferredRecords.times, outputs);
+}
+
 //_____________________________________________________________________________
-/** 
- * Provide labels for the probe values being reported.
- * If report_total_metabolics_only = true, then only the TOTAL metabolics will be
- * calculated. If report_total_metabolics_only = false, then the calculation will
- * consist of a TOTAL value, a BASAL value, and each individual muscle
- * contribution.
+/**
+ * Compute the probe outputs from the probe inputs at the given times.
  */
-Array<string> UchidaBhargava2004MuscleMetabolicsProbe::getProbeOutputLabels() const
+Storage UchidaBhargava2004MuscleMetabolicsProbe::computeDeferredResults(
+    const std::vector<double>& times, const std::vector<Vector>& outputs) const
 {
     Array<string> labels;
-    labels.append(getName()+"_TOTAL");
-
-    if (get_report_total_metabolics_only())
-        return labels;
-
-    labels.append(getName()+"_BASAL");
-
-    for (int i=0; i<getNumMetabolicMuscles(); ++i)
-        labels.append(getName()+"_"+get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i].getName());
-
-    return labels;
+    labels.append("time");
+    labels.append(getProbeOutputLabels());
+    Storage results((int)times.size()+1, getName());
+    results.setColumnLabels(labels);
+
+    const bool integrate = (getOperation() == "integrate");
+    const int numOutputs = getNumProbeInputs();
+    Vector integral(numOutputs, 0.0);
+    if (integrate && getInitialConditions().size() == numOutputs)
+        integral = getInitialConditions();
+
+    for (unsigned int k=0; k<times.size() && k<outputs.size(); ++k) {
+        if (integrate) {
+            if (k > 0)
+                integral += 0.5*(times[k] - times[k-1])
+                            * (outputs[k] + outputs[k-1]);
+            results.append(times[k], getGain()*integral);
+        }
+        else
+            results.append(times[k], getGain()*outputs[k]);
+    }
+    return results;
 }
 
 
@@ -997,3 +1965,593 @@ constructProperties()
     constructProperty_maintenance_constant_fast_twitch(111.0);   
 }
 
+
+
+//=============================================================================
+// EXCITATION RECONSTRUCTION
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Set the activation states from which the excitations are reconstructed.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::setActivationStates(
+    const Storage& states)
+{
+    _excitationEstimator.setActivationStates(states);
+    if (_model)
+        connectExcitationEstimator();
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Add each muscle in the MetabolicMuscleParameterSet to the
+ * excitation estimator.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::connectExcitationEstimator()
+{
+    _excitationEstimator.clearMuscles();
+    if (!get_reconstruct_excitation() || isDisabled())
+        return;
+
+    if (!_excitationEstimator.hasActivationStates()) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": '" << getName()
+            << "' has <reconstruct_excitation> set, but no activation states. "
+            "Specify <activation_states_file> or call setActivationStates()."
+            << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    for (int i=0; i<getNumMetabolicMuscles(); ++i)
+        _excitationEstimator.addMuscle(getMetabolicMuscle(i));
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the excitation of muscle i: its control, or its reconstructed
+ * excitation.
+ */
+double UchidaBhargava2004MuscleMetabolicsProbe::getMuscleExcitation(
+    const State& s, int i) const
+{
+    if (get_reconstruct_excitation())
+        return _excitationEstimator.calcExcitation(i, s.getTime());
+    return getMetabolicMuscle(i).getControl(s);
+}
+
+
+
+//=============================================================================
+// MUSCLE EVALUATIONS
+//=============================================================================
+//_____________________________________________________________________________
+int UchidaBhargava2004MuscleMetabolicsProbe::getNumMuscleEvaluations() const
+{
+    return _numMuscleEvaluations;
+}
+
+void UchidaBhargava2004MuscleMetabolicsProbe::resetMuscleEvaluationCounter()
+{
+    _numMuscleEvaluations = 0;
+}
+
+
+
+//=============================================================================
+// INCREMENTAL EVALUATION
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Get pointers to the inputs of a muscle, in the order of
+ * <_incrementalInputScales>.
+ */
+template <class Inputs, class T>
+void UchidaBhargava2004MuscleMetabolicsProbe::getIncrementalInputs(Inputs& in, T* x[])
+{
+    x[0] = &in.excitation;
+    x[1] = &in.activation;
+    x[2] = &in.active_fiber_force;
+    x[3] = &in.passive_fiber_force;
+    x[4] = &in.fiber_velocity;
+    x[5] = &in.active_force_length_multiplier;
+    x[6] = &in.fiber_length_dependence;
+    x[7] = &in.activation_heat_decay;
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Size the cache of incremental evaluation and compute the scales of
+ * the inputs of each muscle.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::connectIncrementalEvaluation()
+{
+    _incrementalInputScales.clear();
+    if (!get_incremental_evaluation() || isDisabled()) {
+        resetIncrementalEvaluation();
+        return;
+    }
+
+    const int nM = getNumMetabolicMuscles();
+    _incrementalInputScales.resize(nM*NumIncrementalInputs);
+    for (int i=0; i<nM; ++i) {
+        const Muscle& m = getMetabolicMuscle(i);
+        double* scales = &_incrementalInputScales[i*NumIncrementalInputs];
+        scales[0] = 1;                                // excitation
+        scales[1] = 1;                                // activation
+        scales[2] = m.getMaxIsometricForce();         // active_fiber_force
+        scales[3] = m.getMaxIsometricForce();         // passive_fiber_force
+        scales[4] = m.getMaxContractionVelocity()     // fiber_velocity
+                    * m.getOptimalFiberLength();
+        scales[5] = 1;                                // active_force_length_multiplier
+        scales[6] = 1;                                // fiber_length_dependence
+        scales[7] = 1;                                // activation_heat_decay
+    }
+
+    resetIncrementalEvaluation();
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: With <autotune>, time the execution modes of the probe from its
+ * exact settings (or read their cached timings), and choose the fastest mode
+ * within <autotune_tolerance>. The properties of the modes are not changed.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::connectAutotune()
+{
+    _autotunedMode = MuscleMetabolicsAutotuner::Exact;
+    if (!get_autotune())
+        return;
+    if (!(get_autotune_tolerance() >= 0)) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": '" << getName()
+            << "' has <autotune_tolerance> " << get_autotune_tolerance()
+            << ", which must be nonnegative." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    _autotuneResult =
+        MuscleMetabolicsAutotuner::tune(*this, get_autotune_cache_file());
+    _autotunedMode = MuscleMetabolicsAutotuner::selectMode(_autotuneResult,
+        get_autotune_tolerance());
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Find the registered compiled kernel whose parameter hash matches
+ * the settings and muscle constants of the probe.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::connectCompiledKernel()
+{
+    _compiledKernel = 0;
+    if (!usesCompiledKernel() || isDisabled())
+        return;
+
+    const string hash = MuscleMetabolicsKernelGenerator::calcParameterHash(*this);
+    if (!MuscleMetabolicsCompiledKernelRegistry::find(hash, _compiledKernel)
+        || _compiledKernel->getNumMuscles() != getNumMetabolicMuscles()) {
+        cout << "WARNING: " << getName() << ": No compiled kernel is loaded "
+            "for the parameters of the probe (hash " << hash << "). The "
+            "kernel will be evaluated from the properties." << endl;
+        _compiledKernel = 0;
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Whether the inputs of the ith muscle are within
+ * <incremental_tolerance> of its cached inputs (which are NaN until the muscle
+ * is first evaluated), and on the same branches of the equations.
+ */
+bool UchidaBhargava2004MuscleMetabolicsProbe::isWithinIncrementalTolerance(int i,
+    const Kernel::MuscleConstants& mc,
+    const Kernel::MuscleInputs<double>& in) const
+{
+    const Kernel::MuscleInputs<double>& cached = _incrementalInputs[i];
+    const double* x[NumIncrementalInputs];
+    const double* y[NumIncrementalInputs];
+    getIncrementalInputs(in, x);
+    getIncrementalInputs(cached, y);
+    const double* scales = &_incrementalInputScales[i*NumIncrementalInputs];
+    const double tol = get_incremental_tolerance();
+    for (int k=0; k<NumIncrementalInputs; ++k)
+        if (!(fabs(*x[k] - *y[k]) <= tol*scales[k]))
+            return false;
+    return Kernel::isSameBranch(mc, in, cached);
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Cache the inputs and rates of the ith muscle, and update the sum of
+ * the cached metabolic rates by the change in its rate. The sum is recomputed
+ * if it has become NaN, so that a NaN rate does not persist once replaced.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::updateIncrementalCache(int i,
+    const Kernel::MuscleInputs<double>& in,
+    const Kernel::MuscleRates<double>& rates) const
+{
+    _incrementalTotal += rates.Edot - _incrementalRates[i].Edot;
+    _incrementalInputs[i] = in;
+    _incrementalRates[i] = rates;
+    if (isNaN(_incrementalTotal)) {
+        _incrementalTotal = 0;
+        for (unsigned int j=0; j<_incrementalRates.size(); ++j)
+            _incrementalTotal += _incrementalRates[j].Edot;
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Calculate the first-order bound on the error in the metabolic rate of the
+ * ith muscle when its cached rates are reused. The partial derivatives are
+ * evaluated with MuscleMetabolicsDual, one normalized input at a time.
+ */
+double UchidaBhargava2004MuscleMetabolicsProbe::calcIncrementalErrorBound(int i) const
+{
+    if (i < 0 || i >= (int)_incrementalInputs.size()
+        || isNaN(_incrementalInputs[i].excitation))
+        return 0;
+
+    typedef MuscleMetabolicsDual Dual;
+    const Kernel::Settings settings = getKernelSettings();
+    const Kernel::MuscleConstants mc = getKernelMuscleConstants(i);
+    const double* scales = &_incrementalInputScales[i*NumIncrementalInputs];
+    double bound = 0;
+    for (int k=0; k<NumIncrementalInputs; ++k) {
+        Kernel::MuscleInputs<Dual> in;
+        Kernel::convert(_incrementalInputs[i], in);
+        Dual* x[NumIncrementalInputs];
+        getIncrementalInputs(in, x);
+        x[k]->derivative = get_incremental_tolerance()*scales[k];
+
+        Kernel::MuscleRates<Dual> rates;
+        Kernel::calcHeatRates(settings, mc, in, rates);
+        const Dual heatRate = rates.Adot + rates.Mdot + rates.Sdot;
+        Kernel::calcWorkAndTotalRates(settings, mc, in, rates);
+        bound += (fabs(heatRate.derivative)
+                  + fabs(rates.Wdot.derivative));
+    }
+    return bound;
+}
+
+int UchidaBhargava2004MuscleMetabolicsProbe::getNumIncrementalEvaluations() const
+{
+    return _numIncrementalEvaluations;
+}
+
+int UchidaBhargava2004MuscleMetabolicsProbe::getNumReusedMuscleEvaluations() const
+{
+    return _numReusedMuscleEvaluations;
+}
+
+double UchidaBhargava2004MuscleMetabolicsProbe::getIncrementalReuseRatio() const
+{
+    if (_numIncrementalEvaluations == 0)
+        return 0;
+    return double(_numReusedMuscleEvaluations) / _numIncrementalEvaluations;
+}
+
+void UchidaBhargava2004MuscleMetabolicsProbe::resetIncrementalEvaluation()
+{
+    _incrementalTotal = 0;
+    _numIncrementalEvaluations = 0;
+    _numReusedMuscleEvaluations = 0;
+
+    Kernel::MuscleInputs<double> uncached;
+    double* x[NumIncrementalInputs];
+    getIncrementalInputs(uncached, x);
+    for (int k=0; k<NumIncrementalInputs; ++k)
+        *x[k] = SimTK::NaN;
+    const int nM = (int)_incrementalInputScales.size() / NumIncrementalInputs;
+    _incrementalInputs.assign(nM, uncached);
+    _incrementalRates.assign(nM, Kernel::MuscleRates<double>());
+}
+
+
+
+//=============================================================================
+// MULTI-RATE SAMPLING
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Evaluate the probe at the given state and record the sample: it replaces
+ * the held sample, is added to the trapezoidal integral, and is appended to
+ * the sampled results, if any. A sample that precedes the last one starts a
+ * new series; a repeated sample is ignored.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::recordSample(const State& s) const
+{
+    const double t = s.getTime();
+    if (_numSamples > 0 && t <= _lastSampleTime) {
+        if (t == _lastSampleTime)
+            return;
+        _numSamples = 0;
+        if (_sampledResults)
+            _sampledResults->purge();
+    }
+
+    _model->getMultibodySystem().realize(s, SimTK::Stage::Dynamics);
+    const Vector EdotOutput = calcMetabolicPower(s);
+    if (_numSamples == 0) {
+        _sampledEnergy.resize(EdotOutput.size());
+        _sampledEnergy = 0;
+        if (getInitialConditions().size() == EdotOutput.size())
+            _sampledEnergy = getInitialConditions();
+    }
+    else
+        _sampledEnergy += 0.5*(t - _lastSampleTime)
+                          * (EdotOutput + _lastSampleInputs);
+    _lastSampleTime = t;
+    _lastSampleInputs = EdotOutput;
+    ++_numSamples;
+
+    if (_sampledResults)
+        _sampledResults->append(t, getGain()*(getOperation() == "integrate"
+                                              ? _sampledEnergy : EdotOutput));
+}
+
+int UchidaBhargava2004MuscleMetabolicsProbe::getNumSamples() const
+{
+    return _numSamples;
+}
+
+void UchidaBhargava2004MuscleMetabolicsProbe::clearSamples()
+{
+    _numSamples = 0;
+    _lastSampleTime = SimTK::NaN;
+    _lastSampleInputs.resize(0);
+    _sampledEnergy.resize(0);
+    _sampledResults = 0;
+}
+
+SimTK::Vector UchidaBhargava2004MuscleMetabolicsProbe::getSampledEnergy() const
+{
+    return getGain()*_sampledEnergy;
+}
+
+//_____________________________________________________________________________
+/**
+ * Label the given storage as the sampled results of the probe, and append
+ * the probe outputs to it at each subsequent sample.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::setSampledResults(Storage* results)
+{
+    _sampledResults = results;
+    if (!results)
+        return;
+    Array<string> labels;
+    labels.append("time");
+    labels.append(getProbeOutputLabels());
+    results->purge();
+    results->setName(getName() + "_sampled");
+    results->setColumnLabels(labels);
+}
+
+
+
+
+//=============================================================================
+// SUMMARY STATISTICS
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Add the probe inputs at the given time to the statistics.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::accumulateStatistics(double time,
+                                                   const Vector& inputs)
+{
+    _statistics.add(time, inputs);
+}
+
+const MuscleMetabolicsStatistics&
+    UchidaBhargava2004MuscleMetabolicsProbe::getStatistics() const
+{
+    return _statistics;
+}
+
+void UchidaBhargava2004MuscleMetabolicsProbe::clearStatistics()
+{
+    _statistics = MuscleMetabolicsStatistics(getProbeOutputLabels());
+}
+
+
+
+
+//=============================================================================
+// PEAK TRACKING
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Update the peaks with the probe inputs at the given time.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::updatePeaks(double time, const Vector& inputs)
+{
+    _peaks.update(time, inputs);
+}
+
+const MuscleMetabolicsPeaks&
+    UchidaBhargava2004MuscleMetabolicsProbe::getPeaks() const
+{
+    return _peaks;
+}
+
+void UchidaBhargava2004MuscleMetabolicsProbe::clearPeaks()
+{
+    _peaks = MuscleMetabolicsPeaks(getProbeOutputLabels());
+}
+
+
+
+
+//=============================================================================
+// PARAMETER SENSITIVITY
+//=============================================================================
+Array<string> UchidaBhargava2004MuscleMetabolicsProbe::getSensitivityParameterNames() const
+{
+    static const char* globalNames[NumGlobalSensitivityParameters] = {
+        "muscle_effort_scaling_factor", "basal_coefficient", "basal_exponent" };
+    static const char* muscleNames[NumMuscleSensitivityParameters] = {
+        "ratio_slow_twitch_fibers", "specific_tension", "density",
+        "provided_muscle_mass", "activation_constant_slow_twitch",
+        "activation_constant_fast_twitch", "maintenance_constant_slow_twitch",
+        "maintenance_constant_fast_twitch" };
+
+    Array<string> names;
+    for (int k=0; k<NumGlobalSensitivityParameters; ++k)
+        names.append(globalNames[k]);
+    const UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet& mms =
+        get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet();
+    for (int i=0; i<mms.getSize(); ++i)
+        for (int k=0; k<NumMuscleSensitivityParameters; ++k)
+            names.append(mms[i].getName() + "." + muscleNames[k]);
+    return names;
+}
+
+Vector UchidaBhargava2004MuscleMetabolicsProbe::getSensitivityParameterValues() const
+{
+    const UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet& mms =
+        get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet();
+    Vector values(NumGlobalSensitivityParameters
+                  + NumMuscleSensitivityParameters*mms.getSize());
+    values[0] = get_muscle_effort_scaling_factor();
+    values[1] = get_basal_coefficient();
+    values[2] = get_basal_exponent();
+    for (int i=0; i<mms.getSize(); ++i) {
+        const int j = NumGlobalSensitivityParameters
+                      + NumMuscleSensitivityParameters*i;
+        values[j] = mms[i].get_ratio_slow_twitch_fibers();
+        values[j+1] = mms[i].get_specific_tension();
+        values[j+2] = mms[i].get_density();
+        values[j+3] = mms[i].get_provided_muscle_mass();
+        values[j+4] = mms[i].get_activation_constant_slow_twitch();
+        values[j+5] = mms[i].get_activation_constant_fast_twitch();
+        values[j+6] = mms[i].get_maintenance_constant_slow_twitch();
+        values[j+7] = mms[i].get_maintenance_constant_fast_twitch();
+    }
+    return values;
+}
+
+//_____________________________________________________________________________
+/**
+ * Evaluate the total metabolic power and its partial derivatives. The
+ * derivatives of the basal rate are analytic; those of each muscle are
+ * propagated through the kernel with MuscleMetabolicsDual, seeding the muscle effort
+ * scaling factor, the ratio of slow-twitch fibers, the muscle mass and the
+ * activation and maintenance constants
+ * one at a time.
+ */
+double UchidaBhargava2004MuscleMetabolicsProbe::calcParameterSensitivity(
+    const State& s, Vector& derivatives) const
+{
+    typedef MuscleMetabolicsDual Dual;
+    const int nM = getNumMetabolicMuscles();
+    derivatives.resize(NumGlobalSensitivityParameters
+                       + NumMuscleSensitivityParameters*nM);
+    derivatives = 0;
+
+    double total = 0;
+    if (get_basal_rate_on()) {
+        const double mass = _model->getMatterSubsystem().calcSystemMass(s);
+        const double massTerm = pow(mass, get_basal_exponent());
+        total = get_basal_coefficient()*massTerm;
+        derivatives[1] = massTerm;
+        derivatives[2] = total*log(mass);
+    }
+
+    Kernel::BasicSettings<Dual> settings;
+    Kernel::convert(getKernelSettings(), settings);
+    for (int i=0; i<nM; ++i) {
+        const UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameter& mm =
+            get_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i];
+        Kernel::MuscleInputs<double> inDouble;
+        gatherMuscleInputs(s, i, inDouble);
+        Kernel::MuscleInputs<Dual> in;
+        Kernel::convert(inDouble, in);
+        Kernel::BasicMuscleConstants<Dual> mc;
+        Kernel::convert(getKernelMuscleConstants(i), mc);
+
+        Dual* seeds[] = { &settings.muscle_effort_scaling_factor,
+            &mc.ratio_slow_twitch_fibers, &mc.muscle_mass,
+            &mc.activation_constant_slow_twitch,
+            &mc.activation_constant_fast_twitch,
+            &mc.maintenance_constant_slow_twitch,
+            &mc.maintenance_constant_fast_twitch };
+        const int numSeeds = sizeof(seeds)/sizeof(seeds[0]);
+        double dEdot[numSeeds];
+        for (int k=0; k<numSeeds; ++k) {
+            seeds[k]->derivative = 1;
+            Kernel::MuscleRates<Dual> rates;
+            Kernel::calcMuscleRates(settings, mc, in, rates);
+            seeds[k]->derivative = 0;
+            dEdot[k] = rates.Edot.derivative;
+            if (k == 0)
+                total += rates.Edot.value;
+        }
+
+        derivatives[0] += dEdot[0];
+        const int j = NumGlobalSensitivityParameters
+                      + NumMuscleSensitivityParameters*i;
+        derivatives[j] = dEdot[1];
+        // The muscle mass is either provided, or
+        // (max isometric force/specific tension)*density*optimal fiber length.
+        if (mm.get_use_provided_muscle_mass())
+            derivatives[j+3] = dEdot[2];
+        else {
+            const double mass = mc.muscle_mass.value;
+            derivatives[j+1] = -dEdot[2]*mass/mm.get_specific_tension();
+            derivatives[j+2] = dEdot[2]*mass/mm.get_density();
+        }
+        for (int k=3; k<numSeeds; ++k)
+            derivatives[j+k+1] = dEdot[k];
+    }
+    return total;
+}
+
+//_____________________________________________________________________________
+/**
+ * Evaluate the derivatives at the given state, and add them to the
+ * sensitivity.
+ */
+void UchidaBhargava2004MuscleMetabolicsProbe::accumulateSensitivity(const State& s)
+{
+    Vector derivatives;
+    const double power = calcParameterSensitivity(s, derivatives);
+    _sensitivity.add(s.getTime(), power, derivatives);
+}
+
+const MuscleMetabolicsSensitivity&
+    UchidaBhargava2004MuscleMetabolicsProbe::getSensitivity() const
+{
+    return _sensitivity;
+}
+
+void UchidaBhargava2004MuscleMetabolicsProbe::clearSensitivity()
+{
+    _sensitivity = MuscleMetabolicsSensitivity(getSensitivityParameterNames(),
+                                               getSensitivityParameterValues());
+}
+
+
+
+
+//=============================================================================
+// ENERGY BUDGET
+//=============================================================================
+void UchidaBhargava2004MuscleMetabolicsProbe::setEnergyBudget(double budget)
+{
+    set_energy_budget(budget);
+    _energyBudgetExceededTime = SimTK::NaN;
+}
+
+bool UchidaBhargava2004MuscleMetabolicsProbe::hasExceededEnergyBudget() const
+{
+    return !SimTK::isNaN(_energyBudgetExceededTime);
+}
+
+double UchidaBhargava2004MuscleMetabolicsProbe::getEnergyBudgetExceededTime() const
+{
+    return _energyBudgetExceededTime;
+}
+
+void UchidaBhargava2004MuscleMetabolicsProbe::recordEnergyBudgetExceeded(double t) const
+{
+    _energyBudgetExceededTime = t;
+}
@@ -0,0 +1,420 @@
+#ifndef OPENSIM_UCHIDAUMBERGER2010_METABOLICS_KERNEL_H_
+#define OPENSIM_UCHIDAUMBERGER2010_METABOLICS_KERNEL_H_
+/* -------------------------------------------------------------------------- *
+ *             OpenSim:  UchidaUmberger2010MuscleMetabolicsKernel.h           *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ * Author(s): Tim Dorn                                                        *
+ * Contributor(s): Thomas Uchida                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+#include "MuscleMetabolicsFastMath.h"
+#include <SimTKcommon/Constants.h>
+#include <cmath>
+
+namespace OpenSim {
+
+//=============================================================================
+//        PER-MUSCLE KERNEL OF UchidaUmberger2010MuscleMetabolicsProbe
+//=============================================================================
+/**
+ * The per-muscle computation of UchidaUmberger2010MuscleMetabolicsProbe,
+ * separated from the probe so that it can be evaluated from inputs that were
+ * gathered from a State (see
+ * UchidaUmberger2010MuscleMetabolicsProbe::gatherMuscleInputs()) and in
+ * different scalar types. The equations are documented in
+ * UchidaUmberger2010MuscleMetabolicsProbe.
+ *
+ * The kernel performs no I/O and no heap allocation; NaN checking and
+ * warnings remain the responsibility of the caller.
+ */
+class UchidaUmberger2010MuscleMetabolicsKernel {
+public:
+    /** Probe-wide settings, taken from the properties of the probe. The
+        coefficients are of type P: double, or MuscleMetabolicsDual to
+        differentiate the rates with respect to one of them (see
+        convert()). */
+    template <class P>
+    struct BasicSettings {
+        bool activation_maintenance_rate_on;
+        bool shortening_rate_on;
+        bool mechanical_work_rate_on;
+        bool enforce_minimum_heat_rate_per_muscle;
+        bool use_Bhargava_recruitment_model;
+        bool include_negative_mechanical_work;
+        bool forbid_negative_total_power;
+        bool fast_math;
+        P aerobic_factor;
+        P muscle_effort_scaling_factor;
+    };
+    typedef BasicSettings<double> Settings;
+
+    /** Constant parameters of a single muscle, of type P (see
+        BasicSettings). */
+    template <class P>
+    struct BasicMuscleConstants {
+        P muscle_mass;                      // (kg)
+        P ratio_slow_twitch_fibers;
+        P max_contraction_velocity;         // (optimal fiber lengths/s)
+        P optimal_fiber_length;             // (m)
+    };
+    typedef BasicMuscleConstants<double> MuscleConstants;
+
+    /** State-dependent inputs of a single muscle, as reported by the Muscle
+        (i.e., not yet scaled by muscle_effort_scaling_factor). */
+    template <class T>
+    struct MuscleInputs {
+        T excitation;
+        T activation;
+        T active_fiber_force;               // (N)
+        T normalized_fiber_length;
+        T fiber_velocity;                   // (m/s)
+        T active_force_length_multiplier;
+    };
+
+    /** The terms of the heat rates of a single muscle that depend only on
+        its excitation (see calcExcitationTerms()). */
+    template <class T>
+    struct ExcitationTerms {
+        T excitation;                       // Scaled.
+        T slow_twitch_ratio;                // Of the recruited fibers.
+    };
+
+    /** Heat rates and mechanical work rate (W/kg), and total metabolic rate
+        (W) of a single muscle. */
+    template <class T>
+    struct MuscleRates {
+        T AMdot;
+        T Sdot;
+        T Wdot;
+        T Edot;
+    };
+
+    /** Convert muscle inputs to another scalar type. */
+    template <class T, class U>
+    static void convert(const MuscleInputs<U>& from, MuscleInputs<T>& to)
+    {
+        to.excitation = T(from.excitation);
+        to.activation = T(from.activation);
+        to.active_fiber_force = T(from.active_fiber_force);
+        to.normalized_fiber_length = T(from.normalized_fiber_length);
+        to.fiber_velocity = T(from.fiber_velocity);
+        to.active_force_length_multiplier = T(from.active_force_length_multiplier);
+    }
+
+    /** Convert muscle rates to another scalar type. */
+    template <class T, class U>
+    static void convert(const MuscleRates<U>& from, MuscleRates<T>& to)
+    {
+        to.AMdot = T(from.AMdot);
+        to.Sdot = T(from.Sdot);
+        to.Wdot = T(from.Wdot);
+        to.Edot = T(from.Edot);
+    }
+
+    /** Convert settings to another coefficient type. */
+    template <class P, class Q>
+    static void convert(const BasicSettings<Q>& from, BasicSettings<P>& to)
+    {
+        to.activation_maintenance_rate_on = from.activation_maintenance_rate_on;
+        to.shortening_rate_on = from.shortening_rate_on;
+        to.mechanical_work_rate_on = from.mechanical_work_rate_on;
+        to.enforce_minimum_heat_rate_per_muscle =
+            from.enforce_minimum_heat_rate_per_muscle;
+        to.use_Bhargava_recruitment_model = from.use_Bhargava_recruitment_model;
+        to.include_negative_mechanical_work =
+            from.include_negative_mechanical_work;
+        to.forbid_negative_total_power = from.forbid_negative_total_power;
+        to.fast_math = from.fast_math;
+        to.aerobic_factor = P(from.aerobic_factor);
+        to.muscle_effort_scaling_factor = P(from.muscle_effort_scaling_factor);
+    }
+
+    /** Convert muscle constants to another coefficient type. */
+    template <class P, class Q>
+    static void convert(const BasicMuscleConstants<Q>& from,
+                        BasicMuscleConstants<P>& to)
+    {
+        to.muscle_mass = P(from.muscle_mass);
+        to.ratio_slow_twitch_fibers = P(from.ratio_slow_twitch_fibers);
+        to.max_contraction_velocity = P(from.max_contraction_velocity);
+        to.optimal_fiber_length = P(from.optimal_fiber_length);
+    }
+
+    /** Whether two sets of inputs of a single muscle take the same branches
+        of the equations (shortening or lengthening, fiber length below or
+        above optimal, excitation above or below activation, and the bound on
+        the slow-twitch shortening heat rate), i.e., whether the rates vary
+        smoothly between them, apart from the clamps on the total power and
+        heat rate. */
+    template <class T, class P>
+    static bool isSameBranch(const BasicMuscleConstants<P>& mc,
+                             const MuscleInputs<T>& a,
+                             const MuscleInputs<T>& b)
+    {
+        // Fiber velocity (m/s) at which the slow-twitch shortening heat rate
+        // reaches its maximum of 100 W/kg.
+        const T maxSlowTwitchVelocity = T(-mc.max_contraction_velocity / 2.5
+                                          * mc.optimal_fiber_length);
+        return (a.excitation > a.activation) == (b.excitation > b.activation)
+            && (a.excitation == T(0)) == (b.excitation == T(0))
+            && (a.normalized_fiber_length <= T(1))
+               == (b.normalized_fiber_length <= T(1))
+            && (a.fiber_velocity <= T(0)) == (b.fiber_velocity <= T(0))
+            && (a.fiber_velocity < maxSlowTwitchVelocity)
+               == (b.fiber_velocity < maxSlowTwitchVelocity)
+            && (a.active_fiber_force < T(0)) == (b.active_fiber_force < T(0));
+    }
+
+    /** Evaluate the metabolic rate of a single muscle. */
+    template <class T, class P>
+    static void calcMuscleRates(const BasicSettings<P>& settings,
+                                const BasicMuscleConstants<P>& mc,
+                                const MuscleInputs<T>& in,
+                                MuscleRates<T>& out)
+    {
+        calcHeatRates(settings, mc, in, out);
+        calcWorkAndTotalRates(settings, mc, in, out);
+    }
+
+    /** Evaluate the activation and maintenance heat rate (out.AMdot) and the
+        shortening heat rate (out.Sdot) of a single muscle, before the clamps
+        applied by calcWorkAndTotalRates(). These are the rates approximated
+        by a MuscleMetabolicsSurrogate; they do not depend on the active fiber
+        force. */
+    template <class T, class P>
+    static void calcHeatRates(const BasicSettings<P>& settings,
+                              const BasicMuscleConstants<P>& mc,
+                              const MuscleInputs<T>& in,
+                              MuscleRates<T>& out)
+    {
+        ExcitationTerms<T> terms;
+        calcExcitationTerms(settings, mc, in.excitation, terms);
+        calcHeatRates(settings, mc, in, terms, out);
+    }
+
+    /** Evaluate the terms of the heat rates that depend only on the
+        (unscaled) excitation: the scaled excitation and the ratio of
+        slow-twitch fibers among the recruited fibers. These terms contain the
+        transcendental functions of the excitation, and may be computed once
+        for an excitation that recurs (see calcHeatRates()). */
+    template <class T, class P>
+    static void calcExcitationTerms(const BasicSettings<P>& settings,
+                                    const BasicMuscleConstants<P>& mc,
+                                    const T& unscaledExcitation,
+                                    ExcitationTerms<T>& terms)
+    {
+        using std::sin;
+        using std::cos;
+
+        const T excitation =
+            T(settings.muscle_effort_scaling_factor) * unscaledExcitation;
+
+        // Bhargava et al. (2004) recruitment model.
+        T slowTwitchRatio = T(mc.ratio_slow_twitch_fibers);
+        if (settings.use_Bhargava_recruitment_model) {
+            const T uSlow = slowTwitchRatio * (settings.fast_math
+                ? MuscleMetabolicsFastMath::sinHalfPi(excitation)
+                : sin(T(0.5)*T(SimTK_PI) * excitation));
+            const T uFast = (T(1) - slowTwitchRatio) * (settings.fast_math
+                ? MuscleMetabolicsFastMath::oneMinusCosHalfPi(excitation)
+                : (T(1) - cos(T(0.5)*T(SimTK_PI) * excitation)));
+            slowTwitchRatio = (excitation == T(0))
+                              ? T(1) : uSlow / (uSlow + uFast);
+        }
+
+        terms.excitation = excitation;
+        terms.slow_twitch_ratio = slowTwitchRatio;
+    }
+
+    /** calcHeatRates() with the excitation terms computed by
+        calcExcitationTerms() for in.excitation. */
+    template <class T, class P>
+    static void calcHeatRates(const BasicSettings<P>& settings,
+                              const BasicMuscleConstants<P>& mc,
+                              const MuscleInputs<T>& in,
+                              const ExcitationTerms<T>& terms,
+                              MuscleRates<T>& out)
+    {
+        using std::pow;
+
+        T AMdot = T(0), Sdot = T(0);
+
+        const T S = T(settings.aerobic_factor);
+        const T scale = T(settings.muscle_effort_scaling_factor);
+        const T max_shortening_velocity = T(mc.max_contraction_velocity);
+        const T activation = scale * in.activation;
+        const T excitation = terms.excitation;
+        const T fiber_length_normalized = in.normalized_fiber_length;
+        const T fiber_velocity = in.fiber_velocity;
+        const T F_iso = in.active_force_length_multiplier;
+
+        // Umberger defines fiber_velocity_normalized as Vm/LoM, not Vm/Vmax
+        // (p101, top left, Umberger(2003)).
+        const T fiber_velocity_normalized =
+            fiber_velocity / T(mc.optimal_fiber_length);
+
+        // Set activation dependence scaling parameter: A
+        T A;
+        if (excitation > activation)
+            A = excitation;
+        else
+            A = (excitation + activation) / T(2);
+
+        // Ratio of slow-twitch fibers (Bhargava et al. (2004) recruitment
+        // model, if enabled).
+        const T slowTwitchRatio = terms.slow_twitch_ratio;
+
+        // ACTIVATION & MAINTENANCE HEAT RATE (W/kg)
+        if (settings.forbid_negative_total_power ||
+            settings.activation_maintenance_rate_on)
+        {
+            const T unscaledAMdot = T(128)*(T(1) - slowTwitchRatio) + T(25);
+            const T A_pow = settings.fast_math
+                ? MuscleMetabolicsFastMath::pow06(A) : pow(A, T(0.6));
+
+            if (fiber_length_normalized <= T(1))
+                AMdot = S * A_pow * unscaledAMdot;
+            else
+                AMdot = S * A_pow * ((T(0.4) * unscaledAMdot)
+                                     + (T(0.6) * unscaledAMdot * F_iso));
+        }
+
+        // SHORTENING HEAT RATE (W/kg)
+        // --> note that we define Vm<0 as shortening and Vm>0 as lengthening
+        if (settings.forbid_negative_total_power || settings.shortening_rate_on)
+        {
+            const T Vmax_fasttwitch = max_shortening_velocity;
+            const T Vmax_slowtwitch = max_shortening_velocity / T(2.5);
+            const T alpha_shortening_fasttwitch = T(153) / Vmax_fasttwitch;
+            const T alpha_shortening_slowtwitch = T(100) / Vmax_slowtwitch;
+            T unscaledSdot, tmp_slowTwitch, tmp_fastTwitch;
+
+            if (fiber_velocity_normalized <= T(0))    // concentric, Vm<0
+            {
+                const T maxShorteningRate = T(100);   // (W/kg)
+
+                tmp_slowTwitch =
+                    -alpha_shortening_slowtwitch * fiber_velocity_normalized;
+                if (tmp_slowTwitch > maxShorteningRate)
+                    tmp_slowTwitch = maxShorteningRate;
+
+                tmp_fastTwitch = alpha_shortening_fasttwitch
+                    * fiber_velocity_normalized * (T(1) - slowTwitchRatio);
+                unscaledSdot = (tmp_slowTwitch * slowTwitchRatio)
+                               - tmp_fastTwitch;
+                const T A_squared = settings.fast_math
+                    ? MuscleMetabolicsFastMath::pow2(A) : pow(A, T(2.0));
+                Sdot = S * A_squared * unscaledSdot;
+            }
+            else                                      // eccentric, Vm>0
+            {
+                unscaledSdot =
+                    T(settings.include_negative_mechanical_work ? 4.0 : 0.3)
+                    * alpha_shortening_slowtwitch * fiber_velocity_normalized;
+                Sdot = S * A * unscaledSdot;
+            }
+
+            // Fiber length dependance on scaled shortening heat rate
+            // (for both concentric and eccentric contractions).
+            if (fiber_length_normalized > T(1))
+                Sdot *= F_iso;
+        }
+
+        out.AMdot = AMdot;
+        out.Sdot = Sdot;
+    }
+
+    /** Given the heat rates computed by calcHeatRates() (or approximated by
+        a surrogate) in out.AMdot and out.Sdot, evaluate the mechanical work
+        rate, apply the clamps on the total power and heat rate, and evaluate
+        the total metabolic rate of a single muscle. Only the active fiber
+        force and fiber velocity are used from the inputs. */
+    template <class T, class P>
+    static void calcWorkAndTotalRates(const BasicSettings<P>& settings,
+                                      const BasicMuscleConstants<P>& mc,
+                                      const MuscleInputs<T>& in,
+                                      MuscleRates<T>& out)
+    {
+        const T AMdot = out.AMdot;
+        T Sdot = out.Sdot, Wdot = T(0);
+
+        const T scale = T(settings.muscle_effort_scaling_factor);
+        const T mass = T(mc.muscle_mass);
+        T fiber_force_active = scale * in.active_fiber_force;
+        const T fiber_velocity = in.fiber_velocity;
+
+        // Clamp fiber force. THIS SHOULD NEVER HAPPEN...
+        if (fiber_force_active < T(0))
+            fiber_force_active = T(0);
+
+        // MECHANICAL WORK RATE for the contractile element (W/kg)
+        if (settings.forbid_negative_total_power ||
+            settings.mechanical_work_rate_on)
+        {
+            if (settings.include_negative_mechanical_work
+                || fiber_velocity <= T(0))
+                Wdot = -fiber_force_active*fiber_velocity;
+            else
+                Wdot = T(0);
+
+            Wdot /= mass;
+        }
+
+        // If necessary, increase the shortening heat rate so that the total
+        // power is non-negative.
+        if (settings.forbid_negative_total_power) {
+            const T Edot_Wkg_beforeClamp = AMdot + Sdot + Wdot;
+            if (Edot_Wkg_beforeClamp < T(0))
+                Sdot -= Edot_Wkg_beforeClamp;
+        }
+
+        // The total heat rate (i.e., AMdot + Sdot) for a given muscle cannot
+        // fall below 1.0 W/kg (Umberger(2003), page 104).
+        T totalHeatRate = AMdot + Sdot;
+        if (settings.enforce_minimum_heat_rate_per_muscle
+            && totalHeatRate < T(1)
+            && settings.activation_maintenance_rate_on
+            && settings.shortening_rate_on)
+            totalHeatRate = T(1);
+
+        // TOTAL METABOLIC ENERGY RATE (W)
+        T Edot = T(0);
+        if (settings.activation_maintenance_rate_on
+            && settings.shortening_rate_on)
+            Edot += totalHeatRate;      // May have been clamped to 1.0 W/kg.
+        else {
+            if (settings.activation_maintenance_rate_on)
+                Edot += AMdot;
+            if (settings.shortening_rate_on)
+                Edot += Sdot;
+        }
+        if (settings.mechanical_work_rate_on)
+            Edot += Wdot;
+        Edot *= mass;
+
+        out.Sdot = Sdot;
+        out.Wdot = Wdot;
+        out.Edot = Edot;
+    }
+};
+
+} // namespace OpenSim
+
+#endif // #ifndef OPENSIM_UCHIDAUMBERGER2010_METABOLICS_KERNEL_H_
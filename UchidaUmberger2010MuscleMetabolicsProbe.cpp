@@ -27,7 +27,13 @@
 // INCLUDES and STATICS
 //=============================================================================
 #include "UchidaUmberger2010MuscleMetabolicsProbe.h"
+#include "MuscleMetabolicsFastMath.h"
+#include "MuscleMetabolicsDual.h"
+#include "MuscleMetabolicsSampler.h"
+#include "MuscleMetabolicsEnergyBudget.h"
+#include "MuscleMetabolicsKernelGenerator.h"
 #include <OpenSim/Simulation/Model/Muscle.h>
+#include <algorithm>
 //#define DEBUG_METABOLICS
 
 using namespace std;
@@ -79,6 +85,18 @@ void UchidaUmberger2010MuscleMetabolicsProbe::setNull()
 	setReferences("Umberger, B. R. (2010). Stance and swing phase costs in "
     "human walking. J R Soc Interface 7, 1329-40.");
     _muscleMap.clear();
+    resetSinglePrecisionErrorReport();
+    _surrogateIndices.clear();
+    _numSurrogateFallbacks = 0;
+    clearDeferredInputs();
+    clearSamples();
+    _energyBudgetExceededTime = SimTK::NaN;
+    resetMuscleEvaluationCounter();
+    resetIncrementalEvaluation();
+    _compiledKernel = 0;
+    _probeInputsIndex.invalidate();
+    _autotuneResult = MuscleMetabolicsAutotuner::Result();
+    _autotunedMode = MuscleMetabolicsAutotuner::Exact;
 }
 
 //_____________________________________________________________________________
@@ -101,6 +119,27 @@ void UchidaUmberger2010MuscleMetabolicsProbe::constructProperties()
     constructProperty_include_negative_mechanical_work(true);
     constructProperty_forbid_negative_total_power(true);
     constructProperty_report_total_metabolics_only(true);
+    constructProperty_fast_math(false);
+    constructProperty_single_precision_check_interval(0);
+    constructProperty_single_precision_tolerance(1e-4);
+    constructProperty_use_surrogate(false);
+    constructProperty_surrogate_file("");
+    constructProperty_deferred_evaluation(false);
+    constructProperty_reconstruct_excitation(false);
+    constructProperty_activation_states_file("");
+    constructProperty_count_muscle_evaluations(false);
+    constructProperty_sampling_rate(0);
+    constructProperty_incremental_evaluation(false);
+    constructProperty_incremental_tolerance(1e-4);
+    constructProperty_summary_statistics(false);
+    constructProperty_peak_tracking(false);
+    constructProperty_parameter_sensitivity(false);
+    constructProperty_energy_budget(0);
+    constructProperty_use_compiled_kernel(false);
+    constructProperty_vector_evaluation(false);
+    constructProperty_autotune(false);
+    constructProperty_autotune_tolerance(1e-3);
+    constructProperty_autotune_cache_file("");
     constructProperty_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet
        (UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet());
 }
@@ -129,6 +168,120 @@ void UchidaUmberger2010MuscleMetabolicsProbe::connectToModel(Model& aModel)
         connectIndividualMetabolicMuscle(aModel, 
             upd_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]);
     }
+    resetSinglePrecisionErrorReport();
+
+    // The execution mode is chosen before the connections that depend on
+    // the settings of the kernel.
+    connectAutotune();
+
+    // Load the surrogates from the sidecar file.
+    if (get_use_surrogate() && !get_surrogate_file().empty()) {
+        try {
+            _surrogates = MuscleMetabolicsSurrogateSet(get_surrogate_file());
+        } catch (const std::exception& x) {
+            cout << "WARNING: " << getName() << ": Unable to load surrogates "
+                "from " << get_surrogate_file() << " (" << x.what() << "). "
+                "The exact equations will be used." << endl;
+            _surrogates.setSize(0);
+        }
+    }
+    connectSurrogates();
+
+    // Load the activation states from which the excitations are
+    // reconstructed.
+    if (get_reconstruct_excitation() && !get_activation_states_file().empty())
+        _excitationEstimator.setActivationStates(
+            Storage(get_activation_states_file()));
+    connectExcitationEstimator();
+    connectIncrementalEvaluation();
+    connectCompiledKernel();
+
+    // The outputs of deferred evaluation are computed from the recorded
+    // states, so only operations on the probe values can be supported.
+    clearDeferredInputs();
+    if (get_deferred_evaluation()
+        && getOperation() != "value" && getOperation() != "integrate") {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": '" << getName()
+            << "' uses the '" << getOperation() << "' operation, which is not "
+            "supported with <deferred_evaluation>. Use 'value' or 'integrate'."
+            << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    clearStatistics();
+    clearSensitivity();
+    clearPeaks();
+    if (get_peak_tracking() && get_report_total_metabolics_only())
+        cout << "WARNING: " << getName() << ": <peak_tracking> tracks the "
+             << "TOTAL metabolic power only; set "
+             << "<report_total_metabolics_only> to false to track the peaks "
+             << "of each muscle." << endl;
+
+    // Samples are recorded in place of the evaluations during a simulation,
+    // which deferred evaluation skips altogether.
+    clearSamples();
+    if (get_sampling_rate() < 0
+        || (get_sampling_rate() > 0 && get_deferred_evaluation())) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": '" << getName()
+            << "' has <sampling_rate> " << get_sampling_rate() << ", which "
+            "must be 0, or positive without <deferred_evaluation>." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    // The budget applies to the energy integrated during the simulation,
+    // which deferred evaluation does not compute.
+    if (get_energy_budget() < 0 || (get_energy_budget() > 0
+        && (getOperation() != "integrate" || get_deferred_evaluation()))) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": '" << getName()
+            << "' has <energy_budget> " << get_energy_budget() << ", which "
+            "must be 0, or positive with the 'integrate' operation and "
+            "without <deferred_evaluation>." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Add the sampler of the probe to the System if <sampling_rate> is positive,
+ * and the energy budget if the operation is 'integrate'.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::addToSystem(
+    SimTK::MultibodySystem& system) const
+{
+    Super::addToSystem(system);
+
+    _numSamples = 0;
+    if (get_sampling_rate() > 0 && !isDisabled())
+        system.addEventReporter(
+            new MuscleMetabolicsSampler<UchidaUmberger2010MuscleMetabolicsProbe>(
+                *this, 1.0/get_sampling_rate()));
+
+    _energyBudgetExceededTime = SimTK::NaN;
+    if (getOperation() == "integrate" && !get_deferred_evaluation()
+        && !isDisabled())
+        system.addEventHandler(
+            new MuscleMetabolicsEnergyBudget<UchidaUmberger2010MuscleMetabolicsProbe>(*this));
+}
+
+//_____________________________________________________________________________
+/**
+ * Allocate the cache entry of <vector_evaluation>, which holds the probe
+ * inputs of a State for all of the columns of the probe.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::realizeTopology(
+    SimTK::State& state) const
+{
+    Super::realizeTopology(state);
+
+    _probeInputsIndex.invalidate();
+    if (get_vector_evaluation() && !isDisabled())
+        _probeInputsIndex = getModel().getMultibodySystem()
+            .getDefaultSubsystem().allocateLazyCacheEntry(state,
+                Stage::Dynamics,
+                new Value<Vector>(Vector(getNumProbeInputs(), 0.0)));
 }
 
 //_____________________________________________________________________________
@@ -231,10 +384,45 @@ void UchidaUmberger2010MuscleMetabolicsProbe::connectIndividualMetabolicMuscle(
  * Note: for muscle velocities, Vm, we define Vm<0 as shortening and Vm>0 as lengthening.
  */
 SimTK::Vector UchidaUmberger2010MuscleMetabolicsProbe::computeProbeInputs(const State& s) const
+{
+    // In deferred evaluation, the outputs are computed by
+    // computeDeferredResults() from the inputs recorded by
+    // recordDeferredInputs().
+    if (get_deferred_evaluation())
+        return Vector(getNumProbeInputs(), 0.0);
+
+    // With multi-rate sampling, the inputs are held from the last sample if
+    // it is at or before the time of the state (see recordSample()); only
+    // the last sample is kept, so states before it are evaluated.
+    if (get_sampling_rate() > 0 && _numSamples > 0
+        && s.getTime() >= _lastSampleTime)
+        return _lastSampleInputs;
+
+    // With vector evaluation, the columns of the probe share one evaluation
+    // per State.
+    if (_probeInputsIndex.isValid() && s.getSystemStage() >= Stage::Dynamics) {
+        const DefaultSystemSubsystem& subsystem =
+            getModel().getMultibodySystem().getDefaultSubsystem();
+        Vector& inputs = Value<Vector>::updDowncast(
+            subsystem.updCacheEntry(s, _probeInputsIndex)).upd();
+        if (!subsystem.isCacheValueRealized(s, _probeInputsIndex)) {
+            inputs = calcMetabolicPower(s);
+            subsystem.markCacheValueRealized(s, _probeInputsIndex);
+        }
+        return inputs;
+    }
+
+    return calcMetabolicPower(s);
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Evaluate the metabolic power at the given state.
+ */
+SimTK::Vector UchidaUmberger2010MuscleMetabolicsProbe::calcMetabolicPower(const State& s) const
 {
     // Initialize metabolic energy rate values.
-    double AMdot, Sdot, Bdot, Wdot;
-    AMdot = Sdot = Bdot = Wdot = 0;
+    double Bdot = 0;
     Vector EdotOutput(getNumProbeInputs());
     EdotOutput = 0;
 
@@ -255,6 +443,25 @@ SimTK::Vector UchidaUmberger2010MuscleMetabolicsProbe::computeProbeInputs(const
         EdotOutput(1) = Bdot;    // BASAL metabolic power storage
     
 
+    // Every Nth evaluation is repeated in single precision to estimate the
+    // precision loss of the per-muscle calculations.
+    const Kernel::Settings settings = getKernelSettings();
+    bool singlePrecisionCheck = false;
+    if (get_single_precision_check_interval() > 0) {
+        singlePrecisionCheck = (_numSinglePrecisionEvaluations
+                                % get_single_precision_check_interval() == 0);
+        ++_numSinglePrecisionEvaluations;
+    }
+    double singlePrecisionTotal = Bdot, doublePrecisionTotal = Bdot;
+    const bool incremental = get_incremental_evaluation()
+        && !get_use_surrogate()
+        && (int)_incrementalInputs.size() == getNumMetabolicMuscles();
+    const int numMuscles = getNumMetabolicMuscles();
+    if (singlePrecisionCheck
+        && (int)_singlePrecisionMaxRelErrorMuscles.size() != numMuscles)
+        _singlePrecisionMaxRelErrorMuscles.resize(numMuscles, 0.0);
+
+
     // Loop through each muscle in the MetabolicMuscleParameterSet
     const int nM = 
         get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()
@@ -263,202 +470,100 @@ SimTK::Vector UchidaUmberger2010MuscleMetabolicsProbe::computeProbeInputs(const
     {
         // Get the current muscle parameters from the MetabolicMuscleParameterSet
         // and the corresponding OpenSim::Muscle pointer from the muscleMap.
-        UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter& mm =
+        const UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter& mm =
             get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i];
         const Muscle* m = mm.getMuscle();
 
-        // Get some muscle properties at the current time state
-        //const double max_isometric_force = m->getMaxIsometricForce();
-        const double max_shortening_velocity = m->getMaxContractionVelocity();
-        const double activation = get_muscle_effort_scaling_factor()
-                                  * m->getActivation(s);
-        const double excitation = get_muscle_effort_scaling_factor()
-                                  * m->getControl(s);
-        double fiber_force_active = get_muscle_effort_scaling_factor()
-                                    * m->getActiveFiberForce(s);
-        const double fiber_length_normalized = m->getNormalizedFiberLength(s);
-        const double fiber_velocity = m->getFiberVelocity(s);
-        double A;
-
-        // Umberger defines fiber_velocity_normalized as Vm/LoM, not Vm/Vmax (p101, top left, Umberger(2003))
-        //const double fiber_velocity_normalized = m->getNormalizedFiberVelocity(s);
-        const double fiber_velocity_normalized = fiber_velocity / m->getOptimalFiberLength();
-
-
-        // ---------------------------------------------------------------------------
-        // NOT USED FOR THIS IMPLEMENTATION
-        //const double slow_twitch_excitation = mm.get_ratio_slow_twitch_fibers() * sin(Pi/2 * excitation);
-        //const double fast_twitch_excitation = (1 - mm.get_ratio_slow_twitch_fibers()) * (1 - cos(Pi/2 * excitation));
-
-        // Set normalized hill constants: A_rel and B_rel
-        //const double A_rel = 0.1 + 0.4*(1 - mm.get_ratio_slow_twitch_fibers());
-        //const double B_rel = A_rel * max_shortening_velocity;
-        // ---------------------------------------------------------------------------
-
-
-        // Set activation dependence scaling parameter: A
-        if (excitation > activation)
-            A = excitation;
-        else
-            A = (excitation + activation) / 2;
-
-        // Normalized contractile element force-length curve
-        const double F_iso = m->getActiveForceLengthMultiplier(s);   
+        if (get_count_muscle_evaluations())
+            ++_numMuscleEvaluations;
+
+        // Get the muscle constants and the muscle inputs at the current time
+        // state. If the muscle is within the range of its surrogate, the rates
+        // are evaluated from the surrogate and only its inputs are gathered.
+        const Kernel::MuscleConstants mc = getKernelMuscleConstants(i);
+        Kernel::MuscleInputs<double> in;
+        Kernel::MuscleRates<double> rates;
+        bool surrogate = false;
+        if (get_use_surrogate() && i < (int)_surrogateIndices.size()
+            && _surrogateIndices[i] >= 0) {
+            surrogate = calcSurrogateMuscleRates(s, i, settings, mc, in, rates);
+            if (!surrogate)
+                ++_numSurrogateFallbacks;
+        }
+        if (!surrogate)
+            gatherMuscleInputs(s, i, in);
 
         // Warnings
-        if (fiber_length_normalized < 0)
+        if (in.normalized_fiber_length < 0)
             cout << "WARNING: (t = " << s.getTime() 
             << "), muscle '" << m->getName() 
             << "' has negative normalized fiber-length." << endl; 
 
 
-
-        // ACTIVATION & MAINTENANCE HEAT RATE for muscle i (W/kg)
-        // --> depends on the normalized fiber length of the contractile element
+        // Heat rates (W/kg) and total metabolic energy rate (W) for muscle i.
+        // See UchidaUmberger2010MuscleMetabolicsKernel.
         // -----------------------------------------------------------------------
-        double slowTwitchRatio = mm.get_ratio_slow_twitch_fibers();
-        if (get_use_Bhargava_recruitment_model()) {
-            const double uSlow = slowTwitchRatio * sin(0.5*Pi * excitation);
-            const double uFast = (1 - slowTwitchRatio)
-                                 * (1 - cos(0.5*Pi * excitation));
-            slowTwitchRatio = (excitation == 0) ? 1.0 : uSlow / (uSlow + uFast);
-        }
-
-        if (get_forbid_negative_total_power() ||
-            get_activation_maintenance_rate_on())
-        {
-            const double unscaledAMdot = 128*(1 - slowTwitchRatio) + 25;
-
-            if (fiber_length_normalized <= 1.0)
-                AMdot = get_aerobic_factor() * std::pow(A, 0.6) * unscaledAMdot;
+        bool reused = false;
+        if (!surrogate) {
+            if (incremental && isWithinIncrementalTolerance(i, mc, in)) {
+                reused = true;
+                rates = _incrementalRates[i];
+            }
+            else if (_compiledKernel)
+                _compiledKernel->calcMuscleRates(i, in, rates);
             else
-                AMdot = get_aerobic_factor() * std::pow(A, 0.6) * ((0.4 * unscaledAMdot) + (0.6 * unscaledAMdot * F_iso));
+                Kernel::calcMuscleRates(settings, mc, in, rates);
         }
 
-
-
-        // SHORTENING HEAT RATE for muscle i (W/kg)
-        // --> depends on the normalized fiber length of the contractile element
-        // --> note that we define Vm<0 as shortening and Vm>0 as lengthening
-        // -----------------------------------------------------------------------
-        if (get_forbid_negative_total_power() || get_shortening_rate_on())
-        {
-            const double Vmax_fasttwitch = max_shortening_velocity;
-            const double Vmax_slowtwitch = max_shortening_velocity / 2.5;
-            const double alpha_shortening_fasttwitch = 153 / Vmax_fasttwitch;
-            const double alpha_shortening_slowtwitch = 100 / Vmax_slowtwitch;
-            double unscaledSdot, tmp_slowTwitch, tmp_fastTwitch;
-
-            if (fiber_velocity_normalized <= 0)    // concentric contraction, Vm<0
-            {
-                const double maxShorteningRate = 100.0;    // (W/kg)
-
-                tmp_slowTwitch = -alpha_shortening_slowtwitch * fiber_velocity_normalized;
-
-                // Apply upper limit to the unscaled slow twitch shortening rate.
-                if (tmp_slowTwitch > maxShorteningRate) {
-                    //cout << "WARNING: " << getName() << "  (t = " << s.getTime() << 
-                    //    "Slow twitch shortening heat rate exceeds the max value of " << maxShorteningRate << 
-                    //    " W/kg. Setting to " << maxShorteningRate << " W/kg." << endl; 
-                    tmp_slowTwitch = maxShorteningRate;
-                }
-
-                tmp_fastTwitch = alpha_shortening_fasttwitch * fiber_velocity_normalized * (1-slowTwitchRatio);
-                unscaledSdot = (tmp_slowTwitch * slowTwitchRatio) - tmp_fastTwitch;   // unscaled shortening heat rate: muscle shortening
-                Sdot = get_aerobic_factor() * std::pow(A, 2.0) * unscaledSdot;                      // scaled shortening heat rate: muscle shortening
-            }
-
-            else	// eccentric contraction, Vm>0
-            {
-                unscaledSdot =
-                    (get_include_negative_mechanical_work() ? 4.0 : 0.3)
-                    * alpha_shortening_slowtwitch * fiber_velocity_normalized;  // unscaled shortening heat rate: muscle lengthening
-                Sdot = get_aerobic_factor() * A * unscaledSdot;                                // scaled shortening heat rate: muscle lengthening
+        // The rates of the muscle in single precision, compared to those in
+        // double precision (the surrogate is evaluated in double precision).
+        if (singlePrecisionCheck) {
+            double singlePrecisionEdot = rates.Edot;
+            double doublePrecisionEdot = rates.Edot;
+            if (!surrogate) {
+                Kernel::MuscleInputs<float> inFloat;
+                Kernel::MuscleRates<float> ratesFloat;
+                Kernel::MuscleRates<double> ratesDouble;
+                Kernel::convert(in, inFloat);
+                Kernel::calcMuscleRates(settings, mc, inFloat, ratesFloat);
+                Kernel::convert(ratesFloat, ratesDouble);
+                singlePrecisionEdot = ratesDouble.Edot;
+                Kernel::calcMuscleRates(settings, mc, in, ratesDouble);
+                doublePrecisionEdot = ratesDouble.Edot;
+                updateSinglePrecisionError(
+                    _singlePrecisionMaxRelErrorMuscles[i],
+                    singlePrecisionEdot, doublePrecisionEdot);
             }
-
-
-            // Fiber length dependance on scaled shortening heat rate
-            // (for both concentric and eccentric contractions).
-            if (fiber_length_normalized > 1.0)
-                Sdot *= F_iso;  
+            singlePrecisionTotal += singlePrecisionEdot;
+            doublePrecisionTotal += doublePrecisionEdot;
         }
-        
-
-
-        // Clamp fiber force. THIS SHOULD NEVER HAPPEN...
-        if (fiber_force_active < 0)
-            fiber_force_active = 0.0;
-
-
-
 
-        // MECHANICAL WORK RATE for the contractile element of muscle i (W/kg).
-        // --> note that we define Vm<0 as shortening and Vm>0 as lengthening.
-        // -------------------------------------------------------------------
-        if (get_forbid_negative_total_power() || get_mechanical_work_rate_on())
-        {
-            if (get_include_negative_mechanical_work() || fiber_velocity <= 0)
-                Wdot = -fiber_force_active*fiber_velocity;
+        if (incremental) {
+            ++_numIncrementalEvaluations;
+            if (reused)
+                ++_numReusedMuscleEvaluations;
             else
-                Wdot = 0;
-
-            Wdot /= mm.getMuscleMass();
-        }
-
-
-        // If necessary, increase the shortening heat rate so that the total
-        // power is non-negative.
-        if (get_forbid_negative_total_power()) {
-            const double Edot_Wkg_beforeClamp = AMdot + Sdot + Wdot;
-            if (Edot_Wkg_beforeClamp < 0)
-                Sdot -= Edot_Wkg_beforeClamp;
+                updateIncrementalCache(i, in, rates);
         }
 
 
         // NAN CHECKING
         // ------------------------------------------
-        if (isNaN(AMdot))
+        if (isNaN(rates.AMdot))
             cout << "WARNING::" << getName() << ": AMdot (" << m->getName() << ") = NaN!" << endl;
-        if (isNaN(Sdot))
+        if (isNaN(rates.Sdot))
             cout << "WARNING::" << getName() << ": Sdot (" << m->getName() << ") = NaN!" << endl;
-        if (isNaN(Wdot))
+        if (isNaN(rates.Wdot))
             cout << "WARNING::" << getName() << ": Wdot (" << m->getName() << ") = NaN!" << endl;
 
 
-        // This check is from Umberger(2003), page 104: the total heat rate 
-        // (i.e., AMdot + Sdot) for a given muscle cannot fall below 1.0 W/kg.
-        // -----------------------------------------------------------------------
-        double totalHeatRate = AMdot + Sdot;
-
-        if(get_enforce_minimum_heat_rate_per_muscle() && totalHeatRate < 1.0 
-            && get_activation_maintenance_rate_on() 
-            && get_shortening_rate_on()) {
-                //cout << "WARNING: " << getName() 
-                //    << "  (t = " << s.getTime() 
-                //    << "), the muscle '" << mm.getName() 
-                //    << "' has a net metabolic energy rate of less than 1.0 W/kg." << endl; 
-                totalHeatRate = 1.0;			// not allowed to fall below 1.0 W.kg-1
-        }
-        
-
         // TOTAL METABOLIC ENERGY RATE for muscle i
         // UNITS: W
         // ------------------------------------------
-        double Edot = 0;
-
-        if (get_activation_maintenance_rate_on() && get_shortening_rate_on())
-            Edot += totalHeatRate;      // May have been clamped to 1.0 W/kg.
-        else {
-            if (get_activation_maintenance_rate_on())
-                Edot += AMdot;
-            if (get_shortening_rate_on())
-                Edot += Sdot;
-        }
-        if (get_mechanical_work_rate_on())
-            Edot += Wdot;
-        Edot *= mm.getMuscleMass();
+        const double Edot = rates.Edot;
 
-        EdotOutput(0) += Edot;       // Add to TOTAL metabolic power storage
+        if (!incremental)
+            EdotOutput(0) += Edot;   // Add to TOTAL metabolic power storage
         if (!get_report_total_metabolics_only()) {
             // Metabolic power storage for muscle i
             EdotOutput(i+2) = Edot;  
@@ -468,34 +573,183 @@ SimTK::Vector UchidaUmberger2010MuscleMetabolicsProbe::computeProbeInputs(const
         
 
 #ifdef DEBUG_METABOLICS
-        cout << "muscle_mass = " << mm.getMuscleMass() << endl;
-        cout << "ratio_slow_twitch_fibers = " << slowTwitchRatio << endl;
+        cout << "muscle_mass = " << mc.muscle_mass << endl;
+        cout << "ratio_slow_twitch_fibers = " << mc.ratio_slow_twitch_fibers << endl;
         cout << "bodymass = " << _model->getMatterSubsystem().calcSystemMass(s) << endl;
-        //cout << "max_isometric_force = " << max_isometric_force << endl;
-        cout << "activation = " << activation << endl;
-        cout << "excitation = " << excitation << endl;
-        //cout << "fiber_force_total = " << fiber_force_total << endl;
-        cout << "fiber_force_active = " << fiber_force_active << endl;
-        cout << "fiber_length_normalized = " << fiber_length_normalized << endl;
-        cout << "fiber_velocity = " << fiber_velocity << endl;
-        //cout << "slow_twitch_excitation = " << slow_twitch_excitation << endl;
-        //cout << "fast_twitch_excitation = " << fast_twitch_excitation << endl;
-        cout << "max shortening velocity = " << max_shortening_velocity << endl;
-        //cout << "A_rel = " << A_rel << endl;
-        //cout << "B_rel = " << B_rel << endl;
-        cout << "AMdot = " << AMdot << endl;
-        cout << "Sdot = " << Sdot << endl;
+        cout << "activation = " << in.activation << endl;
+        cout << "excitation = " << in.excitation << endl;
+        cout << "fiber_force_active = " << in.active_fiber_force << endl;
+        cout << "fiber_length_normalized = " << in.normalized_fiber_length << endl;
+        cout << "fiber_velocity = " << in.fiber_velocity << endl;
+        cout << "max shortening velocity = " << mc.max_contraction_velocity << endl;
+        cout << "AMdot = " << rates.AMdot << endl;
+        cout << "Sdot = " << rates.Sdot << endl;
         cout << "Bdot = " << Bdot << endl;
-        cout << "Wdot = " << Wdot << endl;
+        cout << "Wdot = " << rates.Wdot << endl;
         cout << "Edot = " << Edot << endl;
 		std::cin.get();
 #endif
     }
 
+    // In incremental evaluation, the sum of the metabolic rates of the muscles
+    // is updated by updateIncrementalCache().
+    if (incremental)
+        EdotOutput(0) += _incrementalTotal;
+
+    if (singlePrecisionCheck) {
+        ++_numSinglePrecisionChecks;
+        updateSinglePrecisionError(_singlePrecisionMaxRelErrorTotal,
+                                   singlePrecisionTotal, doublePrecisionTotal);
+        checkSinglePrecisionTolerance(s);
+    }
+
     return EdotOutput;
 }
 
 
+//_____________________________________________________________________________
+/**
+ * Get the probe-wide settings used by the per-muscle kernel.
+ */
+UchidaUmberger2010MuscleMetabolicsKernel::Settings
+    UchidaUmberger2010MuscleMetabolicsProbe::getKernelSettings() const
+{
+    Kernel::Settings settings;
+    settings.activation_maintenance_rate_on = get_activation_maintenance_rate_on();
+    settings.shortening_rate_on = get_shortening_rate_on();
+    settings.mechanical_work_rate_on = get_mechanical_work_rate_on();
+    settings.enforce_minimum_heat_rate_per_muscle =
+        get_enforce_minimum_heat_rate_per_muscle();
+    settings.use_Bhargava_recruitment_model = get_use_Bhargava_recruitment_model();
+    settings.include_negative_mechanical_work =
+        get_include_negative_mechanical_work();
+    settings.forbid_negative_total_power = get_forbid_negative_total_power();
+    settings.fast_math = usesFastMath();
+    settings.aerobic_factor = get_aerobic_factor();
+    settings.muscle_effort_scaling_factor = get_muscle_effort_scaling_factor();
+    return settings;
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Get the constant parameters of muscle i used by the per-muscle kernel.
+ */
+UchidaUmberger2010MuscleMetabolicsKernel::MuscleConstants
+    UchidaUmberger2010MuscleMetabolicsProbe::getKernelMuscleConstants(int i) const
+{
+    const UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter& mm =
+        get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i];
+    const Muscle* m = mm.getMuscle();
+
+    Kernel::MuscleConstants mc;
+    mc.muscle_mass = mm.getMuscleMass();
+    mc.ratio_slow_twitch_fibers = mm.get_ratio_slow_twitch_fibers();
+    mc.max_contraction_velocity = m->getMaxContractionVelocity();
+    mc.optimal_fiber_length = m->getOptimalFiberLength();
+    return mc;
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Get muscle i of the MetabolicMuscleParameterSet.
+ */
+const Muscle& UchidaUmberger2010MuscleMetabolicsProbe::getMetabolicMuscle(int i) const
+{
+    return *get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+        .getMuscle();
+}
+
+//_____________________________________________________________________________
+/**
+ * Gather the state-dependent inputs of muscle i used by the per-muscle kernel.
+ * The state must be realized to Stage::Dynamics.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::gatherMuscleInputs(
+    const State& s, int i, Kernel::MuscleInputs<double>& in) const
+{
+    const Muscle* m =
+        get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+        .getMuscle();
+
+    in.excitation = getMuscleExcitation(s, i);
+    in.activation = m->getActivation(s);
+    in.active_fiber_force = m->getActiveFiberForce(s);
+    in.normalized_fiber_length = m->getNormalizedFiberLength(s);
+    in.fiber_velocity = m->getFiberVelocity(s);
+    in.active_force_length_multiplier = m->getActiveForceLengthMultiplier(s);
+}
+
+//_____________________________________________________________________________
+/**
+ * Create a real-time evaluator from the current properties of the probe.
+ */
+UchidaUmberger2010MuscleMetabolicsProbe::RealTimeEvaluator
+    UchidaUmberger2010MuscleMetabolicsProbe::createRealTimeEvaluator(const State& s) const
+{
+    double Bdot = 0;
+    if (get_basal_rate_on())
+        Bdot = get_basal_coefficient()
+            * pow(_model->getMatterSubsystem().calcSystemMass(s), get_basal_exponent());
+
+    RealTimeEvaluator evaluator(getKernelSettings(), Bdot);
+    for (int i=0; i<getNumMetabolicMuscles(); ++i)
+        evaluator.addMuscle(getKernelMuscleConstants(i));
+    return evaluator;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the compiled kernel used when <use_compiled_kernel> is true.
+ */
+const UchidaUmberger2010MuscleMetabolicsProbe::CompiledKernel*
+    UchidaUmberger2010MuscleMetabolicsProbe::getCompiledKernel() const
+{
+    return _compiledKernel;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the trials of the execution modes with <autotune>.
+ */
+const MuscleMetabolicsAutotuner::Result&
+    UchidaUmberger2010MuscleMetabolicsProbe::getAutotuneResult() const
+{
+    return _autotuneResult;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the execution mode chosen with <autotune>.
+ */
+MuscleMetabolicsAutotuner::Mode
+    UchidaUmberger2010MuscleMetabolicsProbe::getAutotunedMode() const
+{
+    return _autotunedMode;
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Whether the muscles are evaluated with the approximations of
+ * <fast_math> or by the compiled kernel: in the mode chosen with <autotune>,
+ * or as set by the properties otherwise.
+ */
+bool UchidaUmberger2010MuscleMetabolicsProbe::usesFastMath() const
+{
+    if (get_autotune())
+        return _autotunedMode == MuscleMetabolicsAutotuner::FastMath;
+    return get_fast_math();
+}
+
+bool UchidaUmberger2010MuscleMetabolicsProbe::usesCompiledKernel() const
+{
+    if (get_autotune())
+        return _autotunedMode == MuscleMetabolicsAutotuner::CompiledKernel;
+    return get_use_compiled_kernel();
+}
+
+
 //_____________________________________________________________________________
 /** 
  * Returns the number of probe inputs in the vector returned by computeProbeInputs().
@@ -531,12 +785,558 @@ Array<string> UchidaUmberger2010MuscleMetabolicsProbe::getProbeOutputLabels() co
 
     labels.append(getName()+"_BASAL");
 
-    for (int i=0; i<getNumMetabolicMuscles(); ++i)
-        labels.append(getName()+"_"+get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i].getName());
+    for (int i=0; i<getNumMetabolicMuscles(); ++i)
+        labels.append(getName()+"_"+get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i].getName());
+
+    return labels;
+}
+
+
+//_____________________________________________________________________________
+/**
+ * Whether computeProbeInputs() may be called concurrently on distinct States.
+ * The options below write to the probe (or, for reconstruct_excitation, to
+ * the workspace of the activation splines) during the evaluation.
+ */
+bool UchidaUmberger2010MuscleMetabolicsProbe::supportsConcurrentEvaluation() const
+{
+    return get_single_precision_check_interval() == 0
+        && !get_use_surrogate()
+        && !get_count_muscle_evaluations()
+        && !get_incremental_evaluation()
+        && !get_reconstruct_excitation()
+        && get_sampling_rate() == 0;
+}
+
+
+
+
+
+//=============================================================================
+// SINGLE-PRECISION ERROR REPORT
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Record the relative deviation of a value computed in single
+ * precision from its double-precision reference.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::updateSinglePrecisionError(
+    double& maxRelError, double value, double reference)
+{
+    double relError = fabs(value - reference);
+    if (fabs(reference) > SimTK::SignificantReal)
+        relError /= fabs(reference);
+    if (relError > maxRelError || isNaN(relError))
+        maxRelError = relError;
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Print a warning (once) if the maximum relative deviation exceeds
+ * the <single_precision_tolerance>.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::checkSinglePrecisionTolerance(
+    const State& s) const
+{
+    if (_singlePrecisionWarningIssued)
+        return;
+
+    double maxRelError = _singlePrecisionMaxRelErrorTotal;
+    for (unsigned int i=0; i<_singlePrecisionMaxRelErrorMuscles.size(); ++i)
+        maxRelError = max(maxRelError, _singlePrecisionMaxRelErrorMuscles[i]);
+
+    if (maxRelError > get_single_precision_tolerance() || isNaN(maxRelError)) {
+        cout << "WARNING: " << getName() << "  (t = " << s.getTime()
+            << "), single-precision metabolic power deviates from double "
+            "precision by " << maxRelError << " (relative), which exceeds "
+            "<single_precision_tolerance> = " << get_single_precision_tolerance()
+            << "." << endl;
+        _singlePrecisionWarningIssued = true;
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the number of evaluations that were checked in double precision.
+ */
+int UchidaUmberger2010MuscleMetabolicsProbe::getNumSinglePrecisionChecks() const
+{
+    return _numSinglePrecisionChecks;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the maximum relative deviation of the TOTAL metabolic power.
+ */
+double UchidaUmberger2010MuscleMetabolicsProbe::
+    getSinglePrecisionMaxRelativeError() const
+{
+    return _singlePrecisionMaxRelErrorTotal;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the maximum relative deviation of the metabolic power of a muscle.
+ */
+double UchidaUmberger2010MuscleMetabolicsProbe::
+    getSinglePrecisionMaxRelativeError(const std::string& muscleName) const
+{
+    const int k = get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()
+                  .getIndex(muscleName);
+    if (k < 0) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": Invalid muscle "
+            << muscleName << " in the MetabolicMuscleParameterSet." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    return (k < (int)_singlePrecisionMaxRelErrorMuscles.size())
+           ? _singlePrecisionMaxRelErrorMuscles[k] : 0.0;
+}
+
+//_____________________________________________________________________________
+/**
+ * Print the single-precision error report.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::
+    printSinglePrecisionErrorReport(std::ostream& out) const
+{
+    const double tol = get_single_precision_tolerance();
+    double maxRelError = _singlePrecisionMaxRelErrorTotal;
+
+    out << getName() << ": single-precision error report ("
+        << _numSinglePrecisionChecks << " evaluations checked)" << endl;
+    out << "    " << getName() << "_TOTAL: " << _singlePrecisionMaxRelErrorTotal
+        << endl;
+    for (int i=0; i<getNumMetabolicMuscles(); ++i) {
+        const double err = (i < (int)_singlePrecisionMaxRelErrorMuscles.size())
+                           ? _singlePrecisionMaxRelErrorMuscles[i] : 0.0;
+        maxRelError = max(maxRelError, err);
+        out << "    " << getName() << "_"
+            << get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i].getName()
+            << ": " << err << endl;
+    }
+    out << "    maximum relative deviation " << maxRelError
+        << ((maxRelError <= tol) ? " is within" : " EXCEEDS")
+        << " <single_precision_tolerance> = " << tol << endl;
+}
+
+//_____________________________________________________________________________
+/**
+ * Reset the single-precision error report.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::resetSinglePrecisionErrorReport()
+{
+    _numSinglePrecisionEvaluations = 0;
+    _numSinglePrecisionChecks = 0;
+    _singlePrecisionMaxRelErrorTotal = 0;
+    _singlePrecisionMaxRelErrorMuscles.clear();
+    _singlePrecisionWarningIssued = false;
+}
+
+
+
+
+//=============================================================================
+// SURROGATES
+//=============================================================================
+namespace {
+    // Heat rates of a muscle at a node of its surrogate, from the exact
+    // kernel. The active-force-length multiplier is interpolated from the
+    // values observed at the node's fiber length.
+    class UmbergerSurrogateNodeFunction {
+    public:
+        UmbergerSurrogateNodeFunction(
+            const UchidaUmberger2010MuscleMetabolicsKernel::Settings& settings,
+            const UchidaUmberger2010MuscleMetabolicsKernel::MuscleConstants& mc,
+            const MuscleMetabolicsSurrogate::FiberLengthTable& table)
+        :   _settings(settings), _mc(mc), _table(table) {}
+
+        void operator()(const MuscleMetabolicsSurrogate::InputVector& x,
+                        double* heatRates) const
+        {
+            UchidaUmberger2010MuscleMetabolicsKernel::MuscleInputs<double> in;
+            in.excitation = x[0];
+            in.activation = x[1];
+            in.normalized_fiber_length = x[2];
+            in.fiber_velocity = x[3] * _mc.optimal_fiber_length;
+            in.active_fiber_force = x[4];
+            in.active_force_length_multiplier = _table.calcValue(x[2])[0];
+
+            UchidaUmberger2010MuscleMetabolicsKernel::MuscleRates<double> rates;
+            UchidaUmberger2010MuscleMetabolicsKernel::calcHeatRates(
+                _settings, _mc, in, rates);
+            heatRates[0] = rates.AMdot;
+            heatRates[1] = rates.Sdot;
+        }
+
+    private:
+        UchidaUmberger2010MuscleMetabolicsKernel::Settings _settings;
+        UchidaUmberger2010MuscleMetabolicsKernel::MuscleConstants _mc;
+        const MuscleMetabolicsSurrogate::FiberLengthTable& _table;
+    };
+}
+
+//_____________________________________________________________________________
+/**
+ * Fit a surrogate for each muscle to the exact equations over the operating
+ * range observed in the given states.
+ */
+MuscleMetabolicsSurrogateSet UchidaUmberger2010MuscleMetabolicsProbe::
+    fitSurrogates(const std::vector<SimTK::State>& states,
+                  int numNodesPerInput) const
+{
+    // The surrogates approximate the exact equations.
+    Kernel::Settings settings = getKernelSettings();
+    settings.fast_math = false;
+
+    MuscleMetabolicsSurrogateSet surrogates;
+    for (int i=0; i<getNumMetabolicMuscles(); ++i) {
+        const Kernel::MuscleConstants mc = getKernelMuscleConstants(i);
+        std::vector<MuscleMetabolicsSurrogate::InputVector>
+            observedInputs(states.size());
+        MuscleMetabolicsSurrogate::FiberLengthTable table;
+        for (unsigned int k=0; k<states.size(); ++k) {
+            Kernel::MuscleInputs<double> in;
+            gatherMuscleInputs(states[k], i, in);
+            gatherSurrogateInputs(states[k], i, observedInputs[k]);
+            table.addSample(in.normalized_fiber_length,
+                            Vec3(in.active_force_length_multiplier, 0, 0));
+        }
+        table.sort();
+
+        MuscleMetabolicsSurrogate* surrogate = new MuscleMetabolicsSurrogate(
+            get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+            .getName());
+        // The heat rates do not depend on the active fiber force.
+        const int numNodes[MuscleMetabolicsSurrogate::NumInputs] = {
+            numNodesPerInput, numNodesPerInput, numNodesPerInput,
+            numNodesPerInput, 1 };
+        surrogate->fit(observedInputs, numNodes, 2,
+                       UmbergerSurrogateNodeFunction(settings, mc, table));
+        surrogates.adoptAndAppend(surrogate);
+    }
+    return surrogates;
+}
+
+//_____________________________________________________________________________
+/**
+ * Set the surrogates used when <use_surrogate> is true.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::setSurrogates(
+    const MuscleMetabolicsSurrogateSet& surrogates)
+{
+    _surrogates = surrogates;
+    connectSurrogates();
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the surrogates used when <use_surrogate> is true.
+ */
+const MuscleMetabolicsSurrogateSet&
+    UchidaUmberger2010MuscleMetabolicsProbe::getSurrogates() const
+{
+    return _surrogates;
+}
+
+//_____________________________________________________________________________
+/**
+ * Compare the surrogates to the exact equations at the given states.
+ */
+SimTK::Vector UchidaUmberger2010MuscleMetabolicsProbe::validateSurrogates(
+    const std::vector<SimTK::State>& states, std::ostream& out) const
+{
+    const Kernel::Settings settings = getKernelSettings();
+    const int nM = getNumMetabolicMuscles();
+    Vector maxError(nM, 0.0);
+
+    out << getName() << ": surrogate validation report (" << states.size()
+        << " states)" << endl;
+    for (int i=0; i<nM; ++i) {
+        const std::string& muscleName =
+            get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+            .getName();
+        const int k = (i < (int)_surrogateIndices.size())
+                      ? _surrogateIndices[i] : -1;
+        if (k < 0) {
+            out << "    " << muscleName << ": no surrogate" << endl;
+            continue;
+        }
+
+        const Kernel::MuscleConstants mc = getKernelMuscleConstants(i);
+        double sumSquaredError = 0, sumSquaredExact = 0;
+        int numInRange = 0;
+        for (unsigned int j=0; j<states.size(); ++j) {
+            Kernel::MuscleInputs<double> in;
+            Kernel::MuscleRates<double> ratesSurrogate, rates;
+            if (!calcSurrogateMuscleRates(states[j], i, settings, mc, in,
+                                          ratesSurrogate))
+                continue;
+            gatherMuscleInputs(states[j], i, in);
+            Kernel::calcMuscleRates(settings, mc, in, rates);
+
+            const double error = fabs(ratesSurrogate.Edot - rates.Edot);
+            maxError[i] = max(maxError[i], error);
+            sumSquaredError += error*error;
+            sumSquaredExact += rates.Edot*rates.Edot;
+            ++numInRange;
+        }
+
+        const double rmsError = numInRange ? sqrt(sumSquaredError/numInRange) : 0;
+        const double rmsExact = numInRange ? sqrt(sumSquaredExact/numInRange) : 0;
+        out << "    " << muscleName << ": max error " << maxError[i]
+            << " W, RMS error " << rmsError << " W (RMS exact " << rmsExact
+            << " W), " << (states.size() - numInRange) << " of "
+            << states.size() << " states out of range" << endl;
+    }
+    return maxError;
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the number of muscle evaluations that fell back to the exact equations.
+ */
+int UchidaUmberger2010MuscleMetabolicsProbe::getNumSurrogateFallbacks() const
+{
+    return _numSurrogateFallbacks;
+}
+
+//_____________________________________________________________________________
+/**
+ * Gather the inputs of the surrogate of muscle i.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::gatherSurrogateInputs(
+    const State& s, int i, MuscleMetabolicsSurrogate::InputVector& x) const
+{
+    const Muscle* m =
+        get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+        .getMuscle();
+
+    x[0] = getMuscleExcitation(s, i);
+    x[1] = m->getActivation(s);
+    x[2] = m->getNormalizedFiberLength(s);
+    x[3] = m->getFiberVelocity(s) / m->getOptimalFiberLength();
+    x[4] = m->getActiveFiberForce(s);
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Map each muscle in the MetabolicMuscleParameterSet to the
+ * surrogate of the same name.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::connectSurrogates()
+{
+    _numSurrogateFallbacks = 0;
+    _surrogateIndices.assign(getNumMetabolicMuscles(), -1);
+    if (_surrogates.getSize() == 0)
+        return;
+
+    for (int i=0; i<getNumMetabolicMuscles(); ++i) {
+        const std::string& muscleName =
+            get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i]
+            .getName();
+        const int k = _surrogates.getIndex(muscleName);
+        if (k < 0) {
+            if (get_use_surrogate())
+                cout << "WARNING: " << getName() << ": No surrogate for muscle '"
+                    << muscleName << "'. The exact equations will be used."
+                    << endl;
+            continue;
+        }
+        _surrogates[k].initialize();
+        _surrogateIndices[i] = k;
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Evaluate the rates of muscle i from its surrogate. The heat rates
+ * are interpolated; the mechanical work rate, the clamps and the total rate
+ * are evaluated exactly by the kernel.
+ */
+bool UchidaUmberger2010MuscleMetabolicsProbe::calcSurrogateMuscleRates(
+    const State& s, int i, const Kernel::Settings& settings,
+    const Kernel::MuscleConstants& mc, Kernel::MuscleInputs<double>& in,
+    Kernel::MuscleRates<double>& rates) const
+{
+    if (i >= (int)_surrogateIndices.size() || _surrogateIndices[i] < 0)
+        return false;
+
+    const MuscleMetabolicsSurrogate& surrogate =
+        _surrogates[_surrogateIndices[i]];
+    MuscleMetabolicsSurrogate::InputVector x;
+    gatherSurrogateInputs(s, i, x);
+    if (!surrogate.isInRange(x))
+        return false;
+
+    double heatRates[MuscleMetabolicsSurrogate::MaxHeatRates];
+    surrogate.calcHeatRates(x, heatRates);
+    rates.AMdot = heatRates[0];
+    rates.Sdot = heatRates[1];
+
+    in.excitation = x[0];
+    in.activation = x[1];
+    in.normalized_fiber_length = x[2];
+    in.fiber_velocity = x[3] * mc.optimal_fiber_length;
+    in.active_fiber_force = x[4];
+    in.active_force_length_multiplier = SimTK::NaN;     // Not gathered.
+    Kernel::calcWorkAndTotalRates(settings, mc, in, rates);
+    return true;
+}
+
+
+
+
+//=============================================================================
+// DEFERRED EVALUATION
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Record the time, the basal rate and the inputs of each muscle at the given
+ * state.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::recordDeferredInputs(const State& s)
+{
+    double Bdot = 0;
+    if (get_basal_rate_on())
+        Bdot = get_basal_coefficient()
+            * pow(_model->getMatterSubsystem().calcSystemMass(s), get_basal_exponent());
+
+    _deferredRecords.times.push_back(s.getTime());
+    _deferredRecords.basalRates.push_back(Bdot);
+    for (int i=0; i<getNumMetabolicMuscles(); ++i) {
+        _deferredRecords.inputs.push_back(Kernel::MuscleInputs<double>());
+        gatherMuscleInputs(s, i, _deferredRecords.inputs.back());
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the number of recorded states.
+ */
+int UchidaUmberger2010MuscleMetabolicsProbe::getNumDeferredRecords() const
+{
+    return (int)_deferredRecords.times.size();
+}
+
+//_____________________________________________________________________________
+/**
+ * Discard the recorded inputs. The capacity of the records is kept, so that
+ * recording resumes without reallocation.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::clearDeferredInputs()
+{
+    _deferredRecords.times.clear();
+    _deferredRecords.basalRates.clear();
+    _deferredRecords.inputs.clear();
+}
+
+//_____________________________________________________________________________
+/**
+ * Exchange the recorded inputs with the given records.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::swapDeferredInputs(DeferredRecords& records)
+{
+    _deferredRecords.times.swap(records.times);
+    _deferredRecords.basalRates.swap(records.basalRates);
+    _deferredRecords.inputs.swap(records.inputs);
+}
+
+//_____________________________________________________________________________
+/**
+ * Compute the probe inputs (TOTAL, BASAL and per-muscle metabolic power, as
+ * returned by computeProbeInputs()) at each of the given records, and append
+ * them to 'outputs'.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::calcDeferredOutputs(const DeferredRecords& records,
+    std::vector<Vector>& outputs) const
+{
+    const Kernel::Settings settings = getKernelSettings();
+    const int numMuscles = getNumMetabolicMuscles();
+    std::vector<Kernel::MuscleConstants> mc(numMuscles);
+    for (int i=0; i<numMuscles; ++i)
+        mc[i] = getKernelMuscleConstants(i);
+
+    const int numOutputs = getNumProbeInputs();
+    std::vector<Kernel::MuscleRates<double> > rates(numMuscles);
+    for (unsigned int k=0; k<records.times.size(); ++k) {
+        Vector EdotOutput(numOutputs, 0.0);
+        const double Bdot = records.basalRates[k];
+        EdotOutput(0) += Bdot;
+        if (!get_report_total_metabolics_only())
+            EdotOutput(1) = Bdot;
+
+        // A compiled kernel evaluates all muscles of a record in one call.
+        if (_compiledKernel && numMuscles > 0)
+            _compiledKernel->calcMuscleRates(&records.inputs[k*numMuscles],
+                                             &rates[0]);
+        else
+            for (int i=0; i<numMuscles; ++i)
+                Kernel::calcMuscleRates(settings, mc[i],
+                    records.inputs[k*numMuscles+i], rates[i]);
+
+        for (int i=0; i<numMuscles; ++i) {
+            EdotOutput(0) += rates[i].Edot;
+            if (!get_report_total_metabolics_only())
+                EdotOutput(i+2) = rates[i].Edot;
+        }
+        outputs.push_back(EdotOutput);
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Create a block for the records of this probe.
+ */
+MuscleMetabolicsReportedProbe::DeferredBlock*
+    UchidaUmberger2010MuscleMetabolicsProbe::createDeferredBlock()
+{
+    return new MuscleMetabolicsDeferredBlock<UchidaUmberger2010MuscleMetabolicsProbe>(*this);
+}
 
-    return labels;
+//_____________________________________________________________________________
+/**
+ * Compute the probe outputs at the recorded states.
+ */
+Storage UchidaUmberger2010MuscleMetabolicsProbe::computeDeferredResults() const
+{
+    std::vector<Vector> outputs;
+    outputs.reserve(getNumDeferredRecords());
+    calcDeferredOutputs(_deferredRecords, outputs);
+    return computeDeferredResults(_deferredRecords.times, outputs);
 }
 
+//_____________________________________________________________________________
+/**
+ * Compute the probe outputs from the probe inputs at the given times.
+ */
+Storage UchidaUmberger2010MuscleMetabolicsProbe::computeDeferredResults(
+    const std::vector<double>& times, const std::vector<Vector>& outputs) const
+{
+    Array<string> labels;
+    labels.append("time");
+    labels.append(getProbeOutputLabels());
+    Storage results((int)times.size()+1, getName());
+    results.setColumnLabels(labels);
+
+    const bool integrate = (getOperation() == "integrate");
+    const int numOutputs = getNumProbeInputs();
+    Vector integral(numOutputs, 0.0);
+    if (integrate && getInitialConditions().size() == numOutputs)
+        integral = getInitialConditions();
+
+    for (unsigned int k=0; k<times.size() && k<outputs.size(); ++k) {
+        if (integrate) {
+            if (k > 0)
+                integral += 0.5*(times[k] - times[k-1])
+                            * (outputs[k] + outputs[k-1]);
+            results.append(times[k], getGain()*integral);
+        }
+        else
+            results.append(times[k], getGain()*outputs[k]);
+    }
+    return results;
+}
 
 
 
@@ -867,3 +1667,581 @@ constructProperties()
 	constructProperty_provided_muscle_mass(SimTK::NaN);
 }
 
+
+
+//=============================================================================
+// EXCITATION RECONSTRUCTION
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Set the activation states from which the excitations are reconstructed.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::setActivationStates(
+    const Storage& states)
+{
+    _excitationEstimator.setActivationStates(states);
+    if (_model)
+        connectExcitationEstimator();
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Add each muscle in the MetabolicMuscleParameterSet to the
+ * excitation estimator.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::connectExcitationEstimator()
+{
+    _excitationEstimator.clearMuscles();
+    if (!get_reconstruct_excitation() || isDisabled())
+        return;
+
+    if (!_excitationEstimator.hasActivationStates()) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": '" << getName()
+            << "' has <reconstruct_excitation> set, but no activation states. "
+            "Specify <activation_states_file> or call setActivationStates()."
+            << endl;
+        throw (Exception(errorMessage.str()));
+    }
+    for (int i=0; i<getNumMetabolicMuscles(); ++i)
+        _excitationEstimator.addMuscle(getMetabolicMuscle(i));
+}
+
+//_____________________________________________________________________________
+/**
+ * Get the excitation of muscle i: its control, or its reconstructed
+ * excitation.
+ */
+double UchidaUmberger2010MuscleMetabolicsProbe::getMuscleExcitation(
+    const State& s, int i) const
+{
+    if (get_reconstruct_excitation())
+        return _excitationEstimator.calcExcitation(i, s.getTime());
+    return getMetabolicMuscle(i).getControl(s);
+}
+
+
+
+//=============================================================================
+// MUSCLE EVALUATIONS
+//=============================================================================
+//_____________________________________________________________________________
+int UchidaUmberger2010MuscleMetabolicsProbe::getNumMuscleEvaluations() const
+{
+    return _numMuscleEvaluations;
+}
+
+void UchidaUmberger2010MuscleMetabolicsProbe::resetMuscleEvaluationCounter()
+{
+    _numMuscleEvaluations = 0;
+}
+
+
+
+//=============================================================================
+// INCREMENTAL EVALUATION
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Get pointers to the inputs of a muscle, in the order of
+ * <_incrementalInputScales>.
+ */
+template <class Inputs, class T>
+void UchidaUmberger2010MuscleMetabolicsProbe::getIncrementalInputs(Inputs& in, T* x[])
+{
+    x[0] = &in.excitation;
+    x[1] = &in.activation;
+    x[2] = &in.active_fiber_force;
+    x[3] = &in.normalized_fiber_length;
+    x[4] = &in.fiber_velocity;
+    x[5] = &in.active_force_length_multiplier;
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Size the cache of incremental evaluation and compute the scales of
+ * the inputs of each muscle.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::connectIncrementalEvaluation()
+{
+    _incrementalInputScales.clear();
+    if (!get_incremental_evaluation() || isDisabled()) {
+        resetIncrementalEvaluation();
+        return;
+    }
+
+    const int nM = getNumMetabolicMuscles();
+    _incrementalInputScales.resize(nM*NumIncrementalInputs);
+    for (int i=0; i<nM; ++i) {
+        const Muscle& m = getMetabolicMuscle(i);
+        double* scales = &_incrementalInputScales[i*NumIncrementalInputs];
+        scales[0] = 1;                                // excitation
+        scales[1] = 1;                                // activation
+        scales[2] = m.getMaxIsometricForce();         // active_fiber_force
+        scales[3] = 1;                                // normalized_fiber_length
+        scales[4] = m.getMaxContractionVelocity()     // fiber_velocity
+                    * m.getOptimalFiberLength();
+        scales[5] = 1;                                // active_force_length_multiplier
+    }
+
+    resetIncrementalEvaluation();
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: With <autotune>, time the execution modes of the probe from its
+ * exact settings (or read their cached timings), and choose the fastest mode
+ * within <autotune_tolerance>. The properties of the modes are not changed.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::connectAutotune()
+{
+    _autotunedMode = MuscleMetabolicsAutotuner::Exact;
+    if (!get_autotune())
+        return;
+    if (!(get_autotune_tolerance() >= 0)) {
+        stringstream errorMessage;
+        errorMessage << getConcreteClassName() << ": '" << getName()
+            << "' has <autotune_tolerance> " << get_autotune_tolerance()
+            << ", which must be nonnegative." << endl;
+        throw (Exception(errorMessage.str()));
+    }
+
+    _autotuneResult =
+        MuscleMetabolicsAutotuner::tune(*this, get_autotune_cache_file());
+    _autotunedMode = MuscleMetabolicsAutotuner::selectMode(_autotuneResult,
+        get_autotune_tolerance());
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Find the registered compiled kernel whose parameter hash matches
+ * the settings and muscle constants of the probe.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::connectCompiledKernel()
+{
+    _compiledKernel = 0;
+    if (!usesCompiledKernel() || isDisabled())
+        return;
+
+    const string hash = MuscleMetabolicsKernelGenerator::calcParameterHash(*this);
+    if (!MuscleMetabolicsCompiledKernelRegistry::find(hash, _compiledKernel)
+        || _compiledKernel->getNumMuscles() != getNumMetabolicMuscles()) {
+        cout << "WARNING: " << getName() << ": No compiled kernel is loaded "
+            "for the parameters of the probe (hash " << hash << "). The "
+            "kernel will be evaluated from the properties." << endl;
+        _compiledKernel = 0;
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Whether the inputs of the ith muscle are within
+ * <incremental_tolerance> of its cached inputs (which are NaN until the muscle
+ * is first evaluated), and on the same branches of the equations.
+ */
+bool UchidaUmberger2010MuscleMetabolicsProbe::isWithinIncrementalTolerance(int i,
+    const Kernel::MuscleConstants& mc,
+    const Kernel::MuscleInputs<double>& in) const
+{
+    const Kernel::MuscleInputs<double>& cached = _incrementalInputs[i];
+    const double* x[NumIncrementalInputs];
+    const double* y[NumIncrementalInputs];
+    getIncrementalInputs(in, x);
+    getIncrementalInputs(cached, y);
+    const double* scales = &_incrementalInputScales[i*NumIncrementalInputs];
+    const double tol = get_incremental_tolerance();
+    for (int k=0; k<NumIncrementalInputs; ++k)
+        if (!(fabs(*x[k] - *y[k]) <= tol*scales[k]))
+            return false;
+    return Kernel::isSameBranch(mc, in, cached);
+}
+
+//_____________________________________________________________________________
+/**
+ * PRIVATE: Cache the inputs and rates of the ith muscle, and update the sum of
+ * the cached metabolic rates by the change in its rate. The sum is recomputed
+ * if it has become NaN, so that a NaN rate does not persist once replaced.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::updateIncrementalCache(int i,
+    const Kernel::MuscleInputs<double>& in,
+    const Kernel::MuscleRates<double>& rates) const
+{
+    _incrementalTotal += rates.Edot - _incrementalRates[i].Edot;
+    _incrementalInputs[i] = in;
+    _incrementalRates[i] = rates;
+    if (isNaN(_incrementalTotal)) {
+        _incrementalTotal = 0;
+        for (unsigned int j=0; j<_incrementalRates.size(); ++j)
+            _incrementalTotal += _incrementalRates[j].Edot;
+    }
+}
+
+//_____________________________________________________________________________
+/**
+ * Calculate the first-order bound on the error in the metabolic rate of the
+ * ith muscle when its cached rates are reused. The partial derivatives are
+ * evaluated with MuscleMetabolicsDual, one normalized input at a time.
+ */
+double UchidaUmberger2010MuscleMetabolicsProbe::calcIncrementalErrorBound(int i) const
+{
+    if (i < 0 || i >= (int)_incrementalInputs.size()
+        || isNaN(_incrementalInputs[i].excitation))
+        return 0;
+
+    typedef MuscleMetabolicsDual Dual;
+    const Kernel::Settings settings = getKernelSettings();
+    const Kernel::MuscleConstants mc = getKernelMuscleConstants(i);
+    const double* scales = &_incrementalInputScales[i*NumIncrementalInputs];
+    double bound = 0;
+    for (int k=0; k<NumIncrementalInputs; ++k) {
+        Kernel::MuscleInputs<Dual> in;
+        Kernel::convert(_incrementalInputs[i], in);
+        Dual* x[NumIncrementalInputs];
+        getIncrementalInputs(in, x);
+        x[k]->derivative = get_incremental_tolerance()*scales[k];
+
+        Kernel::MuscleRates<Dual> rates;
+        Kernel::calcHeatRates(settings, mc, in, rates);
+        const Dual heatRate = rates.AMdot + rates.Sdot;
+        Kernel::calcWorkAndTotalRates(settings, mc, in, rates);
+        bound += mc.muscle_mass*(fabs(heatRate.derivative)
+                  + fabs(rates.Wdot.derivative));
+    }
+    return bound;
+}
+
+int UchidaUmberger2010MuscleMetabolicsProbe::getNumIncrementalEvaluations() const
+{
+    return _numIncrementalEvaluations;
+}
+
+int UchidaUmberger2010MuscleMetabolicsProbe::getNumReusedMuscleEvaluations() const
+{
+    return _numReusedMuscleEvaluations;
+}
+
+double UchidaUmberger2010MuscleMetabolicsProbe::getIncrementalReuseRatio() const
+{
+    if (_numIncrementalEvaluations == 0)
+        return 0;
+    return double(_numReusedMuscleEvaluations) / _numIncrementalEvaluations;
+}
+
+void UchidaUmberger2010MuscleMetabolicsProbe::resetIncrementalEvaluation()
+{
+    _incrementalTotal = 0;
+    _numIncrementalEvaluations = 0;
+    _numReusedMuscleEvaluations = 0;
+
+    Kernel::MuscleInputs<double> uncached;
+    double* x[NumIncrementalInputs];
+    getIncrementalInputs(uncached, x);
+    for (int k=0; k<NumIncrementalInputs; ++k)
+        *x[k] = SimTK::NaN;
+    const int nM = (int)_incrementalInputScales.size() / NumIncrementalInputs;
+    _incrementalInputs.assign(nM, uncached);
+    _incrementalRates.assign(nM, Kernel::MuscleRates<double>());
+}
+
+
+
+//=============================================================================
+// MULTI-RATE SAMPLING
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Evaluate the probe at the given state and record the sample: it replaces
+ * the held sample, is added to the trapezoidal integral, and is appended to
+ * the sampled results, if any. A sample that precedes the last one starts a
+ * new series; a repeated sample is ignored.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::recordSample(const State& s) const
+{
+    const double t = s.getTime();
+    if (_numSamples > 0 && t <= _lastSampleTime) {
+        if (t == _lastSampleTime)
+            return;
+        _numSamples = 0;
+        if (_sampledResults)
+            _sampledResults->purge();
+    }
+
+    _model->getMultibodySystem().realize(s, SimTK::Stage::Dynamics);
+    const Vector EdotOutput = calcMetabolicPower(s);
+    if (_numSamples == 0) {
+        _sampledEnergy.resize(EdotOutput.size());
+        _sampledEnergy = 0;
+        if (getInitialConditions().size() == EdotOutput.size())
+            _sampledEnergy = getInitialConditions();
+    }
+    else
+        _sampledEnergy += 0.5*(t - _lastSampleTime)
+                          * (EdotOutput + _lastSampleInputs);
+    _lastSampleTime = t;
+    _lastSampleInputs = EdotOutput;
+    ++_numSamples;
+
+    if (_sampledResults)
+        _sampledResults->append(t, getGain()*(getOperation() == "integrate"
+                                              ? _sampledEnergy : EdotOutput));
+}
+
+int UchidaUmberger2010MuscleMetabolicsProbe::getNumSamples() const
+{
+    return _numSamples;
+}
+
+void UchidaUmberger2010MuscleMetabolicsProbe::clearSamples()
+{
+    _numSamples = 0;
+    _lastSampleTime = SimTK::NaN;
+    _lastSampleInputs.resize(0);
+    _sampledEnergy.resize(0);
+    _sampledResults = 0;
+}
+
+SimTK::Vector UchidaUmberger2010MuscleMetabolicsProbe::getSampledEnergy() const
+{
+    return getGain()*_sampledEnergy;
+}
+
+//_____________________________________________________________________________
+/**
+ * Label the given storage as the sampled results of the probe, and append
+ * the probe outputs to it at each subsequent sample.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::setSampledResults(Storage* results)
+{
+    _sampledResults = results;
+    if (!results)
+        return;
+    Array<string> labels;
+    labels.append("time");
+    labels.append(getProbeOutputLabels());
+    results->purge();
+    results->setName(getName() + "_sampled");
+    results->setColumnLabels(labels);
+}
+
+
+
+
+//=============================================================================
+// SUMMARY STATISTICS
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Add the probe inputs at the given time to the statistics.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::accumulateStatistics(double time,
+                                                   const Vector& inputs)
+{
+    _statistics.add(time, inputs);
+}
+
+const MuscleMetabolicsStatistics&
+    UchidaUmberger2010MuscleMetabolicsProbe::getStatistics() const
+{
+    return _statistics;
+}
+
+void UchidaUmberger2010MuscleMetabolicsProbe::clearStatistics()
+{
+    _statistics = MuscleMetabolicsStatistics(getProbeOutputLabels());
+}
+
+
+
+
+//=============================================================================
+// PEAK TRACKING
+//=============================================================================
+//_____________________________________________________________________________
+/**
+ * Update the peaks with the probe inputs at the given time.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::updatePeaks(double time, const Vector& inputs)
+{
+    _peaks.update(time, inputs);
+}
+
+const MuscleMetabolicsPeaks&
+    UchidaUmberger2010MuscleMetabolicsProbe::getPeaks() const
+{
+    return _peaks;
+}
+
+void UchidaUmberger2010MuscleMetabolicsProbe::clearPeaks()
+{
+    _peaks = MuscleMetabolicsPeaks(getProbeOutputLabels());
+}
+
+
+
+
+//=============================================================================
+// PARAMETER SENSITIVITY
+//=============================================================================
+Array<string> UchidaUmberger2010MuscleMetabolicsProbe::getSensitivityParameterNames() const
+{
+    static const char* globalNames[NumGlobalSensitivityParameters] = {
+        "aerobic_factor", "muscle_effort_scaling_factor",
+        "basal_coefficient", "basal_exponent" };
+    static const char* muscleNames[NumMuscleSensitivityParameters] = {
+        "ratio_slow_twitch_fibers", "specific_tension", "density",
+        "provided_muscle_mass" };
+
+    Array<string> names;
+    for (int k=0; k<NumGlobalSensitivityParameters; ++k)
+        names.append(globalNames[k]);
+    const UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet& mms =
+        get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet();
+    for (int i=0; i<mms.getSize(); ++i)
+        for (int k=0; k<NumMuscleSensitivityParameters; ++k)
+            names.append(mms[i].getName() + "." + muscleNames[k]);
+    return names;
+}
+
+Vector UchidaUmberger2010MuscleMetabolicsProbe::getSensitivityParameterValues() const
+{
+    const UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet& mms =
+        get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet();
+    Vector values(NumGlobalSensitivityParameters
+                  + NumMuscleSensitivityParameters*mms.getSize());
+    values[0] = get_aerobic_factor();
+    values[1] = get_muscle_effort_scaling_factor();
+    values[2] = get_basal_coefficient();
+    values[3] = get_basal_exponent();
+    for (int i=0; i<mms.getSize(); ++i) {
+        const int j = NumGlobalSensitivityParameters
+                      + NumMuscleSensitivityParameters*i;
+        values[j] = mms[i].get_ratio_slow_twitch_fibers();
+        values[j+1] = mms[i].get_specific_tension();
+        values[j+2] = mms[i].get_density();
+        values[j+3] = mms[i].get_provided_muscle_mass();
+    }
+    return values;
+}
+
+//_____________________________________________________________________________
+/**
+ * Evaluate the total metabolic power and its partial derivatives. The
+ * derivatives of the basal rate are analytic; those of each muscle are
+ * propagated through the kernel with MuscleMetabolicsDual, seeding the aerobic factor,
+ * the muscle effort scaling factor, the ratio of slow-twitch fibers and the
+ * muscle mass
+ * one at a time.
+ */
+double UchidaUmberger2010MuscleMetabolicsProbe::calcParameterSensitivity(
+    const State& s, Vector& derivatives) const
+{
+    typedef MuscleMetabolicsDual Dual;
+    const int nM = getNumMetabolicMuscles();
+    derivatives.resize(NumGlobalSensitivityParameters
+                       + NumMuscleSensitivityParameters*nM);
+    derivatives = 0;
+
+    double total = 0;
+    if (get_basal_rate_on()) {
+        const double mass = _model->getMatterSubsystem().calcSystemMass(s);
+        const double massTerm = pow(mass, get_basal_exponent());
+        total = get_basal_coefficient()*massTerm;
+        derivatives[2] = massTerm;
+        derivatives[3] = total*log(mass);
+    }
+
+    Kernel::BasicSettings<Dual> settings;
+    Kernel::convert(getKernelSettings(), settings);
+    for (int i=0; i<nM; ++i) {
+        const UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter& mm =
+            get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()[i];
+        Kernel::MuscleInputs<double> inDouble;
+        gatherMuscleInputs(s, i, inDouble);
+        Kernel::MuscleInputs<Dual> in;
+        Kernel::convert(inDouble, in);
+        Kernel::BasicMuscleConstants<Dual> mc;
+        Kernel::convert(getKernelMuscleConstants(i), mc);
+
+        Dual* seeds[] = { &settings.aerobic_factor,
+            &settings.muscle_effort_scaling_factor,
+            &mc.ratio_slow_twitch_fibers, &mc.muscle_mass };
+        const int numSeeds = sizeof(seeds)/sizeof(seeds[0]);
+        double dEdot[numSeeds];
+        for (int k=0; k<numSeeds; ++k) {
+            seeds[k]->derivative = 1;
+            Kernel::MuscleRates<Dual> rates;
+            Kernel::calcMuscleRates(settings, mc, in, rates);
+            seeds[k]->derivative = 0;
+            dEdot[k] = rates.Edot.derivative;
+            if (k == 0)
+                total += rates.Edot.value;
+        }
+
+        derivatives[0] += dEdot[0];
+        derivatives[1] += dEdot[1];
+        const int j = NumGlobalSensitivityParameters
+                      + NumMuscleSensitivityParameters*i;
+        derivatives[j] = dEdot[2];
+        // The muscle mass is either provided, or
+        // (max isometric force/specific tension)*density*optimal fiber length.
+        if (mm.get_use_provided_muscle_mass())
+            derivatives[j+3] = dEdot[3];
+        else {
+            const double mass = mc.muscle_mass.value;
+            derivatives[j+1] = -dEdot[3]*mass/mm.get_specific_tension();
+            derivatives[j+2] = dEdot[3]*mass/mm.get_density();
+        }
+    }
+    return total;
+}
+
+//_____________________________________________________________________________
+/**
+ * Evaluate the derivatives at the given state, and add them to the
+ * sensitivity.
+ */
+void UchidaUmberger2010MuscleMetabolicsProbe::accumulateSensitivity(const State& s)
+{
+    Vector derivatives;
+    const double power = calcParameterSensitivity(s, derivatives);
+    _sensitivity.add(s.getTime(), power, derivatives);
+}
+
+const MuscleMetabolicsSensitivity&
+    UchidaUmberger2010MuscleMetabolicsProbe::getSensitivity() const
+{
+    return _sensitivity;
+}
+
+void UchidaUmberger2010MuscleMetabolicsProbe::clearSensitivity()
+{
+    _sensitivity = MuscleMetabolicsSensitivity(getSensitivityParameterNames(),
+                                               getSensitivityParameterValues());
+}
+
+
+
+
+//=============================================================================
+// ENERGY BUDGET
+//=============================================================================
+void UchidaUmberger2010MuscleMetabolicsProbe::setEnergyBudget(double budget)
+{
+    set_energy_budget(budget);
+    _energyBudgetExceededTime = SimTK::NaN;
+}
+
+bool UchidaUmberger2010MuscleMetabolicsProbe::hasExceededEnergyBudget() const
+{
+    return !SimTK::isNaN(_energyBudgetExceededTime);
+}
+
+double UchidaUmberger2010MuscleMetabolicsProbe::getEnergyBudgetExceededTime() const
+{
+    return _energyBudgetExceededTime;
+}
+
+void UchidaUmberger2010MuscleMetabolicsProbe::recordEnergyBudgetExceeded(double t) const
+{
+    _energyBudgetExceededTime = t;
+}
@@ -25,6 +25,16 @@
  * -------------------------------------------------------------------------- */
 
 #include "osimMuscleMetabolicsProbesDLL.h"
+#include "UchidaUmberger2010MuscleMetabolicsKernel.h"
+#include "MuscleMetabolicsSurrogate.h"
+#include "MuscleMetabolicsRealTimeEvaluator.h"
+#include "MuscleMetabolicsCompiledKernel.h"
+#include "MuscleMetabolicsAutotuner.h"
+#include "MuscleMetabolicsSensitivity.h"
+#include "MuscleMetabolicsStatistics.h"
+#include "MuscleMetabolicsPeaks.h"
+#include "MuscleMetabolicsReportedProbe.h"
+#include "MuscleMetabolicsExcitationEstimator.h"
 #include <OpenSim/Simulation/Model/Probe.h>
 #include <OpenSim/Simulation/Model/Model.h>
 
@@ -174,6 +184,203 @@ class UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet;
  * rate (AMdot + Sdot) will be capped to a minimum value of 1.0 W/kg (Umberger(2003), page 104).
  *
  *
+ * If the 'fast_math' property is set to true, sin(Pi/2*u), 1-cos(Pi/2*u) and
+ * A^0.6 are evaluated with the polynomial approximations in
+ * MuscleMetabolicsFastMath.h rather than the exact functions. The maximum
+ * absolute error this introduces in the metabolic power of a muscle is less
+ * than 3e-4 W/kg.
+ *
+ *
+ * If the 'single_precision_check_interval' property is positive, every Nth
+ * evaluation (N = 'single_precision_check_interval') is repeated with the
+ * per-muscle calculations in single precision (float), and the maximum
+ * relative deviation of the TOTAL and per-muscle metabolic power from double
+ * precision is recorded, e.g., to decide whether the kernel may be evaluated
+ * in single precision on another device. The probe itself is always
+ * evaluated in double precision. A warning is printed if the deviation
+ * exceeds 'single_precision_tolerance'; the deviations can be retrieved with
+ * getSinglePrecisionMaxRelativeError() or printed with
+ * printSinglePrecisionErrorReport() at the end of a run.
+ *
+ *
+ * If the 'use_surrogate' property is set to true, the metabolic power of each
+ * muscle is evaluated from a fitted MuscleMetabolicsSurrogate of the muscle
+ * (loaded from 'surrogate_file', or set with setSurrogates()) whenever the
+ * muscle is within the operating range of the surrogate, and with the exact
+ * equations above otherwise. Surrogates are generated with fitSurrogates()
+ * from states of a representative trajectory, and their error on held-out
+ * states is reported by validateSurrogates(). In surrogate mode, the
+ * properties above that affect the per-muscle equations are those in effect
+ * when the surrogates were fitted.
+ *
+ *
+ * For embedded and online-feedback use, createRealTimeEvaluator() returns a
+ * MuscleMetabolicsRealTimeEvaluator with the current properties of the probe,
+ * which evaluates the equations above from muscle inputs supplied by the
+ * caller without heap allocation, I/O, locks or exceptions.
+ *
+ *
+ * If the 'deferred_evaluation' property is set to true, the probe does not
+ * evaluate the equations above when its value is requested during a
+ * simulation (computeProbeInputs() returns zeros). Instead, a
+ * MuscleMetabolicsDeferredReporter records the inputs of each muscle at the
+ * accepted steps of the simulation (e.g., a CMC run) and computes the
+ * metabolic power in bulk at the end, with computeDeferredResults().
+ *
+ *
+ * If the 'sampling_rate' property is positive, the probe is evaluated only at
+ * that fixed rate (e.g., 200 Hz), by an event reporter that samples the state
+ * at multiples of 1/sampling_rate during a simulation (see
+ * MuscleMetabolicsSampler). Between samples, computeProbeInputs() returns the
+ * last sample, so the probe is not evaluated at each step and stage of the
+ * integrator, whatever consumes its value. The metabolic energy is integrated
+ * from the samples by the trapezoidal rule (see getSampledEnergy() and
+ * setSampledResults(), through which a MuscleMetabolicsDeferredReporter
+ * gathers and prints the samples; the probe keeps only the last one); the
+ * 'integrate' operation of the probe itself integrates the held samples, so
+ * its energy differs from the trapezoidal one by O(1/sampling_rate).
+ *
+ *
+ * If the 'summary_statistics' property is set to true, a
+ * MuscleMetabolicsDeferredReporter accumulates the minimum, maximum, mean,
+ * RMS, integral and approximate percentiles of each probe input over the
+ * simulation (see MuscleMetabolicsStatistics) in constant memory, at the
+ * states at which it records, and prints them in a single table at the end
+ * (<base name>_<analysis name>_<probe name>_summary.txt). The statistics
+ * are of the metabolic power, before the operation and the gain. The
+ * statistics and the peaks (below) share a single evaluation of the probe
+ * per recorded state; those of a deferred probe are accumulated from its
+ * outputs as they are computed from the recorded inputs, at the end of the
+ * simulation or on the worker thread of the reporter, so the probe is still
+ * not evaluated during the simulation.
+ *
+ *
+ * If the 'peak_tracking' property is set to true, a
+ * MuscleMetabolicsDeferredReporter also updates the maximum and minimum of
+ * each probe input, and the time at which each first occurred (see
+ * MuscleMetabolicsPeaks), at the states at which it records, and prints
+ * them at the end (<base name>_<analysis name>_<probe name>_peaks.txt). The
+ * peaks are also available from getPeaks(). The probe keeps them in arrays
+ * of its own, so, unlike the 'maximum' and 'maxabs' operations, tracking
+ * adds no state to the system and leaves the output of the probe unchanged
+ * (e.g., with the 'value' operation). The probe inputs are those of its
+ * output: with vector evaluation, the evaluation of the probe at the state
+ * is reused, with a positive 'sampling_rate', the peaks are those of the
+ * held samples, and with 'deferred_evaluation', those of the deferred
+ * outputs. To track each muscle, set 'report_total_metabolics_only' to
+ * false.
+ *
+ *
+ * If the 'parameter_sensitivity' property is set to true, a
+ * MuscleMetabolicsDeferredReporter accumulates the partial derivatives of
+ * the TOTAL metabolic energy with respect to the parameters of the probe
+ * (see MuscleMetabolicsSensitivity) at the states at which it records, and
+ * prints them in a single table at the end
+ * (<base name>_<analysis name>_<probe name>_sensitivity.txt), in place of
+ * an AnalyzeTool run for each perturbed parameter. The parameters are 'aerobic_factor',
+ * 'muscle_effort_scaling_factor', 'basal_coefficient' and 'basal_exponent',
+ * and the 'ratio_slow_twitch_fibers', 'specific_tension', 'density' and
+ * 'provided_muscle_mass' of each muscle (named <muscle>.<property>). The
+ * derivatives are propagated through the kernel in forward mode (see
+ * MuscleMetabolicsDual), with the parameters seeded one at a time; those
+ * with respect to 'specific_tension', 'density' and 'provided_muscle_mass'
+ * are those of the muscle mass, by the chain rule (0 for the properties that
+ * do not determine the mass).
+ *
+ *
+ * If the 'energy_budget' property is positive, a probe with the 'integrate'
+ * operation terminates the simulation when its TOTAL energy exceeds the
+ * budget (see MuscleMetabolicsEnergyBudget), e.g., to abandon a rollout of an
+ * optimization that is already more costly than the best one so far. The
+ * time at which the budget was exceeded is reported by
+ * getEnergyBudgetExceededTime(). The budget may be changed between
+ * simulations with setEnergyBudget(), without recreating the System.
+ *
+ *
+ * If the 'vector_evaluation' property is set to true, the probe is evaluated
+ * once per State for all of its columns. The SDK Probe applies the operation
+ * ('value', 'integrate', 'minimum', 'maximum', ...) with a scalar Measure per
+ * column, each of which calls computeProbeInputs(); with
+ * 'report_total_metabolics_only' set to false, the N muscles would be
+ * evaluated for each of the N+2 columns, i.e., (N+2)*N muscle evaluations
+ * per State. Instead, the probe inputs are held in a lazy cache entry of the
+ * State (at Stage::Dynamics): the first column evaluated at a State computes
+ * them, and the other columns read them, so the cost of a State is linear in
+ * N. The cache is invalidated when the State changes, not when the probe is
+ * modified (call invalidateAllCacheAtOrAbove(Stage::Dynamics) on the State
+ * after changing a property). The inputs held by 'sampling_rate' and the
+ * zeros of 'deferred_evaluation' are not cached.
+ *
+ *
+ * If the 'autotune' property is set to true, the execution mode of the
+ * probe is chosen when it is connected to the model: a
+ * MuscleMetabolicsAutotuner times the exact kernel, the compiled kernel (if
+ * one is loaded for the probe) and 'fast_math' on synthetic inputs of the
+ * probe's muscles, and the probe is evaluated in the fastest mode whose
+ * deviation from the exact kernel is within 'autotune_tolerance'. The mode
+ * replaces 'fast_math' and 'use_compiled_kernel', which are left as they are
+ * in the model file; it is reported by getAutotunedMode(), and the timings
+ * by getAutotuneResult(). The timings are cached by parameter hash and host, in
+ * 'autotune_cache_file' if it is set, so that later runs start in the
+ * chosen mode without timing the modes.
+ *
+ *
+ * CONCURRENT EVALUATION: once the model's System has been created (e.g., by
+ * Model::initSystem()), computeProbeInputs(), getProbeOutputs(),
+ * gatherMuscleInputs() and getMuscleExcitation() may be called concurrently
+ * from several threads on the same connected model, provided that each
+ * thread uses its own State and that nothing modifies the model or the probe
+ * meanwhile. The probe reads its properties, the Muscle pointers set when it
+ * was connected and the const Model; all values computed during the
+ * evaluation are stored in the State or on the stack. This holds as long as
+ * supportsConcurrentEvaluation() returns true: the options that record
+ * samples or single-precision errors, cache rates or count evaluations
+ * inside the probe, and the spline workspace used to reconstruct
+ * excitations, are not thread-safe.
+ * Warnings are printed to std::cout, so their lines may interleave.
+ *
+ *
+ * If the 'reconstruct_excitation' property is set to true, the excitation of
+ * each muscle is not read from its control, but reconstructed from its
+ * activation trajectory in 'activation_states_file' (or set with
+ * setActivationStates()) by inverting first-order activation dynamics (see
+ * MuscleMetabolicsExcitationEstimator). The probe can then be evaluated from
+ * a states file alone, e.g., in an AnalyzeTool without a
+ * ControlSetController.
+ *
+ *
+ * If the 'incremental_evaluation' property is set to true, the inputs and
+ * rates of each muscle are cached when its rates are evaluated, and reused
+ * while the inputs of the muscle remain within 'incremental_tolerance' of the
+ * cached inputs and on the same branches of the equations above (see
+ * isSameBranch() in the kernel). The inputs are compared after normalization:
+ * forces by the maximum isometric force, the fiber velocity by the maximum
+ * contraction velocity (in m/s), and the other inputs as they are. The total
+ * is updated by the changes in the rates of the muscles that were evaluated.
+ * The cached inputs are not updated when the rates are reused, so errors do
+ * not accumulate over time steps: the error in the rate of a muscle is at most
+ * the change in its rate over a change of 'incremental_tolerance' in each
+ * normalized input. To first order, this is bounded by
+ * calcIncrementalErrorBound(), the sum over the normalized inputs of the
+ * magnitudes of the partial derivatives of the heat rate and of the mechanical
+ * work rate, times 'incremental_tolerance' (the clamps on the total power and
+ * heat rate do not increase the change). Incremental evaluation is not used
+ * with 'use_surrogate'.
+ *
+ *
+ * If the 'use_compiled_kernel' property is set to true, the rates of each
+ * muscle are evaluated by the MuscleMetabolicsCompiledKernel registered for
+ * this probe's settings and muscle constants, i.e., generated from this probe
+ * by MuscleMetabolicsKernelGenerator and loaded as a plugin; with
+ * 'deferred_evaluation', all muscles of a record are evaluated in one call.
+ * The results are those of the equations above. If no registered kernel
+ * matches the probe when it is connected to the model, a warning is printed
+ * and the equations are evaluated from the properties. The compiled kernel
+ * is not used by the muscles evaluated by the options above that replace the
+ * equations ('use_surrogate', and the reused muscles of
+ * 'incremental_evaluation').
+ *
+ *
  *
  *
  * <H1>UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter</H1>
@@ -206,7 +413,8 @@ class UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet;
  * @author Tim Dorn
  */
 
-class OSIMMUSCLEMETABOLICSPROBES_API UchidaUmberger2010MuscleMetabolicsProbe : public Probe {
+class OSIMMUSCLEMETABOLICSPROBES_API UchidaUmberger2010MuscleMetabolicsProbe
+    : public Probe, public MuscleMetabolicsReportedProbe {
 OpenSim_DECLARE_CONCRETE_OBJECT(UchidaUmberger2010MuscleMetabolicsProbe, Probe);
 public:
 //==============================================================================
@@ -293,6 +501,145 @@ public:
         "total summation will be reported. If set to true, only the total "
         "summation will be reported.");
 
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(fast_math,
+        bool,
+        "Specify whether polynomial approximations of sin, cos and pow will be "
+        "used in place of the exact functions (true/false). The maximum "
+        "absolute error introduced is less than 3e-4 W/kg per muscle.");
+
+    /** Default value = 0. **/
+    OpenSim_DECLARE_PROPERTY(single_precision_check_interval,
+        int,
+        "Every Nth evaluation is repeated in single precision to estimate the "
+        "precision loss of the per-muscle calculations. Set to 0 to disable.");
+
+    /** Default value = 1e-4. **/
+    OpenSim_DECLARE_PROPERTY(single_precision_tolerance,
+        double,
+        "Maximum relative deviation of the TOTAL and per-muscle metabolic power "
+        "from double precision before a warning is printed.");
+
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(use_surrogate,
+        bool,
+        "Specify whether the metabolic power of each muscle will be evaluated "
+        "from a fitted surrogate within the operating range of the surrogate "
+        "(true/false).");
+
+    /** Default value = "" (surrogates are set from the API). **/
+    OpenSim_DECLARE_PROPERTY(surrogate_file,
+        std::string,
+        "File containing a MuscleMetabolicsSurrogateSet, with a surrogate for "
+        "each muscle, used when use_surrogate is true.");
+
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(deferred_evaluation,
+        bool,
+        "Specify whether the muscle inputs will only be recorded during a "
+        "simulation, by a MuscleMetabolicsDeferredReporter, and metabolic "
+        "power computed in bulk at the end (true/false).");
+
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(reconstruct_excitation,
+        bool,
+        "Specify whether the excitation of each muscle will be reconstructed "
+        "from its activation trajectory instead of read from its control "
+        "(true/false).");
+
+    /** Default value = "" (activation states are set from the API). **/
+    OpenSim_DECLARE_PROPERTY(activation_states_file,
+        std::string,
+        "States file containing the activation of each muscle "
+        "(<muscle name>.activation), used when reconstruct_excitation is true.");
+
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(count_muscle_evaluations,
+        bool,
+        "Specify whether the muscle evaluations will be counted (see "
+        "getNumMuscleEvaluations()); the counts are not thread-safe "
+        "(true/false).");
+
+    /** Default value = 0 (sampling disabled). With the 'integrate'
+        operation, the output of the probe integrates the held samples (a
+        rectangle rule), which differs from the trapezoidal energy of the
+        samples (getSampledEnergy()) by O(1/sampling_rate). **/
+    OpenSim_DECLARE_PROPERTY(sampling_rate,
+        double,
+        "Rate (Hz) at which the probe is evaluated during a simulation, "
+        "independent of the integrator steps; 0 to evaluate the probe "
+        "whenever its value is requested.");
+
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(incremental_evaluation,
+        bool,
+        "Specify whether the rates of muscles whose inputs have changed by no "
+        "more than incremental_tolerance will be reused (true/false).");
+
+    /** Default value = 1e-4. **/
+    OpenSim_DECLARE_PROPERTY(incremental_tolerance,
+        double,
+        "Maximum change in each normalized input of a muscle (forces divided "
+        "by the maximum isometric force, fiber velocity by the maximum "
+        "contraction velocity) for which its rates are reused.");
+
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(summary_statistics,
+        bool,
+        "Specify whether summary statistics of the metabolic power will be "
+        "accumulated by a MuscleMetabolicsDeferredReporter (true/false).");
+
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(peak_tracking,
+        bool,
+        "Specify whether the peaks of the metabolic power, and their times, "
+        "will be tracked by a MuscleMetabolicsDeferredReporter (true/false).");
+
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(parameter_sensitivity,
+        bool,
+        "Specify whether the derivatives of the metabolic energy with respect "
+        "to the parameters of the probe will be accumulated by a "
+        "MuscleMetabolicsDeferredReporter (true/false).");
+
+    /** Default value = 0 (no budget). **/
+    OpenSim_DECLARE_PROPERTY(energy_budget,
+        double,
+        "Metabolic energy (J), integrated by the probe with the 'integrate' "
+        "operation, at which a simulation is terminated; 0 for no budget.");
+
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(use_compiled_kernel,
+        bool,
+        "Specify whether the muscles will be evaluated by the compiled kernel "
+        "generated for the settings and muscle constants of this probe, if "
+        "one is loaded (true/false).");
+
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(vector_evaluation,
+        bool,
+        "Specify whether the probe will be evaluated once per state for all "
+        "of its columns, instead of once per column (true/false).");
+
+    /** Disabled by default. **/
+    OpenSim_DECLARE_PROPERTY(autotune,
+        bool,
+        "Specify whether the fastest execution mode (exact, compiled kernel, "
+        "fast math or single precision) within autotune_tolerance will be "
+        "chosen by timing each mode when the probe is connected (true/false).");
+
+    /** Default value = 1e-3. **/
+    OpenSim_DECLARE_PROPERTY(autotune_tolerance,
+        double,
+        "Maximum relative deviation of the metabolic power of each muscle from "
+        "the exact evaluation for a mode chosen by autotune.");
+
+    /** Default value = "" (cached in memory only). **/
+    OpenSim_DECLARE_PROPERTY(autotune_cache_file,
+        std::string,
+        "File in which the timings of autotune are cached, by parameter hash "
+        "and host, for later runs.");
+
     OpenSim_DECLARE_UNNAMED_PROPERTY(
         UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet,
         "A set containing, for each muscle, the parameters "
@@ -303,6 +650,9 @@ public:
 //=============================================================================
 // PUBLIC METHODS
 //=============================================================================
+    /** The per-muscle kernel used by this probe. */
+    typedef UchidaUmberger2010MuscleMetabolicsKernel Kernel;
+
     /** MuscleMap typedef */
     typedef std::map
        <std::string, 
@@ -337,6 +687,386 @@ public:
         to name your probe appropiately!  */
     virtual OpenSim::Array<std::string> getProbeOutputLabels() const OVERRIDE_11;
 
+    /** Whether computeProbeInputs() may be called concurrently on distinct
+        States with the current properties (see the class description): none
+        of 'use_surrogate', 'count_muscle_evaluations',
+        'incremental_evaluation' and 'reconstruct_excitation' is enabled, and
+        'single_precision_check_interval' and 'sampling_rate' are 0. */
+    bool supportsConcurrentEvaluation() const;
+
+    /** The options of the probe read by a MuscleMetabolicsDeferredReporter
+        (see MuscleMetabolicsReportedProbe): 'deferred_evaluation',
+        'summary_statistics', 'peak_tracking' and 'parameter_sensitivity'. */
+    bool isDeferred() const OVERRIDE_11 { return get_deferred_evaluation(); }
+    bool hasSummaryStatistics() const OVERRIDE_11 { return get_summary_statistics(); }
+    bool hasPeakTracking() const OVERRIDE_11 { return get_peak_tracking(); }
+    bool hasParameterSensitivity() const OVERRIDE_11 { return get_parameter_sensitivity(); }
+
+    /** Get the probe-wide settings used by the per-muscle kernel. */
+    Kernel::Settings getKernelSettings() const;
+
+    /** Get the constant parameters of the ith muscle in the
+        MetabolicMuscleParameterSet used by the per-muscle kernel. */
+    Kernel::MuscleConstants getKernelMuscleConstants(int i) const;
+
+    /** Get the ith muscle in the MetabolicMuscleParameterSet. The probe must
+        be connected to a model. */
+    const Muscle& getMetabolicMuscle(int i) const;
+
+    /** Gather the state-dependent inputs of the ith muscle in the
+        MetabolicMuscleParameterSet. The state must be realized to
+        Stage::Dynamics. */
+    void gatherMuscleInputs(const SimTK::State& s, int i,
+                            Kernel::MuscleInputs<double>& in) const;
+
+    /** The real-time profile of this probe. */
+    typedef MuscleMetabolicsRealTimeEvaluator<Kernel> RealTimeEvaluator;
+
+    /** Create a real-time evaluator from the current properties of the
+        probe, with a muscle for each muscle in the MetabolicMuscleParameterSet
+        (in the same order) and the basal rate of the model at the given
+        state, which must be realized to Stage::Instance. */
+    RealTimeEvaluator createRealTimeEvaluator(const SimTK::State& s) const;
+
+    /** The compiled kernel of this probe (see
+        MuscleMetabolicsKernelGenerator). */
+    typedef MuscleMetabolicsCompiledKernel<Kernel> CompiledKernel;
+
+    /** Get the compiled kernel used when 'use_compiled_kernel' is true (or
+        when it is the mode chosen with 'autotune'): the registered kernel
+        whose parameter hash matched this probe when it was connected to the
+        model, or null if there was none. */
+    const CompiledKernel* getCompiledKernel() const;
+
+    /** Get the timings and deviations of the execution modes trialed when
+        the probe was connected with 'autotune' (see
+        MuscleMetabolicsAutotuner). */
+    const MuscleMetabolicsAutotuner::Result& getAutotuneResult() const;
+
+    /** Get the execution mode chosen when the probe was connected with
+        'autotune' (Exact without 'autotune'). */
+    MuscleMetabolicsAutotuner::Mode getAutotunedMode() const;
+
+
+    //-----------------------------------------------------------------------------
+    /** @name     Single-precision error report
+    When 'single_precision_check_interval' is positive, sampled evaluations
+    are repeated in single precision; these methods report the maximum relative deviation
+    observed since the probe was connected to the model (or since
+    resetSinglePrecisionErrorReport() was called). */
+    /**@{**/
+    /** Get the number of evaluations that were checked in single precision. */
+    int getNumSinglePrecisionChecks() const;
+
+    /** Get the maximum relative deviation of the TOTAL metabolic power. */
+    double getSinglePrecisionMaxRelativeError() const;
+
+    /** Get the maximum relative deviation of the metabolic power of a muscle. */
+    double getSinglePrecisionMaxRelativeError(const std::string& muscleName) const;
+
+    /** Print the number of checks and the maximum relative deviations, and
+        whether they are within 'single_precision_tolerance'. */
+    void printSinglePrecisionErrorReport(std::ostream& out) const;
+
+    /** Reset the single-precision error report. */
+    void resetSinglePrecisionErrorReport();
+    /**@}**/
+
+
+    //-----------------------------------------------------------------------------
+    /** @name     Surrogates
+    Per-muscle surrogates used when 'use_surrogate' is true. The states passed
+    to these methods must be realized to Stage::Dynamics. */
+    /**@{**/
+    /** Fit a surrogate for each muscle in the MetabolicMuscleParameterSet to
+        the exact equations, over the operating range of the muscle observed
+        in the given states, with numNodesPerInput nodes in each input. The
+        result can be printed to a sidecar file for 'surrogate_file'. */
+    MuscleMetabolicsSurrogateSet fitSurrogates(
+        const std::vector<SimTK::State>& states,
+        int numNodesPerInput = 6) const;
+
+    /** Set the surrogates used when 'use_surrogate' is true, replacing any
+        surrogates loaded from 'surrogate_file'. */
+    void setSurrogates(const MuscleMetabolicsSurrogateSet& surrogates);
+
+    /** Get the surrogates used when 'use_surrogate' is true. */
+    const MuscleMetabolicsSurrogateSet& getSurrogates() const;
+
+    /** Compare the surrogates to the exact equations at the given states
+        (e.g., a held-out trajectory) and print, for each muscle, the maximum
+        and RMS errors and the fraction of states outside the range of the
+        surrogate. Returns the maximum absolute error (W) of each muscle over
+        the states within range. */
+    SimTK::Vector validateSurrogates(const std::vector<SimTK::State>& states,
+                                     std::ostream& out) const;
+
+    /** Get the number of muscle evaluations that fell back to the exact
+        equations because the muscle was outside the range of its surrogate. */
+    int getNumSurrogateFallbacks() const;
+
+    /** Gather the inputs of the surrogate of the ith muscle in the
+        MetabolicMuscleParameterSet. */
+    void gatherSurrogateInputs(const SimTK::State& s, int i,
+        MuscleMetabolicsSurrogate::InputVector& x) const;
+    /**@}**/
+
+
+    //-----------------------------------------------------------------------------
+    /** @name     Deferred evaluation
+    When 'deferred_evaluation' is true, the muscle inputs are recorded with
+    recordDeferredInputs() (e.g., by a MuscleMetabolicsDeferredReporter at the
+    accepted steps of a simulation) and the probe outputs are computed from
+    them in bulk by computeDeferredResults(). */
+    /**@{**/
+    /** Record the time, the basal rate and the inputs of each muscle at the
+        given state, which must be realized to Stage::Dynamics. */
+    void recordDeferredInputs(const SimTK::State& s) OVERRIDE_11;
+
+    /** Get the number of states recorded since the probe was connected to
+        the model or clearDeferredInputs() was called. */
+    int getNumDeferredRecords() const;
+
+    /** Discard the recorded inputs. */
+    void clearDeferredInputs() OVERRIDE_11;
+
+    /** Compute the probe outputs at the recorded states, labeled as by
+        getProbeOutputLabels(). The 'value' and 'integrate' operations are
+        supported; integration uses the trapezoidal rule over the recorded
+        times. The gain is applied. */
+    Storage computeDeferredResults() const;
+
+    /** Inputs recorded at a sequence of states: the time and basal rate of
+        each record, and the inputs of each muscle (record-major). */
+    struct DeferredRecords {
+        std::vector<double> times;
+        std::vector<double> basalRates;
+        std::vector<Kernel::MuscleInputs<double> > inputs;
+    };
+
+    /** Exchange the recorded inputs with 'records', e.g., to compute them
+        on another thread while the next states are recorded (see
+        MuscleMetabolicsDeferredReporter). */
+    void swapDeferredInputs(DeferredRecords& records);
+
+    /** Compute the probe inputs (as computeProbeInputs() would, without the
+        operation and the gain) at each record and append them to 'outputs'.
+        Only the properties of the probe are read, so this may be called from
+        another thread while states are recorded. */
+    void calcDeferredOutputs(const DeferredRecords& records,
+                             std::vector<SimTK::Vector>& outputs) const;
+
+    /** Compute the probe outputs, as computeDeferredResults() does, from
+        the probe inputs computed by calcDeferredOutputs() at the given
+        times. */
+    Storage computeDeferredResults(const std::vector<double>& times,
+        const std::vector<SimTK::Vector>& outputs) const;
+
+    /** Create a MuscleMetabolicsDeferredBlock of this probe. */
+    DeferredBlock* createDeferredBlock() OVERRIDE_11;
+    /**@}**/
+
+
+    //-----------------------------------------------------------------------------
+    /** @name     Multi-rate sampling
+    When 'sampling_rate' is positive, the probe is evaluated at multiples of
+    1/sampling_rate by recordSample(), which is called by the
+    MuscleMetabolicsSampler that the probe adds to the System. Only the last
+    sample is kept, for the hold, and its trapezoidal integral; the samples
+    are streamed to the storage given to setSampledResults() (e.g., by a
+    MuscleMetabolicsDeferredReporter). The samples are cleared when the
+    System is created, and when a sample precedes the last one (i.e., a new
+    simulation has started). */
+    /**@{**/
+    /** Evaluate the probe at the given state and record the sample. The
+        state is realized to Stage::Dynamics. */
+    void recordSample(const SimTK::State& s) const;
+
+    /** Get the number of samples recorded. */
+    int getNumSamples() const;
+
+    /** Discard the recorded samples, and stop streaming them. */
+    void clearSamples();
+
+    /** Get the integral of the probe inputs over the recorded samples by the
+        trapezoidal rule, plus the initial conditions of the probe. The gain
+        is applied. */
+    SimTK::Vector getSampledEnergy() const;
+
+    /** Whether 'sampling_rate' is positive. */
+    bool isSampled() const OVERRIDE_11 { return get_sampling_rate() > 0; }
+
+    /** Append the probe outputs at each subsequent sample to 'results',
+        labeled as by getProbeOutputLabels() (the storage is cleared and
+        labeled here), or stop if 'results' is null. The 'value' and
+        'integrate' operations are supported; integration uses the
+        trapezoidal rule over the samples. The gain is applied. The storage
+        must outlive the streaming. */
+    void setSampledResults(Storage* results) OVERRIDE_11;
+    /**@}**/
+
+
+    //-----------------------------------------------------------------------------
+    /** @name     Summary statistics
+    When 'summary_statistics' is true, accumulateStatistics() is called at
+    each recorded state by a MuscleMetabolicsDeferredReporter. The statistics
+    are cleared when the probe is connected to the model. */
+    /**@{**/
+    /** Add the probe inputs at the given time to the statistics. The
+        reporter passes the values of computeProbeInputs() at each recorded
+        state or, with 'deferred_evaluation', the values computed from the
+        recorded inputs (see reportInputs() in MuscleMetabolicsReportedProbe);
+        the probe is evaluated once per record for the statistics and the
+        peaks together. */
+    void accumulateStatistics(double time,
+                              const SimTK::Vector& inputs) OVERRIDE_11;
+
+    /** Get the statistics of the probe inputs accumulated since the probe
+        was connected to the model or clearStatistics() was called. */
+    const MuscleMetabolicsStatistics& getStatistics() const OVERRIDE_11;
+
+    /** Discard the accumulated statistics. */
+    void clearStatistics() OVERRIDE_11;
+    /**@}**/
+
+
+    //-----------------------------------------------------------------------------
+    /** @name     Peak tracking
+    When 'peak_tracking' is true, updatePeaks() is called at each recorded
+    state by a MuscleMetabolicsDeferredReporter. The peaks are cleared when
+    the probe is connected to the model. */
+    /**@{**/
+    /** Update the peaks of the probe inputs with their values at the given
+        time, which are those passed to accumulateStatistics(). */
+    void updatePeaks(double time, const SimTK::Vector& inputs) OVERRIDE_11;
+
+    /** Get the peaks of the probe inputs, and their times, tracked since the
+        probe was connected to the model or clearPeaks() was called. */
+    const MuscleMetabolicsPeaks& getPeaks() const OVERRIDE_11;
+
+    /** Discard the tracked peaks. */
+    void clearPeaks() OVERRIDE_11;
+    /**@}**/
+
+
+    //-----------------------------------------------------------------------------
+    /** @name     Parameter sensitivity
+    When 'parameter_sensitivity' is true, accumulateSensitivity() is called
+    at each recorded state by a MuscleMetabolicsDeferredReporter. The
+    sensitivity is cleared when the probe is connected to the model. */
+    /**@{**/
+    /** The names of the parameters: the global coefficients, followed by the
+        parameters of each muscle of the MetabolicMuscleParameterSet. */
+    Array<std::string> getSensitivityParameterNames() const;
+
+    /** The values of the parameters, in the order of their names. */
+    SimTK::Vector getSensitivityParameterValues() const;
+
+    /** Evaluate the TOTAL metabolic power at the given state, which must be
+        realized to Stage::Dynamics, and its partial derivatives with respect
+        to the parameters (resized to their number). The muscles are
+        evaluated by the kernel in double precision, with the exact
+        functions in place of the fast_math approximations. */
+    double calcParameterSensitivity(const SimTK::State& s,
+                                    SimTK::Vector& derivatives) const;
+
+    /** Evaluate the derivatives at the given state, and add them to the
+        sensitivity. */
+    void accumulateSensitivity(const SimTK::State& s) OVERRIDE_11;
+
+    /** Get the sensitivity accumulated since the probe was connected to the
+        model or clearSensitivity() was called. */
+    const MuscleMetabolicsSensitivity& getSensitivity() const OVERRIDE_11;
+
+    /** Discard the accumulated sensitivity. */
+    void clearSensitivity() OVERRIDE_11;
+    /**@}**/
+
+
+    //-----------------------------------------------------------------------------
+    /** @name     Energy budget
+    When the operation is 'integrate', the probe adds a
+    MuscleMetabolicsEnergyBudget to the System, which terminates the
+    simulation when the TOTAL of the probe rises through 'energy_budget'. */
+    /**@{**/
+    /** Set 'energy_budget' (0 for no budget) for the next simulation, and
+        forget when the budget was last exceeded. */
+    void setEnergyBudget(double budget);
+
+    /** Whether the budget was exceeded since the System was created or
+        setEnergyBudget() was called. */
+    bool hasExceededEnergyBudget() const;
+
+    /** The time at which the simulation was terminated because the budget
+        was exceeded (NaN if it was not). */
+    double getEnergyBudgetExceededTime() const;
+
+    /** Record that the budget was exceeded at time t; called by the
+        MuscleMetabolicsEnergyBudget. */
+    void recordEnergyBudgetExceeded(double t) const;
+    /**@}**/
+
+
+    //-----------------------------------------------------------------------------
+    /** @name     Excitation reconstruction
+    When 'reconstruct_excitation' is true, the excitation of each muscle is
+    reconstructed from its activation trajectory, smoothed, by inverting
+    first-order activation dynamics (see MuscleMetabolicsExcitationEstimator). */
+    /**@{**/
+    /** Set the states containing the activation trajectory of each muscle,
+        replacing those loaded from 'activation_states_file'. */
+    void setActivationStates(const Storage& states);
+
+    /** Get the excitation of the ith muscle in the
+        MetabolicMuscleParameterSet used by the probe: its control, or its
+        reconstructed excitation if 'reconstruct_excitation' is true. */
+    double getMuscleExcitation(const SimTK::State& s, int i) const;
+    /**@}**/
+
+
+    //-----------------------------------------------------------------------------
+    /** @name     Muscle evaluations
+    When 'count_muscle_evaluations' is true, these methods count the muscles
+    evaluated since the probe was connected to the model (or since
+    resetMuscleEvaluationCounter()), one per muscle of each evaluation of the
+    probe; otherwise the count remains 0. */
+    /**@{**/
+    /** Get the number of muscle evaluations. */
+    int getNumMuscleEvaluations() const;
+
+    /** Reset the count of muscle evaluations. */
+    void resetMuscleEvaluationCounter();
+    /**@}**/
+
+
+    //-----------------------------------------------------------------------------
+    /** @name     Incremental evaluation
+    When 'incremental_evaluation' is true, the rates of a muscle are reused
+    while its inputs remain within 'incremental_tolerance' of the inputs at
+    which they were last evaluated. */
+    /**@{**/
+    /** Get the number of muscle evaluations with incremental_evaluation. */
+    int getNumIncrementalEvaluations() const;
+
+    /** Get the number of muscle evaluations that reused the cached rates. */
+    int getNumReusedMuscleEvaluations() const;
+
+    /** Get the fraction of muscle evaluations that reused the cached rates
+        (0 if there were none). */
+    double getIncrementalReuseRatio() const;
+
+    /** Calculate the first-order bound (W) on the error in the metabolic rate
+        of the ith muscle when its cached rates are reused: the sum over the
+        normalized inputs of the magnitudes of the partial derivatives of its
+        heat rate and mechanical work rate at the cached inputs, times
+        'incremental_tolerance'. Returns 0 if the muscle has not been cached. */
+    double calcIncrementalErrorBound(int i) const;
+
+    /** Clear the cached inputs and rates, and the counts of muscle
+        evaluations. */
+    void resetIncrementalEvaluation();
+    /**@}**/
+
 
     //-----------------------------------------------------------------------------
     /** @name     UchidaUmberger2010MuscleMetabolicsProbe Interface
@@ -423,10 +1153,81 @@ private:
     //--------------------------------------------------------------------------
     MuscleMap _muscleMap;
 
+    // Single-precision error report.
+    mutable int _numSinglePrecisionEvaluations;
+    mutable int _numSinglePrecisionChecks;
+    mutable double _singlePrecisionMaxRelErrorTotal;
+    mutable std::vector<double> _singlePrecisionMaxRelErrorMuscles;
+    mutable bool _singlePrecisionWarningIssued;
+
+    // Surrogates, and the index of the surrogate of each muscle (-1 if none).
+    MuscleMetabolicsSurrogateSet _surrogates;
+    std::vector<int> _surrogateIndices;
+    mutable int _numSurrogateFallbacks;
+
+    // Inputs recorded in deferred evaluation.
+    DeferredRecords _deferredRecords;
+
+    // Samples recorded with <sampling_rate>: the number of samples, the
+    // time and probe inputs of the last one, their integral by the
+    // trapezoidal rule, and the storage the samples are streamed to.
+    mutable int _numSamples;
+    mutable double _lastSampleTime;
+    mutable SimTK::Vector _lastSampleInputs;
+    mutable SimTK::Vector _sampledEnergy;
+    Storage* _sampledResults;
+
+    // Statistics accumulated with <summary_statistics>.
+    MuscleMetabolicsStatistics _statistics;
+
+    // Peaks tracked with <peak_tracking>.
+    MuscleMetabolicsPeaks _peaks;
+
+    // Sensitivity accumulated with <parameter_sensitivity>, and the number of
+    // global and per-muscle parameters (see getSensitivityParameterNames()).
+    enum { NumGlobalSensitivityParameters = 4,
+           NumMuscleSensitivityParameters = 4 };
+    MuscleMetabolicsSensitivity _sensitivity;
+
+    // Time at which <energy_budget> was exceeded (NaN if it was not).
+    mutable double _energyBudgetExceededTime;
+
+    // Reconstructs the excitations, with a muscle for each muscle in the
+    // MetabolicMuscleParameterSet, when <reconstruct_excitation> is true.
+    MuscleMetabolicsExcitationEstimator _excitationEstimator;
+
+    // Count of muscle evaluations with <count_muscle_evaluations>.
+    mutable int _numMuscleEvaluations;
+
+    // Inputs and rates of each muscle at its last evaluation with
+    // <incremental_evaluation> (the inputs are NaN until then), the sum of
+    // the cached metabolic rates, the scales of the inputs of each muscle
+    // (NumIncrementalInputs per muscle), and the counts of muscle evaluations.
+    enum { NumIncrementalInputs = 6 };
+    mutable std::vector<Kernel::MuscleInputs<double> > _incrementalInputs;
+    mutable std::vector<Kernel::MuscleRates<double> > _incrementalRates;
+    mutable double _incrementalTotal;
+    std::vector<double> _incrementalInputScales;
+    mutable int _numIncrementalEvaluations;
+    mutable int _numReusedMuscleEvaluations;
+
+    // Compiled kernel matching the probe, with <use_compiled_kernel>.
+    const CompiledKernel* _compiledKernel;
+
+    // Lazy cache entry holding the probe inputs of a State, with
+    // <vector_evaluation>. Invalid if vector evaluation is disabled.
+    mutable SimTK::CacheEntryIndex _probeInputsIndex;
+
+    // Trials of the execution modes and the mode chosen, with <autotune>.
+    MuscleMetabolicsAutotuner::Result _autotuneResult;
+    MuscleMetabolicsAutotuner::Mode _autotunedMode;
+
     //--------------------------------------------------------------------------
     // ModelComponent Interface
     //--------------------------------------------------------------------------
     void connectToModel(Model& aModel) OVERRIDE_11;
+    void addToSystem(SimTK::MultibodySystem& system) const OVERRIDE_11;
+    void realizeTopology(SimTK::State& state) const OVERRIDE_11;
     void connectIndividualMetabolicMuscle
        (Model& aModel, 
         UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameter& mm);
@@ -434,6 +1235,60 @@ private:
     void setNull();
     void constructProperties();
 
+    // Evaluate the metabolic power at the given state (see
+    // computeProbeInputs()).
+    SimTK::Vector calcMetabolicPower(const SimTK::State& s) const;
+
+    // Record the relative deviation of a single-precision value from its
+    // double-precision reference, and warn if the tolerance is exceeded.
+    static void updateSinglePrecisionError(double& maxRelError,
+        double value, double reference);
+    void checkSinglePrecisionTolerance(const SimTK::State& s) const;
+
+    // Map the muscles to their surrogates.
+    void connectSurrogates();
+
+    // Add the muscles to the excitation estimator.
+    void connectExcitationEstimator();
+
+    // Size the cache of incremental evaluation and compute the scales of the
+    // inputs of each muscle.
+    void connectIncrementalEvaluation();
+
+    // Choose the execution mode with <autotune>.
+    void connectAutotune();
+
+    // The execution options in effect: those of the mode chosen with
+    // <autotune>, or the properties otherwise.
+    bool usesFastMath() const;
+    bool usesCompiledKernel() const;
+
+    // Find the registered compiled kernel matching the probe.
+    void connectCompiledKernel();
+
+    // Whether the inputs of the ith muscle are within <incremental_tolerance>
+    // of its cached inputs, and on the same branches of the equations.
+    bool isWithinIncrementalTolerance(int i, const Kernel::MuscleConstants& mc,
+        const Kernel::MuscleInputs<double>& in) const;
+
+    // Cache the inputs and rates of the ith muscle, and update the sum of the
+    // cached metabolic rates by the change in its rate.
+    void updateIncrementalCache(int i, const Kernel::MuscleInputs<double>& in,
+        const Kernel::MuscleRates<double>& rates) const;
+
+    // Get pointers to the NumIncrementalInputs inputs of a muscle, in the
+    // order of <_incrementalInputScales>.
+    template <class Inputs, class T>
+    static void getIncrementalInputs(Inputs& in, T* x[]);
+
+    // Evaluate the rates of muscle i from its surrogate, and set the inputs
+    // of the surrogate in 'in'. Returns false if the muscle has no surrogate
+    // or is outside its range.
+    bool calcSurrogateMuscleRates(const SimTK::State& s, int i,
+        const Kernel::Settings& settings, const Kernel::MuscleConstants& mc,
+        Kernel::MuscleInputs<double>& in,
+        Kernel::MuscleRates<double>& rates) const;
+
 
     //--------------------------------------------------------------------------
     // MetabolicMuscleParameter Private Interface
@@ -0,0 +1,278 @@
+/* -------------------------------------------------------------------------- *
+ *                      OpenSim:  metabolicsService.cpp                       *
+ * -------------------------------------------------------------------------- *
+ * The OpenSim API is a toolkit for musculoskeletal modeling and simulation.  *
+ * See http://opensim.stanford.edu and the NOTICE file for more information.  *
+ * OpenSim is developed at Stanford University and supported by the US        *
+ * National Institutes of Health (U54 GM072970, R24 HD065690) and by DARPA    *
+ * through the Warrior Web program.                                           *
+ *                                                                            *
+ * Copyright (c) 2005-2014 Stanford University and the Authors                *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may    *
+ * not use this file except in compliance with the License. You may obtain a  *
+ * copy of the License at http://www.apache.org/licenses/LICENSE-2.0.         *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ * -------------------------------------------------------------------------- */
+
+// Serves the jobs of a MuscleMetabolicsEvaluationService over a Unix domain
+// socket, one request per line and one reply per line:
+//
+//   load <model file>
+//   unload <model file>
+//   shape <model file> <probe>
+//       -> ok <trace inputs per sample> <trace outputs per sample>
+//   trajectory <model file> <probe> <states file> <results file>
+//              [controls=<controls file>] [<parameter>=<value> ...]
+//       -> ok <number of rows printed to the results file>
+//   trace <model file> <probe> <shared memory object> <number of samples>
+//         [<parameter>=<value> ...]
+//       -> ok <number of muscle rates that were not finite>
+//   quit
+//
+// A model is loaded on the first request that names it, and kept until it is
+// unloaded. The shared memory object of a trace (created by the client with
+// shm_open()) holds the inputs of the samples followed by their outputs, as
+// doubles; the service maps it and evaluates the probe in place. Other
+// replies are 'ok', or 'error <message>'. Requests are served one at a time.
+//
+// Usage: metabolicsService <socket path>
+
+#include "MuscleMetabolicsEvaluationService.h"
+#include <OpenSim/Common/Storage.h>
+#include <OpenSim/Common/Exception.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace OpenSim;
+
+namespace {
+typedef MuscleMetabolicsEvaluationService::Overrides Overrides;
+
+// Split the <name>=<value> arguments of a request into controls and
+// parameter overrides.
+void parseOverrides(istream& in, Overrides& overrides, string* controlsFile)
+{
+    string argument;
+    while (in >> argument) {
+        const string::size_type equals = argument.find('=');
+        if (equals == string::npos || equals == 0) {
+            stringstream errorMessage;
+            errorMessage << "'" << argument << "' is not <name>=<value>.";
+            throw (Exception(errorMessage.str()));
+        }
+        const string name = argument.substr(0, equals);
+        const string value = argument.substr(equals+1);
+        if (controlsFile && name == "controls")
+            *controlsFile = value;
+        else
+            overrides.push_back(make_pair(name, value));
+    }
+}
+
+// Evaluate a trace in a shared memory object.
+int evaluateSharedTrace(MuscleMetabolicsEvaluationService& service,
+    const string& model, const string& probe, const string& objectName,
+    int numSamples, const Overrides& overrides)
+{
+    const size_t numInputs = service.getNumTraceInputs(model, probe);
+    const size_t numOutputs = service.getNumTraceOutputs(model, probe);
+    const size_t size = (numInputs + numOutputs)*numSamples*sizeof(double);
+
+    const int fd = shm_open(objectName.c_str(), O_RDWR, 0);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0 || numSamples < 0
+        || (size_t)status.st_size < size) {
+        if (fd >= 0) close(fd);
+        stringstream errorMessage;
+        errorMessage << "shared memory object '" << objectName << "' cannot "
+            "hold " << numSamples << " samples of " << numInputs
+            << " inputs and " << numOutputs << " outputs.";
+        throw (Exception(errorMessage.str()));
+    }
+    int numInvalid = 0;
+    if (size > 0) {
+        void* memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED)
+            throw (Exception("unable to map shared memory object '"
+                             + objectName + "': " + strerror(errno)));
+        double* inputs = static_cast<double*>(memory);
+        try {
+            numInvalid = service.evaluateTrace(model, probe, numSamples,
+                inputs, inputs + numInputs*numSamples, overrides);
+        } catch (...) {
+            munmap(memory, size);
+            throw;
+        }
+        munmap(memory, size);
+    }
+    else
+        close(fd);
+    return numInvalid;
+}
+
+// Handle a request, and return the reply (without the newline). Sets quit
+// on a 'quit' request.
+string handleRequest(MuscleMetabolicsEvaluationService& service,
+                     const string& request, bool& quit)
+{
+    istringstream in(request);
+    string command, model, probe;
+    in >> command;
+    stringstream reply;
+    reply << "ok";
+    try {
+        if (command == "quit")
+            quit = true;
+        else if (command == "load" && in >> model)
+            service.loadModel(model);
+        else if (command == "unload" && in >> model)
+            service.unloadModel(model);
+        else if (command == "shape" && in >> model >> probe) {
+            service.loadModel(model);
+            reply << " " << service.getNumTraceInputs(model, probe)
+                  << " " << service.getNumTraceOutputs(model, probe);
+        }
+        else if (command == "trajectory" && in >> model >> probe) {
+            string statesFile, resultsFile, controlsFile;
+            Overrides overrides;
+            if (!(in >> statesFile >> resultsFile))
+                throw (Exception("trajectory requires a states file and a "
+                                 "results file."));
+            parseOverrides(in, overrides, &controlsFile);
+            service.loadModel(model);
+            const Storage states(statesFile);
+            Storage results;
+            if (controlsFile.empty())
+                results = service.evaluateTrajectory(model, probe, states, 0,
+                                                     overrides);
+            else {
+                const Storage controls(controlsFile);
+                results = service.evaluateTrajectory(model, probe, states,
+                                                     &controls, overrides);
+            }
+            results.print(resultsFile);
+            reply << " " << results.getSize();
+        }
+        else if (command == "trace" && in >> model >> probe) {
+            string objectName;
+            int numSamples;
+            Overrides overrides;
+            if (!(in >> objectName >> numSamples))
+                throw (Exception("trace requires a shared memory object and "
+                                 "a number of samples."));
+            parseOverrides(in, overrides, 0);
+            service.loadModel(model);
+            reply << " " << evaluateSharedTrace(service, model, probe,
+                                                objectName, numSamples,
+                                                overrides);
+        }
+        else
+            throw (Exception("unknown or incomplete request '" + request
+                             + "'."));
+    } catch (const std::exception& e) {
+        string message = e.what();
+        for (string::size_type k=0; k<message.size(); ++k)
+            if (message[k] == '\n' || message[k] == '\r')
+                message[k] = ' ';
+        return "error " + message;
+    }
+    return reply.str();
+}
+
+bool sendAll(int fd, const string& text)
+{
+    for (size_t sent=0; sent<text.size();) {
+        const ssize_t n = send(fd, text.data() + sent, text.size() - sent, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        cout << "Usage: metabolicsService <socket path>" << endl;
+        return 1;
+    }
+    const string socketPath = argv[1];
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        cerr << "metabolicsService: the socket path is too long." << endl;
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    // A client that disconnects early must not terminate the service.
+    signal(SIGPIPE, SIG_IGN);
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());
+    if (listener < 0
+        || bind(listener, (sockaddr*)&address, sizeof(address)) != 0
+        || listen(listener, 8) != 0) {
+        cerr << "metabolicsService: unable to listen on " << socketPath
+             << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    cout << "metabolicsService: listening on " << socketPath << endl;
+
+    MuscleMetabolicsEvaluationService service;
+    bool quit = false;
+    while (!quit) {
+        const int client = accept(listener, 0, 0);
+        if (client < 0) {
+            if (errno == EINTR)
+                continue;
+            cerr << "metabolicsService: " << strerror(errno) << endl;
+            break;
+        }
+        string buffer;
+        char chunk[4096];
+        bool connected = true;
+        while (connected && !quit) {
+            const string::size_type end = buffer.find('\n');
+            if (end != string::npos) {
+                const string request = buffer.substr(0, end);
+                buffer.erase(0, end+1);
+                connected = sendAll(client,
+                    handleRequest(service, request, quit) + "\n");
+                continue;
+            }
+            const ssize_t n = recv(client, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                connected = false;
+            else
+                buffer.append(chunk, n);
+        }
+        close(client);
+    }
+    close(listener);
+    unlink(socketPath.c_str());
+    return 0;
+}
@@ -35,6 +35,9 @@
 //    configurations. These probes are then attached to Millard2012Equilibrium
 //    muscles for basic functionality testing.
 //
+// C. The optional evaluation modes of the probes are compared to the default
+//    evaluation on the same Millard2012Equilibrium model.
+//
 // References:
 // 1. Umberger, B.R., Gerritsen, K.G.M., Martin, P.E. (2003) A model of human
 //    muscle energy expenditure. Computer Methods in Biomechanics and Biomedical
@@ -52,8 +55,18 @@
 #include <OpenSim/Simulation/osimSimulation.h>
 #include "UchidaUmberger2010MuscleMetabolicsProbe.h"
 #include "UchidaBhargava2004MuscleMetabolicsProbe.h"
+#include "MuscleMetabolicsFastMath.h"
+#include "MuscleMetabolicsDeferredReporter.h"
+#include "MuscleMetabolicsStaticOptimization.h"
+#include "MuscleMetabolicsKernelGenerator.h"
+#include "MuscleMetabolicsIndexedResults.h"
+#include "MuscleMetabolicsEvaluationService.h"
+#include "MuscleMetabolicsCalibration.h"
+#include "MuscleMetabolicsAutotuner.h"
+#include "MuscleMetabolicsScreeningProbe.h"
 #include <OpenSim/Analyses/ProbeReporter.h>
 #include <OpenSim/Analyses/MuscleAnalysis.h>
+#include <OpenSim/Simulation/Model/ControllerSet.h>
 #include "auxiliaryTestFunctions.h"
 
 // The zeroth-order muscle activation dynamics model can be used only once the
@@ -71,6 +84,19 @@ using namespace OpenSim;
 using namespace SimTK;
 using namespace std;
 
+// Heap allocations made through the global operator new of this executable,
+// counted to check that the real-time evaluation path does not allocate. The
+// real-time evaluator is header-only, so its code is instantiated here.
+static long long numHeapAllocations = 0;
+void* operator new(std::size_t size)
+{
+    ++numHeapAllocations;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) throw() { std::free(p); }
+
 
 #ifdef USE_ACTIVATION_DYNAMICS_MODEL
 //==============================================================================
@@ -203,7 +229,7 @@ public:
     //--------------------------------------------------------------------------
     // MUSCLE INTERFACE
     //--------------------------------------------------------------------------
-    void computeInitialFiberEquilibrium(SimTK::State& s) const {}
+    void computeInitialFiberEquilibrium(SimTK::State& /*s*/) const {}
 
     void setActivation(SimTK::State& s, double activation) const
     {
@@ -330,8 +356,8 @@ OpenSim_DECLARE_CONCRETE_OBJECT(ConstantExcitationMuscleController, Controller);
 public:
     ConstantExcitationMuscleController(double u) : _u(u) {}
 
-    void computeControls(const SimTK::State& s, SimTK::Vector &controls) const
-       
+    void computeControls(const SimTK::State& /*s*/,
+                         SimTK::Vector &controls) const
     {
         for (int i=0; i<_model->getMuscles().getSize(); ++i)
             controls[i] = _u;
@@ -1381,31 +1407,3460 @@ void testProbesUsingMillardMuscleSimulation()
 
 
 //==============================================================================
-//                                     MAIN
+//                           TWO-MUSCLE TEST MODEL
 //==============================================================================
-void horizontalRule() { for(int i=0;i<80;++i) cout<<"*"; cout<<endl; }
-int main()
+// Controller that excites muscle i with 0.5 + 0.45*sin(2*Pi*t + i), so that the
+// probes are exercised over most of the range of excitation.
+class SinusoidalExcitationMuscleController : public Controller {
+OpenSim_DECLARE_CONCRETE_OBJECT(SinusoidalExcitationMuscleController, Controller);
+public:
+    SinusoidalExcitationMuscleController() {}
+
+    void computeControls(const SimTK::State& s, SimTK::Vector &controls) const
+    {
+        for (int i=0; i<_model->getMuscles().getSize(); ++i)
+            controls[i] = 0.5 + 0.45*sin(2*SimTK::Pi*s.getTime() + i);
+    }
+};
+
+// Build the block-between-two-muscles model used in
+// testProbesUsingMillardMuscleSimulation(), excited by the controller above.
+// The muscles are named "muscle1" and "muscle2", and the controller
+// "sinusoidalController".
+void buildTwoMuscleModel(Model& model)
 {
-    SimTK::Array_<std::string> failures;
+    model.setName("testModel_metabolics_twoMuscle");
+    OpenSim::Body& ground = model.getGroundBody();
 
-    printf("\n"); horizontalRule();
-    cout << "Comparing Umberger2010 probe output to published results" << endl;
-    horizontalRule();
-    try { compareUmbergerProbeToPublishedResults();
-        cout << "\ncompareUmbergerProbeToPublishedResults test passed\n" << endl;
-    } catch (const OpenSim::Exception& e) {
-        e.print(cerr);
-        failures.push_back("compareUmbergerProbeToPublishedResults");
+    const double blockMass       = 1.0;
+    const double blockSideLength = 0.1;
+    Inertia blockInertia = blockMass * Inertia::brick(Vec3(blockSideLength/2));
+    OpenSim::Body *block = new OpenSim::Body("block", blockMass, Vec3(0),
+                                             blockInertia);
+
+    SliderJoint* prismatic = new SliderJoint("prismatic", ground, Vec3(0), Vec3(0),
+                                                *block, Vec3(0), Vec3(0));
+    CoordinateSet& prisCoordSet = prismatic->upd_CoordinateSet();
+    prisCoordSet[0].setName("xTranslation");
+    prisCoordSet[0].setRangeMin(-1);
+    prisCoordSet[0].setRangeMax(1);
+    Sine motion(0.1, SimTK::Pi, 0);
+    prisCoordSet[0].setPrescribedFunction(motion);
+    prisCoordSet[0].setDefaultIsPrescribed(true);
+    model.addBody(block);
+
+    const double optimalFiberLength = 0.1;
+    const double tendonSlackLength  = 0.2;
+    const double anchorDistance     = optimalFiberLength + tendonSlackLength
+                                      + blockSideLength/2;
+
+    Millard2012EquilibriumMuscle *muscle1 = new Millard2012EquilibriumMuscle(
+        "muscle1", 100, optimalFiberLength, tendonSlackLength, 0);
+    muscle1->addNewPathPoint("m1_ground", ground, Vec3(-anchorDistance,0,0));
+    muscle1->addNewPathPoint("m1_block",  *block, Vec3(-blockSideLength/2,0,0));
+    muscle1->setDefaultActivation(0.5);
+    model.addForce(muscle1);
+
+    Millard2012EquilibriumMuscle *muscle2 = new Millard2012EquilibriumMuscle(
+        "muscle2", 100, optimalFiberLength, tendonSlackLength, 0);
+    muscle2->addNewPathPoint("m2_ground", ground, Vec3(anchorDistance,0,0));
+    muscle2->addNewPathPoint("m2_block",  *block, Vec3(blockSideLength/2,0,0));
+    muscle2->setDefaultActivation(0.5);
+    model.addForce(muscle2);
+
+    SinusoidalExcitationMuscleController* controller =
+        new SinusoidalExcitationMuscleController();
+    controller->setName("sinusoidalController");
+    controller->setActuators(model.updActuators());
+    model.addController(controller);
+}
+
+// Build a model of numMuscles muscles (an even number) pulling on the block
+// of buildTwoMuscleModel(), alternately from either side, excited by
+// SinusoidalExcitationMuscleController. The muscles are named "muscle1" to
+// "muscle<numMuscles>".
+void buildMultiMuscleModel(Model& model, int numMuscles)
+{
+    model.setName("testModel_metabolics_multiMuscle");
+    OpenSim::Body& ground = model.getGroundBody();
+
+    const double blockMass       = 1.0;
+    const double blockSideLength = 0.1;
+    Inertia blockInertia = blockMass * Inertia::brick(Vec3(blockSideLength/2));
+    OpenSim::Body *block = new OpenSim::Body("block", blockMass, Vec3(0),
+                                             blockInertia);
+
+    SliderJoint* prismatic = new SliderJoint("prismatic", ground, Vec3(0), Vec3(0),
+                                                *block, Vec3(0), Vec3(0));
+    CoordinateSet& prisCoordSet = prismatic->upd_CoordinateSet();
+    prisCoordSet[0].setName("xTranslation");
+    prisCoordSet[0].setRangeMin(-1);
+    prisCoordSet[0].setRangeMax(1);
+    Sine motion(0.1, SimTK::Pi, 0);
+    prisCoordSet[0].setPrescribedFunction(motion);
+    prisCoordSet[0].setDefaultIsPrescribed(true);
+    model.addBody(block);
+
+    const double optimalFiberLength = 0.1;
+    const double tendonSlackLength  = 0.2;
+    const double anchorDistance     = optimalFiberLength + tendonSlackLength
+                                      + blockSideLength/2;
+
+    for (int i=0; i<numMuscles; ++i) {
+        const double side = (i % 2 == 0) ? -1 : 1;
+        std::stringstream name;
+        name << "muscle" << i+1;
+        Millard2012EquilibriumMuscle *muscle = new Millard2012EquilibriumMuscle(
+            name.str(), 100, optimalFiberLength, tendonSlackLength, 0);
+        muscle->addNewPathPoint(name.str() + "_ground", ground,
+                                Vec3(side*anchorDistance,0,0));
+        muscle->addNewPathPoint(name.str() + "_block",  *block,
+                                Vec3(side*blockSideLength/2,0,0));
+        muscle->setDefaultActivation(0.5);
+        model.addForce(muscle);
     }
 
-    printf("\n"); horizontalRule();
-    cout << "Testing Umberger2010 and Bhargava2004 probes in simulation" << endl;
-    horizontalRule();
-    try { testProbesUsingMillardMuscleSimulation();
-        cout << "\ntestProbesUsingMillardMuscleSimulation test passed\n" << endl;
-    } catch (const OpenSim::Exception& e) {
-        e.print(cerr);
-        failures.push_back("testProbesUsingMillardMuscleSimulation");
+    SinusoidalExcitationMuscleController* controller =
+        new SinusoidalExcitationMuscleController();
+    controller->setActuators(model.updActuators());
+    model.addController(controller);
+}
+
+
+//==============================================================================
+//                          FAST MATH APPROXIMATIONS
+//==============================================================================
+// The approximations in MuscleMetabolicsFastMath.h are compared to the exact
+// functions across the domain, and the errors propagated through the heat rate
+// expressions of both probes must not exceed the documented bounds (W/kg). The
+// fast_math probes are then compared to the exact probes in simulation.
+void testFastMathApproximations()
+{
+    using namespace MuscleMetabolicsFastMath;
+
+    cout << "- sweeping the domain of the approximations" << endl;
+    double maxErrSin = 0, maxErrCos = 0, maxErrPow = 0;
+    double maxErrUmberger = 0, maxErrBhargava = 0;
+    const int numSamples = 20000;
+    for (int i=1; i<=numSamples; ++i) {
+        const double u = 1.25*i/numSamples;    // Allow for effort scaling.
+        const double sinExact = sin(0.5*Pi*u);
+        const double cosExact = 2*SimTK::square(sin(0.25*Pi*u));   // = 1-cos(Pi/2*u)
+        if (u <= 1) {
+            maxErrSin = max(maxErrSin, fabs(sinHalfPi(u)-sinExact)/sinExact);
+            maxErrCos = max(maxErrCos,
+                            fabs(oneMinusCosHalfPi(u)-cosExact)/cosExact);
+        }
+        maxErrPow = max(maxErrPow, fabs(pow06(u)-pow(u,0.6))/pow(u,0.6));
+
+        const double sinFast = sinHalfPi(u);
+        const double cosFast = oneMinusCosHalfPi(u);
+        for (int k=0; k<=10; ++k) {
+            const double r = 0.1*k;
+
+            // Umberger2010: activation and maintenance, and shortening heat
+            // rates at the extremes of the fiber velocity range (W/kg).
+            const double ratioExact = r*sinExact / (r*sinExact+(1-r)*cosExact);
+            const double ratioFast  = r*sinFast  / (r*sinFast +(1-r)*cosFast);
+            for (int j=0; j<=10; ++j) {
+                const double A = 0.125*j;
+                const double AMdotExact =
+                    1.5*pow(A,0.6)*(128*(1-ratioExact)+25);
+                const double AMdotFast  =
+                    1.5*pow06(A)*(128*(1-ratioFast)+25);
+                const double SdotExact =
+                    1.5*A*A*(100*ratioExact + 153*(1-ratioExact));
+                const double SdotFast  =
+                    1.5*pow2(A)*(100*ratioFast + 153*(1-ratioFast));
+                maxErrUmberger = max(maxErrUmberger,
+                    fabs(AMdotFast-AMdotExact) + fabs(SdotFast-SdotExact));
+            }
+
+            // Bhargava2004: activation and maintenance heat rates (W/kg).
+            const double bhaExact = (40+74)*r*sinExact + (133+111)*(1-r)*cosExact;
+            const double bhaFast  = (40+74)*r*sinFast  + (133+111)*(1-r)*cosFast;
+            maxErrBhargava = max(maxErrBhargava, fabs(bhaFast-bhaExact));
+        }
+    }
+    for (int i=0; i<=1000; ++i) {
+        const double A = pow(10.0, -12 + 12.0*i/1000);
+        maxErrPow = max(maxErrPow, fabs(pow06(A)-pow(A,0.6))/pow(A,0.6));
+    }
+    cout << "  max relative error: sin " << maxErrSin << ", 1-cos " << maxErrCos
+         << ", pow " << maxErrPow << endl;
+    cout << "  max absolute error: Umberger2010 " << maxErrUmberger
+         << " W/kg, Bhargava2004 " << maxErrBhargava << " W/kg" << endl;
+
+    ASSERT(maxErrSin < 6e-9, __FILE__, __LINE__,
+        "sinHalfPi() exceeds its documented error bound.");
+    ASSERT(maxErrCos < 1.2e-8, __FILE__, __LINE__,
+        "oneMinusCosHalfPi() exceeds its documented error bound.");
+    ASSERT(maxErrPow < 9e-7, __FILE__, __LINE__,
+        "pow06() exceeds its documented error bound.");
+    ASSERT(maxErrUmberger < UmbergerMaxAbsErrorPerKg, __FILE__, __LINE__,
+        "Umberger2010: fast_math exceeds its documented error bound.");
+    ASSERT(maxErrBhargava < BhargavaMaxAbsErrorPerKg, __FILE__, __LINE__,
+        "Bhargava2004: fast_math exceeds its documented error bound.");
+    ASSERT(pow06(0) == 0 && sinHalfPi(0) == 0 && oneMinusCosHalfPi(0) == 0,
+        __FILE__, __LINE__, "Fast approximations must be exact at zero.");
+
+    //--------------------------------------------------------------------------
+    // Compare fast_math probes to exact probes in simulation.
+    //--------------------------------------------------------------------------
+    cout << "- comparing fast_math probes to exact probes in simulation" << endl;
+    Model model;
+    buildTwoMuscleModel(model);
+
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbes[2];
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbes[2];
+    for (int i=0; i<2; ++i) {
+        umbergerProbes[i] = new UchidaUmberger2010MuscleMetabolicsProbe(
+            true, true, true, true);
+        model.addProbe(umbergerProbes[i]);
+        umbergerProbes[i]->setName(i==0 ? "umberger" : "umbergerFast");
+        umbergerProbes[i]->setOperation("value");
+        umbergerProbes[i]->set_report_total_metabolics_only(false);
+        umbergerProbes[i]->set_fast_math(i==1);
+        umbergerProbes[i]->addMuscle("muscle1", 0.5);
+        umbergerProbes[i]->addMuscle("muscle2", 0.5);
+
+        bhargavaProbes[i] = new UchidaBhargava2004MuscleMetabolicsProbe(
+            true, true, true, true, true);
+        model.addProbe(bhargavaProbes[i]);
+        bhargavaProbes[i]->setName(i==0 ? "bhargava" : "bhargavaFast");
+        bhargavaProbes[i]->setOperation("value");
+        bhargavaProbes[i]->set_report_total_metabolics_only(false);
+        bhargavaProbes[i]->set_fast_math(i==1);
+        bhargavaProbes[i]->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+        bhargavaProbes[i]->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+    }
+    ProbeReporter* probeReporter = new ProbeReporter(&model);
+    model.addAnalysis(probeReporter);
+    simulateModel(model, 0.0, 1.0);
+
+    Storage probeStorage(probeReporter->getProbeStorage());
+    const char* muscleNames[2] = { "muscle1", "muscle2" };
+    for (int m=0; m<2; ++m) {
+        const std::string muscleName = muscleNames[m];
+        Array<double> umb, umbFast, bha, bhaFast;
+        probeStorage.getDataColumn("umberger_" + muscleName, umb);
+        probeStorage.getDataColumn("umbergerFast_" + muscleName, umbFast);
+        probeStorage.getDataColumn("bhargava_" + muscleName, bha);
+        probeStorage.getDataColumn("bhargavaFast_" + muscleName, bhaFast);
+        ASSERT(umb.getSize() > 0 && umb.getSize() == umbFast.getSize()
+               && bha.getSize() == bhaFast.getSize(), __FILE__, __LINE__,
+               "Probe storage is missing fast_math columns.");
+
+        const double umbTol = UmbergerMaxAbsErrorPerKg
+                              * umbergerProbes[0]->getMuscleMass(muscleName);
+        const double bhaTol = BhargavaMaxAbsErrorPerKg
+                              * bhargavaProbes[0]->getMuscleMass(muscleName);
+        for (int i=0; i<umb.getSize(); ++i) {
+            ASSERT_EQUAL(umb[i], umbFast[i], umbTol, __FILE__, __LINE__,
+                "Umberger2010: fast_math result exceeds documented error.");
+            ASSERT_EQUAL(bha[i], bhaFast[i], bhaTol, __FILE__, __LINE__,
+                "Bhargava2004: fast_math result exceeds documented error.");
+        }
+    }
+}
+
+
+//==============================================================================
+//                         SINGLE-PRECISION EVALUATION
+//==============================================================================
+// Probes whose every evaluation is repeated in single precision are compared
+// to probes without the check. The outputs must be unchanged (the probes are
+// evaluated in double precision), and the deviations reported must be those
+// of the per-muscle calculations in single precision, within the tolerance.
+void testSinglePrecisionEvaluation()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbes[2];
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbes[2];
+    for (int i=0; i<2; ++i) {
+        umbergerProbes[i] = new UchidaUmberger2010MuscleMetabolicsProbe(
+            true, true, true, true);
+        model.addProbe(umbergerProbes[i]);
+        umbergerProbes[i]->setName(i==0 ? "umberger" : "umbergerChecked");
+        umbergerProbes[i]->setOperation("value");
+        umbergerProbes[i]->set_report_total_metabolics_only(false);
+        umbergerProbes[i]->set_single_precision_check_interval(i==0 ? 0 : 1);
+        umbergerProbes[i]->addMuscle("muscle1", 0.5);
+        umbergerProbes[i]->addMuscle("muscle2", 0.5);
+
+        bhargavaProbes[i] = new UchidaBhargava2004MuscleMetabolicsProbe(
+            true, true, true, true, true);
+        model.addProbe(bhargavaProbes[i]);
+        bhargavaProbes[i]->setName(i==0 ? "bhargava" : "bhargavaChecked");
+        bhargavaProbes[i]->setOperation("value");
+        bhargavaProbes[i]->set_report_total_metabolics_only(false);
+        bhargavaProbes[i]->set_single_precision_check_interval(i==0 ? 0 : 1);
+        bhargavaProbes[i]->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+        bhargavaProbes[i]->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+    }
+    ProbeReporter* probeReporter = new ProbeReporter(&model);
+    model.addAnalysis(probeReporter);
+    simulateModel(model, 0.0, 1.0);
+
+    umbergerProbes[1]->printSinglePrecisionErrorReport(cout);
+    bhargavaProbes[1]->printSinglePrecisionErrorReport(cout);
+
+    ASSERT(umbergerProbes[0]->getNumSinglePrecisionChecks() == 0 &&
+           bhargavaProbes[0]->getNumSinglePrecisionChecks() == 0,
+           __FILE__, __LINE__,
+           "Probes without the check must not perform single-precision checks.");
+    ASSERT(umbergerProbes[1]->getNumSinglePrecisionChecks() > 0 &&
+           bhargavaProbes[1]->getNumSinglePrecisionChecks() > 0,
+           __FILE__, __LINE__,
+           "The probes were not checked in single precision.");
+
+    // The probes are evaluated in double precision whether they are checked
+    // or not; every evaluation was checked, so a deviation of the single
+    // precision calculations must have been recorded.
+    Storage probeStorage(probeReporter->getProbeStorage());
+    const char* columns[3] = { "TOTAL", "muscle1", "muscle2" };
+    for (int c=0; c<3; ++c) {
+        const std::string column = columns[c];
+        Array<double> umb, umbChecked, bha, bhaChecked;
+        probeStorage.getDataColumn("umberger_" + column, umb);
+        probeStorage.getDataColumn("umbergerChecked_" + column, umbChecked);
+        probeStorage.getDataColumn("bhargava_" + column, bha);
+        probeStorage.getDataColumn("bhargavaChecked_" + column, bhaChecked);
+
+        const double umbReported = (c == 0)
+            ? umbergerProbes[1]->getSinglePrecisionMaxRelativeError()
+            : umbergerProbes[1]->getSinglePrecisionMaxRelativeError(column);
+        const double bhaReported = (c == 0)
+            ? bhargavaProbes[1]->getSinglePrecisionMaxRelativeError()
+            : bhargavaProbes[1]->getSinglePrecisionMaxRelativeError(column);
+        ASSERT(umbReported > 0 && bhaReported > 0, __FILE__, __LINE__,
+               column + ": no single-precision deviation was recorded.");
+        ASSERT(umbReported <= umbergerProbes[1]->get_single_precision_tolerance(),
+               __FILE__, __LINE__,
+               "Umberger2010: single-precision error exceeds the tolerance.");
+        ASSERT(bhaReported <= bhargavaProbes[1]->get_single_precision_tolerance(),
+               __FILE__, __LINE__,
+               "Bhargava2004: single-precision error exceeds the tolerance.");
+
+        for (int i=0; i<umb.getSize(); ++i) {
+            ASSERT(umb[i] == umbChecked[i] && bha[i] == bhaChecked[i],
+                   __FILE__, __LINE__,
+                   column + ": the single-precision check changed the output.");
+        }
+    }
+}
+
+
+//==============================================================================
+//                            SURROGATE EVALUATION
+//==============================================================================
+// Sample the states of a model at t0, t0+dt, ..., realized to Dynamics.
+std::vector<SimTK::State> sampleStates(Model& model,
+    const SimTK::State& initialState, double t0, double dt, int numStates)
+{
+    SimTK::RungeKuttaMersonIntegrator integrator(model.getMultibodySystem());
+    integrator.setAccuracy(1.0e-8);
+    integrator.initialize(initialState);
+
+    std::vector<SimTK::State> states;
+    for (int k=0; k<numStates; ++k) {
+        if (t0 + k*dt > integrator.getTime())
+            integrator.stepTo(t0 + k*dt);
+        states.push_back(integrator.getState());
+        model.getMultibodySystem().realize(states.back(), SimTK::Stage::Dynamics);
+    }
+    return states;
+}
+
+// Surrogates are fitted to the states of one simulation and evaluated at
+// held-out states in between. The per-muscle surrogate outputs must track the
+// exact outputs, and must survive a round trip through a sidecar file.
+void testSurrogateEvaluation()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbe =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(umbergerProbe);
+    umbergerProbe->setName("umberger");
+    umbergerProbe->setOperation("value");
+    umbergerProbe->set_report_total_metabolics_only(false);
+    umbergerProbe->addMuscle("muscle1", 0.5);
+    umbergerProbe->addMuscle("muscle2", 0.5);
+
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbe =
+        new UchidaBhargava2004MuscleMetabolicsProbe(true, true, true, true, true);
+    model.addProbe(bhargavaProbe);
+    bhargavaProbe->setName("bhargava");
+    bhargavaProbe->setOperation("value");
+    bhargavaProbe->set_report_total_metabolics_only(false);
+    bhargavaProbe->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+    bhargavaProbe->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+
+    SimTK::State& state = model.initSystem();
+    for (int i=0; i<model.getMuscles().getSize(); ++i)
+        model.getMuscles().get(i).setIgnoreActivationDynamics(state, true);
+    model.getMultibodySystem().realize(state, SimTK::Stage::Dynamics);
+    model.equilibrateMuscles(state);
+
+    cout << "- sampling training and held-out states" << endl;
+    const std::vector<SimTK::State> training =
+        sampleStates(model, state, 0.0, 0.01, 101);
+    const std::vector<SimTK::State> heldOut =
+        sampleStates(model, state, 0.005, 0.01, 100);
+
+    cout << "- fitting surrogates" << endl;
+    Probe* probes[2] = { umbergerProbe, bhargavaProbe };
+    umbergerProbe->setSurrogates(umbergerProbe->fitSurrogates(training));
+    bhargavaProbe->setSurrogates(bhargavaProbe->fitSurrogates(training));
+    const SimTK::Vector umbMaxError =
+        umbergerProbe->validateSurrogates(heldOut, cout);
+    const SimTK::Vector bhaMaxError =
+        bhargavaProbe->validateSurrogates(heldOut, cout);
+    ASSERT(umbMaxError.size() == 2 && bhaMaxError.size() == 2
+           && !SimTK::isNaN(umbMaxError.sum()) && !SimTK::isNaN(bhaMaxError.sum()),
+           __FILE__, __LINE__, "Surrogate validation report is incorrect.");
+
+    // Exact outputs at the held-out states.
+    std::vector<SimTK::Vector> exact[2];
+    for (int p=0; p<2; ++p)
+        for (unsigned int k=0; k<heldOut.size(); ++k)
+            exact[p].push_back(probes[p]->computeProbeInputs(heldOut[k]));
+
+    // Surrogate outputs at the held-out states, from the surrogates in memory
+    // and from the surrogates read back from a sidecar file.
+    cout << "- comparing surrogate and exact outputs at held-out states" << endl;
+    umbergerProbe->set_use_surrogate(true);
+    bhargavaProbe->set_use_surrogate(true);
+    for (int pass=0; pass<2; ++pass) {
+        if (pass == 1) {
+            MuscleMetabolicsSurrogateSet umbergerSurrogates =
+                umbergerProbe->getSurrogates();
+            MuscleMetabolicsSurrogateSet bhargavaSurrogates =
+                bhargavaProbe->getSurrogates();
+            umbergerSurrogates.print("testSurrogates_umberger.xml");
+            bhargavaSurrogates.print("testSurrogates_bhargava.xml");
+            umbergerProbe->setSurrogates(
+                MuscleMetabolicsSurrogateSet("testSurrogates_umberger.xml"));
+            bhargavaProbe->setSurrogates(
+                MuscleMetabolicsSurrogateSet("testSurrogates_bhargava.xml"));
+        }
+
+        for (int p=0; p<2; ++p) {
+            double sumSquaredError[2] = { 0, 0 }, sumSquaredExact[2] = { 0, 0 };
+            for (unsigned int k=0; k<heldOut.size(); ++k) {
+                const SimTK::Vector Edot = probes[p]->computeProbeInputs(heldOut[k]);
+                ASSERT_EQUAL(exact[p][k](1), Edot(1), 1e-12, __FILE__, __LINE__,
+                    "Surrogates must not affect the basal rate.");
+                for (int m=0; m<2; ++m) {
+                    const double error = Edot(m+2) - exact[p][k](m+2);
+                    sumSquaredError[m] += error*error;
+                    sumSquaredExact[m] += SimTK::square(exact[p][k](m+2));
+                }
+            }
+            for (int m=0; m<2; ++m) {
+                const double relativeRMSError =
+                    sqrt(sumSquaredError[m] / sumSquaredExact[m]);
+                cout << "  " << probes[p]->getName() << ", muscle" << m+1
+                     << ": relative RMS error " << relativeRMSError << endl;
+                ASSERT(relativeRMSError < 0.1, __FILE__, __LINE__,
+                    probes[p]->getName() + ": surrogate error is too large.");
+            }
+        }
+    }
+    cout << "  fallbacks to the exact equations: "
+         << umbergerProbe->getNumSurrogateFallbacks() << " (Umberger2010), "
+         << bhargavaProbe->getNumSurrogateFallbacks() << " (Bhargava2004)" << endl;
+}
+
+
+//==============================================================================
+//                           REAL-TIME EVALUATION
+//==============================================================================
+// Evaluate the real-time evaluator numCalls times on a synthetic input stream,
+// cycling through the given frames of muscle inputs with pseudo-random
+// excitations and activations. The hot loop must not allocate, print or
+// throw. Prints the latency percentiles of a call.
+template <class Evaluator>
+void benchmarkRealTimeEvaluator(const Evaluator& evaluator,
+    const std::vector<typename Evaluator::MuscleInputs>& frames,
+    int numCalls, const std::string& label)
+{
+    typedef typename Evaluator::MuscleInputs MuscleInputs;
+    const int numMuscles = evaluator.getNumMuscles();
+    const int numFrames = (int)frames.size() / numMuscles;
+
+    // Set up the stream and the output buffers before the hot loop.
+    const int streamLength = 4096;
+    std::vector<MuscleInputs> stream(streamLength*numMuscles);
+    unsigned int seed = 12345;
+    for (int k=0; k<streamLength; ++k) {
+        for (int i=0; i<numMuscles; ++i) {
+            MuscleInputs& in = stream[k*numMuscles+i];
+            in = frames[(k % numFrames)*numMuscles + i];
+            seed = 1664525*seed + 1013904223;
+            in.excitation = (seed >> 8) / 16777216.0;
+            seed = 1664525*seed + 1013904223;
+            in.activation = (seed >> 8) / 16777216.0;
+        }
+    }
+    std::vector<double> outputs(evaluator.getNumOutputs());
+    std::vector<long long> latency(numCalls);
+    std::ostringstream captured;
+    std::streambuf* coutBuffer = cout.rdbuf(captured.rdbuf());
+    std::streambuf* cerrBuffer = cerr.rdbuf(captured.rdbuf());
+
+    const long long numAllocationsBefore = numHeapAllocations;
+    int numInvalid = 0;
+    bool threw = false;
+    double checksum = 0;
+    try {
+        for (int n=0; n<numCalls; ++n) {
+            const MuscleInputs* in = &stream[(n % streamLength)*numMuscles];
+            const long long t0 = SimTK::realTimeInNs();
+            numInvalid += evaluator.calcMetabolicRates(in, &outputs[0]);
+            latency[n] = SimTK::realTimeInNs() - t0;
+            checksum += outputs[0];
+        }
+    } catch (...) {
+        threw = true;
+    }
+    const long long numAllocations = numHeapAllocations - numAllocationsBefore;
+
+    cout.rdbuf(coutBuffer);
+    cerr.rdbuf(cerrBuffer);
+
+    std::sort(latency.begin(), latency.end());
+    cout << "  " << label << ": " << numCalls << " calls, " << numMuscles
+         << " muscles; latency (ns) p50 " << latency[numCalls/2]
+         << ", p99 " << latency[(long long)numCalls*99/100]
+         << ", p99.9 " << latency[(long long)numCalls*999/1000]
+         << ", max " << latency.back() << " (checksum " << checksum << ")"
+         << endl;
+
+    ASSERT(!threw, __FILE__, __LINE__,
+           label + ": the real-time evaluation path threw an exception.");
+    ASSERT(numAllocations == 0, __FILE__, __LINE__,
+           label + ": the real-time evaluation path allocated memory.");
+    ASSERT(captured.str().empty(), __FILE__, __LINE__,
+           label + ": the real-time evaluation path printed output.");
+    ASSERT(numInvalid == 0 && SimTK::isFinite(checksum), __FILE__, __LINE__,
+           label + ": the real-time evaluation produced invalid rates.");
+}
+
+// Real-time evaluators created from probes must reproduce the probe outputs
+// at the states of a simulation, report invalid inputs without printing, and
+// evaluate a synthetic input stream without allocating, printing or throwing.
+void testRealTimeEvaluation()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbe =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(umbergerProbe);
+    umbergerProbe->setName("umberger");
+    umbergerProbe->setOperation("value");
+    umbergerProbe->set_report_total_metabolics_only(false);
+    umbergerProbe->set_fast_math(true);     // Replaced by the mode chosen.
+    umbergerProbe->addMuscle("muscle1", 0.5);
+    umbergerProbe->addMuscle("muscle2", 0.5);
+
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbe =
+        new UchidaBhargava2004MuscleMetabolicsProbe(true, true, true, true, true);
+    model.addProbe(bhargavaProbe);
+    bhargavaProbe->setName("bhargava");
+    bhargavaProbe->setOperation("value");
+    bhargavaProbe->set_report_total_metabolics_only(false);
+    bhargavaProbe->set_fast_math(true);     // Replaced by the mode chosen.
+    bhargavaProbe->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+    bhargavaProbe->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+
+    SimTK::State& state = model.initSystem();
+    for (int i=0; i<model.getMuscles().getSize(); ++i)
+        model.getMuscles().get(i).setIgnoreActivationDynamics(state, true);
+    model.getMultibodySystem().realize(state, SimTK::Stage::Dynamics);
+    model.equilibrateMuscles(state);
+    const std::vector<SimTK::State> states =
+        sampleStates(model, state, 0.0, 0.01, 101);
+
+    const UchidaUmberger2010MuscleMetabolicsProbe::RealTimeEvaluator
+        umbergerEvaluator = umbergerProbe->createRealTimeEvaluator(states[0]);
+    const UchidaBhargava2004MuscleMetabolicsProbe::RealTimeEvaluator
+        bhargavaEvaluator = bhargavaProbe->createRealTimeEvaluator(states[0]);
+    ASSERT(umbergerEvaluator.getNumOutputs() == umbergerProbe->getNumProbeInputs()
+        && bhargavaEvaluator.getNumOutputs() == bhargavaProbe->getNumProbeInputs(),
+        __FILE__, __LINE__, "Real-time evaluators have the wrong number of outputs.");
+
+    // Compare to the probes, and gather the frames of the input stream.
+    cout << "- comparing real-time evaluators to probes" << endl;
+    std::vector<UchidaUmberger2010MuscleMetabolicsKernel::MuscleInputs<double> >
+        umbergerFrames;
+    std::vector<UchidaBhargava2004MuscleMetabolicsKernel::MuscleInputs<double> >
+        bhargavaFrames;
+    std::vector<double> outputs(umbergerEvaluator.getNumOutputs());
+    for (unsigned int k=0; k<states.size(); ++k) {
+        for (int i=0; i<2; ++i) {
+            umbergerFrames.push_back(
+                UchidaUmberger2010MuscleMetabolicsKernel::MuscleInputs<double>());
+            umbergerProbe->gatherMuscleInputs(states[k], i, umbergerFrames.back());
+            bhargavaFrames.push_back(
+                UchidaBhargava2004MuscleMetabolicsKernel::MuscleInputs<double>());
+            bhargavaProbe->gatherMuscleInputs(states[k], i, bhargavaFrames.back());
+        }
+
+        const SimTK::Vector umb = umbergerProbe->computeProbeInputs(states[k]);
+        umbergerEvaluator.calcMetabolicRates(&umbergerFrames[2*k], &outputs[0]);
+        for (int j=0; j<umb.size(); ++j)
+            ASSERT_EQUAL(umb(j), outputs[j], 1e-12*std::max(1.0, fabs(umb(j))),
+                __FILE__, __LINE__,
+                "Umberger2010: real-time evaluator differs from the probe.");
+
+        const SimTK::Vector bha = bhargavaProbe->computeProbeInputs(states[k]);
+        bhargavaEvaluator.calcMetabolicRates(&bhargavaFrames[2*k], &outputs[0]);
+        for (int j=0; j<bha.size(); ++j)
+            ASSERT_EQUAL(bha(j), outputs[j], 1e-12*std::max(1.0, fabs(bha(j))),
+                __FILE__, __LINE__,
+                "Bhargava2004: real-time evaluator differs from the probe.");
+    }
+
+    // An invalid input is reported and excluded from the TOTAL.
+    UchidaUmberger2010MuscleMetabolicsKernel::MuscleInputs<double> invalid[2] =
+        { umbergerFrames[0], umbergerFrames[1] };
+    invalid[1].excitation = SimTK::NaN;
+    ASSERT(umbergerEvaluator.calcMetabolicRates(invalid, &outputs[0]) == 1
+           && SimTK::isNaN(outputs[3]) && SimTK::isFinite(outputs[0]),
+           __FILE__, __LINE__, "Invalid real-time inputs were not reported.");
+
+    cout << "- benchmarking real-time evaluation" << endl;
+    benchmarkRealTimeEvaluator(umbergerEvaluator, umbergerFrames, 2000000,
+                               "Umberger2010");
+    benchmarkRealTimeEvaluator(bhargavaEvaluator, bhargavaFrames, 2000000,
+                               "Bhargava2004");
+}
+
+
+//==============================================================================
+//                            DEFERRED EVALUATION
+//==============================================================================
+// Deferred probes, recorded by a MuscleMetabolicsDeferredReporter, are
+// compared to probes evaluated by a ProbeReporter during the same simulation.
+void testDeferredEvaluation()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+
+    // Probes 0 and 1 report the metabolic power; probes 2 and 3 the energy.
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbes[4];
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbes[4];
+    const char* suffixes[4] = { "", "Deferred", "Energy", "EnergyDeferred" };
+    for (int i=0; i<4; ++i) {
+        umbergerProbes[i] = new UchidaUmberger2010MuscleMetabolicsProbe(
+            true, true, true, true);
+        model.addProbe(umbergerProbes[i]);
+        umbergerProbes[i]->setName(std::string("umberger") + suffixes[i]);
+        umbergerProbes[i]->setOperation(i < 2 ? "value" : "integrate");
+        umbergerProbes[i]->set_report_total_metabolics_only(i >= 2);
+        umbergerProbes[i]->set_deferred_evaluation(i % 2 == 1);
+        umbergerProbes[i]->addMuscle("muscle1", 0.5);
+        umbergerProbes[i]->addMuscle("muscle2", 0.5);
+
+        bhargavaProbes[i] = new UchidaBhargava2004MuscleMetabolicsProbe(
+            true, true, true, true, true);
+        model.addProbe(bhargavaProbes[i]);
+        bhargavaProbes[i]->setName(std::string("bhargava") + suffixes[i]);
+        bhargavaProbes[i]->setOperation(i < 2 ? "value" : "integrate");
+        bhargavaProbes[i]->set_report_total_metabolics_only(i >= 2);
+        bhargavaProbes[i]->set_deferred_evaluation(i % 2 == 1);
+        bhargavaProbes[i]->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+        bhargavaProbes[i]->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+    }
+    ProbeReporter* probeReporter = new ProbeReporter(&model);
+    model.addAnalysis(probeReporter);
+    MuscleMetabolicsDeferredReporter* deferredReporter =
+        new MuscleMetabolicsDeferredReporter(&model);
+    model.addAnalysis(deferredReporter);
+    simulateModel(model, 0.0, 1.0);
+
+    Storage deferred(deferredReporter->getProbeStorage());
+    Storage probeStorage(probeReporter->getProbeStorage());
+    ASSERT(deferred.getSize() > 1
+           && deferred.getColumnLabels().getSize() == 1 + 2*(4+1),
+           __FILE__, __LINE__, "Deferred probes were not recorded.");
+    ASSERT(umbergerProbes[1]->getNumDeferredRecords() == deferred.getSize(),
+           __FILE__, __LINE__, "Deferred records do not match the storage.");
+
+    // The metabolic power must match at every recorded time.
+    cout << "- comparing deferred power to evaluated power" << endl;
+    const char* columns[3] = { "TOTAL", "muscle1", "muscle2" };
+    const char* probeNames[2] = { "umberger", "bhargava" };
+    for (int p=0; p<2; ++p) {
+        Array<double> probeTimes, deferredTimes;
+        probeStorage.getTimeColumn(probeTimes);
+        deferred.getTimeColumn(deferredTimes);
+        for (int c=0; c<3; ++c) {
+            const std::string name = probeNames[p];
+            Array<double> evaluated, recorded;
+            probeStorage.getDataColumn(name + "_" + columns[c], evaluated);
+            deferred.getDataColumn(name + "Deferred_" + columns[c], recorded);
+            ASSERT(recorded.getSize() == deferredTimes.getSize(),
+                   __FILE__, __LINE__, name + ": deferred column is missing.");
+            for (int k=0, j=0; k<deferredTimes.getSize(); ++k) {
+                while (j < probeTimes.getSize() && probeTimes[j] < deferredTimes[k])
+                    ++j;
+                if (j == probeTimes.getSize() || probeTimes[j] != deferredTimes[k])
+                    continue;
+                ASSERT_EQUAL(evaluated[j], recorded[k],
+                    1e-10*std::max(1.0, fabs(evaluated[j])), __FILE__, __LINE__,
+                    name + ": deferred power differs from evaluated power.");
+            }
+        }
+
+        // The energy is integrated from the recorded steps by the trapezoidal
+        // rule, so it agrees with the integrator only to within its accuracy.
+        Array<double> evaluatedEnergy, recordedEnergy;
+        probeStorage.getDataColumn(std::string(probeNames[p]) + "Energy_TOTAL",
+                                   evaluatedEnergy);
+        deferred.getDataColumn(std::string(probeNames[p]) + "EnergyDeferred_TOTAL",
+                               recordedEnergy);
+        const double finalEnergy = evaluatedEnergy.getLast();
+        cout << "  " << probeNames[p] << ": final energy " << finalEnergy
+             << " J (evaluated), " << recordedEnergy.getLast()
+             << " J (deferred)" << endl;
+        ASSERT_EQUAL(finalEnergy, recordedEnergy.getLast(),
+            0.01*fabs(finalEnergy), __FILE__, __LINE__,
+            std::string(probeNames[p]) + ": deferred energy is incorrect.");
+    }
+}
+
+
+//==============================================================================
+//                  METABOLIC-COST STATIC OPTIMIZATION
+//==============================================================================
+// The analytic gradient of the metabolic-cost objective must agree with the
+// one-sided finite differences of the objective (the kernels have kinks, at
+// which the analytic gradient is one of the one-sided derivatives). The
+// derivative of a^0.6 at 0, where it is unbounded, must be infinite rather
+// than 0, and that of the cost at the default minimum activation finite.
+template <class Probe>
+void checkMetabolicCostGradient(Model& model, const Probe& probe,
+    const std::vector<SimTK::State>& states)
+{
+    const int na = model.getActuators().getSize();
+    const double h = 1e-7;
+    int numChecks = 0;
+    for (unsigned int k=0; k<states.size(); ++k) {
+        MuscleMetabolicsStaticOptimizationTarget<Probe> target(states[k],
+            &model, na, 0, true, probe, 0.01);
+        target.setActivationExponent(2);
+        target.prepareMetabolicCost(states[k]);
+        ASSERT(target.getNumMetabolicActuators() == 2, __FILE__, __LINE__,
+            probe.getName() + ": the muscles were not found by the target.");
+
+        for (int step=1; step<10; ++step) {
+            SimTK::Vector x(na);
+            x[0] = 0.1*step;
+            x[1] = 1 - 0.1*step;
+            SimTK::Vector gradient(na);
+            target.gradientFunc(x, true, gradient);
+            for (int j=0; j<na; ++j) {
+                SimTK::Real J, Jplus, Jminus;
+                SimTK::Vector xPerturbed = x;
+                target.objectiveFunc(x, true, J);
+                xPerturbed[j] = x[j] + h;
+                target.objectiveFunc(xPerturbed, true, Jplus);
+                xPerturbed[j] = x[j] - h;
+                target.objectiveFunc(xPerturbed, true, Jminus);
+                const double forward = (Jplus - J)/h;
+                const double backward = (J - Jminus)/h;
+                const double tol = 1e-4*std::max(1.0, fabs(gradient[j]));
+                ASSERT(fabs(gradient[j] - forward) < tol
+                       || fabs(gradient[j] - backward) < tol,
+                       __FILE__, __LINE__,
+                       probe.getName() + ": analytic gradient of the "
+                       "metabolic cost differs from finite differences.");
+                ++numChecks;
+            }
+        }
+    }
+    cout << "  " << probe.getName() << ": " << numChecks
+         << " gradient entries checked" << endl;
+}
+
+void testMetabolicStaticOptimization()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbe =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(umbergerProbe);
+    umbergerProbe->setName("umberger");
+    umbergerProbe->addMuscle("muscle1", 0.5);
+    umbergerProbe->addMuscle("muscle2", 0.5);
+
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbe =
+        new UchidaBhargava2004MuscleMetabolicsProbe(true, true, true, true, true);
+    model.addProbe(bhargavaProbe);
+    bhargavaProbe->setName("bhargava");
+    bhargavaProbe->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+    bhargavaProbe->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+
+    SimTK::State& state = model.initSystem();
+    for (int i=0; i<model.getMuscles().getSize(); ++i)
+        model.getMuscles().get(i).setIgnoreActivationDynamics(state, true);
+    model.getMultibodySystem().realize(state, SimTK::Stage::Dynamics);
+    model.equilibrateMuscles(state);
+    const std::vector<SimTK::State> states =
+        sampleStates(model, state, 0.0, 0.05, 21);
+
+    // The objective of a metabolic muscle is the rate computed by the kernel,
+    // with a rigid tendon and excitation = activation.
+    cout << "- checking the metabolic cost against the kernel" << endl;
+    MuscleMetabolicsStaticOptimizationTarget<UchidaUmberger2010MuscleMetabolicsProbe>
+        target(states[5], &model, 2, 0, true, *umbergerProbe, 1.0);
+    target.prepareMetabolicCost(states[5]);
+    SimTK::State rigidState = states[5];
+    for (int i=0; i<model.getMuscles().getSize(); ++i)
+        model.getMuscles().get(i).setIgnoreTendonCompliance(rigidState, true);
+    model.getMultibodySystem().realize(rigidState, SimTK::Stage::Dynamics);
+    UchidaUmberger2010MuscleMetabolicsKernel::MuscleInputs<double> in;
+    UchidaUmberger2010MuscleMetabolicsKernel::MuscleRates<double> rates;
+    umbergerProbe->gatherMuscleInputs(rigidState, 0, in);
+    const Muscle& muscle = umbergerProbe->getMetabolicMuscle(0);
+    in.excitation = in.activation = 0.3;
+    in.active_fiber_force = 0.3 * muscle.getMaxIsometricForce()
+        * muscle.getActiveForceLengthMultiplier(rigidState)
+        * muscle.getForceVelocityMultiplier(rigidState);
+    UchidaUmberger2010MuscleMetabolicsKernel::calcMuscleRates(
+        umbergerProbe->getKernelSettings(),
+        umbergerProbe->getKernelMuscleConstants(0), in, rates);
+    double dEdot;
+    ASSERT_EQUAL(rates.Edot, target.calcMetabolicRate(0, 0.3, dEdot),
+        1e-10*std::max(1.0, fabs(rates.Edot)), __FILE__, __LINE__,
+        "Metabolic cost differs from the kernel.");
+
+    cout << "- checking analytic gradients" << endl;
+    checkMetabolicCostGradient(model, *umbergerProbe, states);
+    checkMetabolicCostGradient(model, *bhargavaProbe, states);
+
+    cout << "- checking the derivative at zero activation" << endl;
+    const MuscleMetabolicsDual A = pow(MuscleMetabolicsDual(0, 1),
+                                       MuscleMetabolicsDual(0.6));
+    ASSERT(A.value == 0 && A.derivative == SimTK::Infinity, __FILE__,
+           __LINE__, "The derivative of a^0.6 at 0 is not infinite.");
+    target.calcMetabolicRate(0, 0.01, dEdot);
+    ASSERT(SimTK::isFinite(dEdot) && dEdot > 0, __FILE__, __LINE__,
+           "The slope of the metabolic cost at the minimum activation is "
+           "invalid.");
+}
+
+
+//==============================================================================
+//                        EXCITATION RECONSTRUCTION
+//==============================================================================
+// Accumulate the errors of the reconstructed excitation of each muscle of a
+// probe, and of the summed muscle metabolic power, relative to the excitation
+// given by getReference(muscleIndex).
+struct ExcitationReconstructionErrors {
+    ExcitationReconstructionErrors()
+    :   numExcitations(0), sumSqExcitation(0), maxExcitation(0),
+        numPowers(0), sumSqPower(0), sumSqReferencePower(0) {}
+    int numExcitations;
+    double sumSqExcitation, maxExcitation;
+    int numPowers;
+    double sumSqPower, sumSqReferencePower;
+
+    double getRMSExcitationError() const
+    {   return sqrt(sumSqExcitation/std::max(numExcitations, 1)); }
+    double getRelativeRMSPowerError() const
+    {   return sqrt(sumSqPower/std::max(sumSqReferencePower, SimTK::Eps)); }
+    void print(const std::string& name) const
+    {
+        cout << "  " << name << ": excitation error RMS "
+             << getRMSExcitationError() << ", max " << maxExcitation
+             << "; muscle metabolic power relative RMS error "
+             << getRelativeRMSPowerError() << " (" << numPowers
+             << " states)" << endl;
+    }
+};
+
+template <class Probe, class ReferenceExcitations>
+void accumulateExcitationReconstructionErrors(const Probe& probe,
+    const SimTK::State& s, const ReferenceExcitations& getReference,
+    ExcitationReconstructionErrors& errors)
+{
+    typename Probe::Kernel::template MuscleInputs<double> in;
+    typename Probe::Kernel::template MuscleRates<double> rates;
+    double power = 0, referencePower = 0;
+    for (int i=0; i<probe.getNumMetabolicMuscles(); ++i) {
+        probe.gatherMuscleInputs(s, i, in);
+        Probe::Kernel::calcMuscleRates(probe.getKernelSettings(),
+            probe.getKernelMuscleConstants(i), in, rates);
+        power += rates.Edot;
+
+        const double reference = getReference(i);
+        const double error = in.excitation - reference;
+        errors.sumSqExcitation += error*error;
+        errors.maxExcitation = std::max(errors.maxExcitation, fabs(error));
+        ++errors.numExcitations;
+
+        in.excitation = reference;
+        Probe::Kernel::calcMuscleRates(probe.getKernelSettings(),
+            probe.getKernelMuscleConstants(i), in, rates);
+        referencePower += rates.Edot;
+    }
+    errors.sumSqPower += (power - referencePower)*(power - referencePower);
+    errors.sumSqReferencePower += referencePower*referencePower;
+    ++errors.numPowers;
+}
+
+// The reference excitations of the two-muscle model: its controls.
+template <class Probe>
+struct ControlExcitations {
+    ControlExcitations(const Probe& probe, const SimTK::State& s)
+    :   probe(probe), s(s) {}
+    double operator()(int i) const
+    {   return probe.getMetabolicMuscle(i).getControl(s); }
+    const Probe& probe;
+    const SimTK::State& s;
+};
+
+// The reference excitations of the gait example: the CMC controls.
+struct ControlSetExcitations {
+    ControlSetExcitations(ControlSet& controls, double t,
+                          const std::vector<int>& controlIndices)
+    :   controls(controls), t(t), controlIndices(controlIndices) {}
+    double operator()(int i) const
+    {   return controls[controlIndices[i]].getControlValue(t); }
+    ControlSet& controls;
+    double t;
+    const std::vector<int>& controlIndices;
+};
+
+// Report the accuracy of the reconstructed excitations of the probes of the
+// gait example against the CMC controls, if the example is available.
+void reportGaitExcitationReconstruction()
+{
+#ifdef METABOLICS_EXAMPLES_DIR
+    const std::string dir = METABOLICS_EXAMPLES_DIR;
+#else
+    const std::string dir = "../examples";
+#endif
+    const std::string modelFile = dir + "/subject01_simbody_adjusted.osim";
+    const std::string statesFile = dir + "/ResultsCMC/subject01_walk1_states.sto";
+    const std::string controlsFile = dir + "/ResultsCMC/subject01_walk1_controls.xml";
+    if (!std::ifstream(modelFile.c_str()).good()
+        || !std::ifstream(statesFile.c_str()).good()
+        || !std::ifstream(controlsFile.c_str()).good()) {
+        cout << "- gait example not found in " << dir << "; skipping" << endl;
+        return;
+    }
+
+    cout << "- reconstructing the excitations of the gait example" << endl;
+    Model model(modelFile);
+    Storage states(statesFile);
+    ControlSet controls(controlsFile);
+    UchidaUmberger2010MuscleMetabolicsProbe& umbergerProbe =
+        dynamic_cast<UchidaUmberger2010MuscleMetabolicsProbe&>(
+            model.updProbeSet().get("metabolic_power_umb"));
+    UchidaBhargava2004MuscleMetabolicsProbe& bhargavaProbe =
+        dynamic_cast<UchidaBhargava2004MuscleMetabolicsProbe&>(
+            model.updProbeSet().get("metabolic_power_bha"));
+    umbergerProbe.set_reconstruct_excitation(true);
+    umbergerProbe.setActivationStates(states);
+    bhargavaProbe.set_reconstruct_excitation(true);
+    bhargavaProbe.setActivationStates(states);
+    SimTK::State& s = model.initSystem();
+
+    std::vector<int> umbergerControls, bhargavaControls;
+    for (int i=0; i<umbergerProbe.getNumMetabolicMuscles(); ++i)
+        umbergerControls.push_back(controls.getIndex(
+            umbergerProbe.getMetabolicMuscle(i).getName() + ".excitation"));
+    for (int i=0; i<bhargavaProbe.getNumMetabolicMuscles(); ++i)
+        bhargavaControls.push_back(controls.getIndex(
+            bhargavaProbe.getMetabolicMuscle(i).getName() + ".excitation"));
+    ASSERT(std::find(umbergerControls.begin(), umbergerControls.end(), -1)
+                == umbergerControls.end()
+           && std::find(bhargavaControls.begin(), bhargavaControls.end(), -1)
+                == bhargavaControls.end(),
+           __FILE__, __LINE__, "A muscle of the gait example has no control.");
+
+    const Array<std::string> names = model.getStateVariableNames();
+    ExcitationReconstructionErrors umbergerErrors, bhargavaErrors;
+    for (int k=0; k<states.getSize(); k+=5) {
+        const StateVector& row = *states.getStateVector(k);
+        const double t = row.getTime();
+        s.setTime(t);
+        for (int n=0; n<names.getSize(); ++n) {
+            const int index = states.getStateIndex(names[n]);
+            if (index >= 0)
+                model.setStateVariable(s, names[n], row.getData()[index]);
+        }
+        model.getMultibodySystem().realize(s, SimTK::Stage::Dynamics);
+        accumulateExcitationReconstructionErrors(umbergerProbe, s,
+            ControlSetExcitations(controls, t, umbergerControls),
+            umbergerErrors);
+        accumulateExcitationReconstructionErrors(bhargavaProbe, s,
+            ControlSetExcitations(controls, t, bhargavaControls),
+            bhargavaErrors);
+    }
+    umbergerErrors.print("gait example, " + umbergerProbe.getName());
+    bhargavaErrors.print("gait example, " + bhargavaProbe.getName());
+    ASSERT(SimTK::isFinite(umbergerErrors.getRelativeRMSPowerError())
+           && SimTK::isFinite(bhargavaErrors.getRelativeRMSPowerError()),
+           __FILE__, __LINE__,
+           "Reconstructed excitations of the gait example are not finite.");
+}
+
+// The excitations reconstructed from the activation trajectory of a
+// simulation must track the controls that produced it, and the probes must
+// then report nearly the same metabolic power without the controls.
+void testExcitationReconstruction()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbe =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(umbergerProbe);
+    umbergerProbe->setName("umberger");
+    umbergerProbe->addMuscle("muscle1", 0.5);
+    umbergerProbe->addMuscle("muscle2", 0.5);
+
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbe =
+        new UchidaBhargava2004MuscleMetabolicsProbe(true, true, true, true, true);
+    model.addProbe(bhargavaProbe);
+    bhargavaProbe->setName("bhargava");
+    bhargavaProbe->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+    bhargavaProbe->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+
+    SimTK::State& state = model.initSystem();
+    model.equilibrateMuscles(state);
+    const std::vector<SimTK::State> states =
+        sampleStates(model, state, 0.0, 0.005, 201);
+
+    // Record the states, as in a states file.
+    const Array<std::string> names = model.getStateVariableNames();
+    Array<std::string> labels;
+    labels.append("time");
+    labels.append(names);
+    Storage statesStorage;
+    statesStorage.setColumnLabels(labels);
+    for (unsigned int k=0; k<states.size(); ++k) {
+        Array<double> values;
+        model.getStateValues(states[k], values);
+        statesStorage.append(states[k].getTime(), values.getSize(), &values[0]);
+    }
+
+    // Excitations computed with the controls, then reconstructed.
+    std::vector<SimTK::Vector> controlled;
+    for (unsigned int k=0; k<states.size(); ++k)
+        controlled.push_back(umbergerProbe->computeProbeInputs(states[k]));
+    umbergerProbe->set_reconstruct_excitation(true);
+    umbergerProbe->setActivationStates(statesStorage);
+    bhargavaProbe->set_reconstruct_excitation(true);
+    bhargavaProbe->setActivationStates(statesStorage);
+
+    // The ends of the trajectory are excluded, where the smoothing spline is
+    // least accurate.
+    ExcitationReconstructionErrors umbergerErrors, bhargavaErrors;
+    for (unsigned int k=10; k+10<states.size(); ++k) {
+        accumulateExcitationReconstructionErrors(*umbergerProbe, states[k],
+            ControlExcitations<UchidaUmberger2010MuscleMetabolicsProbe>(
+                *umbergerProbe, states[k]), umbergerErrors);
+        accumulateExcitationReconstructionErrors(*bhargavaProbe, states[k],
+            ControlExcitations<UchidaBhargava2004MuscleMetabolicsProbe>(
+                *bhargavaProbe, states[k]), bhargavaErrors);
+
+        const SimTK::Vector reconstructed =
+            umbergerProbe->computeProbeInputs(states[k]);
+        ASSERT_EQUAL(controlled[k][0], reconstructed[0],
+            0.05*fabs(controlled[k][0]), __FILE__, __LINE__,
+            "Umberger2010: metabolic power with reconstructed excitations "
+            "differs from the controlled power.");
+    }
+    umbergerErrors.print("two-muscle model, umberger");
+    bhargavaErrors.print("two-muscle model, bhargava");
+    ASSERT(umbergerErrors.maxExcitation < 0.05
+           && bhargavaErrors.maxExcitation < 0.05, __FILE__, __LINE__,
+           "Reconstructed excitations differ from the controls.");
+    ASSERT(umbergerErrors.getRelativeRMSPowerError() < 0.02
+           && bhargavaErrors.getRelativeRMSPowerError() < 0.02,
+           __FILE__, __LINE__, "Metabolic power with reconstructed excitations "
+           "differs from the controlled power.");
+
+    // Without activation states, the reconstruction cannot be connected.
+    Model modelWithoutStates;
+    buildTwoMuscleModel(modelWithoutStates);
+    UchidaUmberger2010MuscleMetabolicsProbe* probeWithoutStates =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    modelWithoutStates.addProbe(probeWithoutStates);
+    probeWithoutStates->addMuscle("muscle1", 0.5);
+    probeWithoutStates->set_reconstruct_excitation(true);
+    ASSERT_THROW(OpenSim::Exception, modelWithoutStates.initSystem());
+
+    reportGaitExcitationReconstruction();
+}
+
+
+//==============================================================================
+//                           INCREMENTAL EVALUATION
+//==============================================================================
+// Probes that reuse the rates of muscles whose inputs have changed little are
+// evaluated at closely spaced states, and compared to probes that evaluate
+// every muscle. The error of each muscle must be within the first-order bound
+// at the cached inputs, and the TOTAL must be the sum of the muscles.
+template <class Probe>
+void checkIncrementalEvaluation(const Probe& probe, const Probe& incremental,
+    const std::vector<SimTK::State>& states)
+{
+    double maxError = 0, maxBound = 0;
+    for (unsigned int k=0; k<states.size(); ++k) {
+        const SimTK::Vector exact = probe.computeProbeInputs(states[k]);
+        const SimTK::Vector approx = incremental.computeProbeInputs(states[k]);
+        double sum = approx(1);
+        for (int i=0; i<2; ++i) {
+            const double error = fabs(approx(i+2) - exact(i+2));
+            const double bound = incremental.calcIncrementalErrorBound(i);
+            ASSERT(error <= 2*bound + 1e-10*std::max(1.0, fabs(exact(i+2))),
+                __FILE__, __LINE__, probe.getName()
+                + ": incremental error exceeds its first-order bound.");
+            maxError = std::max(maxError, error);
+            maxBound = std::max(maxBound, bound);
+            sum += approx(i+2);
+        }
+        ASSERT_EQUAL(sum, approx(0), 1e-10*std::max(1.0, fabs(sum)),
+            __FILE__, __LINE__, probe.getName()
+            + ": incremental TOTAL differs from the sum of the muscles.");
+    }
+    cout << "  " << probe.getName() << ": reuse ratio "
+         << incremental.getIncrementalReuseRatio() << ", max error "
+         << maxError << " W (max bound " << maxBound << " W)" << endl;
+    ASSERT(incremental.getNumIncrementalEvaluations() == 2*(int)states.size()
+        && incremental.getIncrementalReuseRatio() > 0.1,
+        __FILE__, __LINE__,
+        probe.getName() + ": cached rates were not reused.");
+}
+
+void testIncrementalEvaluation()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbes[2];
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbes[2];
+    for (int i=0; i<2; ++i) {
+        umbergerProbes[i] = new UchidaUmberger2010MuscleMetabolicsProbe(
+            true, true, true, true);
+        model.addProbe(umbergerProbes[i]);
+        umbergerProbes[i]->setName(i==0 ? "umberger" : "umbergerIncremental");
+        umbergerProbes[i]->setOperation("value");
+        umbergerProbes[i]->set_report_total_metabolics_only(false);
+        umbergerProbes[i]->set_incremental_evaluation(i==1);
+        umbergerProbes[i]->set_incremental_tolerance(1e-3);
+        umbergerProbes[i]->addMuscle("muscle1", 0.5);
+        umbergerProbes[i]->addMuscle("muscle2", 0.5);
+
+        bhargavaProbes[i] = new UchidaBhargava2004MuscleMetabolicsProbe(
+            true, true, true, true, true);
+        model.addProbe(bhargavaProbes[i]);
+        bhargavaProbes[i]->setName(i==0 ? "bhargava" : "bhargavaIncremental");
+        bhargavaProbes[i]->setOperation("value");
+        bhargavaProbes[i]->set_report_total_metabolics_only(false);
+        bhargavaProbes[i]->set_incremental_evaluation(i==1);
+        bhargavaProbes[i]->set_incremental_tolerance(1e-3);
+        bhargavaProbes[i]->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+        bhargavaProbes[i]->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+    }
+
+    SimTK::State& state = model.initSystem();
+    for (int i=0; i<model.getMuscles().getSize(); ++i)
+        model.getMuscles().get(i).setIgnoreActivationDynamics(state, true);
+    model.getMultibodySystem().realize(state, SimTK::Stage::Dynamics);
+    model.equilibrateMuscles(state);
+    const std::vector<SimTK::State> states =
+        sampleStates(model, state, 0.0, 1e-4, 2001);
+
+    cout << "- comparing incremental evaluation to full evaluation" << endl;
+    checkIncrementalEvaluation(*umbergerProbes[0], *umbergerProbes[1], states);
+    checkIncrementalEvaluation(*bhargavaProbes[0], *bhargavaProbes[1], states);
+
+    // Without incremental evaluation, nothing is cached.
+    ASSERT(umbergerProbes[0]->getNumIncrementalEvaluations() == 0
+           && umbergerProbes[0]->calcIncrementalErrorBound(0) == 0,
+           __FILE__, __LINE__,
+           "Probes without incremental_evaluation must not cache rates.");
+}
+
+
+//==============================================================================
+//                            MULTI-RATE SAMPLING
+//==============================================================================
+// Probes sampled at fixed rates during a simulation of the two-muscle (Millard)
+// model integrate the metabolic energy from their samples by the trapezoidal
+// rule; the error is measured against the 'integrate' operation of probes
+// evaluated at every stage of the integrator.
+template <class Probe>
+void reportSampledEnergyErrors(const std::vector<Probe*>& sampled,
+    const double* rates, double referenceEnergy, const std::string& name)
+{
+    cout << "  " << name << ": reference energy " << referenceEnergy << " J"
+         << endl;
+    std::vector<double> errors;
+    for (unsigned int r=0; r<sampled.size(); ++r) {
+        const int numSamples = sampled[r]->getNumSamples();
+        const double energy = sampled[r]->getSampledEnergy()[0];
+        errors.push_back(fabs(energy - referenceEnergy)
+                         / fabs(referenceEnergy));
+        cout << "    " << rates[r] << " Hz: " << numSamples << " samples, "
+             << energy << " J (relative error " << errors.back() << ")"
+             << endl;
+        ASSERT(abs(numSamples - (int)(rates[r] + 1.5)) <= 1,
+               __FILE__, __LINE__,
+               name + ": the probe was not sampled at its sampling rate.");
+    }
+    ASSERT(errors[1] < 1e-3 && errors.back() <= errors.front(),
+           __FILE__, __LINE__,
+           name + ": sampled energy differs from the integrated energy.");
+}
+
+void testMultiRateSampling()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+
+    // Reference probes, integrated by the integrator.
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbe =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(umbergerProbe);
+    umbergerProbe->setName("umbergerEnergy");
+    umbergerProbe->setOperation("integrate");
+    umbergerProbe->addMuscle("muscle1", 0.5);
+    umbergerProbe->addMuscle("muscle2", 0.5);
+
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbe =
+        new UchidaBhargava2004MuscleMetabolicsProbe(true, true, true, true, true);
+    model.addProbe(bhargavaProbe);
+    bhargavaProbe->setName("bhargavaEnergy");
+    bhargavaProbe->setOperation("integrate");
+    bhargavaProbe->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+    bhargavaProbe->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+
+    // Sampled probes.
+    const double rates[3] = { 50, 200, 1000 };
+    std::vector<UchidaUmberger2010MuscleMetabolicsProbe*> umbergerSampled;
+    std::vector<UchidaBhargava2004MuscleMetabolicsProbe*> bhargavaSampled;
+    for (int r=0; r<3; ++r) {
+        std::stringstream suffix;
+        suffix << rates[r] << "Hz";
+        umbergerSampled.push_back(
+            new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true));
+        model.addProbe(umbergerSampled.back());
+        umbergerSampled.back()->setName("umberger" + suffix.str());
+        umbergerSampled.back()->setOperation("value");
+        umbergerSampled.back()->set_sampling_rate(rates[r]);
+        umbergerSampled.back()->addMuscle("muscle1", 0.5);
+        umbergerSampled.back()->addMuscle("muscle2", 0.5);
+
+        bhargavaSampled.push_back(new UchidaBhargava2004MuscleMetabolicsProbe(
+            true, true, true, true, true));
+        model.addProbe(bhargavaSampled.back());
+        bhargavaSampled.back()->setName("bhargava" + suffix.str());
+        bhargavaSampled.back()->setOperation("value");
+        bhargavaSampled.back()->set_sampling_rate(rates[r]);
+        bhargavaSampled.back()->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+        bhargavaSampled.back()->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+    }
+    ProbeReporter* probeReporter = new ProbeReporter(&model);
+    model.addAnalysis(probeReporter);
+    MuscleMetabolicsDeferredReporter* reporter =
+        new MuscleMetabolicsDeferredReporter(&model);
+    model.addAnalysis(reporter);
+    umbergerSampled[2]->setOperation("integrate");
+    simulateModel(model, 0.0, 1.0);
+
+    Storage probeStorage(probeReporter->getProbeStorage());
+    Array<double> umbergerEnergy, bhargavaEnergy;
+    probeStorage.getDataColumn("umbergerEnergy_TOTAL", umbergerEnergy);
+    probeStorage.getDataColumn("bhargavaEnergy_TOTAL", bhargavaEnergy);
+
+    cout << "- comparing sampled energy to integrated energy" << endl;
+    reportSampledEnergyErrors(umbergerSampled, rates,
+                              umbergerEnergy.getLast(), "Umberger2010");
+    reportSampledEnergyErrors(bhargavaSampled, rates,
+                              bhargavaEnergy.getLast(), "Bhargava2004");
+
+    // The samples streamed to the reporter hold the power at the sample
+    // times or, with the 'integrate' operation, integrate it as
+    // getSampledEnergy() does.
+    const UchidaUmberger2010MuscleMetabolicsProbe& probe = *umbergerSampled[1];
+    const Storage& power = reporter->getSampledStorage(probe.getName());
+    ASSERT(power.getSize() == probe.getNumSamples(), __FILE__, __LINE__,
+           "Sampled results do not match the samples.");
+    const UchidaUmberger2010MuscleMetabolicsProbe& energyProbe =
+        *umbergerSampled[2];
+    Storage energy(reporter->getSampledStorage(energyProbe.getName()));
+    Array<double> energyColumn;
+    energy.getDataColumn(energyProbe.getName() + "_TOTAL", energyColumn);
+    ASSERT(energy.getSize() == energyProbe.getNumSamples(),
+           __FILE__, __LINE__, "Sampled results do not match the samples.");
+    ASSERT_EQUAL(energyColumn.getLast(), energyProbe.getSampledEnergy()[0],
+        1e-10*fabs(energyColumn.getLast()), __FILE__, __LINE__,
+        "Sampled results are not integrated by the trapezoidal rule.");
+}
+
+
+//==============================================================================
+//                           CONCURRENT EVALUATION
+//==============================================================================
+// Task that realizes the kth state and evaluates a probe at it into the kth
+// result, so that each thread uses its own States.
+template <class Probe>
+class ProbeEvaluationTask : public SimTK::ParallelExecutor::Task {
+public:
+    ProbeEvaluationTask(const Model& model, const Probe& probe,
+        std::vector<SimTK::State>& states, std::vector<SimTK::Vector>& results)
+    :   _model(model), _probe(probe), _states(states), _results(results) {}
+
+    void execute(int k) OVERRIDE_11
+    {
+        _model.getMultibodySystem().realize(_states[k], SimTK::Stage::Dynamics);
+        _results[k] = _probe.computeProbeInputs(_states[k]);
+    }
+
+private:
+    const Model& _model;
+    const Probe& _probe;
+    std::vector<SimTK::State>& _states;
+    std::vector<SimTK::Vector>& _results;
+};
+
+// The states are realized and the probe is evaluated repeatedly by several
+// threads on one connected model, each at its own copies of the states; the
+// results must be identical to the serial results.
+template <class Probe>
+void checkConcurrentEvaluation(const Model& model, const Probe& probe,
+    const std::vector<SimTK::State>& states, int numThreads, int numRounds)
+{
+    ASSERT(probe.supportsConcurrentEvaluation(), __FILE__, __LINE__,
+           probe.getName() + ": concurrent evaluation is not supported.");
+
+    std::vector<SimTK::Vector> serial;
+    for (unsigned int k=0; k<states.size(); ++k)
+        serial.push_back(probe.computeProbeInputs(states[k]));
+
+    SimTK::ParallelExecutor executor(numThreads);
+    for (int round=0; round<numRounds; ++round) {
+        // Fresh copies of the states, which are realized by the threads.
+        std::vector<SimTK::State> copies(states);
+        for (unsigned int k=0; k<copies.size(); ++k)
+            copies[k].invalidateAllCacheAtOrAbove(SimTK::Stage::Position);
+        std::vector<SimTK::Vector> concurrent(states.size());
+        ProbeEvaluationTask<Probe> task(model, probe, copies, concurrent);
+        executor.execute(task, (int)states.size());
+
+        for (unsigned int k=0; k<states.size(); ++k) {
+            ASSERT(concurrent[k].size() == serial[k].size(), __FILE__, __LINE__,
+                   probe.getName() + ": concurrent result has the wrong size.");
+            for (int j=0; j<serial[k].size(); ++j)
+                ASSERT_EQUAL(serial[k][j], concurrent[k][j], 0.0,
+                    __FILE__, __LINE__, probe.getName()
+                    + ": concurrent evaluation differs from serial evaluation.");
+        }
+    }
+    cout << "  " << probe.getName() << ": " << numRounds << " rounds of "
+         << states.size() << " states on " << numThreads
+         << " threads match the serial results" << endl;
+}
+
+void testConcurrentEvaluation()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbe =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(umbergerProbe);
+    umbergerProbe->setName("umberger");
+    umbergerProbe->setOperation("value");
+    umbergerProbe->set_report_total_metabolics_only(false);
+    umbergerProbe->set_use_Bhargava_recruitment_model(true);
+    umbergerProbe->addMuscle("muscle1", 0.5);
+    umbergerProbe->addMuscle("muscle2", 0.5);
+
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbe =
+        new UchidaBhargava2004MuscleMetabolicsProbe(true, true, true, true, true);
+    model.addProbe(bhargavaProbe);
+    bhargavaProbe->setName("bhargava");
+    bhargavaProbe->setOperation("value");
+    bhargavaProbe->set_report_total_metabolics_only(false);
+    bhargavaProbe->set_fast_math(true);     // Replaced by the mode chosen.
+    bhargavaProbe->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+    bhargavaProbe->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+
+    SimTK::State& state = model.initSystem();
+    for (int i=0; i<model.getMuscles().getSize(); ++i)
+        model.getMuscles().get(i).setIgnoreActivationDynamics(state, true);
+    model.getMultibodySystem().realize(state, SimTK::Stage::Dynamics);
+    model.equilibrateMuscles(state);
+    const std::vector<SimTK::State> states =
+        sampleStates(model, state, 0.0, 0.005, 201);
+
+    cout << "- comparing concurrent evaluation to serial evaluation" << endl;
+    const int numThreads =
+        std::max(4, SimTK::ParallelExecutor::getNumProcessors());
+    checkConcurrentEvaluation(model, *umbergerProbe, states, numThreads, 20);
+    checkConcurrentEvaluation(model, *bhargavaProbe, states, numThreads, 20);
+
+    // Options that modify the probe during the evaluation are reported.
+    umbergerProbe->set_incremental_evaluation(true);
+    bhargavaProbe->set_sampling_rate(100);
+    ASSERT(!umbergerProbe->supportsConcurrentEvaluation()
+           && !bhargavaProbe->supportsConcurrentEvaluation(),
+           __FILE__, __LINE__,
+           "Options that are not thread-safe were not reported.");
+}
+
+
+//==============================================================================
+//                          ASYNCHRONOUS EVALUATION
+//==============================================================================
+// The two-muscle (Millard) model is simulated with a deferred reporter that
+// computes the recorded inputs at the end, and again with a reporter that
+// computes them on a worker thread during the simulation, in blocks of several
+// sizes. The simulations are identical, so the results must be identical.
+void testAsynchronousEvaluation()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbe =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(umbergerProbe);
+    umbergerProbe->setName("umbergerDeferred");
+    umbergerProbe->setOperation("value");
+    umbergerProbe->set_report_total_metabolics_only(false);
+    umbergerProbe->set_deferred_evaluation(true);
+    umbergerProbe->addMuscle("muscle1", 0.5);
+    umbergerProbe->addMuscle("muscle2", 0.5);
+
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbe =
+        new UchidaBhargava2004MuscleMetabolicsProbe(true, true, true, true, true);
+    model.addProbe(bhargavaProbe);
+    bhargavaProbe->setName("bhargavaEnergyDeferred");
+    bhargavaProbe->setOperation("integrate");
+    bhargavaProbe->set_deferred_evaluation(true);
+    bhargavaProbe->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+    bhargavaProbe->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+
+    MuscleMetabolicsDeferredReporter* reporter =
+        new MuscleMetabolicsDeferredReporter(&model);
+    model.addAnalysis(reporter);
+    simulateModel(model, 0.0, 1.0);
+    const Storage synchronous(reporter->getProbeStorage());
+    ASSERT(synchronous.getSize() > 1, __FILE__, __LINE__,
+           "Deferred probes were not recorded.");
+
+    const int blockSizes[3] = { 1, 7, 100000 };
+    for (int b=0; b<3; ++b) {
+        cout << "- computing blocks of " << blockSizes[b]
+             << " record(s) on a worker thread" << endl;
+        reporter->set_asynchronous_evaluation(true);
+        reporter->set_asynchronous_block_size(blockSizes[b]);
+        simulateModel(model, 0.0, 1.0);
+
+        const Storage& asynchronous = reporter->getProbeStorage();
+        ASSERT(asynchronous.getSize() == synchronous.getSize()
+               && asynchronous.getColumnLabels().getSize()
+                  == synchronous.getColumnLabels().getSize(),
+               __FILE__, __LINE__,
+               "Asynchronous evaluation did not report every record.");
+        for (int k=0; k<synchronous.getSize(); ++k) {
+            const StateVector& expected = *synchronous.getStateVector(k);
+            const StateVector& found = *asynchronous.getStateVector(k);
+            ASSERT(found.getTime() == expected.getTime(), __FILE__, __LINE__,
+                   "Asynchronous records are out of order.");
+            for (int c=0; c<expected.getSize(); ++c)
+                ASSERT(found.getData()[c] == expected.getData()[c],
+                       __FILE__, __LINE__, "Asynchronous evaluation differs "
+                       "from synchronous evaluation.");
+        }
+        ASSERT(umbergerProbe->getNumDeferredRecords() == 0,
+               __FILE__, __LINE__,
+               "The records of the probes were not handed to the worker.");
+    }
+}
+
+
+//==============================================================================
+//                              COMPILED KERNELS
+//==============================================================================
+// The sources of the kernels of the probes added by addCompiledKernelProbes()
+// are generated at run time and checked for the parameters of the probes. In
+// their place, a kernel that evaluates the same constants is registered under
+// the same hash: probes that use it must reproduce the probes that evaluate
+// the equations, and probes whose parameters differ must fall back to the
+// equations.
+void addCompiledKernelProbes(Model& model, const std::string& suffix,
+    bool useCompiledKernel, UchidaUmberger2010MuscleMetabolicsProbe*& umberger,
+    UchidaBhargava2004MuscleMetabolicsProbe*& bhargava)
+{
+    umberger = new UchidaUmberger2010MuscleMetabolicsProbe(
+        true, true, true, true);
+    model.addProbe(umberger);
+    umberger->setName("umberger" + suffix);
+    umberger->setOperation("value");
+    umberger->set_report_total_metabolics_only(false);
+    umberger->set_use_Bhargava_recruitment_model(false);
+    umberger->set_use_compiled_kernel(useCompiledKernel);
+    umberger->addMuscle("muscle1", 0.5);
+    umberger->addMuscle("muscle2", 0.3);
+
+    bhargava = new UchidaBhargava2004MuscleMetabolicsProbe(
+        true, true, true, true, true);
+    model.addProbe(bhargava);
+    bhargava->setName("bhargava" + suffix);
+    bhargava->setOperation("value");
+    bhargava->set_report_total_metabolics_only(false);
+    bhargava->set_use_force_dependent_shortening_prop_constant(true);
+    bhargava->set_use_compiled_kernel(useCompiledKernel);
+    bhargava->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+    bhargava->addMuscle("muscle2", 0.3, 40, 133, 74, 111);
+}
+
+// A compiled kernel of a connected probe whose constants are read at run time
+// instead of compiled, and which counts its evaluations.
+template <class Probe>
+class RunTimeCompiledKernel : public Probe::CompiledKernel {
+public:
+    typedef typename Probe::Kernel Kernel;
+    typedef typename Probe::CompiledKernel::MuscleInputs MuscleInputs;
+    typedef typename Probe::CompiledKernel::MuscleRates MuscleRates;
+
+    explicit RunTimeCompiledKernel(const Probe& probe)
+    :   _hash(MuscleMetabolicsKernelGenerator::calcParameterHash(probe)),
+        _settings(probe.getKernelSettings()), _numEvaluations(0)
+    {
+        for (int i=0; i<probe.getNumMetabolicMuscles(); ++i)
+            _constants.push_back(probe.getKernelMuscleConstants(i));
+    }
+
+    std::string getParameterHash() const OVERRIDE_11 { return _hash; }
+    int getNumMuscles() const OVERRIDE_11 { return (int)_constants.size(); }
+
+    void calcMuscleRates(int i, const MuscleInputs& in,
+                         MuscleRates& rates) const OVERRIDE_11
+    {
+        ++_numEvaluations;
+        Kernel::calcMuscleRates(_settings, _constants[i], in, rates);
+    }
+
+    void calcMuscleRates(const MuscleInputs* in,
+                         MuscleRates* rates) const OVERRIDE_11
+    {
+        for (int i=0; i<getNumMuscles(); ++i)
+            calcMuscleRates(i, in[i], rates[i]);
+    }
+
+    int getNumEvaluations() const { return _numEvaluations; }
+
+private:
+    std::string _hash;
+    typename Kernel::Settings _settings;
+    std::vector<typename Kernel::MuscleConstants> _constants;
+    mutable int _numEvaluations;
+};
+
+// The generated source must compile the parameters of the probe into a
+// registered kernel with a function per muscle.
+template <class Probe>
+void checkGeneratedKernelSource(const Probe& probe,
+                                const std::string& className)
+{
+    std::stringstream source;
+    MuscleMetabolicsKernelGenerator::generate(probe, className, source);
+    const std::string text = source.str();
+    std::stringstream numMuscles;
+    numMuscles << "int getNumMuscles() const { return "
+               << probe.getNumMetabolicMuscles() << "; }";
+    ASSERT(text.find("class " + className) != std::string::npos
+           && text.find("return \""
+                  + MuscleMetabolicsKernelGenerator::calcParameterHash(probe)
+                  + "\";") != std::string::npos
+           && text.find(numMuscles.str()) != std::string::npos
+           && text.find("calcMuscleRates1(const MuscleInputs& in")
+              != std::string::npos
+           && text.find(className + "Registration(") != std::string::npos,
+           __FILE__, __LINE__,
+           probe.getName() + ": incomplete generated kernel source.");
+}
+
+template <class Probe>
+void checkCompiledKernel(const Probe& probe, const Probe& compiled,
+    const std::vector<SimTK::State>& states)
+{
+    ASSERT(compiled.getCompiledKernel() != 0
+           && compiled.getCompiledKernel()->getParameterHash()
+              == MuscleMetabolicsKernelGenerator::calcParameterHash(probe),
+           __FILE__, __LINE__,
+           compiled.getName() + ": the generated kernel was not registered.");
+
+    double maxDifference = 0;
+    for (unsigned int k=0; k<states.size(); ++k) {
+        const SimTK::Vector exact = probe.computeProbeInputs(states[k]);
+        const SimTK::Vector values = compiled.computeProbeInputs(states[k]);
+
+        // The unrolled evaluation of all muscles.
+        typename Probe::CompiledKernel::MuscleInputs in[2];
+        typename Probe::CompiledKernel::MuscleRates rates[2];
+        for (int i=0; i<2; ++i)
+            compiled.gatherMuscleInputs(states[k], i, in[i]);
+        compiled.getCompiledKernel()->calcMuscleRates(in, rates);
+
+        for (int j=0; j<exact.size(); ++j) {
+            const double tol = 1e-12*std::max(1.0, fabs(exact(j)));
+            ASSERT_EQUAL(exact(j), values(j), tol, __FILE__, __LINE__,
+                compiled.getName() + ": compiled kernel differs from the "
+                "equations.");
+            if (j >= 2)
+                ASSERT_EQUAL(exact(j), rates[j-2].Edot, tol,
+                    __FILE__, __LINE__, compiled.getName() + ": unrolled "
+                    "compiled kernel differs from the equations.");
+            maxDifference = std::max(maxDifference,
+                                     fabs(values(j) - exact(j)));
+        }
+    }
+    cout << "  " << compiled.getName() << ": max difference "
+         << maxDifference << " W" << endl;
+}
+
+void testCompiledKernels()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbes[3];
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbes[3];
+    addCompiledKernelProbes(model, "", false,
+                            umbergerProbes[0], bhargavaProbes[0]);
+    addCompiledKernelProbes(model, "Compiled", true,
+                            umbergerProbes[1], bhargavaProbes[1]);
+    addCompiledKernelProbes(model, "Modified", true,
+                            umbergerProbes[2], bhargavaProbes[2]);
+    umbergerProbes[2]->set_aerobic_factor(1.0);
+    bhargavaProbes[2]->set_muscle_effort_scaling_factor(0.9);
+    model.initSystem();
+
+    cout << "- generating the kernel sources" << endl;
+    checkGeneratedKernelSource(*umbergerProbes[0], "TestUmberger2010Kernel");
+    checkGeneratedKernelSource(*bhargavaProbes[0], "TestBhargava2004Kernel");
+
+    // Register the kernels, and connect the probes again to find them.
+    const RunTimeCompiledKernel<UchidaUmberger2010MuscleMetabolicsProbe>
+        umbergerKernel(*umbergerProbes[0]);
+    const RunTimeCompiledKernel<UchidaBhargava2004MuscleMetabolicsProbe>
+        bhargavaKernel(*bhargavaProbes[0]);
+    const MuscleMetabolicsCompiledKernelRegistration<
+        UchidaUmberger2010MuscleMetabolicsKernel>
+        umbergerRegistration(umbergerKernel);
+    const MuscleMetabolicsCompiledKernelRegistration<
+        UchidaBhargava2004MuscleMetabolicsKernel>
+        bhargavaRegistration(bhargavaKernel);
+    SimTK::State& state = model.initSystem();
+    model.getMultibodySystem().realize(state, SimTK::Stage::Dynamics);
+    model.equilibrateMuscles(state);
+    const std::vector<SimTK::State> states =
+        sampleStates(model, state, 0.0, 1e-2, 101);
+
+    cout << "- comparing compiled kernels to the equations" << endl;
+    checkCompiledKernel(*umbergerProbes[0], *umbergerProbes[1], states);
+    checkCompiledKernel(*bhargavaProbes[0], *bhargavaProbes[1], states);
+
+    ASSERT(umbergerProbes[2]->getCompiledKernel() == 0
+           && bhargavaProbes[2]->getCompiledKernel() == 0,
+           __FILE__, __LINE__,
+           "A compiled kernel was used for probes with other parameters.");
+    ASSERT(MuscleMetabolicsKernelGenerator::calcParameterHash(
+               *umbergerProbes[2])
+           != MuscleMetabolicsKernelGenerator::calcParameterHash(
+               *umbergerProbes[1]),
+           __FILE__, __LINE__,
+           "The parameter hash does not depend on the parameters.");
+}
+
+
+//==============================================================================
+//                            SUMMARY STATISTICS
+//==============================================================================
+// The statistics of known signals, sampled at uneven times, are compared to
+// their exact values, and the statistics of chunks of the samples, merged, to
+// those of all samples. In simulation, the integrals accumulated by a probe
+// with summary statistics must match the energy of a deferred probe recorded
+// at the same states.
+void checkMergedStatistics(const MuscleMetabolicsStatistics& all,
+                           const MuscleMetabolicsStatistics& merged)
+{
+    ASSERT(merged.getNumSamples() == all.getNumSamples()
+           && merged.getDuration() == all.getDuration(),
+           __FILE__, __LINE__, "Merged statistics lost samples.");
+    for (int c=0; c<all.getNumChannels(); ++c) {
+        ASSERT(merged.getMin(c) == all.getMin(c)
+               && merged.getMax(c) == all.getMax(c),
+               __FILE__, __LINE__, "Merged extrema differ.");
+        ASSERT_EQUAL(all.getIntegral(c), merged.getIntegral(c), 1e-12,
+            __FILE__, __LINE__, "Merged integral differs.");
+        ASSERT_EQUAL(all.getRMS(c), merged.getRMS(c), 1e-12,
+            __FILE__, __LINE__, "Merged RMS differs.");
+        for (int p=0; p<=100; p+=5)
+            ASSERT_EQUAL(all.getPercentile(c, p), merged.getPercentile(c, p),
+                2*MuscleMetabolicsStatistics::RelativeAccuracy
+                * fabs(all.getPercentile(c, p)), __FILE__, __LINE__,
+                "Merged percentile differs.");
+    }
+}
+
+void testSummaryStatistics()
+{
+    // Channel 0 is 10 + 5 sin(2 pi t) and channel 1 is -3 + 6t, on [0, 1].
+    Array<std::string> labels;
+    labels.append("sine");
+    labels.append("ramp");
+    MuscleMetabolicsStatistics all(labels);
+    MuscleMetabolicsStatistics chunks[3] = { all, all, all };
+    const int numSamples = 3000;
+    for (int k=0; k<=numSamples; ++k) {
+        const double t = (k + 0.3*sin(1.0*k)*(k > 0 && k < numSamples))
+                         / numSamples;
+        SimTK::Vector values(2);
+        values[0] = 10 + 5*sin(2*SimTK::Pi*t);
+        values[1] = -3 + 6*t;
+        all.add(t, values);
+        chunks[3*k/(numSamples+1)].add(t, values);
+    }
+
+    cout << "- comparing statistics to exact values" << endl;
+    all.print(cout);
+    const double tol = 2*MuscleMetabolicsStatistics::RelativeAccuracy;
+    ASSERT(all.getNumSamples() == numSamples+1 && all.getDuration() == 1,
+           __FILE__, __LINE__, "Samples were not accumulated.");
+    ASSERT_EQUAL(10.0, all.getIntegral(0), 1e-5, __FILE__, __LINE__,
+                 "Incorrect integral.");
+    ASSERT_EQUAL(10.0, all.getMean(0), 1e-5, __FILE__, __LINE__,
+                 "Incorrect mean.");
+    ASSERT_EQUAL(sqrt(100 + 12.5), all.getRMS(0), 1e-5, __FILE__, __LINE__,
+                 "Incorrect RMS.");
+    ASSERT_EQUAL(0.0, all.getMean(1), 1e-10, __FILE__, __LINE__,
+                 "Incorrect mean.");
+    ASSERT_EQUAL(5.0, all.getMin(0), 1e-5, __FILE__, __LINE__,
+                 "Incorrect minimum.");
+    ASSERT_EQUAL(3.0, all.getMax(1), 1e-12, __FILE__, __LINE__,
+                 "Incorrect maximum.");
+    ASSERT_EQUAL(10.0, all.getPercentile(0, 50), tol*10, __FILE__, __LINE__,
+                 "Incorrect median.");
+    ASSERT_EQUAL(10 + 5*cos(0.05*SimTK::Pi), all.getPercentile(0, 95),
+                 tol*15, __FILE__, __LINE__, "Incorrect 95th percentile.");
+    ASSERT_EQUAL(-1.5, all.getPercentile(1, 25), tol*1.5, __FILE__, __LINE__,
+                 "Incorrect 25th percentile.");
+    ASSERT_EQUAL(1.5, all.getPercentile(1, 75), tol*1.5, __FILE__, __LINE__,
+                 "Incorrect 75th percentile.");
+
+    // Chunks merged forwards, and backwards.
+    cout << "- merging statistics of time chunks" << endl;
+    MuscleMetabolicsStatistics forwards(chunks[0]);
+    forwards.merge(chunks[1]);
+    forwards.merge(chunks[2]);
+    checkMergedStatistics(all, forwards);
+    MuscleMetabolicsStatistics backwards(chunks[2]);
+    backwards.merge(chunks[1]);
+    backwards.merge(chunks[0]);
+    checkMergedStatistics(all, backwards);
+    try {
+        MuscleMetabolicsStatistics overlapping(chunks[0]);
+        overlapping.merge(chunks[2]);
+        overlapping.merge(chunks[1]);
+        ASSERT(false, __FILE__, __LINE__,
+               "Overlapping statistics were merged.");
+    } catch (const OpenSim::Exception&) {}
+
+    // In simulation.
+    Model model;
+    buildTwoMuscleModel(model);
+    UchidaUmberger2010MuscleMetabolicsProbe* probe =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(probe);
+    probe->setName("umbergerSummary");
+    probe->setOperation("value");
+    probe->set_report_total_metabolics_only(false);
+    probe->set_summary_statistics(true);
+    probe->addMuscle("muscle1", 0.5);
+    probe->addMuscle("muscle2", 0.5);
+    UchidaUmberger2010MuscleMetabolicsProbe* energyProbe = probe->clone();
+    model.addProbe(energyProbe);
+    energyProbe->setName("umbergerEnergyDeferred");
+    energyProbe->setOperation("integrate");
+    energyProbe->set_summary_statistics(true);
+    energyProbe->set_peak_tracking(true);
+    energyProbe->set_deferred_evaluation(true);
+
+    MuscleMetabolicsDeferredReporter* reporter =
+        new MuscleMetabolicsDeferredReporter(&model);
+    model.addAnalysis(reporter);
+    simulateModel(model, 0.0, 1.0);
+
+    cout << "- comparing accumulated integrals to deferred energy" << endl;
+    const MuscleMetabolicsStatistics& statistics = probe->getStatistics();
+    const Storage& deferred = reporter->getProbeStorage();
+    ASSERT(statistics.getNumChannels() == 4
+           && statistics.getNumSamples() == deferred.getSize(),
+           __FILE__, __LINE__,
+           "Statistics were not accumulated at the recorded states.");
+    const Array<double>& energy = deferred.getLastStateVector()->getData();
+    for (int c=0; c<statistics.getNumChannels(); ++c)
+        ASSERT_EQUAL(energy[c], statistics.getIntegral(c),
+            1e-10*std::max(1.0, fabs(energy[c])), __FILE__, __LINE__,
+            statistics.getLabel(c) + ": integral differs from the energy.");
+    statistics.print(cout);
+
+    cout << "- comparing the statistics and peaks of the deferred probe"
+         << endl;
+    const MuscleMetabolicsStatistics& deferredStatistics =
+        energyProbe->getStatistics();
+    const MuscleMetabolicsPeaks& deferredPeaks = energyProbe->getPeaks();
+    ASSERT(deferredStatistics.getNumSamples() == statistics.getNumSamples()
+           && deferredPeaks.getNumSamples() == statistics.getNumSamples(),
+           __FILE__, __LINE__,
+           "The deferred outputs were not added to the statistics or peaks.");
+    for (int c=0; c<statistics.getNumChannels(); ++c) {
+        const double tol = 1e-10*std::max(1.0, fabs(statistics.getMax(c)));
+        ASSERT_EQUAL(statistics.getIntegral(c),
+            deferredStatistics.getIntegral(c),
+            1e-10*std::max(1.0, fabs(statistics.getIntegral(c))),
+            __FILE__, __LINE__, statistics.getLabel(c)
+            + ": the deferred integral differs.");
+        ASSERT_EQUAL(statistics.getMax(c), deferredPeaks.getMax(c), tol,
+            __FILE__, __LINE__, statistics.getLabel(c)
+            + ": the deferred maximum differs.");
+    }
+
+    reporter->printResults("testSummaryStatistics");
+    std::ifstream table(
+        "testSummaryStatistics_MuscleMetabolicsDeferredReporter_"
+        "umbergerSummary_summary.txt");
+    int numLines = 0;
+    for (std::string line; std::getline(table, line);)
+        ++numLines;
+    ASSERT(numLines == 1 + statistics.getNumChannels(), __FILE__, __LINE__,
+           "The summary table was not printed.");
+}
+
+
+//==============================================================================
+//                              INDEXED RESULTS
+//==============================================================================
+// A long series of samples is written to an indexed results file. Ranges read
+// at the finest level must reproduce the samples, and ranges read at coarser
+// levels must bound and average the samples they summarize.
+void testIndexedResults()
+{
+    const std::string fileName = "testIndexedResults.mmi";
+    const int numSamples = 10000;
+    const int reductionFactor = 4;
+    Storage samples;
+    Array<std::string> columnLabels;
+    columnLabels.append("time");
+    columnLabels.append("TOTAL");
+    columnLabels.append("muscle1");
+    samples.setColumnLabels(columnLabels);
+    for (int k=0; k<numSamples; ++k) {
+        const double t = 0.01*k;
+        double values[2] = { 100 + 50*sin(t), 20*cos(3*t) + 0.001*k };
+        samples.append(t, 2, values);
+    }
+    MuscleMetabolicsIndexedWriter::write(samples, fileName, reductionFactor);
+
+    MuscleMetabolicsIndexedReader reader(fileName);
+    ASSERT(reader.getNumChannels() == 2 && reader.getLabel(1) == "muscle1"
+           && reader.getNumRecords(0) == numSamples
+           && reader.getNumRecords(reader.getNumLevels()-1) == 1
+           && reader.getStartTime() == 0
+           && reader.getEndTime() == samples.getLastTime(),
+           __FILE__, __LINE__, "The indexed results file is incomplete.");
+    for (int k=1; k<reader.getNumLevels(); ++k)
+        ASSERT(reader.getNumRecords(k) == (reader.getNumRecords(k-1)
+                                           + reductionFactor-1)/reductionFactor,
+               __FILE__, __LINE__, "Incorrect number of records in a level.");
+
+    cout << "- reading samples" << endl;
+    Storage range;
+    int numRows = reader.read(0, 12.345, 14.0, range);
+    ASSERT(numRows == 166 && range.getSize() == numRows
+           && range.getColumnLabels().getSize() == 3,
+           __FILE__, __LINE__, "Incorrect range of samples.");
+    for (int r=0; r<numRows; ++r) {
+        const int k = 1235 + r;
+        double t;
+        range.getTime(r, t);
+        ASSERT(t == samples.getStateVector(k)->getTime()
+               && range.getStateVector(r)->getData()[1]
+                  == samples.getStateVector(k)->getData()[1],
+               __FILE__, __LINE__, "Samples were not read exactly.");
+    }
+
+    cout << "- reading coarser levels" << endl;
+    for (int maxPoints=1; maxPoints<=1000; maxPoints*=10) {
+        const int level = reader.readRange(10.0, 60.0, maxPoints, range);
+        ASSERT(range.getSize() <= maxPoints || level == reader.getNumLevels()-1,
+               __FILE__, __LINE__, "Too many points were read.");
+        if (level > 0) {
+            Storage finer;
+            ASSERT(reader.read(level-1, 10.0, 60.0, finer) > maxPoints,
+                   __FILE__, __LINE__, "A finer level fits the points.");
+        }
+        if (level == 0)
+            continue;
+
+        // Compare each record to the samples it summarizes.
+        ASSERT(range.getColumnLabels().getSize() == 1 + 3*2
+               && range.getColumnLabels()[2] == "muscle1_min",
+               __FILE__, __LINE__, "Incorrect columns of a coarser level.");
+        int span = 1;
+        for (int k=0; k<level; ++k)
+            span *= reductionFactor;
+        for (int r=0; r<range.getSize(); ++r) {
+            double t;
+            range.getTime(r, t);
+            const int first = (int)floor(100*t + 0.5);
+            const int last = std::min(first + span, numSamples);
+            ASSERT(first % span == 0, __FILE__, __LINE__,
+                   "A record does not start at a group of samples.");
+            const Array<double>& record = range.getStateVector(r)->getData();
+            for (int c=0; c<2; ++c) {
+                double min = SimTK::Infinity, max = -SimTK::Infinity, sum = 0;
+                for (int k=first; k<last; ++k) {
+                    const double v = samples.getStateVector(k)->getData()[c];
+                    min = std::min(min, v);
+                    max = std::max(max, v);
+                    sum += v;
+                }
+                ASSERT(record[c] == min && record[2+c] == max, __FILE__,
+                       __LINE__, "Incorrect extrema of a record.");
+                ASSERT_EQUAL(sum/(last-first), record[4+c], 1e-9, __FILE__,
+                             __LINE__, "Incorrect mean of a record.");
+            }
+        }
+    }
+
+    // A truncated file is rejected.
+    {
+        std::ifstream in(fileName.c_str(), std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(in)),
+                             std::istreambuf_iterator<char>());
+        std::ofstream out("testIndexedResultsTruncated.mmi", std::ios::binary);
+        out.write(contents.data(), contents.size()/2);
+    }
+    try {
+        MuscleMetabolicsIndexedReader truncated(
+            "testIndexedResultsTruncated.mmi");
+        ASSERT(false, __FILE__, __LINE__, "A truncated file was read.");
+    } catch (const OpenSim::Exception&) {}
+}
+
+
+//==============================================================================
+//                              EVALUATION SERVICE
+//==============================================================================
+// A service keeps a copy of the two-muscle model warm. Its evaluation of the
+// states of a simulation of the model must match a ProbeReporter's, and its
+// parameter overrides must apply to a single job.
+void addServiceTestProbes(Model& model)
+{
+    UchidaUmberger2010MuscleMetabolicsProbe* umberger =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(umberger);
+    umberger->setName("umberger");
+    umberger->setOperation("value");
+    umberger->set_report_total_metabolics_only(false);
+    umberger->addMuscle("muscle1", 0.5);
+    umberger->addMuscle("muscle2", 0.5);
+
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargava =
+        new UchidaBhargava2004MuscleMetabolicsProbe(true, true, true, true, true);
+    model.addProbe(bhargava);
+    bhargava->setName("bhargava");
+    bhargava->setOperation("value");
+    bhargava->set_report_total_metabolics_only(false);
+    bhargava->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+    bhargava->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+}
+
+void testEvaluationService()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+    addServiceTestProbes(model);
+    ProbeReporter* probeReporter = new ProbeReporter(&model);
+    model.addAnalysis(probeReporter);
+    const Storage states = simulateModel(model, 0.0, 1.0);
+    const Storage& probeStorage = probeReporter->getProbeStorage();
+
+    // The service's copy of the model ignores activation dynamics, as
+    // simulateModel() does.
+    MuscleMetabolicsEvaluationService service;
+    Model* warmModel = new Model();
+    buildTwoMuscleModel(*warmModel);
+    addServiceTestProbes(*warmModel);
+    service.addModel("twoMuscle", warmModel);
+    for (int i=0; i<warmModel->getMuscles().getSize(); ++i)
+        warmModel->getMuscles().get(i).setIgnoreActivationDynamics(
+            warmModel->updWorkingState(), true);
+    warmModel->getMultibodySystem().realize(warmModel->updWorkingState(),
+                                            SimTK::Stage::Instance);
+    ASSERT(service.hasModel("twoMuscle") && service.getNumModels() == 1,
+           __FILE__, __LINE__, "The model was not kept.");
+
+    cout << "- evaluating the states of the simulation" << endl;
+    const char* probeNames[2] = { "umberger", "bhargava" };
+    for (int p=0; p<2; ++p) {
+        const Storage results =
+            service.evaluateTrajectory("twoMuscle", probeNames[p], states);
+        ASSERT(results.getSize() == states.getSize()
+               && results.getColumnLabels().getSize() == 5,
+               __FILE__, __LINE__, "Incorrect size of the results.");
+        for (int c=1; c<results.getColumnLabels().getSize(); ++c) {
+            const std::string& label = results.getColumnLabels()[c];
+            const int column = probeStorage.getColumnLabels().findIndex(label);
+            ASSERT(column > 0, __FILE__, __LINE__,
+                   "Missing column " + label + ".");
+            for (int row=0; row<results.getSize(); ++row) {
+                const double t = results.getStateVector(row)->getTime();
+                Array<double> expected(0.0, probeStorage.getColumnLabels().getSize()-1);
+                probeStorage.getDataAtTime(t, expected.getSize(), expected);
+                const double value =
+                    results.getStateVector(row)->getData()[c-1];
+                ASSERT_EQUAL(expected[column-1], value,
+                    1e-8*std::max(1.0, fabs(expected[column-1])),
+                    __FILE__, __LINE__, label + " differs from the probe.");
+            }
+        }
+    }
+
+    cout << "- overriding parameters" << endl;
+    MuscleMetabolicsEvaluationService::Overrides overrides;
+    overrides.push_back(std::make_pair("muscle1.ratio_slow_twitch_fibers",
+                                       std::string("0.9")));
+    overrides.push_back(std::make_pair("basal_coefficient", std::string("0")));
+    const Storage base = service.evaluateTrajectory("twoMuscle", "umberger",
+                                                    states);
+    const Storage overridden = service.evaluateTrajectory("twoMuscle",
+        "umberger", states, 0, overrides);
+    const Storage restored = service.evaluateTrajectory("twoMuscle",
+                                                        "umberger", states);
+    bool muscle1Changed = false;
+    for (int row=0; row<base.getSize(); ++row) {
+        const Array<double>& b = base.getStateVector(row)->getData();
+        const Array<double>& o = overridden.getStateVector(row)->getData();
+        const Array<double>& r = restored.getStateVector(row)->getData();
+        ASSERT(o[1] == 0 && o[3] == b[3] && r[0] == b[0] && r[2] == b[2],
+               __FILE__, __LINE__, "Overrides leaked out of their job.");
+        muscle1Changed |= o[2] != b[2];
+    }
+    ASSERT(muscle1Changed, __FILE__, __LINE__,
+           "The muscle parameter was not overridden.");
+    try {
+        MuscleMetabolicsEvaluationService::Overrides connectTime;
+        connectTime.push_back(std::make_pair("count_muscle_evaluations",
+                                             std::string("true")));
+        service.evaluateTrajectory("twoMuscle", "umberger", states, 0,
+                                   connectTime);
+        ASSERT(false, __FILE__, __LINE__,
+               "A property other than a kernel parameter was overridden.");
+    } catch (const OpenSim::Exception&) {}
+    try {
+        overrides.push_back(std::make_pair("aerobic_factor",
+                                           std::string("high")));
+        service.evaluateTrajectory("twoMuscle", "umberger", states, 0,
+                                   overrides);
+        ASSERT(false, __FILE__, __LINE__, "An invalid value was accepted.");
+    } catch (const OpenSim::Exception&) {}
+    const Storage afterError = service.evaluateTrajectory("twoMuscle",
+                                                          "umberger", states);
+    ASSERT(afterError.getStateVector(0)->getData()[1]
+           == base.getStateVector(0)->getData()[1],
+           __FILE__, __LINE__, "A failed job did not restore the parameters.");
+
+    cout << "- evaluating a trace" << endl;
+    const int numSamples = 3;
+    const int numInputs = service.getNumTraceInputs("twoMuscle", "bhargava");
+    const int numOutputs = service.getNumTraceOutputs("twoMuscle", "bhargava");
+    ASSERT(numInputs == 2*8 && numOutputs == 4, __FILE__, __LINE__,
+           "Incorrect shape of a trace.");
+    std::vector<double> inputs(numSamples*numInputs);
+    for (int k=0; k<(int)inputs.size(); ++k)
+        inputs[k] = 0.1 + 0.5*fabs(sin(1.0*k));
+    std::vector<double> outputs(numSamples*numOutputs, SimTK::NaN);
+    service.evaluateTrace("twoMuscle", "bhargava", numSamples, &inputs[0],
+                          &outputs[0]);
+    const UchidaBhargava2004MuscleMetabolicsProbe& bhargava =
+        dynamic_cast<const UchidaBhargava2004MuscleMetabolicsProbe&>(
+            warmModel->getProbeSet().get("bhargava"));
+    const UchidaBhargava2004MuscleMetabolicsProbe::RealTimeEvaluator evaluator =
+        bhargava.createRealTimeEvaluator(warmModel->getWorkingState());
+    for (int k=0; k<numSamples; ++k) {
+        std::vector<double> expected(numOutputs);
+        evaluator.calcMetabolicRates(
+            reinterpret_cast<const UchidaBhargava2004MuscleMetabolicsProbe::
+                RealTimeEvaluator::MuscleInputs*>(&inputs[k*numInputs]),
+            &expected[0]);
+        for (int c=0; c<numOutputs; ++c)
+            ASSERT(outputs[k*numOutputs+c] == expected[c], __FILE__, __LINE__,
+                   "The trace was not evaluated in place.");
+    }
+
+    service.unloadModel("twoMuscle");
+    ASSERT(!service.hasModel("twoMuscle"), __FILE__, __LINE__,
+           "The model was not unloaded.");
+}
+
+
+//==============================================================================
+//                               ENERGY BUDGET
+//==============================================================================
+// The energy of a probe over a full simulation is used to set a budget of
+// half of it: the next simulation must stop when the energy reaches the
+// budget, and a budget above the energy must not stop the simulation.
+void testEnergyBudget()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+    UchidaUmberger2010MuscleMetabolicsProbe* probe =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(probe);
+    probe->setName("umbergerEnergy");
+    probe->setOperation("integrate");
+    probe->addMuscle("muscle1", 0.5);
+    probe->addMuscle("muscle2", 0.5);
+    ProbeReporter* probeReporter = new ProbeReporter(&model);
+    model.addAnalysis(probeReporter);
+
+    const double t1 = 1.0;
+    Storage states = simulateModel(model, 0.0, t1);
+    const Storage energy(probeReporter->getProbeStorage());
+    const double totalEnergy =
+        energy.getLastStateVector()->getData()[0];
+    ASSERT(!probe->hasExceededEnergyBudget() && states.getLastTime() == t1
+           && totalEnergy > 0, __FILE__, __LINE__,
+           "A simulation without a budget was terminated.");
+
+    cout << "- terminating at half of the energy" << endl;
+    probe->setEnergyBudget(0.5*totalEnergy);
+    states = simulateModel(model, 0.0, t1);
+    const double tb = probe->getEnergyBudgetExceededTime();
+    cout << "  terminated at t = " << tb << " s" << endl;
+    ASSERT(probe->hasExceededEnergyBudget() && tb > 0 && tb < t1
+           && states.getLastTime() == tb, __FILE__, __LINE__,
+           "The simulation was not terminated at the budget.");
+    Array<double> energyAtTermination(0.0, 1);
+    energy.getDataAtTime(tb, 1, energyAtTermination);
+    ASSERT_EQUAL(0.5*totalEnergy, energyAtTermination[0], 1e-3*totalEnergy,
+                 __FILE__, __LINE__,
+                 "The energy at termination differs from the budget.");
+
+    cout << "- running with a budget above the energy" << endl;
+    probe->setEnergyBudget(2*totalEnergy);
+    states = simulateModel(model, 0.0, t1);
+    ASSERT(!probe->hasExceededEnergyBudget() && states.getLastTime() == t1,
+           __FILE__, __LINE__, "A budget above the energy was exceeded.");
+
+    // The budget requires the energy to be integrated during the simulation.
+    probe->setOperation("value");
+    try {
+        model.initSystem();
+        ASSERT(false, __FILE__, __LINE__,
+               "A budget was accepted without the 'integrate' operation.");
+    } catch (const OpenSim::Exception&) {}
+}
+
+
+//==============================================================================
+//                            PARAMETER SENSITIVITY
+//==============================================================================
+// The derivatives of the total metabolic power of each probe with respect to
+// its parameters must match central differences at the final state of a
+// simulation, and the energy accumulated with the derivatives by a reporter
+// must match that of a deferred probe recorded at the same states. muscle1
+// uses a calculated mass, and muscle2 a provided mass.
+template <class ProbeType, class ParameterSet>
+void setSensitivityParameter(ProbeType& probe, ParameterSet& mms,
+                             const std::string& name, double value)
+{
+    const std::string::size_type dot = name.find('.');
+    if (dot == std::string::npos)
+        probe.updPropertyByName(name).template updValue<double>() = value;
+    else
+        mms.get(name.substr(0, dot)).updPropertyByName(name.substr(dot+1))
+            .template updValue<double>() = value;
+    for (int i=0; i<mms.getSize(); ++i)
+        mms[i].setMuscleMass();
+}
+
+template <class ProbeType, class ParameterSet>
+void checkParameterSensitivity(ProbeType& probe, ParameterSet& mms,
+                               const SimTK::State& s)
+{
+    SimTK::Vector derivatives, unused;
+    const double power = probe.calcParameterSensitivity(s, derivatives);
+    const Array<std::string> names = probe.getSensitivityParameterNames();
+    const SimTK::Vector values = probe.getSensitivityParameterValues();
+    ASSERT(derivatives.size() == names.getSize()
+           && values.size() == names.getSize(), __FILE__, __LINE__,
+           "Incorrect number of parameters.");
+
+    for (int k=0; k<names.getSize(); ++k) {
+        // The provided mass of a muscle with a calculated mass is NaN.
+        if (SimTK::isNaN(values[k])) {
+            ASSERT(derivatives[k] == 0, __FILE__, __LINE__,
+                   names[k] + ": the parameter is not used.");
+            continue;
+        }
+        const double h = 1e-6*std::max(1.0, fabs(values[k]));
+        setSensitivityParameter(probe, mms, names[k], values[k] + h);
+        const double powerPlus = probe.calcParameterSensitivity(s, unused);
+        setSensitivityParameter(probe, mms, names[k], values[k] - h);
+        const double powerMinus = probe.calcParameterSensitivity(s, unused);
+        setSensitivityParameter(probe, mms, names[k], values[k]);
+        const double difference = (powerPlus - powerMinus)/(2*h);
+        cout << "  " << names[k] << ": " << derivatives[k] << endl;
+        ASSERT_EQUAL(difference, derivatives[k],
+            1e-5*std::max(1.0, fabs(difference)), __FILE__, __LINE__,
+            names[k] + ": derivative differs from the central difference.");
+    }
+    ASSERT_EQUAL(power, probe.calcParameterSensitivity(s, unused),
+                 1e-12*fabs(power), __FILE__, __LINE__,
+                 "The parameters were not restored.");
+}
+
+void testParameterSensitivity()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbe =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(umbergerProbe);
+    umbergerProbe->setName("umbergerSensitivity");
+    umbergerProbe->setOperation("value");
+    umbergerProbe->set_parameter_sensitivity(true);
+    umbergerProbe->addMuscle("muscle1", 0.5);
+    umbergerProbe->addMuscle("muscle2", 0.6, 0.2);
+    UchidaUmberger2010MuscleMetabolicsProbe* energyProbe =
+        umbergerProbe->clone();
+    model.addProbe(energyProbe);
+    energyProbe->setName("umbergerEnergyDeferred");
+    energyProbe->setOperation("integrate");
+    energyProbe->set_parameter_sensitivity(false);
+    energyProbe->set_deferred_evaluation(true);
+
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbe =
+        new UchidaBhargava2004MuscleMetabolicsProbe(true, true, true, true, true);
+    model.addProbe(bhargavaProbe);
+    bhargavaProbe->setName("bhargavaSensitivity");
+    bhargavaProbe->setOperation("value");
+    bhargavaProbe->set_parameter_sensitivity(true);
+    bhargavaProbe->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+    bhargavaProbe->addMuscle("muscle2", 0.6, 40, 133, 74, 111, 0.2);
+
+    MuscleMetabolicsDeferredReporter* reporter =
+        new MuscleMetabolicsDeferredReporter(&model);
+    model.addAnalysis(reporter);
+    simulateModel(model, 0.0, 1.0);
+
+    cout << "- comparing accumulated energy to deferred energy" << endl;
+    const MuscleMetabolicsSensitivity& sensitivity =
+        umbergerProbe->getSensitivity();
+    const Storage& deferred = reporter->getProbeStorage();
+    const double energy = deferred.getLastStateVector()->getData()[0];
+    ASSERT(sensitivity.getNumSamples() == deferred.getSize()
+           && sensitivity.getNumParameters() == 4 + 2*4, __FILE__, __LINE__,
+           "The sensitivity was not accumulated at the recorded states.");
+    ASSERT_EQUAL(energy, sensitivity.getEnergy(), 1e-8*fabs(energy),
+                 __FILE__, __LINE__,
+                 "The accumulated energy differs from the deferred energy.");
+    sensitivity.print(cout);
+
+    const SimTK::State& s = model.getWorkingState();
+    model.getMultibodySystem().realize(s, SimTK::Stage::Dynamics);
+    cout << "- comparing derivatives to central differences (umberger)"
+         << endl;
+    checkParameterSensitivity(*umbergerProbe,
+        umbergerProbe->upd_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet(),
+        s);
+    cout << "- comparing derivatives to central differences (bhargava)"
+         << endl;
+    checkParameterSensitivity(*bhargavaProbe,
+        bhargavaProbe->upd_UchidaBhargava2004MuscleMetabolicsProbe_MetabolicMuscleParameterSet(),
+        s);
+
+    reporter->printResults("testParameterSensitivity");
+    std::ifstream table(
+        "testParameterSensitivity_MuscleMetabolicsDeferredReporter_"
+        "bhargavaSensitivity_sensitivity.txt");
+    int numLines = 0;
+    for (std::string line; std::getline(table, line);)
+        ++numLines;
+    ASSERT(numLines == 2 + 3 + 2*8, __FILE__, __LINE__,
+           "The sensitivity table was not printed.");
+}
+
+
+//==============================================================================
+//                                CALIBRATION
+//==============================================================================
+// Rates "measured" with known parameters must be fitted from the probe's
+// parameters, the gradient of the cost must match central differences, a
+// parameter whose bound prevents a fit must stop at the bound, and the fitted
+// values must be set in a model by applyTo().
+double calcServiceRate(MuscleMetabolicsEvaluationService& service,
+    const Storage& states,
+    const MuscleMetabolicsEvaluationService::Overrides& overrides)
+{
+    const MuscleMetabolicsSensitivity sensitivity =
+        service.evaluateSensitivity("twoMuscle", "umberger", states, 0,
+                                    overrides);
+    return sensitivity.getEnergy()
+         / (sensitivity.getEndTime() - sensitivity.getStartTime());
+}
+
+void testCalibration()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+    addServiceTestProbes(model);
+    const Storage states = simulateModel(model, 0.0, 1.0);
+    Storage firstHalf(states), secondHalf(states);
+    firstHalf.crop(0.0, 0.5);
+    secondHalf.crop(0.5, 1.0);
+    const Storage* trials[3] = { &states, &firstHalf, &secondHalf };
+
+    MuscleMetabolicsEvaluationService service;
+    Model* warmModel = new Model();
+    buildTwoMuscleModel(*warmModel);
+    addServiceTestProbes(*warmModel);
+    service.addModel("twoMuscle", warmModel);
+    for (int i=0; i<warmModel->getMuscles().getSize(); ++i)
+        warmModel->getMuscles().get(i).setIgnoreActivationDynamics(
+            warmModel->updWorkingState(), true);
+    warmModel->getMultibodySystem().realize(warmModel->updWorkingState(),
+                                            SimTK::Stage::Instance);
+
+    // The measured rates.
+    MuscleMetabolicsEvaluationService::Overrides truth;
+    truth.push_back(std::make_pair("muscle_effort_scaling_factor",
+                                   std::string("1.2")));
+    truth.push_back(std::make_pair("muscle1.ratio_slow_twitch_fibers",
+                                   std::string("0.7")));
+    truth.push_back(std::make_pair("muscle2.ratio_slow_twitch_fibers",
+                                   std::string("0.7")));
+    Array<std::string> ratios;
+    ratios.append("muscle1.ratio_slow_twitch_fibers");
+    ratios.append("muscle2.ratio_slow_twitch_fibers");
+
+    MuscleMetabolicsCalibration calibration(service, "umberger");
+    calibration.addParameter("muscle_effort_scaling_factor", 0.5, 2.0);
+    calibration.addParameterGroup("ratio_slow_twitch_fibers", ratios,
+                                  0.0, 1.0);
+    for (int t=0; t<3; ++t)
+        calibration.addTrial("twoMuscle", *trials[t],
+                             calcServiceRate(service, *trials[t], truth));
+
+    cout << "- comparing the gradient to central differences" << endl;
+    SimTK::Vector values(2), gradient;
+    values[0] = 1.0;
+    values[1] = 0.5;
+    calibration.calcCost(values, &gradient);
+    ASSERT(calibration.getInitialParameterValue(0) == 1.0
+           && calibration.getInitialParameterValue(1) == 0.5,
+           __FILE__, __LINE__, "Incorrect initial values.");
+    for (int k=0; k<2; ++k) {
+        const double h = 1e-6;
+        SimTK::Vector plus(values), minus(values);
+        plus[k] += h;
+        minus[k] -= h;
+        const double difference =
+            (calibration.calcCost(plus) - calibration.calcCost(minus))/(2*h);
+        cout << "  " << calibration.getParameterName(k) << ": "
+             << gradient[k] << endl;
+        ASSERT_EQUAL(difference, gradient[k],
+            1e-5*std::max(1.0, fabs(difference)), __FILE__, __LINE__,
+            "The gradient differs from the central difference.");
+    }
+
+    cout << "- fitting the measured rates" << endl;
+    calibration.calcCost(values);
+    const double cost = calibration.calibrate();
+    calibration.print(cout);
+    for (int t=0; t<calibration.getNumTrials(); ++t)
+        ASSERT_EQUAL(calibration.getMeasuredRate(t),
+            calibration.getTrialRate(t),
+            1e-3*fabs(calibration.getMeasuredRate(t)), __FILE__, __LINE__,
+            "The fitted rate differs from the measured rate.");
+    ASSERT(cost >= 0 && calibration.getParameterValue(1) >= 0
+           && calibration.getParameterValue(1) <= 1, __FILE__, __LINE__,
+           "The fitted values are out of bounds.");
+
+    cout << "- stopping at a bound" << endl;
+    MuscleMetabolicsCalibration bounded(service, "umberger");
+    bounded.addParameter("muscle_effort_scaling_factor", 0.5, 1.5);
+    for (int t=0; t<3; ++t)
+        bounded.addTrial("twoMuscle", *trials[t],
+            2*calcServiceRate(service, *trials[t],
+                              MuscleMetabolicsEvaluationService::Overrides()));
+    bounded.calibrate();
+    ASSERT_EQUAL(1.5, bounded.getParameterValue(0), 1e-8, __FILE__, __LINE__,
+                 "The parameter did not stop at its bound.");
+
+    cout << "- applying the fitted values to a model" << endl;
+    Model calibrated;
+    buildTwoMuscleModel(calibrated);
+    addServiceTestProbes(calibrated);
+    calibrated.initSystem();
+    calibration.applyTo(calibrated);
+    const UchidaUmberger2010MuscleMetabolicsProbe& probe =
+        dynamic_cast<const UchidaUmberger2010MuscleMetabolicsProbe&>(
+            calibrated.getProbeSet().get("umberger"));
+    ASSERT(probe.get_muscle_effort_scaling_factor()
+               == calibration.getParameterValue(0)
+           && probe.getRatioSlowTwitchFibers("muscle2")
+               == calibration.getParameterValue(1), __FILE__, __LINE__,
+           "The fitted values were not applied.");
+
+    // A parameter must be one of the probe's.
+    MuscleMetabolicsCalibration invalid(service, "umberger");
+    invalid.addParameter("muscle3.ratio_slow_twitch_fibers", 0.0, 1.0);
+    invalid.addTrial("twoMuscle", states, 1.0);
+    try {
+        invalid.calibrate();
+        ASSERT(false, __FILE__, __LINE__, "An unknown parameter was accepted.");
+    } catch (const OpenSim::Exception&) {}
+}
+
+
+//==============================================================================
+//                            ACTIVATION HEAT DECAY
+//==============================================================================
+// With only the activation heat rate on, the rate of each muscle of a probe
+// with activation_heat_decay must be that of a probe without, times
+// 0.06 + exp(-z), where z is the integral of u/tau since the start of the
+// simulation (the excitations of the two-muscle model never fall to
+// activation_heat_decay_onset_excitation). A service, which sets the rows of
+// the states (including the stimulation times of the probe) without
+// integrating them, must reproduce the decay. The cost of a step of a
+// 300-muscle model (the realization to Stage::Acceleration, which computes
+// the derivatives of the stimulation times, and the evaluation of the probe)
+// must be less than 1.25 times that without the decay.
+void addActivationHeatDecayProbe(Model& model, const std::string& name,
+                                 bool decay, int numMuscles)
+{
+    UchidaBhargava2004MuscleMetabolicsProbe* probe =
+        new UchidaBhargava2004MuscleMetabolicsProbe(true, false, false, false,
+                                                    false);
+    model.addProbe(probe);
+    probe->setName(name);
+    probe->setOperation("value");
+    probe->set_report_total_metabolics_only(false);
+    probe->set_activation_heat_decay(decay);
+    for (int i=0; i<numMuscles; ++i) {
+        std::stringstream muscle;
+        muscle << "muscle" << i+1;
+        probe->addMuscle(muscle.str(), 0.5, 40, 133, 74, 111);
+    }
+}
+
+// The time (ns) of an evaluation of a probe at a new time, including the
+// realization of the model to Stage::Acceleration: the minimum over blocks
+// of numEvaluations evaluations.
+double timeProbeEvaluation(Model& model, const Probe& probe, int numBlocks,
+                           int numEvaluations)
+{
+    SimTK::State s = model.getWorkingState();
+    double best = SimTK::Infinity, checksum = 0;
+    for (int b=0; b<numBlocks; ++b) {
+        const long long t0 = SimTK::realTimeInNs();
+        for (int n=0; n<numEvaluations; ++n) {
+            s.updTime() += 1e-5;
+            model.getMultibodySystem().realize(s, SimTK::Stage::Acceleration);
+            checksum += probe.computeProbeInputs(s)[0];
+        }
+        best = std::min(best,
+            double(SimTK::realTimeInNs() - t0) / numEvaluations);
+    }
+    ASSERT(SimTK::isFinite(checksum), __FILE__, __LINE__,
+           probe.getName() + ": invalid rates in the benchmark.");
+    return best;
+}
+
+void testActivationHeatDecay()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+    addActivationHeatDecayProbe(model, "bhargava", false, 2);
+    addActivationHeatDecayProbe(model, "bhargavaDecay", true, 2);
+    ProbeReporter* probeReporter = new ProbeReporter(&model);
+    model.addAnalysis(probeReporter);
+    const Storage states = simulateModel(model, 0.0, 1.0);
+    Storage probeStorage(probeReporter->getProbeStorage());
+
+    cout << "- comparing the decay to the integral of the excitation" << endl;
+    const double tau = 0.045;
+    Array<double> times;
+    probeStorage.getTimeColumn(times);
+    double maxError = 0;
+    for (int i=0; i<2; ++i) {
+        const std::string muscle = (i == 0) ? "muscle1" : "muscle2";
+        Array<double> rates, decayed;
+        probeStorage.getDataColumn("bhargava_" + muscle, rates);
+        probeStorage.getDataColumn("bhargavaDecay_" + muscle, decayed);
+        ASSERT(rates.getSize() > 1 && rates.getSize() == decayed.getSize()
+               && rates.getSize() == times.getSize(), __FILE__, __LINE__,
+               muscle + ": probe column is missing.");
+        for (int k=0; k<times.getSize(); ++k) {
+            const double t = times[k];
+            const double z = (0.5*t + 0.45/(2*SimTK::Pi)
+                * (cos(double(i)) - cos(2*SimTK::Pi*t + i))) / tau;
+            const double expected = (0.06 + exp(-z)) * rates[k];
+            maxError = std::max(maxError,
+                                fabs(decayed[k] - expected) / rates[k]);
+        }
+    }
+    cout << "  maximum error of the decay function: " << maxError << endl;
+    ASSERT(maxError < 1e-3, __FILE__, __LINE__,
+           "The activation heat rate does not follow the decay function.");
+
+    cout << "- replaying the decay from the states in a service" << endl;
+    MuscleMetabolicsEvaluationService service;
+    Model* warmModel = new Model();
+    buildTwoMuscleModel(*warmModel);
+    addActivationHeatDecayProbe(*warmModel, "bhargavaDecay", true, 2);
+    service.addModel("twoMuscle", warmModel);
+    for (int i=0; i<warmModel->getMuscles().getSize(); ++i)
+        warmModel->getMuscles().get(i).setIgnoreActivationDynamics(
+            warmModel->updWorkingState(), true);
+    warmModel->getMultibodySystem().realize(warmModel->updWorkingState(),
+                                            SimTK::Stage::Instance);
+    const Storage results =
+        service.evaluateTrajectory("twoMuscle", "bhargavaDecay", states);
+    const int column =
+        probeStorage.getColumnLabels().findIndex("bhargavaDecay_TOTAL");
+    for (int row=0; row<results.getSize(); ++row) {
+        const double t = results.getStateVector(row)->getTime();
+        Array<double> expected(0.0, probeStorage.getColumnLabels().getSize()-1);
+        probeStorage.getDataAtTime(t, expected.getSize(), expected);
+        ASSERT_EQUAL(expected[column-1],
+                     results.getStateVector(row)->getData()[0],
+                     1e-4*fabs(expected[column-1]), __FILE__, __LINE__,
+                     "The service did not reproduce the decay of the simulation.");
+    }
+
+    cout << "- benchmarking a step of a 300-muscle model" << endl;
+    const int numMuscles = 300;
+    const double maxCostRatio = 1.25;
+    double cost[2];
+    for (int d=0; d<2; ++d) {
+        Model benchmarkModel;
+        buildMultiMuscleModel(benchmarkModel, numMuscles);
+        addActivationHeatDecayProbe(benchmarkModel, "bhargava", d == 1,
+                                    numMuscles);
+        benchmarkModel.initSystem();
+        cost[d] = timeProbeEvaluation(benchmarkModel,
+            benchmarkModel.getProbeSet().get("bhargava"), 10, 20);
+    }
+    cout << "  step (ns): " << cost[0] << " without decay, " << cost[1]
+         << " with decay (ratio " << cost[1]/cost[0] << ")" << endl;
+    ASSERT(cost[1] < maxCostRatio*cost[0], __FILE__, __LINE__,
+           "The activation heat decay is too costly per step.");
+}
+
+
+//==============================================================================
+//                              VECTOR EVALUATION
+//==============================================================================
+// The probes report a column for each muscle, each of which is a Measure of
+// the SDK Probe. With vector_evaluation, the muscles must be evaluated once
+// per state for all of the columns, and the outputs (integrated, or values)
+// must be identical to those of probes evaluated once per column.
+
+// Add an Umberger and a Bhargava probe of all muscles of the model, with the
+// given operation, evaluated once per state if vector is true. The muscle
+// evaluations of the probes are counted (see getNumMuscleEvaluations()).
+void addVectorEvaluationProbes(Model& model, const std::string& operation,
+                               bool vector)
+{
+    const std::string suffix = vector ? "Vector" : "";
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbe =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(umbergerProbe);
+    umbergerProbe->setName("umberger" + suffix);
+    umbergerProbe->setOperation(operation);
+    umbergerProbe->set_report_total_metabolics_only(false);
+    umbergerProbe->set_count_muscle_evaluations(true);
+    umbergerProbe->set_vector_evaluation(vector);
+
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbe =
+        new UchidaBhargava2004MuscleMetabolicsProbe(true, true, true, true,
+                                                    true);
+    model.addProbe(bhargavaProbe);
+    bhargavaProbe->setName("bhargava" + suffix);
+    bhargavaProbe->setOperation(operation);
+    bhargavaProbe->set_report_total_metabolics_only(false);
+    bhargavaProbe->set_count_muscle_evaluations(true);
+    bhargavaProbe->set_vector_evaluation(vector);
+
+    for (int i=0; i<model.getMuscles().getSize(); ++i) {
+        const std::string& name = model.getMuscles().get(i).getName();
+        umbergerProbe->addMuscle(name, 0.5);
+        bhargavaProbe->addMuscle(name, 0.5, 40, 133, 74, 111);
+    }
+}
+
+template <class Probe>
+int getNumMuscleEvaluations(const Model& model, const std::string& name)
+{
+    return dynamic_cast<const Probe&>(model.getProbeSet().get(name))
+        .getNumMuscleEvaluations();
+}
+
+template <class Probe>
+void resetMuscleEvaluations(Model& model, const std::string& name)
+{
+    dynamic_cast<Probe&>(model.updProbeSet().get(name))
+        .resetMuscleEvaluationCounter();
+}
+
+void testVectorEvaluation()
+{
+    const char* probeNames[2] = { "umberger", "bhargava" };
+
+    cout << "- integrating the probes of a four-muscle model" << endl;
+    {
+        Model model;
+        buildMultiMuscleModel(model, 4);
+        addVectorEvaluationProbes(model, "integrate", false);
+        addVectorEvaluationProbes(model, "integrate", true);
+        simulateModel(model, 0.0, 0.5);
+        const SimTK::State& s = model.getWorkingState();
+        model.getMultibodySystem().realize(s, SimTK::Stage::Report);
+        for (int p=0; p<2; ++p) {
+            const std::string name = probeNames[p];
+            const SimTK::Vector energy =
+                model.getProbeSet().get(name).getProbeOutputs(s);
+            const SimTK::Vector vectorEnergy =
+                model.getProbeSet().get(name + "Vector").getProbeOutputs(s);
+            ASSERT(energy.size() == 4+2 && vectorEnergy.size() == 4+2
+                   && energy[0] > 0, __FILE__, __LINE__,
+                   name + ": invalid integrated energy.");
+            for (int c=0; c<energy.size(); ++c)
+                ASSERT_EQUAL(energy[c], vectorEnergy[c],
+                    1e-10*std::max(1.0, fabs(energy[c])), __FILE__, __LINE__,
+                    name + ": vector evaluation changed the integrated energy.");
+        }
+    }
+
+    // The outputs of all columns are read at each state, as by a
+    // ProbeReporter; the muscles are realized outside of the timings.
+    cout << "- benchmarking per-muscle reporting" << endl;
+    const int numMuscles[3] = { 4, 16, 64 };
+    const int numStates = 20;
+    for (int m=0; m<3; ++m) {
+        const int M = numMuscles[m];
+        Model model;
+        buildMultiMuscleModel(model, M);
+        addVectorEvaluationProbes(model, "value", false);
+        addVectorEvaluationProbes(model, "value", true);
+        SimTK::State& s = model.initSystem();
+        for (int p=0; p<2; ++p) {
+            resetMuscleEvaluations<UchidaUmberger2010MuscleMetabolicsProbe>(
+                model, probeNames[0] + std::string(p==0 ? "" : "Vector"));
+            resetMuscleEvaluations<UchidaBhargava2004MuscleMetabolicsProbe>(
+                model, probeNames[1] + std::string(p==0 ? "" : "Vector"));
+        }
+
+        double cost[2][2] = { { 0, 0 }, { 0, 0 } };
+        for (int k=0; k<numStates; ++k) {
+            s.updTime() = 0.01*k;
+            model.getMultibodySystem().realize(s, SimTK::Stage::Report);
+            for (int p=0; p<2; ++p) {
+                const std::string name = probeNames[p];
+                const long long t0 = SimTK::realTimeInNs();
+                const SimTK::Vector values =
+                    model.getProbeSet().get(name).getProbeOutputs(s);
+                const long long t1 = SimTK::realTimeInNs();
+                const SimTK::Vector vectorValues =
+                    model.getProbeSet().get(name + "Vector").getProbeOutputs(s);
+                const long long t2 = SimTK::realTimeInNs();
+                cost[p][0] += double(t1 - t0) / numStates;
+                cost[p][1] += double(t2 - t1) / numStates;
+                ASSERT(values.size() == M+2, __FILE__, __LINE__,
+                       name + ": a column is missing.");
+                for (int c=0; c<values.size(); ++c)
+                    ASSERT_EQUAL(values[c], vectorValues[c], 0.0,
+                        __FILE__, __LINE__,
+                        name + ": vector evaluation changed a column.");
+            }
+        }
+
+        const int evaluations[2][2] = {
+            { getNumMuscleEvaluations<UchidaUmberger2010MuscleMetabolicsProbe>(
+                  model, "umberger"),
+              getNumMuscleEvaluations<UchidaUmberger2010MuscleMetabolicsProbe>(
+                  model, "umbergerVector") },
+            { getNumMuscleEvaluations<UchidaBhargava2004MuscleMetabolicsProbe>(
+                  model, "bhargava"),
+              getNumMuscleEvaluations<UchidaBhargava2004MuscleMetabolicsProbe>(
+                  model, "bhargavaVector") } };
+        for (int p=0; p<2; ++p) {
+            const std::string name = probeNames[p];
+            cout << "  " << name << ", " << M << " muscles: "
+                 << evaluations[p][0]/numStates << " muscle evaluations and "
+                 << cost[p][0] << " ns per state by column, "
+                 << evaluations[p][1]/numStates << " and " << cost[p][1]
+                 << " ns per state with vector evaluation" << endl;
+            ASSERT(evaluations[p][1] == numStates*M
+                   && evaluations[p][0] == (M+2)*evaluations[p][1],
+                   __FILE__, __LINE__, name + ": the muscles were not "
+                   "evaluated once per state with vector evaluation.");
+        }
+        if (M == numMuscles[2])
+            ASSERT(cost[0][1] < cost[0][0] && cost[1][1] < cost[1][0],
+                   __FILE__, __LINE__,
+                   "Vector evaluation did not reduce the cost of reporting.");
+    }
+}
+
+
+//==============================================================================
+//                                  AUTOTUNING
+//==============================================================================
+// Probes with autotune must choose the fastest mode within the tolerance and
+// evaluate in it, without changing the properties of the modes, and read the
+// timings from the cache, in memory and in the cache file, when they are
+// connected again.
+template <class Probe>
+void checkAutotunedMode(const Probe& probe, double tolerance, bool cached)
+{
+    const MuscleMetabolicsAutotuner::Result& result = probe.getAutotuneResult();
+    const MuscleMetabolicsAutotuner::Mode mode = probe.getAutotunedMode();
+    const MuscleMetabolicsAutotuner::Trial& exact =
+        result.trials[MuscleMetabolicsAutotuner::Exact];
+    ASSERT(result.cached == cached, __FILE__, __LINE__, probe.getName()
+           + (cached ? ": the timings were not read from the cache."
+                     : ": the timings were read from the cache."));
+    ASSERT(SimTK::isFinite(exact.time) && exact.time > 0 && exact.error == 0,
+           __FILE__, __LINE__, probe.getName() + ": invalid exact trial.");
+    ASSERT(result.trials[mode].error <= tolerance
+           && result.trials[mode].time <= exact.time, __FILE__, __LINE__,
+           probe.getName() + ": the mode chosen is not within the tolerance "
+           "or is slower than the exact mode.");
+    for (int m=0; m<MuscleMetabolicsAutotuner::NumModes; ++m)
+        ASSERT(!SimTK::isFinite(result.trials[m].time)
+               || result.trials[m].error > tolerance
+               || result.trials[m].time >= result.trials[mode].time,
+               __FILE__, __LINE__, probe.getName() + ": a faster mode within "
+               "the tolerance was not chosen.");
+    ASSERT(probe.getKernelSettings().fast_math
+                == (mode == MuscleMetabolicsAutotuner::FastMath)
+           && (probe.getCompiledKernel() != 0)
+                == (mode == MuscleMetabolicsAutotuner::CompiledKernel)
+           && probe.supportsConcurrentEvaluation(),
+           __FILE__, __LINE__,
+           probe.getName() + ": the probe is not evaluated in the mode chosen.");
+    ASSERT(probe.get_fast_math() && !probe.get_use_compiled_kernel(), __FILE__, __LINE__,
+           probe.getName() + ": autotune changed the properties of the probe.");
+}
+
+void testAutotune()
+{
+    const std::string cacheFile = "testAutotune_cache.txt";
+    std::remove(cacheFile.c_str());
+    MuscleMetabolicsAutotuner::clearCache();
+
+    Model model;
+    buildTwoMuscleModel(model);
+    UchidaUmberger2010MuscleMetabolicsProbe* umbergerProbe =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(umbergerProbe);
+    umbergerProbe->setName("umbergerAutotune");
+    umbergerProbe->setOperation("value");
+    umbergerProbe->set_autotune(true);
+    umbergerProbe->set_autotune_cache_file(cacheFile);
+    umbergerProbe->set_fast_math(true);     // Replaced by the mode chosen.
+    umbergerProbe->addMuscle("muscle1", 0.5);
+    umbergerProbe->addMuscle("muscle2", 0.5);
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargavaProbe =
+        new UchidaBhargava2004MuscleMetabolicsProbe(true, true, true, true,
+                                                    true);
+    model.addProbe(bhargavaProbe);
+    bhargavaProbe->setName("bhargavaAutotune");
+    bhargavaProbe->setOperation("value");
+    bhargavaProbe->set_autotune(true);
+    bhargavaProbe->set_autotune_cache_file(cacheFile);
+    bhargavaProbe->set_fast_math(true);     // Replaced by the mode chosen.
+    bhargavaProbe->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+    bhargavaProbe->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+
+    cout << "- timing the execution modes" << endl;
+    model.initSystem();
+    checkAutotunedMode(*umbergerProbe, 1e-3, false);
+    checkAutotunedMode(*bhargavaProbe, 1e-3, false);
+    const MuscleMetabolicsAutotuner::Result timed =
+        umbergerProbe->getAutotuneResult();
+
+    // Without tolerance, only the modes of the exact rates may be chosen.
+    cout << "- choosing a mode without tolerance from the cached timings"
+         << endl;
+    umbergerProbe->set_autotune_tolerance(0);
+    bhargavaProbe->set_autotune_tolerance(0);
+    model.initSystem();
+    checkAutotunedMode(*umbergerProbe, 0, true);
+    checkAutotunedMode(*bhargavaProbe, 0, true);
+
+    // A later run reads the timings from the cache file.
+    cout << "- reading the timings from the cache file" << endl;
+    MuscleMetabolicsAutotuner::clearCache();
+    umbergerProbe->set_autotune_tolerance(1e-3);
+    bhargavaProbe->set_autotune_tolerance(1e-3);
+    model.initSystem();
+    checkAutotunedMode(*umbergerProbe, 1e-3, true);
+    checkAutotunedMode(*bhargavaProbe, 1e-3, true);
+    for (int m=0; m<MuscleMetabolicsAutotuner::NumModes; ++m) {
+        const MuscleMetabolicsAutotuner::Trial& trial = timed.trials[m];
+        const MuscleMetabolicsAutotuner::Trial& read =
+            umbergerProbe->getAutotuneResult().trials[m];
+        ASSERT(SimTK::isFinite(trial.time) == SimTK::isFinite(read.time),
+               __FILE__, __LINE__, "The cache file lost a trial.");
+        if (SimTK::isFinite(trial.time))
+            ASSERT_EQUAL(trial.time, read.time, 1e-5*trial.time,
+                         __FILE__, __LINE__,
+                         "The cache file changed the time of a mode.");
+        ASSERT_EQUAL(trial.error, read.error, 1e-5*trial.error,
+                     __FILE__, __LINE__,
+                     "The cache file changed the deviation of a mode.");
+    }
+    std::remove(cacheFile.c_str());
+}
+
+
+//==============================================================================
+//                             SCREENING PROBE
+//==============================================================================
+// The screening probe must evaluate its kernel at Stage::Velocity, with the
+// same results at Stage::Dynamics, and its parameter sensitivity must match
+// central differences. Once its coefficients are calibrated against the
+// Umberger probe on windows of a simulation (and of the gait example, if it
+// is available), it must rank the windows as the Umberger probe does.
+
+// The Spearman rank correlation of two samples of the same size.
+double calcRankCorrelation(const std::vector<double>& x,
+                           const std::vector<double>& y)
+{
+    const int n = (int)x.size();
+    double sumSqDifference = 0;
+    for (int i=0; i<n; ++i) {
+        int rankX = 0, rankY = 0;
+        for (int j=0; j<n; ++j) {
+            rankX += x[j] < x[i];
+            rankY += y[j] < y[i];
+        }
+        sumSqDifference += (rankX - rankY)*(rankX - rankY);
+    }
+    return 1 - 6*sumSqDifference/(n*(n*(double)n - 1));
+}
+
+// Calibrate the screening probe of a model of the service against a
+// reference probe on windows of a trajectory, and return the rank
+// correlation of the windows' rates.
+double calibrateScreeningWindows(MuscleMetabolicsEvaluationService& service,
+    const std::string& modelName, const std::string& screeningName,
+    const std::string& referenceName, const Storage& states, int numWindows)
+{
+    MuscleMetabolicsCalibration calibration(service, screeningName);
+    calibration.addParameter("activation_coefficient", 1, 1000);
+    calibration.addParameter("positive_work_efficiency", 0.05, 1);
+    const double t0 = states.getFirstTime();
+    const double t1 = states.getLastTime();
+    for (int w=0; w<numWindows; ++w) {
+        Storage window(states);
+        window.crop(t0 + (t1 - t0)*w/numWindows,
+                    t0 + (t1 - t0)*(w + 1)/numWindows);
+        calibration.addReferenceTrial(modelName, window, referenceName);
+    }
+
+    SimTK::Vector initial(2);
+    initial[0] = 100;
+    initial[1] = 0.25;
+    const double initialCost = calibration.calcCost(initial);
+    const double cost = calibration.calibrate();
+    calibration.print(cout);
+    ASSERT(cost <= initialCost, __FILE__, __LINE__,
+           "The calibration increased the cost.");
+
+    std::vector<double> measured, screened;
+    for (int t=0; t<calibration.getNumTrials(); ++t) {
+        measured.push_back(calibration.getMeasuredRate(t));
+        screened.push_back(calibration.getTrialRate(t));
+    }
+    return calcRankCorrelation(measured, screened);
+}
+
+void addScreeningTestProbe(Model& model)
+{
+    MuscleMetabolicsScreeningProbe* screening =
+        new MuscleMetabolicsScreeningProbe(true, true, true);
+    model.addProbe(screening);
+    screening->setName("screening");
+    screening->setOperation("value");
+    screening->set_report_total_metabolics_only(false);
+    screening->addMuscle("muscle1");
+    screening->addMuscle("muscle2");
+}
+
+// Report the calibration of a screening probe against the Umberger probe of
+// the gait example, if the example is available.
+void reportGaitScreeningCalibration()
+{
+#ifdef METABOLICS_EXAMPLES_DIR
+    const std::string dir = METABOLICS_EXAMPLES_DIR;
+#else
+    const std::string dir = "../examples";
+#endif
+    const std::string modelFile = dir + "/subject01_simbody_adjusted.osim";
+    const std::string statesFile = dir + "/ResultsCMC/subject01_walk1_states.sto";
+    if (!std::ifstream(modelFile.c_str()).good()
+        || !std::ifstream(statesFile.c_str()).good()) {
+        cout << "- gait example not found in " << dir << "; skipping" << endl;
+        return;
+    }
+
+    cout << "- calibrating a screening probe on the gait example" << endl;
+    const Storage states(statesFile);
+    Model* model = new Model(modelFile);
+    UchidaUmberger2010MuscleMetabolicsProbe& umbergerProbe =
+        dynamic_cast<UchidaUmberger2010MuscleMetabolicsProbe&>(
+            model->updProbeSet().get("metabolic_power_umb"));
+    umbergerProbe.set_reconstruct_excitation(true);
+    umbergerProbe.setActivationStates(states);
+
+    // The screening probe has the muscles and masses of the Umberger probe.
+    MuscleMetabolicsScreeningProbe* screening =
+        new MuscleMetabolicsScreeningProbe(true, true, true);
+    model->addProbe(screening);
+    screening->setName("metabolic_power_screening");
+    const UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet&
+        muscles = umbergerProbe
+            .get_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet();
+    for (int i=0; i<muscles.getSize(); ++i)
+        screening->upd_UchidaUmberger2010MuscleMetabolicsProbe_MetabolicMuscleParameterSet()
+            .cloneAndAppend(muscles[i]);
+
+    MuscleMetabolicsEvaluationService service;
+    service.addModel("gait", model);
+    const double correlation = calibrateScreeningWindows(service, "gait",
+        "metabolic_power_screening", "metabolic_power_umb", states, 8);
+    cout << "- gait example, rank correlation of the windows' rates: "
+         << correlation << endl;
+    ASSERT(correlation > 0.5, __FILE__, __LINE__,
+           "The screening probe does not rank the gait example as the "
+           "Umberger probe does.");
+}
+
+void testScreeningProbe()
+{
+    Model model;
+    buildTwoMuscleModel(model);
+    addServiceTestProbes(model);
+    addScreeningTestProbe(model);
+    const Storage states = simulateModel(model, 0.0, 1.0);
+    const MuscleMetabolicsScreeningProbe& probe =
+        dynamic_cast<const MuscleMetabolicsScreeningProbe&>(
+            model.getProbeSet().get("screening"));
+
+    cout << "- evaluating at Stage::Velocity" << endl;
+    SimTK::State s = model.getWorkingState();
+    model.getMultibodySystem().realize(s, SimTK::Stage::Velocity);
+    const SimTK::Vector atVelocity = probe.computeProbeInputs(s);
+    double expected = atVelocity[1];
+    for (int i=0; i<probe.getNumMetabolicMuscles(); ++i) {
+        const Muscle& muscle = probe.getMetabolicMuscle(i);
+        const double mass = probe.getMuscleMass(muscle.getName());
+        const double a = muscle.getActivation(s);
+        const double force = a*muscle.getActiveForceLengthMultiplier(s)
+            *muscle.getForceVelocityMultiplier(s)*muscle.getMaxIsometricForce();
+        const double power = -force*muscle.getFiberVelocity(s);
+        const double Edot = mass*probe.get_activation_coefficient()*a*a
+            + std::max(0.0, power)/probe.get_positive_work_efficiency();
+        ASSERT_EQUAL(Edot, atVelocity[i+2], 1e-10*std::max(1.0, Edot),
+                     __FILE__, __LINE__,
+                     "The screening rate differs from its equation.");
+        expected += Edot;
+    }
+    ASSERT_EQUAL(expected, atVelocity[0], 1e-10*expected, __FILE__, __LINE__,
+                 "The TOTAL differs from the sum of the rates.");
+    model.getMultibodySystem().realize(s, SimTK::Stage::Dynamics);
+    const SimTK::Vector atDynamics = probe.computeProbeInputs(s);
+    for (int k=0; k<atVelocity.size(); ++k)
+        ASSERT_EQUAL(atDynamics[k], atVelocity[k], 1e-12*fabs(atDynamics[k]),
+                     __FILE__, __LINE__,
+                     "The screening probe depends on Stage::Dynamics.");
+
+    cout << "- comparing the sensitivity to central differences" << endl;
+    SimTK::Vector derivatives, ignored;
+    const double total = probe.calcParameterSensitivity(s, derivatives);
+    ASSERT_EQUAL(atVelocity[0], total, 1e-10*total, __FILE__, __LINE__,
+                 "The sensitivity evaluates a different TOTAL.");
+    MuscleMetabolicsScreeningProbe& screening =
+        dynamic_cast<MuscleMetabolicsScreeningProbe&>(
+            model.updProbeSet().get("screening"));
+    const double h = 1e-6;
+    const double c = screening.get_activation_coefficient();
+    screening.set_activation_coefficient(c + h);
+    const double plus = screening.calcParameterSensitivity(s, ignored);
+    screening.set_activation_coefficient(c - h);
+    const double minus = screening.calcParameterSensitivity(s, ignored);
+    screening.set_activation_coefficient(c);
+    ASSERT_EQUAL((plus - minus)/(2*h), derivatives[0],
+                 1e-5*std::max(1.0, fabs(derivatives[0])), __FILE__, __LINE__,
+                 "d/d(activation_coefficient) differs from the central "
+                 "difference.");
+    const double eta = screening.get_positive_work_efficiency();
+    screening.set_positive_work_efficiency(eta + h);
+    const double plusEta = screening.calcParameterSensitivity(s, ignored);
+    screening.set_positive_work_efficiency(eta - h);
+    const double minusEta = screening.calcParameterSensitivity(s, ignored);
+    screening.set_positive_work_efficiency(eta);
+    ASSERT_EQUAL((plusEta - minusEta)/(2*h), derivatives[1],
+                 1e-5*std::max(1.0, fabs(derivatives[1])), __FILE__, __LINE__,
+                 "d/d(positive_work_efficiency) differs from the central "
+                 "difference.");
+
+    cout << "- calibrating against the Umberger probe" << endl;
+    MuscleMetabolicsEvaluationService service;
+    Model* warmModel = new Model();
+    buildTwoMuscleModel(*warmModel);
+    addServiceTestProbes(*warmModel);
+    addScreeningTestProbe(*warmModel);
+    service.addModel("twoMuscle", warmModel);
+    for (int i=0; i<warmModel->getMuscles().getSize(); ++i)
+        warmModel->getMuscles().get(i).setIgnoreActivationDynamics(
+            warmModel->updWorkingState(), true);
+    warmModel->getMultibodySystem().realize(warmModel->updWorkingState(),
+                                            SimTK::Stage::Instance);
+    const double correlation = calibrateScreeningWindows(service,
+        "twoMuscle", "screening", "umberger", states, 10);
+    cout << "- rank correlation of the windows' rates: " << correlation
+         << endl;
+    ASSERT(correlation > 0.8, __FILE__, __LINE__,
+           "The screening probe does not rank the windows as the Umberger "
+           "probe does.");
+
+    reportGaitScreeningCalibration();
+}
+
+//==============================================================================
+//                                PEAK TRACKING
+//==============================================================================
+// Add an Umberger and a Bhargava probe of the two-muscle model reporting each
+// muscle's metabolic power, with or without peak tracking.
+void addPeakTrackingProbes(Model& model, bool peakTracking)
+{
+    UchidaUmberger2010MuscleMetabolicsProbe* umberger =
+        new UchidaUmberger2010MuscleMetabolicsProbe(true, true, true, true);
+    model.addProbe(umberger);
+    umberger->setName("umberger");
+    umberger->setOperation("value");
+    umberger->set_report_total_metabolics_only(false);
+    umberger->set_vector_evaluation(true);
+    umberger->set_summary_statistics(true);
+    umberger->set_peak_tracking(peakTracking);
+    umberger->addMuscle("muscle1", 0.5);
+    umberger->addMuscle("muscle2", 0.5);
+
+    UchidaBhargava2004MuscleMetabolicsProbe* bhargava =
+        new UchidaBhargava2004MuscleMetabolicsProbe(true, true, true, true, true);
+    model.addProbe(bhargava);
+    bhargava->setName("bhargava");
+    bhargava->setOperation("value");
+    bhargava->set_report_total_metabolics_only(false);
+    bhargava->set_summary_statistics(true);
+    bhargava->set_peak_tracking(peakTracking);
+    bhargava->addMuscle("muscle1", 0.5, 40, 133, 74, 111);
+    bhargava->addMuscle("muscle2", 0.5, 40, 133, 74, 111);
+}
+
+// The peaks are checked on a short series with ties, then tracked in a
+// simulation: the model must have the same state as without tracking, and
+// the peaks must match the extrema of the accumulated statistics, at times
+// at which the ProbeReporter reported them.
+void testPeakTracking()
+{
+    cout << "- tracking the peaks of a series" << endl;
+    Array<std::string> labels;
+    labels.append("a");
+    labels.append("b");
+    MuscleMetabolicsPeaks series(labels);
+    const double values[4][2] = { {1, -1}, {3, -1}, {3, -4}, {2, 0} };
+    for (int k=0; k<4; ++k)
+        series.update(k, SimTK::Vector(2, values[k]));
+    series.print(cout);
+    ASSERT(series.getNumSamples() == 4
+           && series.getMax(0) == 3 && series.getMaxTime(0) == 1
+           && series.getMin(0) == 1 && series.getMinTime(0) == 0
+           && series.getMax(1) == 0 && series.getMaxTime(1) == 3
+           && series.getMin(1) == -4 && series.getMinTime(1) == 2,
+           __FILE__, __LINE__, "Incorrect peaks or times of the series.");
+
+    cout << "- comparing the state with and without peak tracking" << endl;
+    Model untrackedModel;
+    buildTwoMuscleModel(untrackedModel);
+    addPeakTrackingProbes(untrackedModel, false);
+    const SimTK::State& untracked = untrackedModel.initSystem();
+    Model model;
+    buildTwoMuscleModel(model);
+    addPeakTrackingProbes(model, true);
+    const SimTK::State& tracked = model.initSystem();
+    ASSERT(model.getNumStateVariables()
+               == untrackedModel.getNumStateVariables()
+           && tracked.getNY() == untracked.getNY()
+           && tracked.getNZ() == untracked.getNZ()
+           && tracked.getNEventTriggers() == untracked.getNEventTriggers(),
+           __FILE__, __LINE__, "Peak tracking changed the state.");
+
+    ProbeReporter* probeReporter = new ProbeReporter(&model);
+    model.addAnalysis(probeReporter);
+    MuscleMetabolicsDeferredReporter* reporter =
+        new MuscleMetabolicsDeferredReporter(&model);
+    model.addAnalysis(reporter);
+    simulateModel(model, 0.0, 1.0);
+    Storage probeStorage(probeReporter->getProbeStorage());
+
+    cout << "- comparing the peaks to the statistics and the reported values"
+         << endl;
+    const char* probeNames[2] = { "umberger", "bhargava" };
+    for (int p=0; p<2; ++p) {
+        const MuscleMetabolicsPeaks* peaks;
+        const MuscleMetabolicsStatistics* statistics;
+        if (p == 0) {
+            const UchidaUmberger2010MuscleMetabolicsProbe& probe =
+                dynamic_cast<const UchidaUmberger2010MuscleMetabolicsProbe&>(
+                    model.getProbeSet().get(probeNames[p]));
+            peaks = &probe.getPeaks();
+            statistics = &probe.getStatistics();
+        }
+        else {
+            const UchidaBhargava2004MuscleMetabolicsProbe& probe =
+                dynamic_cast<const UchidaBhargava2004MuscleMetabolicsProbe&>(
+                    model.getProbeSet().get(probeNames[p]));
+            peaks = &probe.getPeaks();
+            statistics = &probe.getStatistics();
+        }
+        peaks->print(cout);
+        ASSERT(peaks->getNumChannels() == 4
+               && peaks->getNumSamples() == statistics->getNumSamples(),
+               __FILE__, __LINE__,
+               "Peaks were not tracked at the recorded states.");
+
+        const int numColumns = probeStorage.getColumnLabels().getSize() - 1;
+        for (int c=0; c<peaks->getNumChannels(); ++c) {
+            const std::string& label = peaks->getLabel(c);
+            ASSERT_EQUAL(statistics->getMax(c), peaks->getMax(c),
+                1e-10*std::max(1.0, fabs(peaks->getMax(c))),
+                __FILE__, __LINE__, label + ": incorrect maximum.");
+            ASSERT_EQUAL(statistics->getMin(c), peaks->getMin(c),
+                1e-10*std::max(1.0, fabs(peaks->getMin(c))),
+                __FILE__, __LINE__, label + ": incorrect minimum.");
+
+            const int column =
+                probeStorage.getColumnLabels().findIndex(label) - 1;
+            Array<double> reported(0.0, numColumns);
+            probeStorage.getDataAtTime(peaks->getMaxTime(c), numColumns,
+                                       reported);
+            ASSERT_EQUAL(peaks->getMax(c), reported[column],
+                1e-10*std::max(1.0, fabs(peaks->getMax(c))),
+                __FILE__, __LINE__, label + ": incorrect time of maximum.");
+            probeStorage.getDataAtTime(peaks->getMinTime(c), numColumns,
+                                       reported);
+            ASSERT_EQUAL(peaks->getMin(c), reported[column],
+                1e-10*std::max(1.0, fabs(peaks->getMin(c))),
+                __FILE__, __LINE__, label + ": incorrect time of minimum.");
+        }
+    }
+
+    reporter->printResults("testPeakTracking");
+    std::ifstream table(
+        "testPeakTracking_MuscleMetabolicsDeferredReporter_umberger_peaks.txt");
+    int numLines = 0;
+    for (std::string line; std::getline(table, line);)
+        ++numLines;
+    ASSERT(numLines == 1 + 4, __FILE__, __LINE__,
+           "The table of peaks was not printed.");
+}
+
+//==============================================================================
+//                                     MAIN
+//==============================================================================
+void horizontalRule() { for(int i=0;i<80;++i) cout<<"*"; cout<<endl; }
+int main()
+{
+    SimTK::Array_<std::string> failures;
+
+    printf("\n"); horizontalRule();
+    cout << "Comparing Umberger2010 probe output to published results" << endl;
+    horizontalRule();
+    try { compareUmbergerProbeToPublishedResults();
+        cout << "\ncompareUmbergerProbeToPublishedResults test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("compareUmbergerProbeToPublishedResults");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing Umberger2010 and Bhargava2004 probes in simulation" << endl;
+    horizontalRule();
+    try { testProbesUsingMillardMuscleSimulation();
+        cout << "\ntestProbesUsingMillardMuscleSimulation test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testProbesUsingMillardMuscleSimulation");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing fast_math approximations" << endl;
+    horizontalRule();
+    try { testFastMathApproximations();
+        cout << "\ntestFastMathApproximations test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testFastMathApproximations");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing single-precision evaluation" << endl;
+    horizontalRule();
+    try { testSinglePrecisionEvaluation();
+        cout << "\ntestSinglePrecisionEvaluation test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testSinglePrecisionEvaluation");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing surrogate evaluation" << endl;
+    horizontalRule();
+    try { testSurrogateEvaluation();
+        cout << "\ntestSurrogateEvaluation test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testSurrogateEvaluation");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing real-time evaluation" << endl;
+    horizontalRule();
+    try { testRealTimeEvaluation();
+        cout << "\ntestRealTimeEvaluation test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testRealTimeEvaluation");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing deferred evaluation" << endl;
+    horizontalRule();
+    try { testDeferredEvaluation();
+        cout << "\ntestDeferredEvaluation test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testDeferredEvaluation");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing metabolic-cost static optimization" << endl;
+    horizontalRule();
+    try { testMetabolicStaticOptimization();
+        cout << "\ntestMetabolicStaticOptimization test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testMetabolicStaticOptimization");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing excitation reconstruction" << endl;
+    horizontalRule();
+    try { testExcitationReconstruction();
+        cout << "\ntestExcitationReconstruction test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testExcitationReconstruction");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing incremental evaluation" << endl;
+    horizontalRule();
+    try { testIncrementalEvaluation();
+        cout << "\ntestIncrementalEvaluation test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testIncrementalEvaluation");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing multi-rate sampling" << endl;
+    horizontalRule();
+    try { testMultiRateSampling();
+        cout << "\ntestMultiRateSampling test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testMultiRateSampling");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing concurrent evaluation" << endl;
+    horizontalRule();
+    try { testConcurrentEvaluation();
+        cout << "\ntestConcurrentEvaluation test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testConcurrentEvaluation");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing asynchronous evaluation" << endl;
+    horizontalRule();
+    try { testAsynchronousEvaluation();
+        cout << "\ntestAsynchronousEvaluation test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testAsynchronousEvaluation");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing compiled kernels" << endl;
+    horizontalRule();
+    try { testCompiledKernels();
+        cout << "\ntestCompiledKernels test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testCompiledKernels");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing summary statistics" << endl;
+    horizontalRule();
+    try { testSummaryStatistics();
+        cout << "\ntestSummaryStatistics test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testSummaryStatistics");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing indexed results" << endl;
+    horizontalRule();
+    try { testIndexedResults();
+        cout << "\ntestIndexedResults test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testIndexedResults");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing the evaluation service" << endl;
+    horizontalRule();
+    try { testEvaluationService();
+        cout << "\ntestEvaluationService test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testEvaluationService");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing the energy budget" << endl;
+    horizontalRule();
+    try { testEnergyBudget();
+        cout << "\ntestEnergyBudget test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testEnergyBudget");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing the parameter sensitivity" << endl;
+    horizontalRule();
+    try { testParameterSensitivity();
+        cout << "\ntestParameterSensitivity test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testParameterSensitivity");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing the calibration" << endl;
+    horizontalRule();
+    try { testCalibration();
+        cout << "\ntestCalibration test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testCalibration");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing the activation heat decay" << endl;
+    horizontalRule();
+    try { testActivationHeatDecay();
+        cout << "\ntestActivationHeatDecay test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testActivationHeatDecay");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing the vector evaluation" << endl;
+    horizontalRule();
+    try { testVectorEvaluation();
+        cout << "\ntestVectorEvaluation test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testVectorEvaluation");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing the autotuning of the execution mode" << endl;
+    horizontalRule();
+    try { testAutotune();
+        cout << "\ntestAutotune test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testAutotune");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing the screening probe" << endl;
+    horizontalRule();
+    try { testScreeningProbe();
+        cout << "\ntestScreeningProbe test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testScreeningProbe");
+    }
+
+    printf("\n"); horizontalRule();
+    cout << "Testing the tracking of peaks" << endl;
+    horizontalRule();
+    try { testPeakTracking();
+        cout << "\ntestPeakTracking test passed\n" << endl;
+    } catch (const OpenSim::Exception& e) {
+        e.print(cerr);
+        failures.push_back("testPeakTracking");
     }
 
     printf("\n"); horizontalRule(); horizontalRule();